@@ -21,13 +21,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
 #include <gsl/gsl_statistics_double.h>
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_linalg.h>
 #include <gsl/gsl_cblas.h>
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
 #include <gsl/gsl_blas.h>
 #include <gsl/gsl_multifit_nlin.h>
 
@@ -42,6 +41,7 @@
 #define MAX_ITER_NO_ANGLE  10		//Number of iteration in the minimization with no angle
 #define MAX_ITER_ANGLE     10		//Number of iteration in the minimization with angle
 #define EPSILON            0.001
+#define PSF_MAX_PARAMS     7		//Number of parameters of the model with angle
 
 const double radian_conversion = ((3600.0 * 180.0) / M_PI) / 1.0E3;
 
@@ -49,14 +49,13 @@ const double radian_conversion = ((3600.0 * 180.0) / M_PI) / 1.0E3;
 static WORD getMedian3x3(gsl_matrix *in, const int xx, const int yy,
 		const int w, const int h) {
 	int step, radius, x, y;
-	double *value, median;
+	double value[8] = { 0.0 }, median;
 
 	step = 1;
 	radius = 1;
 
 	int n = 0;
 	int start;
-	value = calloc(8, sizeof(double));
 
 	for (y = yy - radius; y <= yy + radius; y += step) {
 		for (x = xx - radius; x <= xx + radius; x += step) {
@@ -72,29 +71,27 @@ static WORD getMedian3x3(gsl_matrix *in, const int xx, const int yy,
 	start = 8 - n - 1;
 	quickmedian_double(value, 8);
 	median = gsl_stats_median_from_sorted_data(value + start, 1, n);
-	free(value);
 	return median;
 }
 
-static gsl_matrix *removeHotPixels(gsl_matrix *in) {
+/* out must have the size of in */
+static void removeHotPixels(gsl_matrix *in, gsl_matrix *out) {
 	int width = in->size2;
 	int height = in->size1;
 	int x, y;
-	gsl_matrix *out = gsl_matrix_alloc (in->size1, in->size2);
 
-	gsl_matrix_memcpy (out, in);
 	for (y = 0; y < height; y++) {
 		for (x = 0; x < width; x++) {
 			double a = getMedian3x3(in, x, y, width, height);
 			gsl_matrix_set(out, y, x, a);
 		}
 	}
-	return out;
 }
 
-/* Compute initial values for the algorithm from data in the pixel value matrix */
-static gsl_vector* psf_init_data(gsl_matrix* z, double bg) {
-	gsl_vector * MaxV = gsl_vector_alloc(5);
+/* Compute initial values for the algorithm from data in the pixel value
+ * matrix, filtered being a matrix of the same size used as buffer */
+static void psf_init_data(gsl_matrix* z, double bg, gsl_matrix *filtered,
+		double MaxV[5]) {
 	double max;
 	size_t NbRows = z->size1;
 	size_t NbCols = z->size2;
@@ -102,20 +99,19 @@ static gsl_vector* psf_init_data(gsl_matrix* z, double bg) {
 
 	/* find maximum */
 	/* first we remove hot pixels in the matrix */
-	gsl_matrix *m_tmp = removeHotPixels(z);
-	max = gsl_matrix_max(m_tmp);
-	gsl_matrix_max_index(m_tmp, &i, &j);
-	gsl_matrix_free(m_tmp);
-	gsl_vector_set(MaxV, 0, j);
-	gsl_vector_set(MaxV, 1, i);
-	gsl_vector_set(MaxV, 2, max);
-
-	size_t ii1 = (size_t) gsl_vector_get(MaxV, 1);
-	size_t ii2 = (size_t) gsl_vector_get(MaxV, 1);
-	size_t jj1 = (size_t) gsl_vector_get(MaxV, 0);
-	size_t jj2 = (size_t) gsl_vector_get(MaxV, 0);
-	size_t perm1 = (size_t) gsl_vector_get(MaxV, 1);
-	size_t perm2 = (size_t) gsl_vector_get(MaxV, 0);
+	removeHotPixels(z, filtered);
+	max = gsl_matrix_max(filtered);
+	gsl_matrix_max_index(filtered, &i, &j);
+	MaxV[0] = j;
+	MaxV[1] = i;
+	MaxV[2] = max;
+
+	size_t ii1 = (size_t) MaxV[1];
+	size_t ii2 = (size_t) MaxV[1];
+	size_t jj1 = (size_t) MaxV[0];
+	size_t jj2 = (size_t) MaxV[0];
+	size_t perm1 = (size_t) MaxV[1];
+	size_t perm2 = (size_t) MaxV[0];
 
 	while ((2.0 * (gsl_matrix_get(z, ii1, perm2) - bg)
 			> (gsl_matrix_get(z, perm1, perm2) - bg)) && (ii1 < NbRows - 1.0)) {
@@ -134,12 +130,10 @@ static gsl_vector* psf_init_data(gsl_matrix* z, double bg) {
 			> (gsl_matrix_get(z, perm1, perm2) - bg)) && (jj2 > 0)) {
 		jj2--;
 	}
-	gsl_vector_set(MaxV, 0, (jj1 + jj2 + 2) / 2.0);
-	gsl_vector_set(MaxV, 1, (ii1 + ii2 + 2) / 2.0);
-	gsl_vector_set(MaxV, 3, (size_t) (SQR(ii1 - ii2) / 4.0 / log(2.0)));
-	gsl_vector_set(MaxV, 4, (size_t) (SQR(jj1 - jj2) / 4.0 / log(2.0)));
-
-	return MaxV;
+	MaxV[0] = (jj1 + jj2 + 2) / 2.0;
+	MaxV[1] = (ii1 + ii2 + 2) / 2.0;
+	MaxV[3] = (size_t) (SQR(ii1 - ii2) / 4.0 / log(2.0));
+	MaxV[4] = (size_t) (SQR(jj1 - jj2) / 4.0 / log(2.0));
 }
 
 /* Basic magnitude computation. This is not really accurate, all pixels are
@@ -312,18 +306,58 @@ static int psf_Gaussian_fdf_an(const gsl_vector * x, void *PSF_data,
 	return GSL_SUCCESS;
 }
 
-/* The function returns the fitted parameters without angle. However it
- * returns NULL if the number of parameters is => to the pixel number.
- */
-static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
-		int layer) {
+struct psf_workspace {
+	size_t NbRows, NbCols;
+	gsl_matrix *filtered;	/* the area without hot pixels, for the initial values */
+	gboolean use_gsl;	/* fit with the GSL solver instead of psf_lm_fit() */
+};
+
+/* Allocates the buffers of the fits of areas of NbRows x NbCols pixels. They
+ * can be given to psf_global_minimisation() to avoid allocating them for each
+ * star, but must be used by one thread at a time. */
+psf_workspace *new_psf_workspace(size_t NbRows, size_t NbCols) {
+	psf_workspace *ws;
+
+	if (NbRows == 0 || NbCols == 0)
+		return NULL;
+	ws = calloc(1, sizeof(psf_workspace));
+	if (!ws) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	ws->NbRows = NbRows;
+	ws->NbCols = NbCols;
+	ws->filtered = gsl_matrix_alloc(NbRows, NbCols);
+	if (!ws->filtered) {
+		PRINT_ALLOC_ERR;
+		free(ws);
+		return NULL;
+	}
+	return ws;
+}
+
+void free_psf_workspace(psf_workspace *ws) {
+	if (!ws)
+		return;
+	if (ws->filtered) gsl_matrix_free(ws->filtered);
+	free(ws);
+}
+
+/* Fits made with ws use the GSL solver, which is slower, if use_gsl is TRUE.
+ * This is used to compare both implementations. */
+void psf_workspace_use_gsl(psf_workspace *ws, gboolean use_gsl) {
+	ws->use_gsl = use_gsl;
+}
+
+/* Fits the model with the Levenberg-Marquardt solver of GSL, from the p
+ * parameters in x, which are replaced by the fitted values. err receives the
+ * uncertainties of the parameters and rmse the RMSE of the last evaluation. */
+static void psf_gsl_fit(gsl_matrix *z, size_t p, unsigned int max_iter,
+		double *x, double *err, double *rmse) {
 	size_t i, j;
-	size_t NbRows = z->size1; //characteristics of the selection : height and width
+	size_t NbRows = z->size1;
 	size_t NbCols = z->size2;
-	const size_t p = 6;			// Number of parameters fitted
 	const size_t n = NbRows * NbCols;
-	fitted_PSF *psf = malloc(sizeof(fitted_PSF));
-	gsl_vector *MaxV = psf_init_data(z, background);
 	int status;
 	unsigned int iter = 0;
 	gsl_matrix *covar = gsl_matrix_alloc(p, p);
@@ -331,30 +365,19 @@ static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
 	double *sigma = malloc(n * sizeof(double));
 	struct PSF_data d = { n, y, sigma, NbRows, NbCols, 0 };
 	gsl_multifit_function_fdf f;
-	const gsl_rng_type * type;
-	gsl_rng * r;
-	const gsl_multifit_fdfsolver_type *T;
+	gsl_vector_view x_view = gsl_vector_view_array(x, p);
 	gsl_multifit_fdfsolver *s;
-	double x_init[] = { background, gsl_vector_get(MaxV, 2), gsl_vector_get(
-			MaxV, 0), gsl_vector_get(MaxV, 1), gsl_vector_get(MaxV, 4),
-			gsl_vector_get(MaxV, 3) };
-	gsl_vector_view x = gsl_vector_view_array(x_init, p);
-
-	gsl_rng_env_setup();
 
-	type = gsl_rng_default;
-	r = gsl_rng_alloc(type);
-
-	f.f = &psf_Gaussian_f;
-	f.df = &psf_Gaussian_df;
-	f.fdf = &psf_Gaussian_fdf;
-	f.n = n;
-	if (n <= p) {
-		free(psf);
-		free(y);
-		free(sigma);
-		return NULL;
+	if (p == 6) {
+		f.f = &psf_Gaussian_f;
+		f.df = &psf_Gaussian_df;
+		f.fdf = &psf_Gaussian_fdf;
+	} else {
+		f.f = &psf_Gaussian_f_an;
+		f.df = &psf_Gaussian_df_an;
+		f.fdf = &psf_Gaussian_fdf_an;
 	}
+	f.n = n;
 	f.p = p;
 	f.params = &d;
 
@@ -365,9 +388,8 @@ static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
 		}
 	}
 
-	T = gsl_multifit_fdfsolver_lmsder;
-	s = gsl_multifit_fdfsolver_alloc(T, n, p);
-	gsl_multifit_fdfsolver_set(s, &f, &x.vector);
+	s = gsl_multifit_fdfsolver_alloc(gsl_multifit_fdfsolver_lmsder, n, p);
+	gsl_multifit_fdfsolver_set(s, &f, &x_view.vector);
 
 	do {
 		iter++;
@@ -375,7 +397,7 @@ static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
 		if (status)
 			break;
 		status = gsl_multifit_test_delta(s->dx, s->x, 1e-4, 1e-4);
-	} while (status == GSL_CONTINUE && iter < MAX_ITER_NO_ANGLE);
+	} while (status == GSL_CONTINUE && iter < max_iter);
 
 #if HAVE_GSL_1
 	gsl_multifit_covar(s->J, 0.0, covar);
@@ -388,8 +410,241 @@ static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
 	gsl_matrix_free(J);
 #endif
 
-#define FIT(i) gsl_vector_get(s->x, i)
-#define ERR(i) sqrt(gsl_matrix_get(covar,i,i))	//for now, errors are not displayed
+	for (i = 0; i < p; i++) {
+		x[i] = gsl_vector_get(s->x, i);
+		err[i] = sqrt(gsl_matrix_get(covar, i, i));
+	}
+	*rmse = d.rmse;
+
+	free(sigma);
+	free(y);
+	gsl_multifit_fdfsolver_free(s);
+	gsl_matrix_free(covar);
+}
+
+/* Sum of the squared residuals of the model of parameters x on the area z,
+ * B + A * exp(-(X^2 / SX + Y^2 / SY)) where (X, Y) is the position relative
+ * to (x0, y0) rotated by the angle, the 7th parameter if p is 7.
+ * If JtJ and Jtr are not NULL, they receive the lower half of the normal
+ * matrix and the gradient of the half sum, from the analytic derivatives of
+ * the model, computed in the same pass over the pixels. */
+static double psf_lm_eval(const gsl_matrix *z, size_t p, const double *x,
+		double JtJ[PSF_MAX_PARAMS][PSF_MAX_PARAMS], double *Jtr) {
+	size_t NbRows = z->size1;
+	size_t NbCols = z->size2;
+	size_t i, j, a, b;
+	double B = x[0], A = x[1], x0 = x[2], y0 = x[3], SX = x[4], SY = x[5];
+	double ca = 1.0, sa = 0.0, chi2 = 0.0;
+
+	if (p == 7) {
+		ca = cos(x[6]);
+		sa = sin(x[6]);
+	}
+	if (JtJ) {
+		for (a = 0; a < p; a++) {
+			Jtr[a] = 0.0;
+			for (b = 0; b <= a; b++)
+				JtJ[a][b] = 0.0;
+		}
+	}
+
+	for (i = 0; i < NbRows; i++) {
+		const double *row = z->data + i * z->tda;
+		double v = i + 1 - y0;
+		for (j = 0; j < NbCols; j++) {
+			double u = j + 1 - x0;
+			double X = ca * u - sa * v;
+			double Y = sa * u + ca * v;
+			double e = exp(-(X * X / SX + Y * Y / SY));
+			double r = B + A * e - row[j];
+			chi2 += r * r;
+			if (JtJ) {
+				double g[PSF_MAX_PARAMS];
+				double Ae = A * e, dX = 2.0 * Ae * X / SX, dY = 2.0 * Ae * Y / SY;
+				g[0] = 1.0;
+				g[1] = e;
+				g[2] = dX * ca + dY * sa;
+				g[3] = -dX * sa + dY * ca;
+				g[4] = Ae * X * X / (SX * SX);
+				g[5] = Ae * Y * Y / (SY * SY);
+				if (p == 7)
+					g[6] = -dX * (-sa * u - ca * v) - dY * (ca * u - sa * v);
+				for (a = 0; a < p; a++) {
+					Jtr[a] += g[a] * r;
+					for (b = 0; b <= a; b++)
+						JtJ[a][b] += g[a] * g[b];
+				}
+			}
+		}
+	}
+	return chi2;
+}
+
+/* Cholesky decomposition of the symmetric matrix of which M holds the lower
+ * half, in place. Returns 1 if it is not positive definite. */
+static int psf_cholesky(double M[PSF_MAX_PARAMS][PSF_MAX_PARAMS], size_t p) {
+	size_t i, j, k;
+	for (j = 0; j < p; j++) {
+		double d = M[j][j];
+		for (k = 0; k < j; k++)
+			d -= M[j][k] * M[j][k];
+		if (!(d > 0.0))
+			return 1;
+		M[j][j] = sqrt(d);
+		for (i = j + 1; i < p; i++) {
+			double s = M[i][j];
+			for (k = 0; k < j; k++)
+				s -= M[i][k] * M[j][k];
+			M[i][j] = s / M[j][j];
+		}
+	}
+	return 0;
+}
+
+/* solves L L^T x = b in place, L from psf_cholesky() */
+static void psf_cholesky_solve(double L[PSF_MAX_PARAMS][PSF_MAX_PARAMS],
+		size_t p, double *b) {
+	size_t i, k;
+	for (i = 0; i < p; i++) {
+		for (k = 0; k < i; k++)
+			b[i] -= L[i][k] * b[k];
+		b[i] /= L[i][i];
+	}
+	for (i = p; i-- > 0;) {
+		for (k = i + 1; k < p; k++)
+			b[i] -= L[k][i] * b[k];
+		b[i] /= L[i][i];
+	}
+}
+
+/* Same as psf_gsl_fit() without GSL and without any allocation: the model is
+ * the one of psf_Gaussian_f() and psf_Gaussian_f_an(), with exact
+ * derivatives, and the normal equations of the Levenberg-Marquardt steps are
+ * built in a single pass over the pixels and solved by a Cholesky
+ * decomposition, as there are only 6 or 7 parameters. An iteration is an
+ * accepted step, and the convergence test is the one used with GSL. The
+ * damping follows the ratio of the actual and predicted reductions of chi2
+ * (Nielsen): a step that barely reduces it is not followed by a larger one,
+ * which made the angle oscillate on some stars until the last iteration. */
+static void psf_lm_fit(gsl_matrix *z, size_t p, unsigned int max_iter,
+		double *x, double *err, double *rmse) {
+	double JtJ[PSF_MAX_PARAMS][PSF_MAX_PARAMS], M[PSF_MAX_PARAMS][PSF_MAX_PARAMS];
+	double Jtr[PSF_MAX_PARAMS], dx[PSF_MAX_PARAMS], x_new[PSF_MAX_PARAMS];
+	double chi2, lambda = 1E-3, nu = 2.0;
+	const size_t n = z->size1 * z->size2;
+	unsigned int iter = 0;
+	size_t a, b;
+
+	chi2 = psf_lm_eval(z, p, x, JtJ, Jtr);
+	while (iter < max_iter && isfinite(chi2)) {
+		gboolean accepted = FALSE, converged = TRUE;
+		double chi2_new = 0.0, predicted, rho;
+		int tries;
+
+		iter++;
+		for (tries = 0; tries < 10 && !accepted; tries++) {
+			for (a = 0; a < p; a++) {
+				for (b = 0; b < a; b++)
+					M[a][b] = JtJ[a][b];
+				M[a][a] = JtJ[a][a] * (1.0 + lambda) + DBL_MIN;
+				dx[a] = -Jtr[a];
+			}
+			if (!psf_cholesky(M, p)) {
+				psf_cholesky_solve(M, p, dx);
+				for (a = 0; a < p; a++)
+					x_new[a] = x[a] + dx[a];
+				chi2_new = psf_lm_eval(z, p, x_new, NULL, NULL);
+				if (chi2_new <= chi2) {	// false if not finite
+					accepted = TRUE;
+					break;
+				}
+			}
+			lambda *= nu;
+			nu *= 2.0;
+		}
+		if (!accepted)
+			break;
+		/* predicted reduction of chi2 for the step, from
+		 * (JtJ + lambda diag(JtJ)) dx = -Jtr */
+		predicted = 0.0;
+		for (a = 0; a < p; a++)
+			predicted += dx[a] * (lambda * JtJ[a][a] * dx[a] - Jtr[a]);
+		rho = predicted > 0.0 ? (chi2 - chi2_new) / predicted : 0.0;
+		lambda = max(lambda * max(1.0 / 3.0, 1.0 - pow(2.0 * rho - 1.0, 3)), 1E-12);
+		nu = 2.0;
+		for (a = 0; a < p; a++) {
+			if (fabs(dx[a]) >= 1e-4 + 1e-4 * fabs(x_new[a]))
+				converged = FALSE;
+			x[a] = x_new[a];
+		}
+		chi2 = psf_lm_eval(z, p, x, JtJ, Jtr);
+		if (converged)
+			break;
+	}
+
+	/* uncertainties from the inverse of the normal matrix */
+	for (a = 0; a < p; a++)
+		for (b = 0; b <= a; b++)
+			M[a][b] = JtJ[a][b];
+	if (psf_cholesky(M, p)) {
+		for (a = 0; a < p; a++)
+			err[a] = NAN;
+	} else {
+		for (a = 0; a < p; a++) {
+			double col[PSF_MAX_PARAMS] = { 0.0 };
+			col[a] = 1.0;
+			psf_cholesky_solve(M, p, col);
+			err[a] = sqrt(col[a]);
+		}
+	}
+	*rmse = sqrt(chi2 / n);
+}
+
+static void psf_fit(gsl_matrix *z, size_t p, unsigned int max_iter,
+		double *x, double *err, double *rmse, psf_workspace *ws) {
+	if (ws && ws->use_gsl)
+		psf_gsl_fit(z, p, max_iter, x, err, rmse);
+	else psf_lm_fit(z, p, max_iter, x, err, rmse);
+}
+
+/* The function returns the fitted parameters without angle. However it
+ * returns NULL if the number of parameters is => to the pixel number.
+ * ws is used if it has the size of z, otherwise buffers are allocated for
+ * this fit.
+ */
+static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
+		int layer, psf_workspace *ws) {
+	size_t NbRows = z->size1; //characteristics of the selection : height and width
+	size_t NbCols = z->size2;
+	const size_t p = 6;			// Number of parameters fitted
+	const size_t n = NbRows * NbCols;
+	fitted_PSF *psf;
+	double MaxV[5], x[6], err[6], rmse;
+	gboolean own_buffer = !ws || ws->NbRows != NbRows || ws->NbCols != NbCols;
+	gsl_matrix *filtered;
+
+	if (n <= p)
+		return NULL;
+	psf = malloc(sizeof(fitted_PSF));
+	if (!psf) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	filtered = own_buffer ? gsl_matrix_alloc(NbRows, NbCols) : ws->filtered;
+	psf_init_data(z, background, filtered, MaxV);
+	if (own_buffer)
+		gsl_matrix_free(filtered);
+
+	x[0] = background;
+	x[1] = MaxV[2];
+	x[2] = MaxV[0];
+	x[3] = MaxV[1];
+	x[4] = MaxV[4];
+	x[5] = MaxV[3];
+	psf_fit(z, p, MAX_ITER_NO_ANGLE, x, err, &rmse, ws);
+
+#define FIT(i) x[i]
+#define ERR(i) err[i]	//for now, errors are not displayed
 
 	/* Output structure with parameters fitted */
 	psf->B = FIT(0);
@@ -409,7 +664,7 @@ static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
 	// Layer: not fitted
 	psf->layer = layer;
 	// RMSE
-	psf->rmse = d.rmse;
+	psf->rmse = rmse;
 	// absolute uncertainties
 	psf->B_err = ERR(0) / FIT(0);
 	psf->A_err = ERR(1) / FIT(1);
@@ -420,13 +675,6 @@ static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
 	psf->ang_err = 0;
 	psf->xpos = 0;		// will be set by the peaker
 	psf->ypos = 0;
-	// we free the memory
-	free(sigma);
-	free(y);
-	gsl_vector_free(MaxV);
-	gsl_multifit_fdfsolver_free(s);
-	gsl_matrix_free(covar);
-	gsl_rng_free(r);
 	return psf;
 }
 
@@ -434,74 +682,20 @@ static fitted_PSF *psf_minimiz_no_angle(gsl_matrix* z, double background,
  * NULL if the number of parameters is => to the pixel number.
  * This should not happen because this case is already treated by the
  * minimiz_no_angle function */
-static fitted_PSF *psf_minimiz_angle(gsl_matrix* z, fitted_PSF *psf, gboolean for_photometry, gboolean verbose) {
-	size_t i, j;
-	size_t NbRows = z->size1; //characteristics of the selection : height and width
-	size_t NbCols = z->size2;
+static fitted_PSF *psf_minimiz_angle(gsl_matrix* z, fitted_PSF *psf,
+		gboolean for_photometry, gboolean verbose, psf_workspace *ws) {
 	const size_t p = 7;			// Number of parameters fitted
-	const size_t n = NbRows * NbCols;
+	const size_t n = z->size1 * z->size2;
 	g_assert (n > 0);
 	fitted_PSF *psf_angle = malloc(sizeof(fitted_PSF));
-	int status;
-	unsigned int iter = 0;
-	gsl_matrix *covar = gsl_matrix_alloc(p, p);
-	double *y = malloc(n * sizeof(double));
-	double *sigma = malloc(n * sizeof(double));
-	struct PSF_data d = { n, y, sigma, NbRows, NbCols, 0 };
-	gsl_multifit_function_fdf f_angle;
-	double x_init[7] = { psf->B, psf->A, psf->x0, psf->y0, psf->sx, psf->sy, 0 };
-	gsl_vector_view x = gsl_vector_view_array(x_init, p);
-	const gsl_rng_type * type;
-	gsl_rng * r;
-	const gsl_multifit_fdfsolver_type *T;
-	gsl_multifit_fdfsolver *s;
+	double x[7] = { psf->B, psf->A, psf->x0, psf->y0, psf->sx, psf->sy, 0 };
+	double err[7], rmse;
 
-	gsl_rng_env_setup();
-
-	type = gsl_rng_default;
-	r = gsl_rng_alloc(type);
-
-	f_angle.f = &psf_Gaussian_f_an;
-	f_angle.df = &psf_Gaussian_df_an;
-	f_angle.fdf = &psf_Gaussian_fdf_an;
-	f_angle.n = n;
-	f_angle.p = p;
-	f_angle.params = &d;
-
-	for (i = 0; i < NbRows; i++) {
-		for (j = 0; j < NbCols; j++) {
-			y[NbCols * i + j] = gsl_matrix_get(z, i, j);
-			sigma[NbCols * i + j] = 1;
-		}
+	if (!psf_angle) {
+		PRINT_ALLOC_ERR;
+		return NULL;
 	}
-
-	T = gsl_multifit_fdfsolver_lmsder;
-	s = gsl_multifit_fdfsolver_alloc(T, n, p);
-	gsl_multifit_fdfsolver_set(s, &f_angle, &x.vector);
-
-	do {
-		iter++;
-		status = gsl_multifit_fdfsolver_iterate(s);
-		if (status)
-			break;
-		status = gsl_multifit_test_delta(s->dx, s->x, 1e-4, 1e-4);
-	} while (status == GSL_CONTINUE && iter < MAX_ITER_ANGLE);
-
-#if HAVE_GSL_1
-	gsl_multifit_covar(s->J, 0.0, covar);
-#elif HAVE_GSL_2
-	gsl_matrix * J;
-
-	J = gsl_matrix_alloc(n, p);
-
-	gsl_multifit_fdfsolver_jac(s, J);
-	gsl_multifit_covar(J, 0.0, covar);
-
-	gsl_matrix_free(J);
-#endif
-
-#define FIT(i) gsl_vector_get(s->x, i)
-#define ERR(i) sqrt(gsl_matrix_get(covar,i,i))	//for now, errors are not displayed
+	psf_fit(z, p, MAX_ITER_ANGLE, x, err, &rmse, ws);
 
 	/*Output structure with parameters fitted */
 	psf_angle->B = FIT(0);
@@ -547,7 +741,7 @@ static fitted_PSF *psf_minimiz_angle(gsl_matrix* z, fitted_PSF *psf, gboolean fo
 	//Layer: not fitted
 	psf_angle->layer = psf->layer;
 	//RMSE
-	psf_angle->rmse = d.rmse;
+	psf_angle->rmse = rmse;
 	// absolute uncertainties
 	psf_angle->B_err = ERR(0) / FIT(0);
 	psf_angle->A_err = ERR(1) / FIT(1);
@@ -558,11 +752,6 @@ static fitted_PSF *psf_minimiz_angle(gsl_matrix* z, fitted_PSF *psf, gboolean fo
 	psf_angle->ang_err = ERR(6) / FIT(6);
 
 	//we free the memory
-	free(sigma);
-	free(y);
-	gsl_multifit_fdfsolver_free(s);
-	gsl_matrix_free(covar);
-	gsl_rng_free(r);
 	free(psf_angle->phot);
 	return psf_angle;
 }
@@ -610,7 +799,7 @@ fitted_PSF *psf_get_minimisation(fits *fit, int layer, rectangle *area, gboolean
 		}
 		from += stridefrom;
 	}
-	result = psf_global_minimisation(z, bg, layer, TRUE, for_photometry, verbose);
+	result = psf_global_minimisation(z, bg, layer, TRUE, for_photometry, verbose, NULL);
 	if (result)
 		fwhm_to_arcsec_if_needed(fit, &result);
 	gsl_matrix_free(z);
@@ -626,13 +815,16 @@ fitted_PSF *psf_get_minimisation(fits *fit, int layer, rectangle *area, gboolean
  * If the difference is smaller OR if fit_Angle is equal to FALSE (in the case
  * of the star_finder algorithm), no angle parameter is fitted.
  * The function returns NULL if values look bizarre.
+ * ws, from new_psf_workspace(), may be NULL; it avoids allocations when many
+ * areas of the same size are fitted by the same thread.
  */
 fitted_PSF *psf_global_minimisation(gsl_matrix* z, double bg, int layer,
-		gboolean fit_angle, gboolean for_photometry, gboolean verbose) {
+		gboolean fit_angle, gboolean for_photometry, gboolean verbose,
+		psf_workspace *ws) {
 	fitted_PSF *psf;
 
 	// To compute good starting values, we first compute with no angle
-	if ((psf = psf_minimiz_no_angle(z, bg, layer)) != NULL) {
+	if ((psf = psf_minimiz_no_angle(z, bg, layer, ws)) != NULL) {
 		if (fit_angle) {
 			/* This next check is to avoid possible angle divergence
 			 * when sx and sy are too close (star is quite round).
@@ -655,7 +847,7 @@ fitted_PSF *psf_global_minimisation(gsl_matrix* z, double bg, int layer,
 			} else {
 				fitted_PSF *tmp_psf;
 
-				if ((tmp_psf = psf_minimiz_angle(z, psf, for_photometry, verbose))
+				if ((tmp_psf = psf_minimiz_angle(z, psf, for_photometry, verbose, ws))
 						== NULL) {
 					free(psf);
 					return NULL;
@@ -693,6 +885,21 @@ fitted_PSF *psf_global_minimisation(gsl_matrix* z, double bg, int layer,
 	return psf;
 }
 
+/* Fits nb areas of NbRows x NbCols pixels stored one after the other in data,
+ * like psf_global_minimisation() without angle and photometry, using the same
+ * workspace. results[i] is NULL if the fit of the area i failed. */
+void psf_global_minimisation_batch(double *data, int nb, size_t NbRows,
+		size_t NbCols, double bg, int layer, psf_workspace *ws,
+		fitted_PSF **results) {
+	int i;
+	for (i = 0; i < nb; i++) {
+		gsl_matrix_view z = gsl_matrix_view_array(data + i * NbRows * NbCols,
+				NbRows, NbCols);
+		results[i] = psf_global_minimisation(&z.matrix, bg, layer, FALSE,
+				FALSE, FALSE, ws);
+	}
+}
+
 void psf_display_result(fitted_PSF *result, rectangle *area) {
 	char buffer[256];
 	char *str;
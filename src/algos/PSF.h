@@ -40,9 +40,18 @@ struct PSF_data {
 	double rmse;
 };
 
+/* buffers of the PSF fit, see new_psf_workspace() */
+typedef struct psf_workspace psf_workspace;
+
+psf_workspace *new_psf_workspace(size_t NbRows, size_t NbCols);
+void free_psf_workspace(psf_workspace *ws);
+void psf_workspace_use_gsl(psf_workspace *ws, gboolean use_gsl);
 double psf_get_fwhm(fits *, int, double *);
 fitted_PSF *psf_get_minimisation(fits *, int, rectangle *, gboolean, gboolean);
-fitted_PSF *psf_global_minimisation(gsl_matrix *, double, int, gboolean, gboolean, gboolean);
+fitted_PSF *psf_global_minimisation(gsl_matrix *, double, int, gboolean, gboolean, gboolean, psf_workspace *);
+void psf_global_minimisation_batch(double *data, int nb, size_t NbRows,
+		size_t NbCols, double bg, int layer, psf_workspace *ws,
+		fitted_PSF **results);
 void psf_display_result(fitted_PSF *, rectangle *);
 void fwhm_to_arcsec_if_needed(fits*, fitted_PSF**);
 
@@ -882,7 +882,8 @@ static int retrieveXTRANSPattern(char *bayer, int xtrans[6][6]) {
 	return 0;
 }
 
-int debayer(fits* fit, interpolation_method interpolation, gboolean stretch_cfa) {
+int debayer(fits* fit, interpolation_method interpolation, sensor_pattern pattern,
+		gboolean stretch_cfa) {
 	int i, j;
 	int width = fit->rx;
 	int height = fit->ry;
@@ -903,8 +904,8 @@ int debayer(fits* fit, interpolation_method interpolation, gboolean stretch_cfa)
 		buf++;
 	}
 
-	newbuf = debayer_buffer(buf, &width, &height, interpolation,
-			com.debayer.bayer_pattern, xtrans);
+	newbuf = debayer_buffer(buf, &width, &height, interpolation, pattern,
+			xtrans);
 	if (newbuf == NULL) {
 		return 1;
 	}
@@ -1117,7 +1118,7 @@ int split_cfa_image_hook(struct generic_seq_args *args, int o, int i, fits *fit,
 }
 
 void apply_split_cfa_to_sequence(struct split_cfa_data *split_cfa_args) {
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
 	args->seq = split_cfa_args->seq;
 	args->partial_image = FALSE;
 	args->filtering_criterion = seq_filter_included;
@@ -9,7 +9,7 @@ struct split_cfa_data {
 
 WORD *debayer_buffer(WORD *buf, int *width, int *height,
 		interpolation_method interpolation, sensor_pattern pattern, int xtrans[6][6]);
-int debayer(fits*, interpolation_method, gboolean);
+int debayer(fits*, interpolation_method, sensor_pattern, gboolean);
 void get_debayer_area(const rectangle *area, rectangle *debayer_area,
 		const rectangle *image_area, int *debayer_offset_x,
 		int *debayer_offset_y);
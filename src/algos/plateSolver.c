@@ -1140,7 +1140,7 @@ gpointer match_catalog(gpointer p) {
 	args->ret = 1;
 	while (args->ret && attempt < NB_OF_MATCHING_TRY){
 		args->ret = new_star_match(com.stars, cstars, n, nobj,
-				args->scale - 0.2, args->scale + 0.2, &H, args->for_photometry_cc);
+				args->scale - 0.2, args->scale + 0.2, NULL, &H, args->for_photometry_cc);
 		nobj += 50;
 		attempt++;
 	}
@@ -217,6 +217,59 @@ double QualityEstimate(fits *fit, int layer, int qtype) {
 	return dval;
 }
 
+// -------------------------------------------------------
+// Quality of a square area of size pixels, starting at data in an image of
+// stride pixels wide, for the comparison of the same area in several frames.
+// It is the mean squared gradient of the area subsampled by QTILE_SUBSAMPLE,
+// relative to its squared mean level so that it does not depend on the
+// transparency. Subsampling by 2 sums the four pixels of each Bayer cell, so
+// undebayered CFA frames can be used directly.
+// work must hold (size / QTILE_SUBSAMPLE)^2 floats, it avoids allocating for
+// each area; data is not modified.
+// -------------------------------------------------------
+double TileQuality(const WORD *data, int stride, int size, float *work) {
+	int n = size / QTILE_SUBSAMPLE, x, y;
+	double sum = 0.0, grad = 0.0, mean;
+
+	if (n < 2)
+		return 0.0;
+	for (y = 0; y < n; y++) {
+		const WORD *row0 = data + (size_t) y * QTILE_SUBSAMPLE * stride;
+		const WORD *row1 = row0 + stride;
+		float *out = work + (size_t) y * n;
+		float rowsum = 0.f;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:rowsum)
+#endif
+		for (x = 0; x < n; x++) {
+			float v = (float) row0[2 * x] + (float) row0[2 * x + 1] +
+				(float) row1[2 * x] + (float) row1[2 * x + 1];
+			out[x] = v;
+			rowsum += v;
+		}
+		sum += rowsum;
+	}
+	mean = sum / ((double) n * n);
+	if (mean <= 0.0)
+		return 0.0;
+
+	for (y = 0; y < n - 1; y++) {
+		const float *cur = work + (size_t) y * n;
+		const float *next = cur + n;
+		float rowgrad = 0.f;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:rowgrad)
+#endif
+		for (x = 0; x < n - 1; x++) {
+			float d1 = cur[x + 1] - cur[x];
+			float d2 = next[x] - cur[x];
+			rowgrad += d1 * d1 + d2 * d2;
+		}
+		grad += rowgrad;
+	}
+	return grad / ((double) (n - 1) * (n - 1) * mean * mean);
+}
+
 /*
  * Subsample a region starting at *ptr of size X size pixels.
  */
@@ -28,6 +28,8 @@
 #define QSUBSAMPLE_MIN 3
 #define THRESHOLD 40
 #define QF_APERTURE_RADIUS 0
+// subsampling of TileQuality, must stay 2 to bin Bayer cells
+#define QTILE_SUBSAMPLE 2
 
 #undef DEBUG
 
@@ -36,6 +38,7 @@ enum {
 };
 
 double QualityEstimate(fits *fit, int layer, int qtype);
+double TileQuality(const WORD *data, int stride, int size, float *work);
 int FindCentre(fits *fit, double *x_avg, double *y_avg);
 
 #endif /* SRC_QUALITY_H_ */
@@ -56,6 +56,36 @@ void quicksort_d (double *a, int n) {
 	quicksort_d(left, a + n - left);
 }
 
+/**
+ * In-place quick sort of array of float a of size n
+ * @param a array to sort
+ * @param n size of the array
+ */
+void quicksort_f (float *a, int n) {
+	if (n < 2)
+		return;
+	float pivot = a[n / 2];
+	float *left = a;
+	float *right = a + n - 1;
+	register float t;
+
+	while (left <= right) {
+		if (*left < pivot) {
+			left++;
+			continue;
+		}
+		if (*right > pivot) {
+			right--;
+			continue;
+		}
+		t = *left;
+		*left++ = *right;
+		*right-- = t;
+	}
+	quicksort_f(a, right - a + 1);
+	quicksort_f(left, a + n - left);
+}
+
 /**
  * In-place quick sort of array of WORD a of size n
  * @param a array to sort
@@ -175,6 +205,49 @@ double quickmedian_double (double *a, int n) {
 	return (n % 2 == 0) ? (a[k - 1] + a[k]) / 2 : a[k];
 }
 
+/* quickmedian_float returns the median from array of length n
+ * Derived from the original quickselect algorithm from Hoare
+ * warning: data are sorted in place
+ * non recurssive version modified to return median value
+ * @param a array of float to search
+ * @param n size of the array
+ * @return median as double for even size average the middle two elements
+ */
+double quickmedian_float (float *a, int n) {
+	int i;
+	int k = n / 2;		// size to sort
+	int pindex;		// pivot index
+	int left = 0; 		// left index
+	int right = n - 1; 	// right index
+	float pivot, tmp;
+
+	while (left < right) { //we stop when our indicies have crossed
+		pindex = (left + right) / 2; // pivot selection, this can be whatever
+		pivot = a[pindex];
+		a[pindex] = a[right];
+		a[right] = pivot; // SWAP(pivot,right)
+
+		for (i = pindex = left; i < right; i++) {
+			if (a[i] < pivot) { // SWAP
+				tmp = a[pindex];
+				a[pindex] = a[i];
+				a[i] = tmp;
+				pindex++;
+			}
+		}
+		a[right] = a[pindex];
+		a[pindex] = pivot; // SWAP(right,j)
+
+		if (pindex < k)
+			left = pindex + 1;
+		else
+			// pindex >= k
+			right = pindex;
+	}
+	return (n % 2 == 0) ?
+			((double) a[k - 1] + (double) a[k]) / 2.0 : (double) a[k];
+}
+
 /*
  * quickmedian_int returns the median from array of int of of length n
  * Derived from original quickselect algorithm from Hoare
@@ -6,10 +6,12 @@
 /* the quicksorts */
 void quicksort_d (double *a, int n);
 void quicksort_s (WORD *a, int n);
+void quicksort_f (float *a, int n);
 
 /* Quick median based on quick select */
 double quickmedian (WORD *a, int n);
 double quickmedian_double(double *a, int n);
+double quickmedian_float (float *a, int n);
 double quickmedian_int (int *a, int n);
 
 /* Histogram median for very large array of unsigned short */
@@ -144,7 +144,77 @@ void update_peaker_GUI() {
  Copyleft (L) 1998 Kenneth J. Mighell (Kitt Peak National Observatory)
  */
 
-/* returns a NULL-ended array of FWHM info */
+/* rows of the wavelet image scanned by one thread at a time */
+#define PEAKER_BAND_HEIGHT 32
+/* candidates fitted by one thread at a time */
+#define PEAKER_FIT_BATCH 16
+
+struct peaker_candidate {
+	int x, y;
+};
+
+/* the local maxima found in a band of rows, in the order of the scan */
+struct peaker_band {
+	struct peaker_candidate *candidates;
+	int nb, size;
+};
+
+/* Searches the local maxima of the rows y0 to y1 - 1 of the wavelet image,
+ * between columns x0 and x1 - 1. A pixel is a maximum if it is greater than
+ * its neighbors, ties being broken by position as in the original algorithm:
+ * it must be strictly greater than the neighbors above it and than the one on
+ * its left. The test is made on a whole row to be vectorized. */
+static int find_candidates(WORD **wave_image, int x0, int x1, int y0, int y1,
+		WORD threshold, WORD norm, guchar *flags, struct peaker_band *band) {
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		const WORD *above = wave_image[y - 1];
+		const WORD *row = wave_image[y];
+		const WORD *below = wave_image[y + 1];
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (x = x0; x < x1; x++) {
+			WORD pixel = row[x];
+			flags[x] = (pixel > threshold) & (pixel < norm) &
+				(pixel > above[x - 1]) & (pixel > above[x]) &
+				(pixel > above[x + 1]) & (pixel > row[x - 1]) &
+				(pixel >= row[x + 1]) & (pixel >= below[x - 1]) &
+				(pixel >= below[x]) & (pixel >= below[x + 1]);
+		}
+
+		for (x = x0; x < x1; x++) {
+			if (!flags[x])
+				continue;
+			if (band->nb == band->size) {
+				struct peaker_candidate *tmp;
+				band->size = band->size ? band->size * 2 : 256;
+				tmp = realloc(band->candidates,
+						band->size * sizeof(struct peaker_candidate));
+				if (!tmp) {
+					PRINT_ALLOC_ERR;
+					return 1;
+				}
+				band->candidates = tmp;
+			}
+			band->candidates[band->nb].x = x;
+			band->candidates[band->nb].y = y;
+			band->nb++;
+		}
+	}
+	return 0;
+}
+
+/* Star detection is made in two passes: the local maxima of the wavelet
+ * image are searched in bands of rows in parallel, then a PSF is fitted on
+ * each of them in parallel, by batches of areas, each thread reusing its own
+ * buffers. Candidates
+ * are kept in the order of the scan, so the result does not depend on the
+ * number of threads. */
+/* returns a NULL-ended array of FWHM info, NULL if no star was found or on
+ * allocation failure */
 fitted_PSF **peaker(fits *fit, int layer, star_finder_params *sf, int *nb_stars, rectangle *area, gboolean showtime) {
 	int nx = fit->rx;
 	int ny = fit->ry;
@@ -152,12 +222,15 @@ fitted_PSF **peaker(fits *fit, int layer, star_finder_params *sf, int *nb_stars,
 	int areaY0 = 0;
 	int areaX1 = nx;
 	int areaY1 = ny;
-	int y, k, nbstars = 0;
+	int k, b, nbstars = 0, nb_bands, nb_candidates = 0, retval = 0;
+	int x0, x1, y0, y1;
 	double bg;
 	WORD threshold, norm;
 	WORD **wave_image, **real_image;
 	fits wave_fit = { 0 };
-	fitted_PSF **results;
+	fitted_PSF **results, **fitted = NULL;
+	struct peaker_band *bands = NULL;
+	struct peaker_candidate *candidates = NULL;
 	struct timeval t_start, t_end;
 
 	assert(nx > 0 && ny > 0);
@@ -210,68 +283,175 @@ fitted_PSF **peaker(fits *fit, int layer, star_finder_params *sf, int *nb_stars,
 		areaX1 = area->w + areaX0;
 		areaY1 = area->h + areaY0;
 	}
+	x0 = sf->radius + areaX0;
+	x1 = areaX1 - sf->radius;
+	y0 = sf->radius + areaY0;
+	y1 = areaY1 - sf->radius;
+
+	/* first pass: local maxima */
+	nb_bands = y1 > y0 ? (y1 - y0 + PEAKER_BAND_HEIGHT - 1) / PEAKER_BAND_HEIGHT : 0;
+	if (nb_bands > 0 && x1 > x0) {
+		bands = calloc(nb_bands, sizeof(struct peaker_band));
+		if (!bands) {
+			PRINT_ALLOC_ERR;
+			retval = 1;
+		}
+	} else nb_bands = 0;
+
+	if (!retval && nb_bands > 0) {
+		int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(com.max_thread) reduction(+:failed)
+#endif
+		{
+			guchar *flags = malloc(nx * sizeof(guchar));
+			if (!flags) {
+				PRINT_ALLOC_ERR;
+				failed++;
+			}
+#ifdef _OPENMP
+#pragma omp for private(b) schedule(dynamic)
+#endif
+			for (b = 0; b < nb_bands; b++) {
+				int band_y0 = y0 + b * PEAKER_BAND_HEIGHT;
+				int band_y1 = min(band_y0 + PEAKER_BAND_HEIGHT, y1);
+				if (failed)
+					continue;
+				if (find_candidates(wave_image, x0, x1, band_y0, band_y1,
+							threshold, norm, flags, bands + b))
+					failed++;
+			}
+			free(flags);
+		}
+		if (failed)
+			retval = 1;
+	}
 
-	for (y = sf->radius + areaY0; y < areaY1 - sf->radius; y++) {
-		int x;
-		for (x = sf->radius + areaX0; x < areaX1 - sf->radius; x++) {
-			WORD pixel = wave_image[y][x];
-			if (pixel > threshold && pixel < norm) {
-				int yy, xx;
-				gboolean bingo = TRUE;
-				WORD neighbor;
-				for (yy = y - 1; yy <= y + 1; yy++) {
-					for (xx = x - 1; xx <= x + 1; xx++) {
-						if (xx == x && yy == y)
-							continue;
-						neighbor = wave_image[yy][xx];
-						if (neighbor > pixel) {
-							bingo = FALSE;
-							break;
-						} else if (neighbor == pixel) {
-							if ((xx <= x && yy <= y) || (xx > x && yy < y)) {
-								bingo = FALSE;
-								break;
-							}
-						}
-					}
+	/* the candidates of the bands are put together in the order of the scan */
+	if (!retval && nb_bands > 0) {
+		for (b = 0; b < nb_bands; b++)
+			nb_candidates += bands[b].nb;
+		if (nb_candidates > 0) {
+			candidates = malloc(nb_candidates * sizeof(struct peaker_candidate));
+			fitted = calloc(nb_candidates, sizeof(fitted_PSF *));
+			if (!candidates || !fitted) {
+				PRINT_ALLOC_ERR;
+				retval = 1;
+			} else {
+				for (b = 0, k = 0; b < nb_bands; b++) {
+					memcpy(candidates + k, bands[b].candidates,
+							bands[b].nb * sizeof(struct peaker_candidate));
+					k += bands[b].nb;
 				}
-				if (bingo && nbstars < MAX_STARS) {
-					int ii, jj, i, j;
-					//~ fprintf(stdout, "Found a probable star at position (%d, %d) with a value of %hu\n", x, y, pixel);
-					gsl_matrix *z = gsl_matrix_alloc(sf->radius * 2, sf->radius * 2);
-					/* FILL z */
-					for (jj = 0, j = y - sf->radius; j < y + sf->radius;
-							j++, jj++) {
-						for (ii = 0, i = x - sf->radius; i < x + sf->radius;
-								i++, ii++) {
-							gsl_matrix_set(z, ii, jj, (double)real_image[j][i]);
+			}
+		}
+	}
+	if (bands) {
+		for (b = 0; b < nb_bands; b++)
+			free(bands[b].candidates);
+		free(bands);
+	}
+
+	/* second pass: PSF fitting, by rounds of no more candidates than stars
+	 * still accepted, so that none is fitted once MAX_STARS are found */
+	if (!retval && nb_candidates > 0) {
+		int failed = 0;
+		/* the normalization value of gfit is computed by the first fit,
+		 * it is done here before the threads share it */
+		get_normalized_value(&gfit);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(com.max_thread)
+#endif
+		{
+			size_t size = sf->radius * 2;
+			double *areas = malloc(PEAKER_FIT_BATCH * size * size * sizeof(double));
+			psf_workspace *ws = new_psf_workspace(size, size);
+			int c0, round_start = 0;
+			if (!areas) {
+				PRINT_ALLOC_ERR;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+				failed++;
+			}
+			/* all threads see the same failed, nbstars and round_start,
+			 * they run the same rounds */
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+			while (!failed && round_start < nb_candidates && nbstars < MAX_STARS) {
+				int round_end = round_start + max(MAX_STARS - nbstars,
+						PEAKER_FIT_BATCH * com.max_thread);
+				if (round_end > nb_candidates)
+					round_end = nb_candidates;
+#ifdef _OPENMP
+#pragma omp for private(c0) schedule(dynamic)
+#endif
+				for (c0 = round_start; c0 < round_end; c0 += PEAKER_FIT_BATCH) {
+					int c, nb = min(PEAKER_FIT_BATCH, round_end - c0);
+					for (c = 0; c < nb; c++) {
+						int x = candidates[c0 + c].x, y = candidates[c0 + c].y;
+						int ii, jj, i, j;
+						double *z = areas + c * size * size;
+						/* FILL z */
+						for (jj = 0, j = y - sf->radius; j < y + sf->radius;
+								j++, jj++) {
+							for (ii = 0, i = x - sf->radius; i < x + sf->radius;
+									i++, ii++) {
+								z[ii * size + jj] = (double)real_image[j][i];
+							}
 						}
 					}
 					/* ****** */
 					/* In this case the angle is not fitted because it
-					 *  slows down the algorithm too much 
-					 * To fit the angle, set the 4th parameter to TRUE */
-					fitted_PSF *cur_star = psf_global_minimisation(z, bg, layer,
-							FALSE, FALSE, FALSE);
-					if (cur_star) {
+					 *  slows down the algorithm too much */
+					psf_global_minimisation_batch(areas, nb, size, size, bg, layer,
+							ws, fitted + c0);
+					for (c = c0; c < c0 + nb; c++) {
+						fitted_PSF *cur_star = fitted[c];
+						if (!cur_star)
+							continue;
 						fwhm_to_arcsec_if_needed(fit, &cur_star);
 						if (is_star(cur_star, sf)) {
-							cur_star->xpos = x + cur_star->x0 - sf->radius - 1.0;
-							cur_star->ypos = y + cur_star->y0 - sf->radius - 1.0;
-							if (nbstars < MAX_STARS) {
-								results[nbstars] = cur_star;
-								results[nbstars + 1] = NULL;
-//								printf("%f\t\t%f\t\t%f\n", cur_star->xpos, cur_star->ypos, cur_star->mag);
-								nbstars++;
-							}
-
+							cur_star->xpos = candidates[c].x + cur_star->x0 - sf->radius - 1.0;
+							cur_star->ypos = candidates[c].y + cur_star->y0 - sf->radius - 1.0;
+						} else {
+							free(cur_star);
+							fitted[c] = NULL;
+						}
+					}
+				}
+				/* the stars of the round are kept in the order of the scan */
+#ifdef _OPENMP
+#pragma omp single
+#endif
+				{
+					for (k = round_start; k < round_end; k++) {
+						if (!fitted[k])
+							continue;
+						if (nbstars < MAX_STARS) {
+							results[nbstars] = fitted[k];
+							results[nbstars + 1] = NULL;
+							nbstars++;
+						} else {
+							free(fitted[k]);
 						}
 					}
-					gsl_matrix_free(z);
 				}
+				round_start = round_end;
 			}
+			free_psf_workspace(ws);
+			free(areas);
+		}
+		if (failed) {
+			for (k = 0; k < nbstars; k++)
+				free(results[k]);
+			nbstars = 0;
+			retval = 1;
 		}
 	}
+	free(candidates);
+	free(fitted);
 
 	if (nbstars == 0) {
 		free(results);
@@ -0,0 +1,226 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib/gstdio.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "core/processing.h"
+#include "gui/progress_and_log.h"
+
+#include "tiling.h"
+
+/* Computes the size of the tiles, without their halo, from the memory that
+ * can be used. memory_MB <= 0 uses the memory limit of the settings. */
+static int compute_tile_size(struct tile_operation *op, int memory_MB, int *tw, int *th) {
+	double max_pixels;
+	int halo2 = 2 * op->halo, side;
+
+	if (memory_MB <= 0)
+		memory_MB = get_max_memory_in_MB();
+	if (memory_MB < 0)	// unlimited
+		memory_MB = get_available_memory_in_MB();
+	max_pixels = (double)memory_MB * BYTES_IN_A_MB / (op->bytes_per_pixel * op->nb_layers);
+
+	switch (op->shape) {
+	case TILES_ROWS:
+		*tw = op->rx;
+		*th = (int)(max_pixels / op->rx) - halo2;
+		break;
+	case TILES_COLUMNS:
+		*th = op->ry;
+		*tw = (int)(max_pixels / op->ry) - halo2;
+		break;
+	default:
+	case TILES_SQUARE:
+		side = (int)sqrt(max_pixels) - halo2;
+		*tw = min(side, op->rx);
+		// use the memory left by a narrow image for taller tiles
+		*th = *tw > 0 ? (int)(max_pixels / (*tw + halo2)) - halo2 : 0;
+	}
+	*tw = min(*tw, op->rx);
+	*th = min(*th, op->ry);
+	if (*tw < 1 || *th < 1) {
+		siril_log_message(_("Not enough memory to process %s by tiles (%d MB allowed)\n"),
+				op->name, memory_MB);
+		return 1;
+	}
+	if ((*tw < op->rx && *tw < op->halo) || (*th < op->ry && *th < op->halo))
+		siril_log_message(_("Warning: tiles are smaller than their halo, "
+					"processing will be slow. Allow more memory to improve it.\n"));
+	return 0;
+}
+
+/* reads an area of all layers of the input in tile */
+static int read_tile(fits *in, fits **tile, int nb_layers, const rectangle *area) {
+	int layer;
+	if (new_fit_image(tile, area->w, area->h, nb_layers))
+		return 1;
+	(*tile)->bitpix = in->bitpix;
+	(*tile)->orig_bitpix = in->orig_bitpix;
+	for (layer = 0; layer < nb_layers; layer++) {
+		if (read_fits_area(in, layer, area, (*tile)->pdata[layer]))
+			return 1;
+	}
+	return 0;
+}
+
+/* writes the area of the tile read from halo_area, without its halo */
+static int write_tile(fits *out, fits *tile, WORD *buffer, const rectangle *halo_area,
+		const rectangle *area) {
+	int layer, y;
+	int dx = area->x - halo_area->x;
+	/* tile data is bottom-up, so the bottom halo is at its start */
+	int dy = (halo_area->y + halo_area->h) - (area->y + area->h);
+
+	for (layer = 0; layer < tile->naxes[2]; layer++) {
+		for (y = 0; y < area->h; y++) {
+			memcpy(buffer + y * area->w,
+					tile->pdata[layer] + (y + dy) * tile->rx + dx,
+					area->w * sizeof(WORD));
+		}
+		if (write_fits_area(out, layer, area, buffer))
+			return 1;
+	}
+	return 0;
+}
+
+static void add_halo(struct tile_operation *op, const rectangle *area, rectangle *halo_area) {
+	int x1 = min(area->x + area->w + op->halo, op->rx);
+	int y1 = min(area->y + area->h + op->halo, op->ry);
+	halo_area->x = max(area->x - op->halo, 0);
+	halo_area->y = max(area->y - op->halo, 0);
+	halo_area->w = x1 - halo_area->x;
+	halo_area->h = y1 - halo_area->y;
+}
+
+/* Applies op to the image of the input FITS file and saves the result in the
+ * output FITS file, never having more than memory_MB megabytes of the image
+ * in memory. With memory_MB <= 0, the memory limit of the settings is used.
+ * Tiles are processed one after the other, operations being parallel. */
+int process_fits_by_tiles(const char *input, const char *output,
+		struct tile_operation *op, int memory_MB) {
+	fits in = { 0 }, out = { 0 }, *tile = NULL;
+	WORD *buffer = NULL;
+	gchar *filename;
+	rectangle area, halo_area;
+	int tw, th, nb_tiles, pass, done = 0, retval = 1;
+	gboolean output_created = FALSE;
+	struct timeval t_start, t_end;
+
+	gettimeofday(&t_start, NULL);
+	if (open_fits_for_areas(input, &in))
+		return 1;
+	if (ends_with(output, com.ext))
+		filename = g_strdup(output);
+	else filename = g_strdup_printf("%s%s", output, com.ext);
+	op->rx = in.rx;
+	op->ry = in.ry;
+	op->nb_layers = in.naxes[2];
+	if (compute_tile_size(op, memory_MB, &tw, &th))
+		goto the_end;
+
+	nb_tiles = ((op->rx + tw - 1) / tw) * ((op->ry + th - 1) / th);
+	siril_log_message(_("%s: processing %s by %d tiles of %dx%d pixels, with a halo of %d pixels\n"),
+			op->name, input, nb_tiles, tw, th, op->halo);
+	set_progress_bar_data(op->name, PROGRESS_RESET);
+
+	for (pass = 0; pass < op->nb_passes; pass++) {
+		for (area.y = 0; area.y < op->ry; area.y += th) {
+			area.h = min(th, op->ry - area.y);
+			for (area.x = 0; area.x < op->rx; area.x += tw) {
+				area.w = min(tw, op->rx - area.x);
+				if (!get_thread_run() || read_tile(&in, &tile, op->nb_layers, &area) ||
+						op->analyse(op, pass, tile, &area))
+					goto the_end;
+				set_progress_bar_data(NULL, (double)++done / (nb_tiles * (op->nb_passes + 1)));
+			}
+		}
+		if (op->end_pass && op->end_pass(op, pass))
+			goto the_end;
+	}
+
+	copy_fits_metadata(&in, &out);
+	out.bitpix = in.bitpix == BYTE_IMG ? BYTE_IMG : USHORT_IMG;
+	out.orig_bitpix = out.bitpix;
+	out.naxis = in.naxis;
+	out.naxes[0] = out.rx = in.rx;
+	out.naxes[1] = out.ry = in.ry;
+	out.naxes[2] = in.naxes[2];
+	out.hi = in.hi;
+	out.lo = in.lo;
+	if (create_fits_for_areas(filename, &out))
+		goto the_end;
+	output_created = TRUE;
+
+	buffer = malloc((size_t)tw * th * sizeof(WORD));
+	if (!buffer) {
+		PRINT_ALLOC_ERR;
+		goto the_end;
+	}
+	for (area.y = 0; area.y < op->ry; area.y += th) {
+		area.h = min(th, op->ry - area.y);
+		for (area.x = 0; area.x < op->rx; area.x += tw) {
+			area.w = min(tw, op->rx - area.x);
+			add_halo(op, &area, &halo_area);
+			if (!get_thread_run() || read_tile(&in, &tile, op->nb_layers, &halo_area) ||
+					op->process(op, tile, &halo_area) ||
+					write_tile(&out, tile, buffer, &halo_area, &area))
+				goto the_end;
+			set_progress_bar_data(NULL, (double)++done / (nb_tiles * (op->nb_passes + 1)));
+		}
+	}
+	retval = 0;
+
+the_end:
+	if (output_created && close_fits_for_areas(&out))
+		retval = 1;
+	if (output_created && retval)
+		g_unlink(filename);	// don't leave a partial image
+	close_fits_for_areas(&in);
+	clearfits(&in);
+	if (tile) {
+		clearfits(tile);
+		free(tile);
+	}
+	free(buffer);
+	if (retval) {
+		set_progress_bar_data(_("Processing by tiles failed"), PROGRESS_DONE);
+	} else {
+		gettimeofday(&t_end, NULL);
+		show_time(t_start, t_end);
+		siril_log_message(_("Result saved in %s\n"), filename);
+		set_progress_bar_data(PROGRESS_TEXT_RESET, PROGRESS_DONE);
+	}
+	g_free(filename);
+	return retval;
+}
+
+void free_tile_operation(struct tile_operation *op) {
+	if (!op)
+		return;
+	if (op->free_data)
+		op->free_data(op);
+	else free(op->data);
+	free(op);
+}
@@ -0,0 +1,43 @@
+#ifndef SRC_ALGOS_TILING_H_
+#define SRC_ALGOS_TILING_H_
+
+#include "core/siril.h"
+
+/* shapes of the tiles of an image processed by tiles */
+typedef enum {
+	TILES_SQUARE,	/* tiles as square as possible, for local filters */
+	TILES_ROWS,	/* bands of complete rows */
+	TILES_COLUMNS	/* bands of complete columns */
+} tile_shape;
+
+/* An operation applied to an image stored in a FITS file, without loading
+ * the whole image in memory. The image is read by tiles, each extended by a
+ * halo of neighbouring pixels the operation needs for the pixels of the tile,
+ * and only the tile without its halo is written to the output file.
+ * Operations that need data about the whole image can first read it in
+ * read-only passes, over tiles without halo. */
+struct tile_operation {
+	const char *name;
+	tile_shape shape;
+	int halo;		// in pixels, on each side of the tiles
+	double bytes_per_pixel;	// memory needed per pixel of a tile, with the temporary data of the operation
+	int nb_passes;		// number of read-only passes, calling analyse and end_pass
+
+	/* area of the tile in the image is in siril's coordinates, with y = 0
+	 * at the top, tile data being stored bottom-up like any fits */
+	int (*analyse)(struct tile_operation *op, int pass, fits *tile, const rectangle *area);
+	int (*end_pass)(struct tile_operation *op, int pass);
+	/* processes in place a tile and its halo, area including the halo */
+	int (*process)(struct tile_operation *op, fits *tile, const rectangle *area);
+	void (*free_data)(struct tile_operation *op);
+	void *data;
+
+	/* size of the processed image, set before the first pass */
+	int rx, ry, nb_layers;
+};
+
+int process_fits_by_tiles(const char *input, const char *output,
+		struct tile_operation *op, int memory_MB);
+void free_tile_operation(struct tile_operation *op);
+
+#endif /* SRC_ALGOS_TILING_H_ */
@@ -0,0 +1,513 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "algos/statistics.h"
+#include "gui/progress_and_log.h"
+#include "warp.h"
+
+/* Planar implementation of OpenCV's warpPerspective(), with the same
+ * interpolation kernels and a black constant border. Each channel of the
+ * image is read and written only once, without interleaving. */
+
+#define WARP_CHUNK 256		// output pixels whose taps are computed together
+#define WARP_MAX_TAPS 8
+#define WARP_TAB_SIZE 256	// fractional positions of the tabulated weights
+/* largest position error, in pixels, allowed to treat a transformation as
+ * affine or as a translation */
+#define WARP_EPSILON 1E-3
+#define LANCZOS_A 4
+#define CUBIC_A -0.75		// as in OpenCV
+
+enum warp_kind { WARP_TRANSLATION, WARP_AFFINE, WARP_PERSPECTIVE };
+
+enum warp_border {
+	WARP_INSIDE,	// all taps are in the input image
+	WARP_PARTIAL,	// some taps are outside, they count as black
+	WARP_OUTSIDE	// no tap in the input image
+};
+
+/* the pixels of the input used to compute an output pixel */
+struct warp_tap {
+	int x, y;		// input position of the first tap
+	enum warp_border border;
+	const float *wx, *wy;	// weights of the taps in each direction
+};
+
+struct warp_params {
+	double I[9];		// transformation from output to input positions
+	enum warp_kind kind;
+	opencv_interpolation interpolation;
+	int nb_taps, offset;	// number of taps and position of the first
+	int rx, ry;		// size of the input
+	gboolean integer_shift;	// translation without resampling
+	int shiftx, shifty;
+	float tab[WARP_TAB_SIZE + 1][WARP_MAX_TAPS];
+	float shift_wx[WARP_MAX_TAPS], shift_wy[WARP_MAX_TAPS];
+};
+
+static double lanczos(double x) {
+	if (x == 0.0)
+		return 1.0;
+	if (x <= -LANCZOS_A || x >= LANCZOS_A)
+		return 0.0;
+	x *= M_PI;
+	return LANCZOS_A * sin(x) * sin(x / LANCZOS_A) / (x * x);
+}
+
+/* weights of the taps for a position of fractional part f */
+static void interpolation_weights(opencv_interpolation interpolation, double f, float *w) {
+	int i;
+	switch (interpolation) {
+	case OPENCV_NEAREST:
+		w[0] = 1.f;
+		break;
+	case OPENCV_CUBIC: {
+		double c0 = ((CUBIC_A * (f + 1.0) - 5.0 * CUBIC_A) * (f + 1.0) + 8.0 * CUBIC_A) * (f + 1.0) - 4.0 * CUBIC_A;
+		double c1 = ((CUBIC_A + 2.0) * f - (CUBIC_A + 3.0)) * f * f + 1.0;
+		double c2 = ((CUBIC_A + 2.0) * (1.0 - f) - (CUBIC_A + 3.0)) * (1.0 - f) * (1.0 - f) + 1.0;
+		w[0] = (float) c0;
+		w[1] = (float) c1;
+		w[2] = (float) c2;
+		w[3] = (float) (1.0 - c0 - c1 - c2);
+		break;
+	}
+	case OPENCV_LANCZOS4: {
+		double l[2 * LANCZOS_A], sum = 0.0;
+		for (i = 0; i < 2 * LANCZOS_A; i++) {
+			l[i] = lanczos(f + LANCZOS_A - 1 - i);
+			sum += l[i];
+		}
+		for (i = 0; i < 2 * LANCZOS_A; i++)
+			w[i] = (float) (l[i] / sum);
+		break;
+	}
+	default:
+		w[0] = (float) (1.0 - f);
+		w[1] = (float) f;
+	}
+}
+
+/* Computes the transformation from output to input positions and chooses the
+ * fastest way to apply it. Returns 1 if H cannot be inverted. */
+static int init_warp_params(struct warp_params *p, const Homography *H,
+		const fits *in, const fits *out, opencv_interpolation interpolation) {
+	double *I = p->I, det, size = in->rx + in->ry;
+	int i, k;
+
+	det = H->h00 * (H->h11 * H->h22 - H->h12 * H->h21)
+		- H->h01 * (H->h10 * H->h22 - H->h12 * H->h20)
+		+ H->h02 * (H->h10 * H->h21 - H->h11 * H->h20);
+	if (fabs(det) < 1e-12)
+		return 1;
+	I[0] = (H->h11 * H->h22 - H->h12 * H->h21) / det;
+	I[1] = (H->h02 * H->h21 - H->h01 * H->h22) / det;
+	I[2] = (H->h01 * H->h12 - H->h02 * H->h11) / det;
+	I[3] = (H->h12 * H->h20 - H->h10 * H->h22) / det;
+	I[4] = (H->h00 * H->h22 - H->h02 * H->h20) / det;
+	I[5] = (H->h02 * H->h10 - H->h00 * H->h12) / det;
+	I[6] = (H->h10 * H->h21 - H->h11 * H->h20) / det;
+	I[7] = (H->h01 * H->h20 - H->h00 * H->h21) / det;
+	I[8] = (H->h00 * H->h11 - H->h01 * H->h10) / det;
+
+	p->kind = WARP_PERSPECTIVE;
+	if (I[8] != 0.0) {
+		for (i = 0; i < 9; i++)
+			I[i] /= I[8];
+		/* the relative variation of the denominator over the output image
+		 * moves the input positions by at most this times their range */
+		if ((fabs(I[6]) * out->rx + fabs(I[7]) * out->ry) * size < WARP_EPSILON) {
+			p->kind = WARP_AFFINE;
+			I[6] = I[7] = 0.0;
+			if ((fabs(I[0] - 1.0) + fabs(I[3])) * out->rx
+					+ (fabs(I[1]) + fabs(I[4] - 1.0)) * out->ry < WARP_EPSILON) {
+				p->kind = WARP_TRANSLATION;
+				I[0] = I[4] = 1.0;
+				I[1] = I[3] = 0.0;
+			}
+		}
+	}
+
+	/* like warpPerspective(), area interpolation is done as bilinear */
+	switch (interpolation) {
+	case OPENCV_NEAREST:
+		p->nb_taps = 1;
+		break;
+	case OPENCV_CUBIC:
+		p->nb_taps = 4;
+		break;
+	case OPENCV_LANCZOS4:
+		p->nb_taps = 2 * LANCZOS_A;
+		break;
+	default:
+		interpolation = OPENCV_LINEAR;
+		p->nb_taps = 2;
+	}
+	p->interpolation = interpolation;
+	p->offset = p->nb_taps / 2 - 1;
+	if (p->offset < 0)
+		p->offset = 0;
+	p->rx = in->rx;
+	p->ry = in->ry;
+
+	for (k = 0; k <= WARP_TAB_SIZE; k++)
+		interpolation_weights(interpolation, (double) k / WARP_TAB_SIZE, p->tab[k]);
+
+	/* the fractional part of the positions is the same for all the pixels
+	 * of a translation, the exact weights are used */
+	p->integer_shift = FALSE;
+	if (p->kind == WARP_TRANSLATION) {
+		double fx = I[2] - floor(I[2]), fy = I[5] - floor(I[5]);
+		if (interpolation == OPENCV_NEAREST ||
+				(min(fx, 1.0 - fx) < WARP_EPSILON && min(fy, 1.0 - fy) < WARP_EPSILON)) {
+			if (fabs(I[2]) < size && fabs(I[5]) < size) {
+				p->integer_shift = TRUE;
+				p->shiftx = round_to_int(I[2]);
+				p->shifty = round_to_int(I[5]);
+			} else p->kind = WARP_AFFINE;	// no pixel of the input is visible
+		}
+		interpolation_weights(interpolation, fx, p->shift_wx);
+		interpolation_weights(interpolation, fy, p->shift_wy);
+	}
+	return 0;
+}
+
+static void set_tap(const struct warp_params *p, double fx, double fy, struct warp_tap *t) {
+	int nb = p->nb_taps, ix, iy;
+
+	if (nb == 1) {
+		fx += 0.5;
+		fy += 0.5;
+	}
+	/* floor(fx) must be in ]offset - nb, rx + offset[, this also rejects
+	 * the NaN of the positions sent to infinity */
+	if (!(fx >= p->offset - nb + 1 && fx < p->rx + p->offset &&
+				fy >= p->offset - nb + 1 && fy < p->ry + p->offset)) {
+		t->border = WARP_OUTSIDE;
+		return;
+	}
+	ix = (int) fx;
+	iy = (int) fy;
+	if (ix > fx) ix--;
+	if (iy > fy) iy--;
+	t->x = ix - p->offset;
+	t->y = iy - p->offset;
+	if (t->x >= 0 && t->y >= 0 && t->x + nb <= p->rx && t->y + nb <= p->ry)
+		t->border = WARP_INSIDE;
+	else t->border = WARP_PARTIAL;
+	if (nb == 1) {
+		t->wx = t->wy = p->tab[0];
+		return;
+	}
+	t->wx = p->tab[(int) ((fx - ix) * WARP_TAB_SIZE + 0.5)];
+	t->wy = p->tab[(int) ((fy - iy) * WARP_TAB_SIZE + 0.5)];
+}
+
+/* computes the taps of n pixels of the output row y, starting at x0 */
+static void make_taps(const struct warp_params *p, int y, int x0, int n, struct warp_tap *taps) {
+	const double *I = p->I;
+	double fx, fy;
+	int i;
+
+	switch (p->kind) {
+	case WARP_TRANSLATION:
+		fy = y + I[5];
+		for (i = 0; i < n; i++) {
+			set_tap(p, x0 + i + I[2], fy, taps + i);
+			taps[i].wx = p->shift_wx;
+			taps[i].wy = p->shift_wy;
+		}
+		break;
+	case WARP_AFFINE:
+		fx = I[0] * x0 + I[1] * y + I[2];
+		fy = I[3] * x0 + I[4] * y + I[5];
+		for (i = 0; i < n; i++) {
+			set_tap(p, fx, fy, taps + i);
+			fx += I[0];
+			fy += I[3];
+		}
+		break;
+	default:
+		for (i = 0; i < n; i++) {
+			double x = x0 + i;
+			double w = I[6] * x + I[7] * y + I[8];
+			set_tap(p, (I[0] * x + I[1] * y + I[2]) / w,
+					(I[3] * x + I[4] * y + I[5]) / w, taps + i);
+		}
+	}
+}
+
+static void warp_chunk_ushort(const struct warp_params *p, const WORD *in,
+		const struct warp_tap *taps, int n, WORD *out) {
+	int i, j, k, nb = p->nb_taps;
+
+	for (i = 0; i < n; i++) {
+		const struct warp_tap *t = taps + i;
+		double value = 0.0;
+
+		if (t->border == WARP_OUTSIDE) {
+			out[i] = 0;
+			continue;
+		}
+		if (nb == 1) {
+			out[i] = in[(size_t) t->y * p->rx + t->x];
+			continue;
+		}
+		if (nb == 2 && t->border == WARP_INSIDE) {
+			const WORD *line = in + (size_t) t->y * p->rx + t->x;
+			value = t->wy[0] * (t->wx[0] * line[0] + t->wx[1] * line[1]) +
+				t->wy[1] * (t->wx[0] * line[p->rx] + t->wx[1] * line[p->rx + 1]);
+			out[i] = round_to_WORD(value);
+			continue;
+		}
+		for (j = 0; j < nb; j++) {
+			int y = t->y + j;
+			const WORD *line;
+			double row = 0.0;
+
+			if (t->border == WARP_PARTIAL && (y < 0 || y >= p->ry))
+				continue;
+			line = in + (size_t) y * p->rx;
+			if (t->border == WARP_PARTIAL) {
+				for (k = 0; k < nb; k++)
+					if (t->x + k >= 0 && t->x + k < p->rx)
+						row += t->wx[k] * line[t->x + k];
+			} else {
+				for (k = 0; k < nb; k++)
+					row += t->wx[k] * line[t->x + k];
+			}
+			value += t->wy[j] * row;
+		}
+		out[i] = round_to_WORD(value);
+	}
+}
+
+static void warp_chunk_float(const struct warp_params *p, const float *in,
+		const struct warp_tap *taps, int n, float *out) {
+	int i, j, k, nb = p->nb_taps;
+
+	for (i = 0; i < n; i++) {
+		const struct warp_tap *t = taps + i;
+		double value = 0.0;
+
+		if (t->border == WARP_OUTSIDE) {
+			out[i] = 0.f;
+			continue;
+		}
+		if (nb == 1) {
+			out[i] = in[(size_t) t->y * p->rx + t->x];
+			continue;
+		}
+		if (nb == 2 && t->border == WARP_INSIDE) {
+			const float *line = in + (size_t) t->y * p->rx + t->x;
+			value = t->wy[0] * (t->wx[0] * line[0] + t->wx[1] * line[1]) +
+				t->wy[1] * (t->wx[0] * line[p->rx] + t->wx[1] * line[p->rx + 1]);
+			out[i] = (float) value;
+			continue;
+		}
+		for (j = 0; j < nb; j++) {
+			int y = t->y + j;
+			const float *line;
+			double row = 0.0;
+
+			if (t->border == WARP_PARTIAL && (y < 0 || y >= p->ry))
+				continue;
+			line = in + (size_t) y * p->rx;
+			if (t->border == WARP_PARTIAL) {
+				for (k = 0; k < nb; k++)
+					if (t->x + k >= 0 && t->x + k < p->rx)
+						row += t->wx[k] * line[t->x + k];
+			} else {
+				for (k = 0; k < nb; k++)
+					row += t->wx[k] * line[t->x + k];
+			}
+			value += t->wy[j] * row;
+		}
+		out[i] = (float) value;
+	}
+}
+
+/* copies the row y of the output of an integer translation, pixels being of
+ * size bytes */
+static void shift_row(const struct warp_params *p, const char *in, char *out,
+		int width, int y, size_t size) {
+	int sy = y + p->shifty;
+	int xstart = max(0, -p->shiftx), xend = min(width, p->rx - p->shiftx);
+
+	if (sy < 0 || sy >= p->ry || xstart >= xend) {
+		memset(out, 0, width * size);
+		return;
+	}
+	in += ((size_t) sy * p->rx + xstart + p->shiftx) * size;
+	memset(out, 0, xstart * size);
+	memcpy(out + xstart * size, in, (xend - xstart) * size);
+	memset(out + xend * size, 0, (width - xend) * size);
+}
+
+/* Transforms in into out with the homography H, like warpPerspective(): each
+ * pixel of out is interpolated at the position of in that H maps to it. The
+ * size of out, which must be allocated with the same number of channels and
+ * the same type as in, gives the size of the result. Positions are those of
+ * the rows as stored in the data. */
+int warp_image(fits *in, fits *out, Homography H, opencv_interpolation interpolation) {
+	struct warp_params *p;
+	int y;
+
+	if (in->naxes[2] != out->naxes[2] || in->type != out->type) {
+		siril_debug_print("warp_image: input and output images are not compatible\n");
+		return -1;
+	}
+	p = malloc(sizeof(struct warp_params));
+	if (!p) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	if (init_warp_params(p, &H, in, out, interpolation)) {
+		siril_log_message(_("The transformation cannot be applied, it is not invertible\n"));
+		free(p);
+		return 1;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(y) schedule(static)
+#endif
+	for (y = 0; y < out->ry; y++) {
+		struct warp_tap taps[WARP_CHUNK];
+		size_t row = (size_t) y * out->rx;
+		int x0, layer;
+
+		if (p->integer_shift) {
+			for (layer = 0; layer < out->naxes[2]; layer++) {
+				if (in->type == DATA_FLOAT)
+					shift_row(p, (char *) in->fpdata[layer],
+							(char *) (out->fpdata[layer] + row),
+							out->rx, y, sizeof(float));
+				else shift_row(p, (char *) in->pdata[layer],
+						(char *) (out->pdata[layer] + row),
+						out->rx, y, sizeof(WORD));
+			}
+			continue;
+		}
+		for (x0 = 0; x0 < out->rx; x0 += WARP_CHUNK) {
+			int n = min(WARP_CHUNK, out->rx - x0);
+			make_taps(p, y, x0, n, taps);
+			for (layer = 0; layer < out->naxes[2]; layer++) {
+				if (in->type == DATA_FLOAT)
+					warp_chunk_float(p, in->fpdata[layer], taps, n,
+							out->fpdata[layer] + row + x0);
+				else warp_chunk_ushort(p, in->pdata[layer], taps, n,
+						out->pdata[layer] + row + x0);
+			}
+		}
+	}
+	free(p);
+	invalidate_stats_from_fit(out);
+	return 0;
+}
+
+/* conjugates H by the vertical flips of the input and output images */
+static Homography flip_homography(Homography H, int in_height, int out_height) {
+	double a = in_height - 1, b = out_height - 1;
+	Homography F = H;
+
+	/* F = Flip_out . H . Flip_in, with Flip(y) = height - 1 - y */
+	F.h01 = -H.h01;
+	F.h02 = H.h02 + a * H.h01;
+	F.h10 = b * H.h20 - H.h10;
+	F.h11 = H.h11 - b * H.h21;
+	F.h12 = b * (H.h22 + a * H.h21) - H.h12 - a * H.h11;
+	F.h21 = -H.h21;
+	F.h22 = H.h22 + a * H.h21;
+	return F;
+}
+
+/* Transforms fit with H, given in top-down coordinates like the star
+ * positions of the registration, into an image of width x height pixels that
+ * replaces its data. */
+int warp_fits(fits *fit, int width, int height, Homography H, opencv_interpolation interpolation) {
+	size_t nbdata = (size_t) width * height;
+	int nb_layers = fit->naxes[2], layer;
+	fits out = { 0 };
+
+	if (nb_layers != 1 && nb_layers != 3) {
+		siril_log_message(_("Transformation is not supported for images with %d channels\n"), nb_layers);
+		return -1;
+	}
+	out.rx = out.naxes[0] = width;
+	out.ry = out.naxes[1] = height;
+	out.naxes[2] = nb_layers;
+	out.type = fit->type;
+	if (fit->type == DATA_FLOAT) {
+		out.fdata = malloc(nbdata * nb_layers * sizeof(float));
+		if (!out.fdata) {
+			PRINT_ALLOC_ERR;
+			return 1;
+		}
+		for (layer = 0; layer < 3; layer++)
+			out.fpdata[layer] = out.fdata + (nb_layers == 3 ? nbdata * layer : 0);
+	} else {
+		out.data = malloc(nbdata * nb_layers * sizeof(WORD));
+		if (!out.data) {
+			PRINT_ALLOC_ERR;
+			return 1;
+		}
+		for (layer = 0; layer < 3; layer++)
+			out.pdata[layer] = out.data + (nb_layers == 3 ? nbdata * layer : 0);
+	}
+
+	/* FITS data is stored bottom-up */
+	if (warp_image(fit, &out, flip_homography(H, fit->ry, height), interpolation)) {
+		free(out.data);
+		free(out.fdata);
+		return 1;
+	}
+
+	if (fit->type == DATA_FLOAT) {
+		free(fit->fdata);
+		fit->fdata = out.fdata;
+		for (layer = 0; layer < 3; layer++)
+			fit->fpdata[layer] = out.fpdata[layer];
+	} else {
+		if (fit->mapped_base) {
+#ifdef HAVE_MMAP
+			munmap(fit->mapped_base, fit->mapped_size);
+#endif
+			fit->mapped_base = NULL;
+		} else free(fit->data);
+		fit->data = out.data;
+		for (layer = 0; layer < 3; layer++)
+			fit->pdata[layer] = out.pdata[layer];
+	}
+	fit->rx = fit->naxes[0] = width;
+	fit->ry = fit->naxes[1] = height;
+	invalidate_stats_from_fit(fit);
+	return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef SRC_ALGOS_WARP_H_
+#define SRC_ALGOS_WARP_H_
+
+#include "core/siril.h"
+
+int	warp_image(fits *in, fits *out, Homography H, opencv_interpolation interpolation);
+int	warp_fits(fits *fit, int width, int height, Homography H, opencv_interpolation interpolation);
+
+#endif /* SRC_ALGOS_WARP_H_ */
@@ -66,6 +66,7 @@
 #include "filters/rgradient.h"
 #include "filters/saturation.h"
 #include "filters/scnr.h"
+#include "filters/wavelets.h"
 #include "algos/PSF.h"
 #include "algos/star_finder.h"
 #include "algos/Def_Math.h"
@@ -76,10 +77,13 @@
 #include "algos/statistics.h"
 #include "algos/sorting.h"
 #include "algos/geometry.h"
+#include "algos/tiling.h"
 #include "stacking/stacking.h"
 #include "stacking/sum.h"
+#include "stacking/stream.h"
 #include "registration/registration.h"
 #include "registration/matching/match.h"
+#include "registration/multipoint.h"
 
 static char *word[MAX_COMMAND_WORDS];	// NULL terminated
 
@@ -97,7 +101,7 @@ static command commands[] = {
 	{"clear", 0, "clear", process_clear, STR_CLEAR, FALSE},
 	{"clearstar", 0, "clearstar", process_clearstar, STR_CLEARSTAR, FALSE},
 	{"close", 0, "close", process_close, STR_CLOSE, TRUE},
-	{"convertraw", 1, "convertraw basename [-debayer]", process_convertraw, STR_CONVERT, TRUE},
+	{"convertraw", 1, "convertraw basename [-debayer] [-threads=n]", process_convertraw, STR_CONVERT, TRUE},
 	{"cosme", 1, "cosme [filename].lst", process_cosme, STR_COSME, TRUE},
 	{"cosme_cfa", 1, "cosme_cfa [filename].lst", process_cosme, STR_COSME_CFA, TRUE},
 	{"crop", 0, "crop [x y width height]", process_crop, STR_CROP, TRUE},
@@ -150,10 +154,11 @@ static command commands[] = {
 	
 	{"offset", 1, "offset value", process_offset, STR_OFFSET, TRUE},
 	
-	{"preprocess", 1, "preprocess sequencename [-bias=filename] [-dark=filename] [-flat=filename] [-cfa] [-debayer] [-stretch] [-flip] [-equalize_cfa] [-opt]", process_preprocess, STR_PREPROCESS, TRUE},
+	{"preprocess", 1, "preprocess sequencename [-bias=filename] [-dark=filename] [-flat=filename] [-cfa] [-debayer] [-stretch] [-flip] [-equalize_cfa] [-opt] [-32b] [-chunked]", process_preprocess, STR_PREPROCESS, TRUE},
 	{"psf", 0, "psf", process_psf, STR_PSF, FALSE},
 	
-	{"register", 1, "register sequence [-norot] [-drizzle]", process_register, STR_REGISTER, TRUE},
+	{"register", 1, "register sequence [-norot|-noout] [-drizzle]", process_register, STR_REGISTER, TRUE},
+	{"registermp", 1, "registermp sequence [-box=size]", process_registermp, STR_REGISTERMP, TRUE},
 	{"resample", 1, "resample factor", process_resample, STR_RESAMPLE, TRUE},
 	{"rgradient", 4, "rgradient xc yc dR dalpha", process_rgradient, STR_RGRADIENT, TRUE},
 	{"rl", 2, "rl iterations sigma", process_rl, STR_RL, TRUE},
@@ -179,6 +184,7 @@ static command commands[] = {
 	{"seqcrop", 1, "seqcrop sequencename [x y width height]", process_seq_crop, STR_SEQCROP, TRUE},
 	{"seqfind_cosme", 3, "seqfind_cosme sequencename cold_sigma hot_sigma", process_findcosme, STR_SEQFIND_COSME, TRUE},
 	{"seqfind_cosme_cfa", 3, "seqfind_cosme_cfa sequencename cold_sigma hot_sigma", process_findcosme, STR_SEQFIND_COSME_CFA, TRUE},
+	{"seqpipeline", 2, "seqpipeline sequencename operation [options] [+ operation [options]]...", process_seqpipeline, STR_SEQPIPELINE, TRUE},
 	{"seqpsf", 0, "seqpsf", process_seq_psf, STR_SEQPSF, FALSE},
 	{"seqsplit_cfa", 0, "seqsplit_cfa sequencename", process_seq_split_cfa, STR_SEQSPLIT_CFA, FALSE},
 #ifdef _OPENMP
@@ -191,13 +197,15 @@ static command commands[] = {
 	{"setmem", 1, "setmem ratio", process_set_mem, STR_SETMEM, TRUE},
 	{"split", 3, "split R G B", process_split, STR_SPLIT, TRUE},
 	{"split_cfa", 0, "split_cfa", process_split_cfa, STR_SPLIT_CFA, TRUE},
-	{"stack", 1, "stack sequencename [type] [sigma low] [sigma high] [-nonorm, norm=] [-out=result_filename] [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]]", process_stackone, STR_STACK, TRUE},
-	{"stackall", 0, "stackall [type] [sigma low] [sigma high] [-nonorm, norm=] [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]]", process_stackall, STR_STACKALL, TRUE},
+	{"stack", 1, "stack sequencename [type] [sigma low] [sigma high] [-nonorm, norm=] [-approx] [-interp=] [-32b] [-tilebest=percent] [-out=result_filename] [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]]", process_stackone, STR_STACK, TRUE},
+	{"stackall", 0, "stackall [type] [sigma low] [sigma high] [-nonorm, norm=] [-approx] [-interp=] [-32b] [-tilebest=percent] [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]]", process_stackall, STR_STACKALL, TRUE},
+	{"stackstream", 1, "stackstream sequencename [type] [sigma low] [sigma high] [-every=n] [-out=result_filename] [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]]", process_stackstream, STR_STACKSTREAM, TRUE},
 	{"stat", 0, "stat", process_stat, STR_STAT, TRUE},
 	
 	{"threshlo", 1, "threshlo level", process_threshlo, STR_THRESHLO, TRUE},
 	{"threshhi", 1, "threshi level", process_threshhi, STR_THRESHHI, TRUE},
 	{"thresh", 2, "thresh lo hi", process_thresh, STR_THRESH, TRUE}, /* threshes hi and lo */
+	{"tileproc", 5, "tileproc input output { fmedian ksize modulation | rl iterations sigma | fixbanding amount sigma [-vertical] | wlayer NbPlans plan } [-mem=MB]", process_tileproc, STR_TILEPROC, TRUE},
 	
 	{"unselect", 2, "unselect from to", process_unselect, STR_UNSELECT, FALSE},
 	{"unsetmag", 0, "unsetmag", process_unset_mag, STR_UNSETMAG, FALSE},
@@ -1976,6 +1984,7 @@ int process_convertraw(int nb) {
 	GList *list = NULL;
 
 	struct timeval t_start;
+	int i, nb_threads = com.max_thread;
 
 	if (get_thread_run()) {
 		siril_log_message(_("Another task is "
@@ -1983,9 +1992,15 @@ int process_convertraw(int nb) {
 		return 1;
 	}
 
-	if (word[2]) {
-		if (!strcmp(word[2], "-debayer")) {
+	for (i = 2; i < nb; i++) {
+		if (!strcmp(word[i], "-debayer")) {
 			set_debayer_in_convflags();
+		} else if (g_str_has_prefix(word[i], "-threads=")) {
+			nb_threads = g_ascii_strtoll(word[i] + 9, NULL, 10);
+			if (nb_threads < 1) {
+				siril_log_message(_("Invalid number of threads: %s\n"), word[i] + 9);
+				return 1;
+			}
 		}
 	}
 
@@ -2034,8 +2049,11 @@ int process_convertraw(int nb) {
 	args->t_start.tv_sec = t_start.tv_sec;
 	args->t_start.tv_usec = t_start.tv_usec;
 	args->compatibility = FALSE;	// not used here
+	args->stretch_cfa = FALSE;
+	args->several_type_of_files = FALSE;
 	args->command_line = TRUE;
 	args->destroot = g_strdup(word[1]);
+	args->nb_threads = nb_threads;
 	start_in_new_thread(convert_thread_worker, args);
 	return 0;
 }
@@ -2107,6 +2125,9 @@ int process_register(int nb) {
 				reg_args->x2upscale = TRUE;
 			} else if (!strcmp(word[i], "-norot")) {
 				reg_args->translation_only = TRUE;
+			} else if (!strcmp(word[i], "-noout")) {
+				reg_args->translation_only = TRUE;
+				reg_args->transform_at_stacking = TRUE;
 			}
 		}
 	}
@@ -2151,6 +2172,74 @@ int process_register(int nb) {
 	return 0;
 }
 
+int process_registermp(int nb) {
+	struct registration_args *reg_args;
+	int i;
+
+	if (get_thread_run()) {
+		siril_log_message(_("Another task is "
+				"already in progress, ignoring new request.\n"));
+		return 1;
+	}
+
+	gchar *file = g_strdup(word[1]);
+	if (!ends_with(file, ".seq")) {
+		str_append(&file, ".seq");
+	}
+	if (!existseq(file)) {
+		if (check_seq(FALSE)) {
+			siril_log_message(_("No sequence `%s' found.\n"), file);
+			g_free(file);
+			return 1;
+		}
+	}
+	sequence *seq = readseqfile(file);
+	g_free(file);
+	if (seq == NULL) {
+		siril_log_message(_("No sequence `%s' found.\n"), word[1]);
+		return 1;
+	}
+	if (seq_check_basic_data(seq, FALSE) == -1) {
+		free(seq);
+		return 1;
+	}
+
+	reg_args = calloc(1, sizeof(struct registration_args));
+	reg_args->func = register_multipoint;
+	reg_args->seq = seq;
+	reg_args->reference_image = sequence_find_refimage(seq);
+	reg_args->process_all_frames = TRUE;
+	reg_args->layer = (seq->nb_layers == 3) ? 1 : 0;
+	reg_args->box_size = MP_DEFAULT_BOX_SIZE;
+	reg_args->run_in_thread = TRUE;
+	reg_args->load_new_sequence = FALSE;
+
+	for (i = 2; i < nb; i++) {
+		if (g_str_has_prefix(word[i], "-box=")) {
+			reg_args->box_size = atoi(word[i] + 5);
+			if (reg_args->box_size < 16) {
+				siril_log_message(_("The size of the boxes must be at least 16 pixels\n"));
+				free_sequence(seq, TRUE);
+				free(reg_args);
+				return 1;
+			}
+		} else {
+			siril_log_message(_("Unknown option %s\n"), word[i]);
+			free_sequence(seq, TRUE);
+			free(reg_args);
+			return 1;
+		}
+	}
+
+	if (!com.script)
+		control_window_switch_to_tab(OUTPUT_LOGS);
+	siril_log_color_message(_("Registration: processing using method: %s\n"), "red",
+			_("Multi-point alignment"));
+	set_cursor_waiting(TRUE);
+	start_in_new_thread(register_thread_func, reg_args);
+	return 0;
+}
+
 // parse normalization and filters from the stack command line, starting at word `first'
 static int parse_stack_command_line(struct stacking_configuration *arg, int first, gboolean norm_allowed, gboolean out_allowed) {
 	while (word[first]) {
@@ -2173,6 +2262,55 @@ static int parse_stack_command_line(struct stacking_configuration *arg, int firs
 			}
 		}
 
+		else if (g_str_has_prefix(current, "-interp=")) {
+			value = current + 8;
+			if (!strcmp(value, "no") || !strcmp(value, "nearest"))
+				arg->interpolation = OPENCV_NEAREST;
+			else if (!strcmp(value, "bilinear"))
+				arg->interpolation = OPENCV_LINEAR;
+			else if (!strcmp(value, "lanczos"))
+				arg->interpolation = OPENCV_LANCZOS4;
+			else {
+				siril_log_message(_("Unknown interpolation `%s', aborting.\n"), value);
+				return 1;
+			}
+		}
+
+		else if (!strcmp(current, "-approx")) {
+			if (arg->method != stack_median) {
+				siril_log_message(_("The approximate mode is only available for the median stacking, ignoring.\n"));
+			} else arg->method = stack_median_approx;
+		}
+		else if (!strcmp(current, "-32b")) {
+			if (arg->method != stack_median && arg->method != stack_mean_with_rejection) {
+				siril_log_message(_("32-bit output is only available for the median and mean stackings, ignoring.\n"));
+			} else arg->use_32bit_output = TRUE;
+		}
+		else if (g_str_has_prefix(current, "-tilebest=")) {
+			if (arg->method != stack_multipoint) {
+				siril_log_message(_("Selecting the best frames of each box is only available for the mp stacking, ignoring.\n"));
+			} else {
+				value = current + 10;
+				arg->tile_best = atof(value);
+				if (arg->tile_best <= 0.0 || arg->tile_best > 100.0) {
+					siril_log_message(_("Wrong parameter values. Percentage must be greater than 0 and less or equal to 100, aborting.\n"));
+					return 1;
+				}
+			}
+		}
+		else if (g_str_has_prefix(current, "-every=")) {
+			if (arg->method != stack_streaming) {
+				siril_log_message(_("Saving intermediate results is only possible with streaming stacking, ignoring.\n"));
+			} else {
+				value = current + 7;
+				arg->stream_every = atoi(value);
+				if (arg->stream_every <= 0) {
+					siril_log_message(_("Wrong parameter values. Number of images must be greater than 0, aborting.\n"));
+					return 1;
+				}
+			}
+		}
+
 		else if (g_str_has_prefix(current, "-filter-fwhm=")) {
 			value = strchr(current, '=') + 1;
 			if (value[0] != '\0') {
@@ -2266,10 +2404,12 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 		args.seq = seq;
 		args.ref_image = sequence_find_refimage(seq);
 		// the three below: used only if method is average w/ rejection
-		if (arg->method == stack_mean_with_rejection && (arg->sig[0] != 0.0 || arg->sig[1] != 0.0)) {
+		if ((arg->method == stack_mean_with_rejection || arg->method == stack_streaming) &&
+				(arg->sig[0] != 0.0 || arg->sig[1] != 0.0)) {
 			args.sig[0] = arg->sig[0];
 			args.sig[1] = arg->sig[1];
-			args.type_of_rejection = WINSORIZED;
+			// streaming stacking can only do an online sigma clipping
+			args.type_of_rejection = arg->method == stack_streaming ? SIGMA : WINSORIZED;
 		} else {
 			args.type_of_rejection = NO_REJEC;
 			siril_log_message(_("Not using rejection for stacking\n"));
@@ -2278,12 +2418,18 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 		args.coeff.mul = NULL;
 		args.coeff.scale = NULL;
 		if (!arg->force_no_norm &&
-				(arg->method == stack_median || arg->method == stack_mean_with_rejection))
+				(arg->method == stack_median || arg->method == stack_median_approx ||
+				 arg->method == stack_mean_with_rejection))
 			args.normalize = arg->norm;
 		else args.normalize = NO_NORM;
+		args.interpolation = arg->interpolation;
+		args.stream_type = arg->stream_type;
+		args.stream_every = arg->stream_every;
 		args.method = arg->method;
 		args.force_norm = FALSE;
 		args.norm_to_16 = TRUE;
+		args.use_32bit_output = arg->use_32bit_output && arg->method != stack_median_approx;
+		args.tile_best = arg->tile_best;
 		args.reglayer = args.seq->nb_layers == 1 ? 0 : 1;
 
 		// manage filters
@@ -2302,6 +2448,7 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 					seq->seqname, suffix, com.ext);
 			arg->result_file = strdup(filename);
 		}
+		args.output_filename = arg->result_file;
 
 		main_stack(&args);
 
@@ -2313,10 +2460,13 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 
 		if (!retval) {
 			struct noise_data noise_args = { .fit = &gfit, .verbose = FALSE, .use_idle = FALSE };
-			noise(&noise_args);
 			if (savefits(arg->result_file, &gfit))
 				siril_log_color_message(_("Could not save the stacking result %s\n"),
 						"red", arg->result_file);
+			/* noise is evaluated on 16-bit data */
+			if (gfit.type == DATA_FLOAT)
+				fit_convert_to_ushort(&gfit);
+			noise(&noise_args);
 			clearfits(&gfit);
 			++arg->number_of_loaded_sequences;
 		}
@@ -2377,7 +2527,7 @@ int process_stackall(int nb) {
 	arg->filter_included = FALSE; arg->norm = NO_NORM; arg->force_no_norm = FALSE;
 
 	// stackall { sum | min | max } [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]]
-	// stackall { med | median } [-nonorm, norm=] [-filter-incl[uded]]
+	// stackall { med | median } [-nonorm, norm=] [-approx] [-filter-incl[uded]]
 	// stackall { rej | mean } sigma_low sigma_high [-nonorm, norm=] [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]]
 	if (!word[1]) {
 		arg->method = stack_summing_generic;
@@ -2393,6 +2543,8 @@ int process_stackall(int nb) {
 		} else if (!strcmp(word[1], "med") || !strcmp(word[1], "median")) {
 			arg->method = stack_median;
 			allow_norm = TRUE;
+		} else if (!strcmp(word[1], "mp")) {
+			arg->method = stack_multipoint;
 		} else if (!strcmp(word[1], "rej") || !strcmp(word[1], "mean")) {
 			if (!word[2] || !word[3] || (arg->sig[0] = atof(word[2])) < 0.0
 					|| (arg->sig[1] = atof(word[3])) < 0.0) {
@@ -2472,7 +2624,7 @@ int process_stackone(int nb) {
 	arg->seqfile = file;
 
 	// stack seqfilename { sum | min | max } [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]] -out=result_filename
-	// stack seqfilename { med | median } [-nonorm, norm=] [-filter-incl[uded]] -out=result_filename
+	// stack seqfilename { med | median } [-nonorm, norm=] [-approx] [-filter-incl[uded]] -out=result_filename
 	// stack seqfilename { rej | mean } sigma_low sigma_high [-nonorm, norm=] [-filter-fwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]] -out=result_filename
 	if (!word[2]) {
 		arg->method = stack_summing_generic;
@@ -2488,6 +2640,8 @@ int process_stackone(int nb) {
 		} else if (!strcmp(word[2], "med") || !strcmp(word[2], "median")) {
 			arg->method = stack_median;
 			allow_norm = TRUE;
+		} else if (!strcmp(word[2], "mp")) {
+			arg->method = stack_multipoint;
 		} else if (!strcmp(word[2], "rej") || !strcmp(word[2], "mean")) {
 			if (!word[3] || !word[4] || (arg->sig[0] = atof(word[3])) < 0.0
 					|| (arg->sig[1] = atof(word[4])) < 0.0) {
@@ -2521,11 +2675,81 @@ failure:
 	return 1;
 }
 
+int process_stackstream(int nb) {
+	struct stacking_configuration *arg;
+	gchar *file;
+	int start_arg_opt = 3;
+
+	arg = calloc(1, sizeof(struct stacking_configuration));
+	arg->f_fwhm = -1.f; arg->f_fwhm_p = -1.f; arg->f_round = -1.f;
+	arg->f_round_p = -1.f; arg->f_quality = -1.f; arg->f_quality_p = -1.f;
+	arg->filter_included = FALSE; arg->norm = NO_NORM; arg->force_no_norm = TRUE;
+	arg->method = stack_streaming;
+	arg->stream_type = STACK_MEAN;
+
+	file = g_strdup(word[1]);
+	if (!ends_with(file, ".seq")) {
+		str_append(&file, ".seq"); // reallocs file
+	}
+
+	if (!existseq(file)) {
+		if (check_seq(FALSE)) {
+			siril_log_message(_("No sequence `%s' found.\n"), file);
+			goto failure;
+		}
+	}
+	arg->seqfile = file;
+
+	// stackstream seqfilename { sum | mean | min | max } [-every=n] [-filter-*] -out=result_filename
+	// stackstream seqfilename rej sigma_low sigma_high [-every=n] [-filter-*] -out=result_filename
+	if (word[2]) {
+		if (!strcmp(word[2], "sum")) {
+			arg->stream_type = STACK_SUM;
+		} else if (!strcmp(word[2], "mean")) {
+			arg->stream_type = STACK_MEAN;
+		} else if (!strcmp(word[2], "max")) {
+			arg->stream_type = STACK_MAX;
+		} else if (!strcmp(word[2], "min")) {
+			arg->stream_type = STACK_MIN;
+		} else if (!strcmp(word[2], "rej")) {
+			if (!word[3] || !word[4] || (arg->sig[0] = atof(word[3])) < 0.0
+					|| (arg->sig[1] = atof(word[4])) < 0.0) {
+				siril_log_message(_("The streaming stacking with rejection uses an online sigma "
+							"clipping and requires two extra arguments: sigma low and high.\n"));
+				goto failure;
+			}
+			arg->stream_type = STACK_MEAN;
+			start_arg_opt = 5;
+		} else if (word[2][0] == '-') {
+			start_arg_opt = 2;
+		} else {
+			siril_log_message(_("Stacking method type '%s' is invalid\n"), word[2]);
+			goto failure;
+		}
+		if (parse_stack_command_line(arg, start_arg_opt, FALSE, TRUE))
+			goto failure;
+	}
+	set_cursor_waiting(TRUE);
+	gettimeofday(&arg->t_start, NULL);
+	if (!com.headless)
+		control_window_switch_to_tab(OUTPUT_LOGS);
+
+	start_in_new_thread(stackone_worker, arg);
+	return 0;
+
+failure:
+	g_free(arg->result_file);
+	g_free(arg->seqfile);
+	free(arg);
+	return 1;
+}
+
+static int parse_preprocess_options(struct preprocessing_data *args, int first, int last);
+
 int process_preprocess(int nb) {
 	struct preprocessing_data *args;
-	int nb_command_max = 10;
+	int nb_command_max = 11;
 	gchar *file;
-	int i, retvalue = 0;
 
 	if (word[1][0] == '\0') {
 		return -1;
@@ -2556,12 +2780,38 @@ int process_preprocess(int nb) {
 	}
 
 	args = calloc(1, sizeof(struct preprocessing_data));
+	if (parse_preprocess_options(args, 2, nb_command_max)) {
+		free(args);
+		return -1;
+	}
+
+	siril_log_color_message(_("Preprocessing...\n"), "red");
+	gettimeofday(&args->t_start, NULL);
+	args->seq = seq;
+
+	// start preprocessing
+	set_cursor_waiting(TRUE);
+
+	start_sequence_preprocessing(args, TRUE);
+	return 0;
+}
+
+/* reads preprocess options and master files from word[first] to word[last - 1] */
+static int parse_preprocess_options(struct preprocessing_data *args, int first, int last) {
+	int i, retvalue = 0;
 
-	/* checking for options */
-	for (i = 2; i < nb_command_max; i++) {
+	/* masters are read in float for a 32-bit output, wherever the option is */
+	for (i = first; i < last && word[i]; i++) {
+		if (!strcmp(word[i], "-32b"))
+			args->float_output = TRUE;
+	}
+	data_type master_type = args->float_output ? DATA_FLOAT : DATA_USHORT;
+
+	for (i = first; i < last && word[i]; i++) {
 		if (word[i]) {
 			if (g_str_has_prefix(word[i], "-bias=")) {
 				args->bias = calloc(1, sizeof(fits));
+				args->bias->type = master_type;
 				if (!readfits(word[i] + 6, args->bias, NULL)) {
 					args->use_bias = TRUE;
 				} else {
@@ -2571,6 +2821,7 @@ int process_preprocess(int nb) {
 				}
 			} else if (g_str_has_prefix(word[i], "-dark=")) {
 				args->dark = calloc(1, sizeof(fits));
+				args->dark->type = master_type;
 				if (!readfits(word[i] + 6, args->dark, NULL)) {
 					args->use_dark = TRUE;
 					args->use_cosmetic_correction = TRUE;
@@ -2581,6 +2832,7 @@ int process_preprocess(int nb) {
 				}
 			} else if (g_str_has_prefix(word[i], "-flat=")) {
 				args->flat = calloc(1, sizeof(fits));
+				args->flat->type = master_type;
 				if (!readfits(word[i] + 6, args->flat, NULL)) {
 					args->use_flat = TRUE;
 				} else {
@@ -2600,29 +2852,253 @@ int process_preprocess(int nb) {
 				args->compatibility = TRUE;
 			} else if (!strcmp(word[i], "-equalize_cfa")) {
 				args->equalize_cfa = TRUE;
+			} else if (!strcmp(word[i], "-chunked")) {
+				args->chunked_output = TRUE;
 			}
 		}
 	}
+	if (retvalue)
+		return retvalue;
 
-	if (retvalue) {
-		free(args);
-		return -1;
-	}
-
-	siril_log_color_message(_("Preprocessing...\n"), "red");
-	gettimeofday(&args->t_start, NULL);
-	args->seq = seq;
 	args->is_sequence = TRUE;
 	args->autolevel = TRUE;
 	args->normalisation = 1.0f;	// will be updated anyway
 	args->sigma[0] = -1.00; /* cold pixels: it is better to deactive it */
 	args->sigma[1] =  3.00; /* hot pixels */
 	args->ppprefix = "pp_";
+	return 0;
+}
+
+static gpointer seqpipeline_worker(gpointer p) {
+	struct generic_seq_args *args = (struct generic_seq_args *)p;
+	sequence *seq = args->seq;
+	gpointer retval = generic_sequence_worker(args);
+	free_sequence(seq, TRUE);
+	free(args);
+	return retval;
+}
+
+/* creates the operation of a seqpipeline command from word[first] to
+ * word[last - 1] */
+static struct generic_seq_args *parse_seqpipeline_stage(sequence *seq, int first, int last) {
+	const char *op = word[first];
+	int nb_args = last - first - 1;
+
+	if (!strcmp(op, "preprocess")) {
+		struct preprocessing_data *prepro = calloc(1, sizeof(struct preprocessing_data));
+		if (parse_preprocess_options(prepro, first + 1, last)) {
+			free(prepro);
+			return NULL;
+		}
+		gettimeofday(&prepro->t_start, NULL);
+		prepro->seq = seq;
+		return new_preprocessing_seq_args(prepro);
+	}
+	if (!strcmp(op, "find_cosme") || !strcmp(op, "find_cosme_cfa")) {
+		struct cosmetic_data *cosme;
+		if (nb_args != 2) {
+			siril_log_message(_("%s requires two arguments: cold and hot sigma\n"), op);
+			return NULL;
+		}
+		cosme = calloc(1, sizeof(struct cosmetic_data));
+		cosme->seq = seq;
+		cosme->sigma[0] = atof(word[first + 1]);
+		cosme->sigma[1] = atof(word[first + 2]);
+		cosme->amount = 1.0;
+		cosme->is_cfa = !strcmp(op, "find_cosme_cfa");
+		cosme->seqEntry = "cc_";
+		return new_cosmetic_seq_args(cosme);
+	}
+	if (!strcmp(op, "fixbanding")) {
+		struct banding_data *banding;
+		if (nb_args != 2) {
+			siril_log_message(_("%s requires two arguments: amount and sigma\n"), op);
+			return NULL;
+		}
+		banding = calloc(1, sizeof(struct banding_data));
+		banding->amount = atof(word[first + 1]);
+		banding->sigma = atof(word[first + 2]);
+		banding->protect_highlights = TRUE;
+		banding->seqEntry = "unband_";
+		return new_banding_seq_args(seq, banding);
+	}
+	siril_log_message(_("Unknown operation `%s' for seqpipeline\n"), op);
+	return NULL;
+}
+
+int process_seqpipeline(int nb) {
+	struct generic_seq_args *args;
+	GSList *stages = NULL, *l;
+	sequence *seq;
+	gchar *file;
+	int first = 2, last;
+
+	if (get_thread_run()) {
+		siril_log_message(_("Another task is already in progress, ignoring new request.\n"));
+		return 1;
+	}
+
+	file = g_strdup(word[1]);
+	if (!ends_with(file, ".seq")) {
+		str_append(&file, ".seq");
+	}
+	if (!existseq(file)) {
+		if (check_seq(FALSE)) {
+			siril_log_message(_("No sequence `%s' found.\n"), file);
+			g_free(file);
+			return 1;
+		}
+	}
+	seq = readseqfile(file);
+	if (seq == NULL) {
+		siril_log_message(_("No sequence `%s' found.\n"), file);
+		g_free(file);
+		return 1;
+	}
+	g_free(file);
+	if (seq_check_basic_data(seq, FALSE) == -1) {
+		free(seq);
+		return 1;
+	}
+
+	// seqpipeline sequencename operation [options] [+ operation [options]]...
+	while (first < nb) {
+		struct generic_seq_args *stage;
+		for (last = first; last < nb && strcmp(word[last], "+"); last++);
+		if (last == first) {
+			siril_log_message(_("Missing operation in seqpipeline\n"));
+			goto failure;
+		}
+		stage = parse_seqpipeline_stage(seq, first, last);
+		if (!stage)
+			goto failure;
+		stages = g_slist_append(stages, stage);
+		first = last + 1;
+	}
+
+	args = new_fused_seq_args(seq, stages);
+	if (!args)
+		goto failure;
+	args->already_in_a_thread = TRUE;
 
-	// start preprocessing
 	set_cursor_waiting(TRUE);
+	start_in_new_thread(seqpipeline_worker, args);
+	return 0;
 
-	start_sequence_preprocessing(args, TRUE);
+failure:
+	for (l = stages; l; l = l->next) {
+		struct generic_seq_args *stage = l->data;
+		if (stage->finalize_hook)
+			stage->finalize_hook(stage);
+		free(stage);
+	}
+	g_slist_free(stages);
+	free_sequence(seq, TRUE);
+	return 1;
+}
+
+struct tileproc_args {
+	gchar *input, *output;
+	struct tile_operation *op;
+	int memory_MB;
+};
+
+static gpointer tileproc_worker(gpointer p) {
+	struct tileproc_args *args = (struct tileproc_args *)p;
+	int retval = process_fits_by_tiles(args->input, args->output, args->op,
+			args->memory_MB);
+	free_tile_operation(args->op);
+	g_free(args->input);
+	g_free(args->output);
+	free(args);
+	siril_add_idle(end_generic, NULL);
+	return GINT_TO_POINTER(retval);
+}
+
+int process_tileproc(int nb) {
+	struct tileproc_args *args;
+	struct tile_operation *op = NULL;
+	const char *operation = word[3];
+	int memory_MB = 0, nb_op_args = nb, i;
+	gboolean vertical = FALSE;
+
+	if (get_thread_run()) {
+		siril_log_message(_("Another task is already in progress, ignoring new request.\n"));
+		return 1;
+	}
+
+	// tileproc input output operation arguments [-vertical] [-mem=MB]
+	for (i = 4; i < nb; i++) {
+		if (g_str_has_prefix(word[i], "-mem=")) {
+			memory_MB = atoi(word[i] + 5);
+			if (memory_MB <= 0) {
+				siril_log_message(_("Invalid argument to %s, aborting.\n"), word[i]);
+				return 1;
+			}
+		} else if (!strcmp(word[i], "-vertical")) {
+			vertical = TRUE;
+		} else continue;
+		nb_op_args--;
+	}
+	if (nb_op_args != 6) {
+		siril_log_message(_("Operation %s requires two arguments\n"), operation);
+		return 1;
+	}
+
+	if (!strcmp(operation, "fmedian")) {
+		int ksize = atoi(word[4]);
+		double amount = atof(word[5]);
+		if (!(ksize & 1) || ksize < 2) {
+			siril_log_message(_("The size of the kernel MUST be odd and greater than 1.\n"));
+			return 1;
+		}
+		if (amount < 0.0 || amount > 1.0) {
+			siril_log_message(_("Modulation value MUST be between 0 and 1\n"));
+			return 1;
+		}
+		op = new_median_tile_operation(ksize, amount, 1);
+	} else if (!strcmp(operation, "rl")) {
+		int iter = atoi(word[4]);
+		double sigma = atof(word[5]);
+		if (iter <= 0) {
+			siril_log_message(_("Number of iterations must be > 0.\n"));
+			return 1;
+		}
+		if (sigma <= 0) {
+			siril_log_message(_("Sigma must be > 0.\n"));
+			return 1;
+		}
+		op = new_deconvolution_tile_operation(sigma, iter);
+	} else if (!strcmp(operation, "fixbanding")) {
+		struct banding_data banding = { 0 };
+		banding.amount = atof(word[4]);
+		banding.sigma = atof(word[5]);
+		banding.protect_highlights = TRUE;
+		banding.applyRotation = vertical;
+		op = new_banding_tile_operation(&banding);
+	} else if (!strcmp(operation, "wlayer")) {
+		int Nbr_Plan = atoi(word[4]);
+		int plan = atoi(word[5]);
+		if (Nbr_Plan < 1 || plan < 0 || plan >= Nbr_Plan) {
+			siril_log_message(_("Wavelet: the plane must be between 0 and the number of planes minus one\n"));
+			return 1;
+		}
+		op = new_wavelet_layer_tile_operation(Nbr_Plan, plan, TO_PAVE_BSPLINE);
+	} else {
+		siril_log_message(_("Unknown operation `%s' for tileproc\n"), operation);
+		return 1;
+	}
+	if (!op)
+		return 1;
+
+	args = malloc(sizeof(struct tileproc_args));
+	args->input = g_strdup(word[1]);
+	args->output = g_strdup(word[2]);
+	args->op = op;
+	args->memory_MB = memory_MB;
+
+	set_cursor_waiting(TRUE);
+	start_in_new_thread(tileproc_worker, args);
 	return 0;
 }
 
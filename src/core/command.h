@@ -91,6 +91,7 @@ int	process_rl(int nb);
 int	process_rotate(int nb);
 int	process_rotatepi(int nb);
 int 	process_psf(int nb);
+int	process_seqpipeline(int nb);
 int	process_seq_psf(int nb);
 int	process_bg(int nb);
 int	process_bgnoise(int nb);
@@ -98,6 +99,7 @@ int	process_histo(int nb);
 int	process_thresh(int nb);
 int	process_threshlo(int nb);
 int	process_threshhi(int nb);
+int	process_tileproc(int nb);
 int	process_nozero(int nb);
 int	process_ddp(int nb);
 int	process_new(int nb);
@@ -125,9 +127,11 @@ int	process_unset_mag(int nb);
 int	process_unset_mag_seq(int nb);
 int	process_unselect(int nb);
 int process_register(int nb);
+int	process_registermp(int nb);
 int	process_stat(int nb);
 int	process_stackall(int nb);
 int	process_stackone(int nb);
+int	process_stackstream(int nb);
 int	process_set_mem(int nb);
 int process_preprocess(int nb);
 #ifdef _OPENMP
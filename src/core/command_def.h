@@ -15,7 +15,7 @@
 #define STR_CLEAR N_("Clears the graphical output logs")
 #define STR_CLEARSTAR N_("Clear all the stars saved in memory and displayed on the screen")
 #define STR_CLOSE N_("Properly closes the opened image and the opened sequence, if any")
-#define STR_CONVERT N_("Convert DSLR RAW files into Siril's FITS images. The argument \"basename\" is the basename of the new sequence. The option \"-debayer\" applies demosaicing to images")
+#define STR_CONVERT N_("Convert DSLR RAW files into Siril's FITS images. The argument \"basename\" is the basename of the new sequence. The option \"-debayer\" applies demosaicing to images. Several images are converted at the same time, by as many threads as allowed by the settings, or by n threads with the option \"-threads=n\"")
 #define STR_COSME N_("Apply the local mean to a set of pixels on the in-memory image (cosmetic correction). The coordinates of these pixels are in an ASCII file [.lst file]. COSME is adapted to correct residual hot and cold pixels after preprocessing")
 #define STR_COSME_CFA N_("Same function that COSME but applying to RAW CFA images")
 #define STR_CROP N_("It can be used with the GUI: if a selection has been made with the mouse, calling the CROP command without arguments crops it on this selection. Otherwise, or in scripts, arguments have to be given, with \"x\" and \"y\" being the coordinates of the top left corner, and \"width\" and \"height\" the size of the selection")
@@ -62,10 +62,11 @@
 
 #define STR_OFFSET N_("Adds the constant \"value\" to the current image. This constant can take a negative value. As Siril uses unsigned FITS files, if the intensity of the pixel become negative its value is replaced by 0 and by 65535 (for a 16-bit file) if the pixel intensity overflows")
 
-#define STR_PREPROCESS N_("Preprocesses the sequence \"sequencename\" using bias, dark and flat given in argument. It is possible to specify if images are CFA for cosmetic correction purposes with the option \"-cfa\" and also to demosaic images at the end of the process with \"-debayer\". This option can be associated to \"-stretch\" in order to stretch to 16-bit the image during this operation (works only with images from DSLR). The \"-flip\" option tells to Siril to read image from up to bottom for demosaicing operation and the \"-equalize_cfa\" option equalizes the mean intensity of RGB layers of the CFA flat master. It is also possible to optimize the dark subtraction with \"-opt\".\n\nNote that only hot pixels are corrected in cosmetic correction process")
+#define STR_PREPROCESS N_("Preprocesses the sequence \"sequencename\" using bias, dark and flat given in argument. It is possible to specify if images are CFA for cosmetic correction purposes with the option \"-cfa\" and also to demosaic images at the end of the process with \"-debayer\". This option can be associated to \"-stretch\" in order to stretch to 16-bit the image during this operation (works only with images from DSLR). The \"-flip\" option tells to Siril to read image from up to bottom for demosaicing operation and the \"-equalize_cfa\" option equalizes the mean intensity of RGB layers of the CFA flat master. It is also possible to optimize the dark subtraction with \"-opt\". With \"-32b\", images are calibrated and saved in 32-bit float, without rounding nor clipping; it is available for FITS sequences without \"-opt\", \"-debayer\", \"-equalize_cfa\" and \"-chunked\". With \"-chunked\", the calibrated images are saved in a single compressed file (.csq) from which parts of the images can be read without decompressing them entirely.\n\nNote that only hot pixels are corrected in cosmetic correction process")
 #define STR_PSF N_("Performs a PSF (Point Spread Function) on the selected star")
 
-#define STR_REGISTER N_("Performs geometric transforms on images of the sequence given in argument so that they may be superimposed on the reference image. The output sequence name starts with the prefix \"r_\". Using stars for registration, this algorithm only works with deepsky images. The option \"-norot\" performs a translation only with no new sequence built while the option \"-drizzle\" applies a x2 drizzle on the images")
+#define STR_REGISTER N_("Performs geometric transforms on images of the sequence given in argument so that they may be superimposed on the reference image. The output sequence name starts with the prefix \"r_\". Using stars for registration, this algorithm only works with deepsky images. The option \"-norot\" performs a translation only with no new sequence built, the option \"-noout\" does not build a new sequence either but keeps the rotation, to apply it during stacking, while the option \"-drizzle\" applies a x2 drizzle on the images")
+#define STR_REGISTERMP N_("Registers the sequence given in argument with a grid of alignment boxes of \"size\" pixels, 64 by default, set with \"-box=\". Each box of each frame gets its own shift, computed around the shift of the frame from a previous registration, or from the center of the frames if the sequence is not registered. This corrects the local distortions of the seeing on large planetary, lunar or solar frames. Boxes without enough contrast are not used. The quality of each box of each frame is measured at the same time. The data is saved in a file named after the sequence with the .mpr extension, and used by the mp type of the STACK command")
 #define STR_RESAMPLE N_("Resamples image with a factor \"factor\"")
 #define STR_RGRADIENT N_("Creates two images, with a radial shift (\"dR\" in pixels) and a rotational shift (\"dalpha\" in degrees) with respect to the point (\"xc\", \"yc\"). Between these two images, the shifts have the same amplitude, but an opposite sign. The two images are then added to create the final image. This process is also called Larson Sekanina filter")
 #define STR_RL N_("Restores an image using the Richardson-Lucy method. \"Iterations\" is the number of iterations to be performed (typically between 10 and 50). \"Sigma\" is the size of the kernel to be applied")
@@ -85,6 +86,7 @@
 #define STR_SEQCROP N_("Crops the loaded sequence")
 #define STR_SEQFIND_COSME N_("Same command than FIND_COSME but for the sequence \"sequencename\"")
 #define STR_SEQFIND_COSME_CFA N_("Same command than FIND_COSME_CFA but for the sequence \"sequencename\"")
+#define STR_SEQPIPELINE N_("Applies several operations to the \"sequencename\" sequence in a single pass, each image being read and saved only once, the operations being separated by \" + \". Available operations are \"preprocess\" with the options of the PREPROCESS command, \"find_cosme\" and \"find_cosme_cfa\" with cold and hot sigma, and \"fixbanding\" with amount and sigma. The result is the sequence that would be obtained by applying the operations one after the other, for example \"seqpipeline light preprocess -dark=master-dark -flat=master-flat -cfa + find_cosme_cfa -1 3\" creates the cc_pp_light sequence")
 #define STR_SEQPSF N_("Same command than PSF but works for sequences. Results are dumped in the console in a form that can be used to produce brightness variation curves")
 #define STR_SEQSPLIT_CFA N_("Same command than SPLIT_CFA but for the sequence \"sequencename\"")
 #define STR_SETCPU N_("Defines the number of processing threads used for calculation. Can be as high as the number of virtual threads existing on the system, which is the number of CPU cores or twice this number if hyperthreading (Intel HT) is available")
@@ -95,13 +97,15 @@
 #define STR_SETMEM N_("Sets a new ratio of free memory on memory used for stacking. Value should be between 0.05 and 2, depending on other activities of the machine. A higher ratio should allow siril to stack faster, but setting the ratio of memory used for stacking above 1 will require the use of on-disk memory, which is very slow and unrecommended")
 #define STR_SPLIT N_("Splits the color image into three distinct files (one for each color) and save them in \"r\" \"g\" and \"b\" file")
 #define STR_SPLIT_CFA N_("Splits the CFA image into four distinct files (one for each channel) and save them in files")
-#define STR_STACK N_("Stacks the \"sequencename\" sequence, using options. The allowed types are: sum, max, min, med or median, and rej or mean that requires the use of additional arguments \"sigma low\" and \"high\" used for the Winsorized sigma clipping rejection algorithm (cannot be changed from here).\nDifferent types of normalisation are allowed: \"-norm=add\" for addition, \"-norm=mul\" for multiplicative. Options \"-norm=addscale\" and \"-norm=mulscale\" apply same normalisations but with scale operations.\nIf no argument other than the sequence name is provided, sum stacking is assumed.\nResult image's name can be set with the \"-out=\" option.\nStacked images can be selected based on some filters, like manual selection or best FWHM, with some of the \"-filter-*\" options.\nSee the command reference for the complete documentation on this command")
+#define STR_STACK N_("Stacks the \"sequencename\" sequence, using options. The allowed types are: sum, max, min, med or median, and rej or mean that requires the use of additional arguments \"sigma low\" and \"high\" used for the Winsorized sigma clipping rejection algorithm (cannot be changed from here).\nDifferent types of normalisation are allowed: \"-norm=add\" for addition, \"-norm=mul\" for multiplicative. Options \"-norm=addscale\" and \"-norm=mulscale\" apply same normalisations but with scale operations.\nThe mp type stacks the sequence registered with REGISTERMP, blending the boxes aligned with their own shifts; \"-tilebest=percent\" keeps for each box only this percentage of the frames, those where the box is the sharpest.\nWith med or median, \"-approx\" computes an approximate median in two passes over the images, with a memory use that does not depend on the number of images, and logs its accuracy.\nWith rej or mean, registered images are aligned with sub-pixel accuracy, or with their full transformation if registration was done with \"-noout\", using \"-interp=bilinear\" or \"-interp=lanczos\"; \"-interp=no\", the default, only uses whole pixel shifts.\nWith med, rej or mean, \"-32b\" saves the result in 32-bit float, without rounding the stacked values.\nIf no argument other than the sequence name is provided, sum stacking is assumed.\nResult image's name can be set with the \"-out=\" option.\nStacked images can be selected based on some filters, like manual selection or best FWHM, with some of the \"-filter-*\" options.\nSee the command reference for the complete documentation on this command")
+#define STR_STACKSTREAM N_("Stacks the \"sequencename\" sequence one image after the other, with a memory use that does not depend on the number of images. The allowed types are: sum, mean (default), min, max, and rej that requires the \"sigma low\" and \"high\" arguments of an online sigma clipping, which compares each pixel to the mean of the previous images. Images are not normalized.\nWith \"-every=n\", the result is also saved every n images, for example to follow a long sequence while it is acquired.\nResult image's name can be set with the \"-out=\" option and images can be selected with the \"-filter-*\" options of the STACK command")
 #define STR_STACKALL N_("Opens all sequences in the CWD and stacks them with the optionally specified stacking type and filtering or with sum stacking. See STACK command for options description")
 #define STR_STAT N_("Returns global statistics of the current image. If a selection is made, the command returns statistics within the selection")
 
 #define STR_THRESHLO N_("Replaces values below \"level\" with \"level\"")
 #define STR_THRESHHI N_("Replaces values above \"level\" with \"level\"")
 #define STR_THRESH N_("Replaces values below \"lo\" with \"lo\" and values above \"hi\" with \"hi\"")
+#define STR_TILEPROC N_("Applies an operation to the image of the \"input\" FITS file and saves the result in \"output\", processing the image by tiles so that it never has to fit in memory. Tiles are as large as the memory limit of SETMEM allows, or \"-mem=\" megabytes, and are read with the margin of neighbouring pixels the operation needs. Available operations are \"fmedian ksize modulation\" and \"rl iterations sigma\" with the arguments of the FMEDIAN and RL commands, \"fixbanding amount sigma\" like FIXBANDING, \"-vertical\" correcting columns instead of rows, and \"wlayer NbPlans plan\" extracting the plane \"plan\", from 0, of the wavelet transform on \"NbPlans\" planes like EXTRACT")
 
 #define STR_UNSELECT N_("Allows easy mass unselection of images in the loaded sequence (from \"from\" to \"to\" included). See SELECT")
 #define STR_UNSETMAG N_("Reset the magnitude calibration to 0. See SETMAG")
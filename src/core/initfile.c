@@ -118,6 +118,7 @@ static int readinitfile() {
 	config_setting_t *reg_setting = config_lookup(&config, keywords[REG]);
 	if (reg_setting) {
 		config_setting_lookup_int(reg_setting, "method", &com.reg_settings);
+		config_setting_lookup_bool(reg_setting, "fftw_wisdom", &com.fftw_wisdom);
 	}
 
 	/* Stacking setting */
@@ -300,6 +301,9 @@ static void _save_registration(config_t *config, config_setting_t *root) {
 
 	reg_setting = config_setting_add(reg_group, "method", CONFIG_TYPE_INT);
 	config_setting_set_int(reg_setting, com.reg_settings);
+
+	reg_setting = config_setting_add(reg_group, "fftw_wisdom", CONFIG_TYPE_BOOL);
+	config_setting_set_bool(reg_setting, com.fftw_wisdom);
 }
 
 static void _save_stacking(config_t *config, config_setting_t *root) {
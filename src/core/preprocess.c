@@ -158,6 +158,40 @@ static int darkOptimization(fits *raw, fits *dark, fits *offset) {
 	return ret;
 }
 
+/* Float calibration only implements the arithmetic of the calibration, the
+ * options that would work on 16-bit copies of the images are refused. */
+static int check_float_preprocessing(struct preprocessing_data *prepro) {
+	const char *option = NULL;
+	if (prepro->use_dark_optim && prepro->use_dark)
+		option = "-opt";
+	else if (prepro->debayer)
+		option = "-debayer";
+	else if (prepro->equalize_cfa && prepro->use_flat)
+		option = "-equalize_cfa";
+	else if (prepro->chunked_output)
+		option = "-chunked";
+	if (option) {
+		siril_log_message(_("The %s option is not supported with 32-bit output\n"), option);
+		return 1;
+	}
+	if (prepro->seq && prepro->seq->type != SEQ_REGULAR) {
+		siril_log_message(_("32-bit output is only supported for FITS sequences\n"));
+		return 1;
+	}
+	return 0;
+}
+
+static double float_layer_mean(fits *fit, int layer) {
+	size_t i, n = fit->rx * fit->ry;
+	double sum = 0.0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) reduction(+:sum)
+#endif
+	for (i = 0; i < n; i++)
+		sum += fit->fpdata[layer][i];
+	return sum / n;
+}
+
 static int prepro_prepare_hook(struct generic_seq_args *args) {
 	struct preprocessing_data *prepro = args->user;
 
@@ -176,29 +210,48 @@ static int prepro_prepare_hook(struct generic_seq_args *args) {
 			return 1;
 	}
 
+	if (prepro->float_output && check_float_preprocessing(prepro))
+		return 1;
+
 	// precompute flat levels
 	if (prepro->use_flat) {
 		if (prepro->equalize_cfa) {
 			compute_grey_flat(prepro->flat);
 		}
 		if (prepro->autolevel) {
-			imstats *stat = statistics(NULL, -1, prepro->flat, RLAYER, NULL, STATS_BASIC);
-			if (!stat) {
-				siril_log_message(_("Error: statistics computation failed.\n"));
-				return 1;
+			if (prepro->flat->type == DATA_FLOAT) {
+				/* same value as the mean of the 16-bit flat */
+				prepro->normalisation = (float) (float_layer_mean(prepro->flat, RLAYER) * USHRT_MAX_DOUBLE);
+			} else {
+				imstats *stat = statistics(NULL, -1, prepro->flat, RLAYER, NULL, STATS_BASIC);
+				if (!stat) {
+					siril_log_message(_("Error: statistics computation failed.\n"));
+					return 1;
+				}
+				prepro->normalisation = stat->mean;
+				free_stats(stat);
 			}
-			prepro->normalisation = stat->mean;
 			siril_log_message(_("Normalisation value auto evaluated: %.2lf\n"),
 					prepro->normalisation);
-			free_stats(stat);
 		}
 	}
 
 	// proceed to cosmetic correction
 	if (prepro->use_cosmetic_correction && prepro->use_dark) {
 		if (prepro->dark->naxes[2] == 1) {
-			prepro->dev = find_deviant_pixels(prepro->dark, prepro->sigma,
+			fits dark16 = { 0 }, *dark = prepro->dark;
+			if (dark->type == DATA_FLOAT) {
+				/* deviant pixels are searched in a 16-bit copy of the dark */
+				if (copyfits(dark, &dark16, CP_ALLOC | CP_COPYA | CP_FORMAT, -1) ||
+						fit_convert_to_ushort(&dark16)) {
+					clearfits(&dark16);
+					return 1;
+				}
+				dark = &dark16;
+			}
+			prepro->dev = find_deviant_pixels(dark, prepro->sigma,
 					&(prepro->icold), &(prepro->ihot));
+			clearfits(&dark16);
 			siril_log_message(_("%ld pixels corrected (%ld + %ld)\n"),
 					prepro->icold + prepro->ihot, prepro->icold, prepro->ihot);
 		} else
@@ -222,7 +275,8 @@ static int prepro_image_hook(struct generic_seq_args *args, int out_index, int i
 		cosmeticCorrection(fit, prepro->dev, prepro->icold + prepro->ihot, prepro->is_cfa);
 
 	if (prepro->debayer) {
-		if (!prepro->seq || prepro->seq->type == SEQ_REGULAR) {
+		if (!prepro->seq || prepro->seq->type == SEQ_REGULAR ||
+				prepro->seq->type == SEQ_CHUNKED) {
 			// not for SER because it is done on-the-fly
 			debayer_if_needed(TYPEFITS, fit,
 					prepro->compatibility, TRUE, prepro->stretch_cfa);
@@ -258,8 +312,8 @@ gpointer prepro_worker(gpointer p) {
 	return retval;
 }
 
-void start_sequence_preprocessing(struct preprocessing_data *prepro, gboolean from_script) {
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
+struct generic_seq_args *new_preprocessing_seq_args(struct preprocessing_data *prepro) {
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
 	args->seq = prepro->seq;
 	args->partial_image = FALSE;
 	args->filtering_criterion = seq_filter_all;
@@ -275,8 +329,15 @@ void start_sequence_preprocessing(struct preprocessing_data *prepro, gboolean fr
 	args->new_seq_prefix = prepro->ppprefix;
 	args->load_new_sequence = TRUE;
 	args->force_ser_output = FALSE;
+	args->force_chunked_output = prepro->chunked_output;
 	args->parallel = TRUE;
+	args->float_data = prepro->float_output;
 	args->user = prepro;
+	return args;
+}
+
+void start_sequence_preprocessing(struct preprocessing_data *prepro, gboolean from_script) {
+	struct generic_seq_args *args = new_preprocessing_seq_args(prepro);
 
 	if (from_script) {
 		args->already_in_a_thread = TRUE;
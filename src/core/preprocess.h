@@ -3,6 +3,7 @@
 
 #include "siril.h"
 #include "filters/cosmetic_correction.h"
+#include "processing.h"
 
 /* preprocessing data from GUI */
 struct preprocessing_data {
@@ -22,11 +23,14 @@ struct preprocessing_data {
 	gboolean stretch_cfa;
 	gboolean equalize_cfa;
 	float normalisation;
+	gboolean float_output;	// calibrate and save images in 32-bit float
+	gboolean chunked_output;	// save the sequence in a chunked file
 	int retval;
 	const char *ppprefix;	 // prefix for output files
 };
 
 int preprocess_single_image(struct preprocessing_data *args);
+struct generic_seq_args *new_preprocessing_seq_args(struct preprocessing_data *prepro);
 void start_sequence_preprocessing(struct preprocessing_data *prepro, gboolean from_script);
 
 #endif
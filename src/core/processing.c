@@ -30,8 +30,308 @@
 #include "gui/progress_and_log.h"
 #include "io/sequence.h"
 #include "io/ser.h"
+#include "io/chunked.h"
 #include "algos/statistics.h"
 
+/* reads the full frame or the area of the frame that will be processed */
+static int generic_read_frame(struct generic_seq_args *args, int input_idx, fits *fit, rectangle *area) {
+	if (args->partial_image) {
+		// if we run in parallel, it will not be the same for all
+		// and we don't want to overwrite the original anyway
+		*area = args->area;
+		if (args->regdata_for_partial) {
+			int shiftx = roundf_to_int(args->seq->regparam[args->layer_for_partial][input_idx].shiftx);
+			int shifty = roundf_to_int(args->seq->regparam[args->layer_for_partial][input_idx].shifty);
+			area->x -= shiftx;
+			area->y += shifty;
+		}
+
+		// args->area may be modified in hooks
+		enforce_area_in_image(area, args->seq);
+		return seq_read_frame_part(args->seq, args->layer_for_partial,
+				input_idx, fit, area, args->get_photometry_data_for_partial);
+	}
+	// image is obtained bottom to top here, while it's in natural order for partial images!
+	*area = args->area;
+	if (args->float_data && args->seq->type == SEQ_REGULAR)
+		fit->type = DATA_FLOAT;	// float FITS are read without conversion
+	if (seq_read_frame(args->seq, input_idx, fit))
+		return 1;
+	if (args->float_data && fit->type != DATA_FLOAT)
+		return fit_convert_to_float(fit);
+	return 0;
+}
+
+static int generic_save_frame(struct generic_seq_args *args, int frame, int input_idx, fits *fit) {
+	if (args->save_hook)
+		return args->save_hook(args, frame, input_idx, fit);
+	return generic_save(args, frame, input_idx, fit);
+}
+
+static void generic_progress(struct generic_seq_args *args, int input_idx, int progress, int nb_frames) {
+	char filename[256], msg[256];
+	// leave margin for rounding errors and post processing
+	float nb_framesf = (float)nb_frames + 0.3f;
+	if (!seq_get_image_filename(args->seq, input_idx, filename))
+		filename[0] = '\0';
+	snprintf(msg, 256, _("%s. Processing image %d (%s)"), args->description, input_idx, filename);
+	set_progress_bar_data(msg, (float)progress / nb_framesf);
+}
+
+/* each thread reads, processes and saves its frames in turn */
+static int generic_loop(struct generic_seq_args *args, int nb_frames, int *index_mapping, int *excluded_frames) {
+	int frame, input_idx, progress = 0, abort = 0;
+	fits fit = { 0 };
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) firstprivate(fit) private(input_idx) schedule(static) \
+	if(args->parallel && ((args->seq->type == SEQ_REGULAR && fits_is_reentrant()) || args->seq->type == SEQ_SER || args->seq->type == SEQ_CHUNKED))
+#endif
+	for (frame = 0; frame < nb_frames; frame++) {
+		if (!abort) {
+			rectangle area;
+			int current;
+
+			if (!get_thread_run()) {
+				abort = 1;
+				continue;
+			}
+			if (index_mapping)
+				input_idx = index_mapping[frame];
+			else input_idx = frame;
+
+			if (generic_read_frame(args, input_idx, &fit, &area)) {
+				abort = 1;
+				clearfits(&fit);
+				continue;
+			}
+
+			if (args->image_hook(args, frame, input_idx, &fit, &area)) {
+				if (args->stop_on_error)
+					abort = 1;
+				else {
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+					(*excluded_frames)++;
+				}
+				clearfits(&fit);
+				continue;
+			}
+
+			if (args->has_output && generic_save_frame(args, frame, input_idx, &fit)) {
+				abort = 1;
+				clearfits(&fit);
+				continue;
+			}
+
+			// save stats that may have been computed for the first time
+			save_stats_from_fit(&fit, args->seq, input_idx);
+			clearfits(&fit);
+
+#ifdef _OPENMP
+#pragma omp atomic capture
+#endif
+			current = ++progress;
+			generic_progress(args, input_idx, current, nb_frames);
+		}
+	}
+	return abort;
+}
+
+/* Pipelined execution: I/O threads read frames ahead and save processed
+ * frames while the processing threads run the image hook, so that disks and
+ * processors are busy at the same time. Stages are joined by queues, and
+ * the number of frames in memory is bounded by a pool of slots. Processing
+ * threads take the next frame available, which balances their load when
+ * frames don't take the same time.
+ * Reading or writing in a thread while others process requires SER or a
+ * reentrant cfitsio, like the parallel loop. Sequential operations can also
+ * use it, with a single reader and processing thread keeping the order of
+ * frames, unless they read partial images: their hooks may move the area of
+ * the next frames. */
+struct pipeline_frame {
+	int frame, input_idx;
+	fits fit;
+	rectangle area;
+};
+
+struct pipeline {
+	struct generic_seq_args *args;
+	int nb_frames;
+	int *index_mapping;
+	GAsyncQueue *slots;		// free slots, bounds the frames in memory
+	GAsyncQueue *to_process;	// read frames
+	GAsyncQueue *to_save;		// processed frames
+	struct pipeline_frame end;	// end of stream marker
+	gint next_frame;	// next frame to read
+	gint active_readers;
+	gint abort;
+	gint progress;
+	int nb_process_threads;
+};
+
+/* one slot token: queues can't store NULL */
+#define PIPELINE_SLOT GINT_TO_POINTER(1)
+
+static gboolean pipeline_is_possible(struct generic_seq_args *args) {
+	if (!((args->seq->type == SEQ_REGULAR && fits_is_reentrant()) ||
+				args->seq->type == SEQ_SER || args->seq->type == SEQ_CHUNKED))
+		return FALSE;
+	return args->parallel || !args->partial_image;
+}
+
+static void pipeline_release(struct pipeline *pipe, struct pipeline_frame *item) {
+	clearfits(&item->fit);
+	free(item);
+	g_async_queue_push(pipe->slots, PIPELINE_SLOT);
+}
+
+static void pipeline_done(struct pipeline *pipe, struct pipeline_frame *item) {
+	int progress;
+	// save stats that may have been computed for the first time
+	save_stats_from_fit(&item->fit, pipe->args->seq, item->input_idx);
+	progress = g_atomic_int_add(&pipe->progress, 1) + 1;
+	generic_progress(pipe->args, item->input_idx, progress, pipe->nb_frames);
+	pipeline_release(pipe, item);
+}
+
+static gpointer pipeline_reader(gpointer p) {
+	struct pipeline *pipe = (struct pipeline *) p;
+	int frame, i;
+
+	while ((frame = g_atomic_int_add(&pipe->next_frame, 1)) < pipe->nb_frames) {
+		struct pipeline_frame *item;
+		g_async_queue_pop(pipe->slots);
+		if (g_atomic_int_get(&pipe->abort) || !get_thread_run()) {
+			g_atomic_int_set(&pipe->abort, 1);
+			g_async_queue_push(pipe->slots, PIPELINE_SLOT);
+			break;
+		}
+		item = calloc(1, sizeof(struct pipeline_frame));
+		if (!item) {
+			PRINT_ALLOC_ERR;
+			g_atomic_int_set(&pipe->abort, 1);
+			g_async_queue_push(pipe->slots, PIPELINE_SLOT);
+			break;
+		}
+		item->frame = frame;
+		item->input_idx = pipe->index_mapping ? pipe->index_mapping[frame] : frame;
+		if (generic_read_frame(pipe->args, item->input_idx, &item->fit, &item->area)) {
+			g_atomic_int_set(&pipe->abort, 1);
+			pipeline_release(pipe, item);
+			break;
+		}
+		g_async_queue_push(pipe->to_process, item);
+	}
+
+	/* the last reader tells the processing threads that it's finished */
+	if (g_atomic_int_dec_and_test(&pipe->active_readers))
+		for (i = 0; i < pipe->nb_process_threads; i++)
+			g_async_queue_push(pipe->to_process, &pipe->end);
+	return NULL;
+}
+
+static gpointer pipeline_writer(gpointer p) {
+	struct pipeline *pipe = (struct pipeline *) p;
+	struct pipeline_frame *item;
+
+	while ((item = g_async_queue_pop(pipe->to_save)) != &pipe->end) {
+		if (g_atomic_int_get(&pipe->abort)) {
+			pipeline_release(pipe, item);
+			continue;
+		}
+		if (generic_save_frame(pipe->args, item->frame, item->input_idx, &item->fit)) {
+			g_atomic_int_set(&pipe->abort, 1);
+			pipeline_release(pipe, item);
+			continue;
+		}
+		pipeline_done(pipe, item);
+	}
+	return NULL;
+}
+
+static int generic_pipeline(struct generic_seq_args *args, int nb_frames, int *index_mapping, int *excluded_frames) {
+	struct pipeline pipe = { 0 };
+	GThread **readers, **writers;
+	int i, nb_io_threads, nb_slots;
+
+	pipe.args = args;
+	pipe.nb_frames = nb_frames;
+	pipe.index_mapping = index_mapping;
+	pipe.nb_process_threads = 1;
+#ifdef _OPENMP
+	if (args->parallel)
+		pipe.nb_process_threads = com.max_thread;
+#endif
+	/* one reader keeps the frames in order for sequential processing */
+	nb_io_threads = args->parallel ? max(1, pipe.nb_process_threads / 4) : 1;
+	/* a frame for each processing thread, and for each I/O thread one being
+	 * read ahead and one being saved */
+	nb_slots = pipe.nb_process_threads + nb_io_threads * 2;
+	siril_debug_print("pipelined processing with %d threads, %d I/O threads and %d frames in memory\n",
+			pipe.nb_process_threads, nb_io_threads, nb_slots);
+
+	pipe.slots = g_async_queue_new();
+	pipe.to_process = g_async_queue_new();
+	pipe.to_save = g_async_queue_new();
+	for (i = 0; i < nb_slots; i++)
+		g_async_queue_push(pipe.slots, PIPELINE_SLOT);
+	pipe.active_readers = nb_io_threads;
+
+	readers = malloc(nb_io_threads * sizeof(GThread *));
+	writers = malloc(nb_io_threads * sizeof(GThread *));
+	for (i = 0; i < nb_io_threads; i++) {
+		readers[i] = g_thread_new("reader", pipeline_reader, &pipe);
+		writers[i] = args->has_output ? g_thread_new("writer", pipeline_writer, &pipe) : NULL;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(pipe.nb_process_threads)
+#endif
+	{
+		struct pipeline_frame *item;
+		while ((item = g_async_queue_pop(pipe.to_process)) != &pipe.end) {
+			if (g_atomic_int_get(&pipe.abort) || !get_thread_run()) {
+				g_atomic_int_set(&pipe.abort, 1);
+				pipeline_release(&pipe, item);
+				continue;
+			}
+			if (args->image_hook(args, item->frame, item->input_idx, &item->fit, &item->area)) {
+				if (args->stop_on_error)
+					g_atomic_int_set(&pipe.abort, 1);
+				else {
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+					(*excluded_frames)++;
+				}
+				pipeline_release(&pipe, item);
+				continue;
+			}
+			if (args->has_output)
+				g_async_queue_push(pipe.to_save, item);
+			else pipeline_done(&pipe, item);
+		}
+	}
+
+	for (i = 0; i < nb_io_threads; i++) {
+		if (writers[i])
+			g_async_queue_push(pipe.to_save, &pipe.end);
+	}
+	for (i = 0; i < nb_io_threads; i++) {
+		g_thread_join(readers[i]);
+		if (writers[i])
+			g_thread_join(writers[i]);
+	}
+	free(readers);
+	free(writers);
+	g_async_queue_unref(pipe.slots);
+	g_async_queue_unref(pipe.to_process);
+	g_async_queue_unref(pipe.to_save);
+	return pipe.abort;
+}
+
 // called in start_in_new_thread only
 // works in parallel if the arg->parallel is TRUE for FITS or SER sequences
 gpointer generic_sequence_worker(gpointer p) {
@@ -40,11 +340,9 @@ gpointer generic_sequence_worker(gpointer p) {
 	int frame;	// output frame index
 	int input_idx;	// index of the frame being processed in the sequence
 	int *index_mapping = NULL;
-	int nb_frames, excluded_frames = 0, progress = 0;
-	float nb_framesf;
+	int nb_frames, excluded_frames = 0;
 	int abort = 0;	// variable for breaking out of loop
 	GString *desc;	// temporary string description for logs
-	fits fit = { 0 };
 
 	assert(args);
 	assert(args->seq);
@@ -63,7 +361,6 @@ gpointer generic_sequence_worker(gpointer p) {
 			goto the_end;
 		}
 	}
-	nb_framesf = (float)nb_frames + 0.3f;	// leave margin for rounding errors and post processing
 	args->retval = 0;
 
 	if (args->prepare_hook && args->prepare_hook(args)) {
@@ -115,105 +412,9 @@ gpointer generic_sequence_worker(gpointer p) {
 	omp_init_lock(&args->lock);
 #endif
 
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(com.max_thread) firstprivate(fit) private(input_idx) schedule(static) \
-	if(args->parallel && ((args->seq->type == SEQ_REGULAR && fits_is_reentrant()) || args->seq->type == SEQ_SER))
-#endif
-	for (frame = 0; frame < nb_frames; frame++) {
-		if (!abort) {
-			char filename[256], msg[256];
-			rectangle area = { .x = args->area.x, .y = args->area.y,
-				.w = args->area.w, .h = args->area.h };
-
-			if (!get_thread_run()) {
-				abort = 1;
-				continue;
-			}
-			if (index_mapping)
-				input_idx = index_mapping[frame];
-			else input_idx = frame;
-
-			if (!seq_get_image_filename(args->seq, input_idx, filename)) {
-				abort = 1;
-				continue;
-			}
-
-			if (args->partial_image) {
-				// if we run in parallel, it will not be the same for all
-				// and we don't want to overwrite the original anyway
-				if (args->regdata_for_partial) {
-					int shiftx = roundf_to_int(args->seq->regparam[args->layer_for_partial][input_idx].shiftx);
-					int shifty = roundf_to_int(args->seq->regparam[args->layer_for_partial][input_idx].shifty);
-					area.x -= shiftx;
-					area.y += shifty;
-				}
-
-				// args->area may be modified in hooks
-				enforce_area_in_image(&area, args->seq);
-				if (seq_read_frame_part(args->seq,
-							args->layer_for_partial,
-							input_idx, &fit, &area,
-							args->get_photometry_data_for_partial))
-				{
-					abort = 1;
-					clearfits(&fit);
-					continue;
-				}
-				/*char tmpfn[100];	// this is for debug purposes
-				sprintf(tmpfn, "/tmp/partial_%d.fit", input_idx);
-				savefits(tmpfn, &fit);*/
-			} else {
-				// image is obtained bottom to top here, while it's in natural order for partial images!
-				if (seq_read_frame(args->seq, input_idx, &fit)) {
-					abort = 1;
-					clearfits(&fit);
-					continue;
-				}
-			}
-
-			if (args->image_hook(args, frame, input_idx, &fit, &area)) {
-				if (args->stop_on_error)
-					abort = 1;
-				else {
-					//args->seq->imgparam[frame].incl = FALSE;
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-					{
-						//if (args->nb_filtered_images > 0)
-						//	args->nb_filtered_images--;
-						//args->seq->selnum--;
-						excluded_frames++;
-					}
-				}
-				clearfits(&fit);
-				continue;
-			}
-
-			if (args->has_output) {
-				int retval;
-				if (args->save_hook)
-					retval = args->save_hook(args, frame, input_idx, &fit);
-				else retval = generic_save(args, frame, input_idx, &fit);
-				if (retval) {
-					abort = 1;
-					clearfits(&fit);
-					continue;
-				}
-			}
-
-			// save stats that may have been computed for the first time
-			save_stats_from_fit(&fit, args->seq, input_idx);
-			clearfits(&fit);
-
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-			progress++;
-			snprintf(msg, 256, _("%s. Processing image %d (%s)"), args->description, input_idx, filename);
-			set_progress_bar_data(msg, (float)progress / nb_framesf);
-		}
-	}
+	if (pipeline_is_possible(args))
+		abort = generic_pipeline(args, nb_frames, index_mapping, &excluded_frames);
+	else abort = generic_loop(args, nb_frames, index_mapping, &excluded_frames);
 
 	if (abort) {
 		set_progress_bar_data(_("Sequence processing failed. Check the log."), PROGRESS_RESET);
@@ -272,20 +473,44 @@ gboolean end_generic_sequence(gpointer p) {
 	return end_generic(NULL);
 }
 
+/* the output is in a single file, SER or chunked, for outputs of the same
+ * type as the input sequence or when forced. Chunked output is forced over
+ * SER input too. */
+static gboolean has_chunked_output(struct generic_seq_args *args) {
+	return args->force_chunked_output ||
+		(!args->force_ser_output && args->seq->type == SEQ_CHUNKED);
+}
+
+static gboolean has_ser_output(struct generic_seq_args *args) {
+	return !args->force_chunked_output &&
+		(args->force_ser_output || args->seq->type == SEQ_SER);
+}
+
 int ser_prepare_hook(struct generic_seq_args *args) {
-	if (args->force_ser_output || args->seq->type == SEQ_SER) {
+	if (args->has_output && (has_ser_output(args) || has_chunked_output(args))) {
 		gchar *dest;
+		const char *ext = has_ser_output(args) ? "ser" : "csq";
 		const char *ptr = strrchr(args->seq->seqname, G_DIR_SEPARATOR);
 		if (ptr)
-			dest = g_strdup_printf("%s%s.ser", args->new_seq_prefix, ptr + 1);
-		else dest = g_strdup_printf("%s%s.ser", args->new_seq_prefix, args->seq->seqname);
-
-		args->new_ser = malloc(sizeof(struct ser_struct));
-		if (ser_create_file(dest, args->new_ser, TRUE, args->seq->ser_file)) {
-			free(args->new_ser);
-			args->new_ser = NULL;
-			g_free(dest);
-			return 1;
+			dest = g_strdup_printf("%s%s.%s", args->new_seq_prefix, ptr + 1, ext);
+		else dest = g_strdup_printf("%s%s.%s", args->new_seq_prefix, args->seq->seqname, ext);
+
+		if (has_ser_output(args)) {
+			args->new_ser = malloc(sizeof(struct ser_struct));
+			if (ser_create_file(dest, args->new_ser, TRUE, args->seq->ser_file)) {
+				free(args->new_ser);
+				args->new_ser = NULL;
+				g_free(dest);
+				return 1;
+			}
+		} else {
+			args->new_chunked = malloc(sizeof(struct chunked_struct));
+			if (chunked_create_file(dest, args->new_chunked, CHUNKED_DEFLATE)) {
+				free(args->new_chunked);
+				args->new_chunked = NULL;
+				g_free(dest);
+				return 1;
+			}
 		}
 		g_free(dest);
 	}
@@ -294,20 +519,33 @@ int ser_prepare_hook(struct generic_seq_args *args) {
 
 int ser_finalize_hook(struct generic_seq_args *args) {
 	int retval = 0;
-	if ((args->force_ser_output || args->seq->type == SEQ_SER) && args->new_ser) {
+	if (has_ser_output(args) && args->new_ser) {
 		retval = ser_write_and_close(args->new_ser);
 		free(args->new_ser);
+		args->new_ser = NULL;
+	}
+	if (has_chunked_output(args) && args->new_chunked) {
+		retval = chunked_write_and_close(args->new_chunked);
+		free(args->new_chunked);
+		args->new_chunked = NULL;
 	}
 	return retval;
 }
 
-/* In SER, all images must be in a contiguous sequence, so we use the out_index.
+/* In SER and chunked files, all images must be in a contiguous sequence, so
+ * we use the out_index.
  * In FITS sequences, to keep track of image accross processings, we keep the
  * input file number all along (in_index is the index in the sequence, not the name).
  */
 int generic_save(struct generic_seq_args *args, int out_index, int in_index, fits *fit) {
-	if (args->force_ser_output || args->seq->type == SEQ_SER) {
+	if (has_ser_output(args)) {
+		if (fit->type == DATA_FLOAT && fit_convert_to_ushort(fit))
+			return 1;
 		return ser_write_frame_from_fit(args->new_ser, fit, out_index);
+	} else if (has_chunked_output(args)) {
+		if (fit->type == DATA_FLOAT && fit_convert_to_ushort(fit))
+			return 1;
+		return chunked_write_frame_from_fit(args->new_chunked, fit, out_index);
 	} else {
 		char *dest = fit_sequence_get_image_filename_prefixed(args->seq,
 				args->new_seq_prefix, in_index);
@@ -318,6 +556,154 @@ int generic_save(struct generic_seq_args *args, int out_index, int in_index, fit
 	}
 }
 
+/* Fused processing: the operations, called stages here, are applied one
+ * after the other to each frame in the image hook, so that frames are read
+ * and saved only once. Stages are the generic_seq_args of the operations,
+ * their output is disabled and replaced by the output of the fused
+ * processing, which is named with all the stage prefixes, like a sequence
+ * processed by each operation successively would be.
+ * The generic_seq_args is the first member of the fused data, which is
+ * its user data, so that it is freed as any other by the end of the
+ * processing while the prefix is still used at that time. */
+struct fused_seq_args {
+	struct generic_seq_args args;
+	GSList *stages;
+	gchar prefix[256];
+	gchar description[256];
+};
+
+static int fused_prepare_hook(struct generic_seq_args *args) {
+	struct fused_seq_args *fused = args->user;
+	GSList *l;
+
+	if (ser_prepare_hook(args))
+		return 1;
+	for (l = fused->stages; l; l = l->next) {
+		struct generic_seq_args *stage = l->data;
+		if (stage->prepare_hook && stage->prepare_hook(stage)) {
+			siril_log_message(_("Preparing %s failed.\n"), stage->description);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int fused_image_hook(struct generic_seq_args *args, int o, int i, fits *fit, rectangle *area) {
+	struct fused_seq_args *fused = args->user;
+	GSList *l;
+
+	for (l = fused->stages; l; l = l->next) {
+		struct generic_seq_args *stage = l->data;
+		if (stage->image_hook(stage, o, i, fit, area))
+			return 1;
+	}
+	return 0;
+}
+
+static int fused_finalize_hook(struct generic_seq_args *args) {
+	struct fused_seq_args *fused = args->user;
+	int retval = ser_finalize_hook(args);
+	GSList *l;
+
+	for (l = fused->stages; l; l = l->next) {
+		struct generic_seq_args *stage = l->data;
+		if (stage->finalize_hook && stage->finalize_hook(stage))
+			retval = 1;
+#ifdef _OPENMP
+		omp_destroy_lock(&stage->lock);
+#endif
+		free(stage);
+	}
+	g_slist_free(fused->stages);
+	fused->stages = NULL;
+	return retval;
+}
+
+/* Creates the arguments of the processing of seq by the operations of the
+ * list stages, in this order. Stages must have an output, process full
+ * images and release their user data in their finalize hook, as they have no
+ * idle function. The stages are freed at the end of the processing, and the
+ * returned value can be used and freed as any generic_seq_args. */
+struct generic_seq_args *new_fused_seq_args(sequence *seq, GSList *stages) {
+	struct fused_seq_args *fused;
+	struct generic_seq_args *first;
+	GSList *l;
+
+	if (!stages)
+		return NULL;
+	for (l = stages; l; l = l->next) {
+		struct generic_seq_args *stage = l->data;
+		if (!stage->has_output || stage->partial_image || stage->save_hook ||
+				stage->idle_function) {
+			siril_log_message(_("%s cannot be fused with other operations\n"),
+					stage->description);
+			return NULL;
+		}
+		if (stage->float_data != ((struct generic_seq_args *)stages->data)->float_data) {
+			siril_log_message(_("Operations on 16-bit and 32-bit images cannot be fused\n"));
+			return NULL;
+		}
+	}
+
+	fused = calloc(1, sizeof(struct fused_seq_args));
+	if (!fused) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	first = stages->data;
+	fused->stages = stages;
+	fused->args.seq = seq;
+	fused->args.partial_image = FALSE;
+	// the first operation decides which images are processed
+	fused->args.filtering_criterion = first->filtering_criterion;
+	fused->args.filtering_parameter = first->filtering_parameter;
+	fused->args.nb_filtered_images = first->nb_filtered_images;
+	fused->args.stop_on_error = FALSE;
+	fused->args.parallel = TRUE;
+	fused->args.float_data = first->float_data;
+	for (l = stages; l; l = l->next) {
+		struct generic_seq_args *stage = l->data;
+		gchar *tmp;
+
+		stage->seq = seq;
+		if (stage->stop_on_error)
+			fused->args.stop_on_error = TRUE;
+		if (!stage->parallel)
+			fused->args.parallel = FALSE;
+		if (stage->new_seq_prefix) {
+			tmp = g_strconcat(stage->new_seq_prefix, fused->prefix, NULL);
+			g_strlcpy(fused->prefix, tmp, sizeof(fused->prefix));
+			g_free(tmp);
+		}
+		if (l != stages)
+			g_strlcat(fused->description, " + ", sizeof(fused->description));
+		g_strlcat(fused->description, stage->description, sizeof(fused->description));
+		/* the fused processing saves the frames */
+		stage->has_output = FALSE;
+		stage->load_new_sequence = FALSE;
+#ifdef _OPENMP
+		omp_init_lock(&stage->lock);
+#endif
+	}
+
+	fused->args.prepare_hook = fused_prepare_hook;
+	fused->args.image_hook = fused_image_hook;
+	fused->args.save_hook = NULL;
+	fused->args.finalize_hook = fused_finalize_hook;
+	fused->args.idle_function = NULL;
+	fused->args.description = fused->description;
+	fused->args.has_output = TRUE;
+	fused->args.new_seq_prefix = fused->prefix;
+	fused->args.load_new_sequence = TRUE;
+	fused->args.force_ser_output = FALSE;
+	fused->args.force_chunked_output = FALSE;
+	for (l = stages; l; l = l->next)
+		if (((struct generic_seq_args *)l->data)->force_chunked_output)
+			fused->args.force_chunked_output = TRUE;
+	fused->args.user = fused;
+	return &fused->args;
+}
+
 /*****************************************************************************
  *      P R O C E S S I N G      T H R E A D      M A N A G E M E N T        *
  ****************************************************************************/
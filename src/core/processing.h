@@ -71,6 +71,14 @@ struct generic_seq_args {
 	gboolean force_ser_output;
 	/** new output SER if seq->type == SEQ_SER or force_ser_output (internal) */
 	struct ser_struct *new_ser;
+	/** flag to force output to be a chunked sequence file */
+	gboolean force_chunked_output;
+	/** new output chunked file if seq->type == SEQ_CHUNKED or
+	 * force_chunked_output (internal) */
+	struct chunked_struct *new_chunked;
+	/** frames are given to the image hook in 32-bit float and saved in
+	 * float FITS files, or converted back to 16 bits for SER output */
+	gboolean float_data;
 
 	/** user data: pointer to operation-specific data */
 	void *user;
@@ -94,6 +102,8 @@ int ser_prepare_hook(struct generic_seq_args *args);
 int ser_finalize_hook(struct generic_seq_args *args);
 int generic_save(struct generic_seq_args *, int, int, fits *);
 
+struct generic_seq_args *new_fused_seq_args(sequence *seq, GSList *stages);
+
 void start_in_new_thread(gpointer(*f)(gpointer p), gpointer p);
 gpointer waiting_for_thread();
 void stop_processing_thread();
@@ -23,6 +23,14 @@ int import_metadata_from_fitsfile(fitsfile *fptr, fits *to);
 void	clearfits(fits *);
 int	readfits_partial(const char *filename, int layer, fits *fit, const rectangle *area, gboolean read_date);
 int	read_opened_fits_partial(sequence *seq, int layer, int index, WORD *buffer, const rectangle *area);
+int	read_opened_fits_partial_float(sequence *seq, int layer, int index, float *buffer, const rectangle *area);
+void	open_fits_direct(sequence *seq, int index, const char *filename);
+void	close_fits_direct(sequence *seq, int index);
+int	open_fits_for_areas(const char *filename, fits *fit);
+int	read_fits_area(fits *fit, int layer, const rectangle *area, WORD *dest);
+int	create_fits_for_areas(const char *name, fits *fit);
+int	write_fits_area(fits *fit, int layer, const rectangle *area, WORD *src);
+int	close_fits_for_areas(fits *fit);
 int 	savefits(const char *, fits *);
 int	copyfits(fits *from, fits *to, unsigned char oper, int layer);
 int	copy_fits_metadata(fits *from, fits *to);
@@ -36,6 +44,8 @@ void	rgb48bit_to_fits48bit(WORD *rgbbuf, fits *fit, gboolean inverted, gboolean
 void	fits_flip_top_to_bottom(fits *fit);
 void	extract_region_from_fits(fits *from, int layer, fits *to, const rectangle *area);
 int 	new_fit_image(fits **fit, int width, int height, int nblayer);
+int	fit_convert_to_float(fits *fit);
+int	fit_convert_to_ushort(fits *fit);
 void	keep_first_channel_from_fits(fits *fit);
 
 /****************** image_formats_internal.h ******************/
@@ -99,6 +99,80 @@ int nozero(fits *fit, int level) {
  *       S I R I L      A R I T H M E T I C      O P E R A T I O N S         *
  ****************************************************************************/
 
+/* Float images: operations give the same results as on 16-bit images,
+ * values being expressed between 0 and 1 instead of 0 and 65535, but without
+ * rounding and clipping. Scalars and 16-bit operands keep their 16-bit scale. */
+
+/* value of a pixel of an operand of a float operation, in the 16-bit scale */
+static inline double get_operand_value(fits *b, int layer, size_t i) {
+	if (b->type == DATA_FLOAT)
+		return b->fpdata[layer][i] * USHRT_MAX_DOUBLE;
+	return (double) b->pdata[layer][i];
+}
+
+static int soper_float(fits *a, double scalar, char oper) {
+	size_t i, n = a->rx * a->ry;
+	int layer;
+	float fscalar = (float) scalar;
+
+	if (oper == OPER_ADD || oper == OPER_SUB)
+		fscalar = (float) (scalar / USHRT_MAX_DOUBLE);
+	for (layer = 0; layer < a->naxes[2]; ++layer) {
+		float *gbuf = a->fpdata[layer];
+		switch (oper) {
+		case OPER_ADD:
+			for (i = 0; i < n; ++i)
+				gbuf[i] += fscalar;
+			break;
+		case OPER_SUB:
+			for (i = 0; i < n; ++i)
+				gbuf[i] -= fscalar;
+			break;
+		case OPER_MUL:
+			for (i = 0; i < n; ++i)
+				gbuf[i] *= fscalar;
+			break;
+		case OPER_DIV:
+			for (i = 0; i < n; ++i)
+				gbuf[i] /= fscalar;
+			break;
+		}
+	}
+	invalidate_stats_from_fit(a);
+	return 0;
+}
+
+static int imoper_float(fits *a, fits *b, char oper) {
+	size_t i, n = a->rx * a->ry;
+	int layer;
+
+	for (layer = 0; layer < a->naxes[2]; ++layer) {
+		float *gbuf = a->fpdata[layer];
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(i) schedule(static) if(n > 100000)
+#endif
+		for (i = 0; i < n; ++i) {
+			double dbuf = get_operand_value(b, layer, i);
+			switch (oper) {
+			case OPER_ADD:
+				gbuf[i] += (float) (dbuf / USHRT_MAX_DOUBLE);
+				break;
+			case OPER_SUB:
+				gbuf[i] -= (float) (dbuf / USHRT_MAX_DOUBLE);
+				break;
+			case OPER_MUL:
+				gbuf[i] *= (float) dbuf;
+				break;
+			case OPER_DIV:
+				gbuf[i] = (dbuf == 0.0) ? 0.0f : (float) (gbuf[i] / dbuf);
+				break;
+			}
+		}
+	}
+	invalidate_stats_from_fit(a);
+	return 0;
+}
+
 /* equivalent to (map simple_operation a), with simple_operation being
  * (lambda (pixel) (oper pixel scalar))
  * oper is a for addition, s for substraction (i for difference) and so on. */
@@ -108,6 +182,8 @@ int soper(fits *a, double scalar, char oper) {
 	int n = a->rx * a->ry;
 
 	assert(n > 0);
+	if (a->type == DATA_FLOAT)
+		return soper_float(a, scalar, oper);
 
 	for (layer = 0; layer < a->naxes[2]; ++layer) {
 		gbuf = a->pdata[layer];
@@ -150,6 +226,12 @@ int imoper(fits *a, fits *b, char oper) {
 				a->rx, b->rx, a->ry, b->ry);
 		return 1;
 	}
+	if (a->type == DATA_FLOAT)
+		return imoper_float(a, b, oper);
+	if (b->type == DATA_FLOAT) {
+		siril_log_message(_("imoper: a float image cannot be applied to a 16-bit image\n"));
+		return 1;
+	}
 	for (layer = 0; layer < a->naxes[2]; ++layer) {
 		WORD *buf = b->pdata[layer];
 		WORD *gbuf = a->pdata[layer];
@@ -211,6 +293,27 @@ int siril_fdiv(fits *a, fits *b, float coef) {
 				b->rx, a->ry, b->ry);
 		return -1;
 	}
+	if (a->type == DATA_FLOAT) {
+		size_t n = a->rx * a->ry, j;
+		for (layer = 0; layer < a->naxes[2]; ++layer) {
+			float *gbuf = a->fpdata[layer];
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(j) schedule(static) if(n > 100000)
+#endif
+			for (j = 0; j < n; ++j) {
+				double div = get_operand_value(b, layer, j);
+				if (div == 0.0)
+					div = 1.0;	// avoid division by 0, as below
+				gbuf[j] = (float) ((double) coef * gbuf[j] / div);
+			}
+		}
+		invalidate_stats_from_fit(a);
+		return 0;
+	}
+	if (b->type == DATA_FLOAT) {
+		siril_log_message(_("fdiv: a float image cannot be applied to a 16-bit image\n"));
+		return -1;
+	}
 	for (layer = 0; layer < a->naxes[2]; ++layer) {
 		WORD *buf = b->pdata[layer];
 		WORD *gbuf = a->pdata[layer];
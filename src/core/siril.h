@@ -60,7 +60,7 @@
 typedef unsigned char BYTE;		// default type for image display data
 typedef unsigned short WORD;		// default type for internal image data
 
-#define MAX_COMMAND_WORDS 16		// max number of words to split in command line input
+#define MAX_COMMAND_WORDS 32		// max number of words to split in command line input
 
 #define MAX_SEQPSF 7			// max number of stars for which seqpsf can be run
 
@@ -177,6 +177,9 @@ typedef enum {
 
 typedef struct imdata imgdata;
 typedef struct registration_data regdata;
+typedef struct multipoint_registration_data mpregdata;
+typedef struct registration_cache regcache;
+typedef struct fits_direct_struct fits_direct;
 typedef struct layer_info_struct layer_info;
 typedef struct sequ sequence;
 typedef struct single_image single;
@@ -275,7 +278,13 @@ struct layer_info_struct {
 	display_mode rendering_mode;	// defaults to NORMAL_DISPLAY
 };
 
-typedef enum { SEQ_REGULAR, SEQ_SER,
+/* storage of the pixels of a fits */
+typedef enum {
+	DATA_USHORT,	// 16-bit unsigned integers in data
+	DATA_FLOAT	// 32-bit floats in fdata, normalized between 0 and 1
+} data_type;
+
+typedef enum { SEQ_REGULAR, SEQ_SER, SEQ_CHUNKED,
 #ifdef HAVE_FFMS2
 	SEQ_AVI,
 #endif
@@ -290,14 +299,43 @@ struct imdata {
 };
 
 /* registration data, exists once for each image and each layer */
+typedef struct Homo {
+	double h00, h01, h02;
+	double h10, h11, h12;
+	double h20, h21, h22;
+	int pair_matched;
+	int Inliers;
+} Homography;
+
 struct registration_data {
 	float shiftx, shifty;	// we could have a subpixel precision, but is it needed? saved
+	Homography H;		// transformation to the reference image, applied when
+				// stacking, in the memory orientation of the sequence
+				// like shifty; h22 is 0 if unset. saved
 	fitted_PSF *fwhm_data;	// used in PSF/FWHM registration, not saved
 	float fwhm;		// copy of fwhm->fwhmx, used as quality indicator, saved data
 	float roundness;	// fwhm->fwhmy / fwhm->fwhmx, 0 when uninit, ]0, 1] when set 
 	double quality;
 };
 
+/* local registration data of the multi-point registration: the reference frame
+ * is covered by a grid of square alignment boxes overlapping by half of their
+ * size, and each frame has a shift for each box, in the same coordinates as
+ * the shifts of regdata. Saved in a file next to the sequence file. */
+struct multipoint_registration_data {
+	int layer;		// layer used for the registration
+	int box_size;		// side of the boxes, in pixels
+	int grid_x, grid_y;	// bottom-left corner of the first box of the grid
+	int grid_w, grid_h;	// number of box positions in the grid
+	int nb_boxes;		// number of boxes kept, showing enough contrast
+	int *box_index;		// for each grid position, index of its box or -1
+	int *box_x, *box_y;	// bottom-left corners of the boxes in the reference
+	int nb_frames;		// copy of seq->number
+	float *global;		// for each frame, x and y of its global shift
+	float *shifts;		// for each frame, x and y of the shifts of each box
+	float *quality;		// for each frame, quality of each box, -1 if not computed
+};
+
 /* see explanation about sequence and single image management in io/sequence.c */
 
 struct sequ {
@@ -314,6 +352,8 @@ struct sequ {
 	int reference_image;	// reference image for registration
 	imgdata *imgparam;	// a structure for each image of the sequence
 	regdata **regparam;	// *regparam[nb_layers], may be null if nb_layers is unknown
+	mpregdata *mpregparam;	// multi-point registration data, may be null
+	regcache *cache;	// cached analysis of the frames, see io/regcache.c, may be null
 	imstats ***stats;	// statistics of the images for each layer, may be null too
 	/* in the case of a CFA sequence, depending on the opening mode, we cannot store
 	 * and use everything that was in the seqfile, so we back them up here */
@@ -328,12 +368,14 @@ struct sequ {
 	sequence_type type;
 	struct ser_struct *ser_file;
 	gboolean cfa_opened_monochrome;	// in case the CFA SER was opened in monochrome mode
+	struct chunked_struct *chunked_file;	// for SEQ_CHUNKED, see io/chunked.h
 #ifdef HAVE_FFMS2
 	struct film_struct *film_file;
 	char *ext;		// extension of video, NULL if not video
 #endif
 	fits **internal_fits;	// for INTERNAL sequences: images references. Length: number
 	fitsfile **fptr;	// file descriptors for open-mode operations
+	fits_direct *direct;	// direct reads of the opened files, see read_opened_fits_partial()
 #ifdef _OPENMP
 	omp_lock_t *fd_lock;	// locks for open-mode threaded operations
 #endif
@@ -431,8 +473,17 @@ struct ffit {
 	double mini, maxi;	// min and max of the stats->max[3]
 
 	fitsfile *fptr;		// file descriptor. Only used for file read and write.
+	data_type type;		// storage of the pixels. Setting it to DATA_FLOAT
+				// before readfits() reads the image in float
 	WORD *data;		// 16-bit image data (depending on image type)
 	WORD *pdata[3];		// pointers on data, per layer data access (RGB)
+	float *fdata;		// 32-bit image data, with type DATA_FLOAT
+	float *fpdata[3];	// pointers on fdata, per layer data access (RGB)
+	/* when data is not allocated but points in a private mapping of the
+	 * file (see ser.c), the mapping, unmapped by clearfits(). Such data
+	 * can be modified, but must not be reallocated or freed. */
+	void *mapped_base;
+	size_t mapped_size;
 
 	gboolean top_down;	// image data is stored top-down, normally false for FITS, true for SER
 
@@ -562,6 +613,7 @@ struct cominf {
 	char *ext;		// FITS extension used in SIRIL
 
 	int reg_settings;		// Use to save registration method in the init file
+	gboolean fftw_wisdom;		// keep the FFTW plans of DFT registration across runs
 	
 	gboolean dontShowConfirm;
 
@@ -631,14 +683,6 @@ struct image_stats {
 	int _nb_refs;	// reference counting for data management
 };
 
-typedef struct Homo {
-	double h00, h01, h02;
-	double h10, h11, h12;
-	double h20, h21, h22;
-	int pair_matched;
-	int Inliers;
-} Homography;
-
 #if 0
 /* TODO: this structure aims to allow the composition of several 1-channel images and make
  * more easy the management of RGB compositing */
@@ -26,6 +26,7 @@
 #include "core/processing.h"
 #include "algos/statistics.h"
 #include "algos/sorting.h"
+#include "algos/tiling.h"
 #include "gui/progress_and_log.h"
 #include "gui/callbacks.h"
 #include "gui/dialogs.h"
@@ -45,14 +46,20 @@ int banding_image_hook(struct generic_seq_args *args, int o, int i, fits *fit, r
 			banding_args->protect_highlights, banding_args->applyRotation);
 }
 
-void apply_banding_to_sequence(struct banding_data *banding_args) {
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
-	args->seq = &com.seq;
+static int banding_finalize_hook(struct generic_seq_args *args) {
+	int retval = ser_finalize_hook(args);
+	free(args->user);
+	return retval;
+}
+
+struct generic_seq_args *new_banding_seq_args(sequence *seq, struct banding_data *banding_args) {
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
+	args->seq = seq;
 	args->partial_image = FALSE;
 	args->filtering_criterion = seq_filter_included;
-	args->nb_filtered_images = com.seq.selnum;
+	args->nb_filtered_images = seq->selnum;
 	args->prepare_hook = ser_prepare_hook;
-	args->finalize_hook = ser_finalize_hook;
+	args->finalize_hook = banding_finalize_hook;
 	args->save_hook = NULL;
 	args->image_hook = banding_image_hook;
 	args->idle_function = NULL;
@@ -67,8 +74,11 @@ void apply_banding_to_sequence(struct banding_data *banding_args) {
 	args->parallel = TRUE;
 
 	banding_args->fit = NULL;	// not used here
+	return args;
+}
 
-	start_in_new_thread(generic_sequence_worker, args);
+void apply_banding_to_sequence(struct banding_data *banding_args) {
+	start_in_new_thread(generic_sequence_worker, new_banding_seq_args(&com.seq, banding_args));
 }
 
 // idle function executed at the end of the BandingEngine processing
@@ -118,6 +128,29 @@ gpointer BandingEngineThreaded(gpointer p) {
 	return GINT_TO_POINTER(retval);
 }
 
+/* difference between the background and the median of a line of n pixels,
+ * highlights above reject being ignored if protect_highlights is TRUE; tmp
+ * is a buffer of n pixels */
+static double banding_line_value(const WORD *line, int n, WORD *tmp, double background,
+		gboolean protect_highlights, WORD reject) {
+	int i;
+	double median;
+
+	memcpy(tmp, line, n * sizeof(WORD));
+	if (protect_highlights) {
+		quicksort_s(tmp, n);
+		for (i = n - 1; i >= 0; i--) {
+			if (tmp[i] < reject)
+				break;
+			n--;
+		}
+		median = gsl_stats_ushort_median_from_sorted_data(tmp, 1, n);
+	} else {
+		median = round_to_WORD(quickmedian(tmp, n));
+	}
+	return background - median;
+}
+
 int BandingEngine(fits *fit, double sigma, double amount, gboolean protect_highlights, gboolean applyRotation) {
 	int chan, row, i, ret = 0;
 	WORD *line, *fixline;
@@ -141,44 +174,26 @@ int BandingEngine(fits *fit, double sigma, double amount, gboolean protect_highl
 		}
 		double background = stat->median;
 		double *rowvalue = calloc(fit->ry, sizeof(double));
-		if (rowvalue == NULL) {
+		WORD *cpyline = calloc(fit->rx, sizeof(WORD));
+		if (rowvalue == NULL || cpyline == NULL) {
 			PRINT_ALLOC_ERR;
 			free_stats(stat);
+			free(rowvalue);
+			free(cpyline);
 			return 1;
 		}
 		if (protect_highlights) {
 			globalsigma = stat->mad * MAD_NORM;
 		}
 		free_stats(stat);
+		WORD reject = round_to_WORD(background + invsigma * globalsigma);
 		for (row = 0; row < fit->ry; row++) {
 			line = fit->pdata[chan] + row * fit->rx;
-			WORD *cpyline = calloc(fit->rx, sizeof(WORD));
-			if (cpyline == NULL) {
-				PRINT_ALLOC_ERR;
-				free(rowvalue);
-				return 1;
-			}
-			memcpy(cpyline, line, fit->rx * sizeof(WORD));
-			int n = fit->rx;
-			double median;
-			if (protect_highlights) {
-				quicksort_s(cpyline, n);
-				WORD reject = round_to_WORD(
-						background + invsigma * globalsigma);
-				for (i = fit->rx - 1; i >= 0; i--) {
-					if (cpyline[i] < reject)
-						break;
-					n--;
-				}
-				median = gsl_stats_ushort_median_from_sorted_data(cpyline, 1, n);
-			} else {
-				median = round_to_WORD(quickmedian(cpyline, n));
-			}
-
-			rowvalue[row] = background - median;
+			rowvalue[row] = banding_line_value(line, fit->rx, cpyline,
+					background, protect_highlights, reject);
 			minimum = min(minimum, rowvalue[row]);
-			free(cpyline);
 		}
+		free(cpyline);
 		for (row = 0; row < fit->ry; row++) {
 			fixline = fiximage->pdata[chan] + row * fiximage->rx;
 			for (i = 0; i < fit->rx; i++)
@@ -200,6 +215,214 @@ int BandingEngine(fits *fit, double sigma, double amount, gboolean protect_highl
 	return ret;
 }
 
+/*** Banding reduction applied by tiles to a FITS file, with
+ * process_fits_by_tiles(). The statistics of the whole image are computed in
+ * a first pass from histograms, the correction of each row in a second pass
+ * over bands of complete rows, or columns with applyRotation, and the
+ * corrections are applied in the last pass. ***/
+
+struct banding_tiles_data {
+	struct banding_data args;
+	guint64 *histogram[3];	// of the non-zero pixels of each layer
+	double background[3], globalsigma[3];
+	double *linevalue[3];	// for each row, or column with rotation
+	double minimum[3];
+};
+
+/* value of rank k in the multiset described by a histogram of USHRT_MAX + 1 bins */
+static double histogram_rank_value(const guint64 *histogram, guint64 k) {
+	guint64 count = 0;
+	int i;
+	for (i = 0; i < USHRT_MAX; i++) {
+		count += histogram[i];
+		if (count > k)
+			break;
+	}
+	return (double) i;
+}
+
+/* same as histogram_median() on the values of the histogram */
+static double histogram_median_of_counts(const guint64 *histogram) {
+	guint64 n = 0;
+	int i;
+	for (i = 0; i <= USHRT_MAX; i++)
+		n += histogram[i];
+	if (n == 0)
+		return 0.0;
+	if (n % 2 == 0)
+		return (histogram_rank_value(histogram, n / 2 - 1) +
+				histogram_rank_value(histogram, n / 2)) / 2.0;
+	return histogram_rank_value(histogram, n / 2);
+}
+
+static int banding_analyse_tile(struct tile_operation *op, int pass, fits *tile, const rectangle *area) {
+	struct banding_tiles_data *data = (struct banding_tiles_data *) op->data;
+	gboolean columns = data->args.applyRotation;
+	int chan;
+
+	for (chan = 0; chan < tile->naxes[2]; chan++) {
+		WORD *pixels = tile->pdata[chan];
+		size_t i, n = tile->rx * tile->ry;
+
+		if (pass == 0) {
+			for (i = 0; i < n; i++) {
+				if (pixels[i])
+					data->histogram[chan][pixels[i]]++;
+			}
+			continue;
+		}
+
+		WORD reject = round_to_WORD(data->background[chan] +
+				data->globalsigma[chan] / data->args.sigma);
+		int nb_lines = columns ? tile->rx : tile->ry;
+		int length = columns ? tile->ry : tile->rx;
+		int first_line = columns ? area->x : op->ry - area->y - area->h;
+		int error = 0;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(com.max_thread) reduction(+:error)
+#endif
+		{
+			WORD *line = malloc(length * sizeof(WORD));
+			WORD *tmp = malloc(length * sizeof(WORD));
+			int l, j;
+			if (!line || !tmp) {
+				PRINT_ALLOC_ERR;
+				error = 1;
+			} else {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+				for (l = 0; l < nb_lines; l++) {
+					if (columns) {
+						for (j = 0; j < length; j++)
+							line[j] = pixels[j * tile->rx + l];
+					} else {
+						memcpy(line, pixels + l * tile->rx, length * sizeof(WORD));
+					}
+					data->linevalue[chan][first_line + l] = banding_line_value(line, length,
+							tmp, data->background[chan],
+							data->args.protect_highlights, reject);
+				}
+			}
+			free(line);
+			free(tmp);
+		}
+		if (error)
+			return 1;
+	}
+	return 0;
+}
+
+static int banding_end_pass(struct tile_operation *op, int pass) {
+	struct banding_tiles_data *data = (struct banding_tiles_data *) op->data;
+	int chan, nb_lines = data->args.applyRotation ? op->rx : op->ry;
+	double minimum = DBL_MAX;
+
+	for (chan = 0; chan < op->nb_layers; chan++) {
+		if (pass == 0) {
+			/* median and MAD of the non-zero pixels, like statistics() */
+			guint64 *deviations = calloc(USHRT_MAX + 1, sizeof(guint64));
+			int median, i;
+			if (!deviations) {
+				PRINT_ALLOC_ERR;
+				return 1;
+			}
+			data->background[chan] = histogram_median_of_counts(data->histogram[chan]);
+			median = round_to_int(data->background[chan]);
+			for (i = 1; i <= USHRT_MAX; i++)
+				deviations[abs(i - median)] += data->histogram[chan][i];
+			if (data->args.protect_highlights)
+				data->globalsigma[chan] = histogram_median_of_counts(deviations) * MAD_NORM;
+			free(deviations);
+			data->linevalue[chan] = malloc(nb_lines * sizeof(double));
+			if (!data->linevalue[chan]) {
+				PRINT_ALLOC_ERR;
+				return 1;
+			}
+		} else {
+			/* as in BandingEngine(), the minimum is over the lines
+			 * of this layer and the previous ones */
+			int l;
+			for (l = 0; l < nb_lines; l++)
+				minimum = min(minimum, data->linevalue[chan][l]);
+			data->minimum[chan] = minimum;
+		}
+	}
+	return 0;
+}
+
+static int banding_process_tile(struct tile_operation *op, fits *tile, const rectangle *area) {
+	struct banding_tiles_data *data = (struct banding_tiles_data *) op->data;
+	gboolean columns = data->args.applyRotation;
+	float amount = data->args.amount;
+	int chan;
+
+	for (chan = 0; chan < tile->naxes[2]; chan++) {
+		const double *linevalue = data->linevalue[chan] +
+			(columns ? area->x : op->ry - area->y - area->h);
+		int y;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+		for (y = 0; y < tile->ry; y++) {
+			WORD *pixels = tile->pdata[chan] + y * tile->rx;
+			int x;
+			for (x = 0; x < tile->rx; x++) {
+				double value = columns ? linevalue[x] : linevalue[y];
+				WORD fix = round_to_WORD(value - data->minimum[chan]);
+				fix = round_to_WORD(fix * amount);
+				pixels[x] = round_to_WORD((double) pixels[x] + (double) fix);
+			}
+		}
+	}
+	return 0;
+}
+
+static void banding_free_tiles_data(struct tile_operation *op) {
+	struct banding_tiles_data *data = (struct banding_tiles_data *) op->data;
+	int chan;
+	if (!data)
+		return;
+	for (chan = 0; chan < 3; chan++) {
+		free(data->histogram[chan]);
+		free(data->linevalue[chan]);
+	}
+	free(data);
+}
+
+struct tile_operation *new_banding_tile_operation(struct banding_data *banding_args) {
+	struct tile_operation *op = calloc(1, sizeof(struct tile_operation));
+	struct banding_tiles_data *data = calloc(1, sizeof(struct banding_tiles_data));
+	int chan;
+	if (!op || !data) {
+		PRINT_ALLOC_ERR;
+		free(op);
+		free(data);
+		return NULL;
+	}
+	data->args = *banding_args;
+	for (chan = 0; chan < 3; chan++) {
+		data->histogram[chan] = calloc(USHRT_MAX + 1, sizeof(guint64));
+		if (!data->histogram[chan]) {
+			PRINT_ALLOC_ERR;
+			op->data = data;
+			free_tile_operation(op);
+			return NULL;
+		}
+	}
+	op->name = _("Banding Reduction");
+	op->shape = banding_args->applyRotation ? TILES_COLUMNS : TILES_ROWS;
+	op->halo = 0;
+	op->bytes_per_pixel = 2.0 * sizeof(WORD);	// the tile and the buffer to write it
+	op->nb_passes = 2;
+	op->analyse = banding_analyse_tile;
+	op->end_pass = banding_end_pass;
+	op->process = banding_process_tile;
+	op->free_data = banding_free_tiles_data;
+	op->data = data;
+	return op;
+}
+
 /***************** GUI for Canon Banding Reduction ********************/
 
 void on_menuitem_fixbanding_activate(GtkMenuItem *menuitem, gpointer user_data) {
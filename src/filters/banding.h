@@ -2,6 +2,8 @@
 #define SRC_FILTERS_BANDING_H_
 
 #include "core/siril.h"
+#include "core/processing.h"
+#include "algos/tiling.h"
 
 /* Banding data from GUI */
 struct banding_data {
@@ -13,8 +15,10 @@ struct banding_data {
 	const gchar *seqEntry;
 };
 
+struct generic_seq_args *new_banding_seq_args(sequence *seq, struct banding_data *banding_args);
 void apply_banding_to_sequence(struct banding_data *banding_args);
 gpointer BandingEngineThreaded(gpointer p);
 int BandingEngine(fits *fit, double sigma, double amount, gboolean protect_highlights, gboolean applyRotation);
+struct tile_operation *new_banding_tile_operation(struct banding_data *banding_args);
 
 #endif /* SRC_FILTERS_BANDING_H_ */
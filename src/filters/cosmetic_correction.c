@@ -279,8 +279,59 @@ int cosmeticCorrOneLine(fits *fit, deviant_pixel dev, gboolean is_cfa) {
 	return 0;
 }
 
+/* same as getMedian5x5() and getAverage3x3() for float images */
+static float getMedian5x5_float(float *buf, const int xx, const int yy, const int w,
+		const int h, gboolean is_cfa) {
+	int step = is_cfa ? 2 : 1, radius = is_cfa ? 4 : 2, x, y, n = 0;
+	double value[24];
+
+	for (y = yy - radius; y <= yy + radius; y += step) {
+		for (x = xx - radius; x <= xx + radius; x += step) {
+			if (y >= 0 && y < h && x >= 0 && x < w && (x != xx || y != yy))
+				value[n++] = buf[x + y * w];
+		}
+	}
+	return (float) quickmedian_double(value, n);
+}
+
+static float getAverage3x3_float(float *buf, const int xx, const int yy, const int w,
+		const int h, gboolean is_cfa) {
+	int step = is_cfa ? 2 : 1, radius = step, x, y, n = 0;
+	double value = 0.0;
+
+	for (y = yy - radius; y <= yy + radius; y += step) {
+		for (x = xx - radius; x <= xx + radius; x += step) {
+			if (y >= 0 && y < h && x >= 0 && x < w && (x != xx || y != yy)) {
+				value += buf[x + y * w];
+				n++;
+			}
+		}
+	}
+	return (float) (value / n);
+}
+
+static int cosmeticCorrection_float(fits *fit, deviant_pixel *dev, int size, gboolean is_cfa) {
+	int i;
+	float *buf = fit->fpdata[RLAYER];
+
+	for (i = 0; i < size; i++) {
+		int xx = (int) dev[i].p.x;
+		int yy = (int) dev[i].p.y;
+
+		if (dev[i].type == COLD_PIXEL)
+			buf[xx + yy * fit->rx] = getMedian5x5_float(buf, xx, yy, fit->rx, fit->ry, is_cfa);
+		else
+			buf[xx + yy * fit->rx] = getAverage3x3_float(buf, xx, yy, fit->rx, fit->ry, is_cfa);
+	}
+
+	invalidate_stats_from_fit(fit);
+	return 0;
+}
+
 int cosmeticCorrection(fits *fit, deviant_pixel *dev, int size, gboolean is_cfa) {
 	int i;
+	if (fit->type == DATA_FLOAT)
+		return cosmeticCorrection_float(fit, dev, size, is_cfa);
 	WORD *buf = fit->pdata[RLAYER];		// Cosmetic correction, as developed here, is only used on 1-channel images
 	int width = fit->rx;
 	int height = fit->ry;
@@ -321,14 +372,20 @@ int cosmetic_image_hook(struct generic_seq_args *args, int o, int i, fits *fit,
 	return 0;
 }
 
-void apply_cosmetic_to_sequence(struct cosmetic_data *cosme_args) {
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
+static int cosmetic_finalize_hook(struct generic_seq_args *args) {
+	int retval = ser_finalize_hook(args);
+	free(args->user);
+	return retval;
+}
+
+struct generic_seq_args *new_cosmetic_seq_args(struct cosmetic_data *cosme_args) {
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
 	args->seq = cosme_args->seq;
 	args->partial_image = FALSE;
 	args->filtering_criterion = seq_filter_included;
 	args->nb_filtered_images = cosme_args->seq->selnum;
 	args->prepare_hook = ser_prepare_hook;
-	args->finalize_hook = ser_finalize_hook;
+	args->finalize_hook = cosmetic_finalize_hook;
 	args->save_hook = NULL;
 	args->image_hook = cosmetic_image_hook;
 	args->idle_function = NULL;
@@ -343,8 +400,11 @@ void apply_cosmetic_to_sequence(struct cosmetic_data *cosme_args) {
 	args->parallel = TRUE;
 
 	cosme_args->fit = NULL;	// not used here
+	return args;
+}
 
-	start_in_new_thread(generic_sequence_worker, args);
+void apply_cosmetic_to_sequence(struct cosmetic_data *cosme_args) {
+	start_in_new_thread(generic_sequence_worker, new_cosmetic_seq_args(cosme_args));
 }
 
 // idle function executed at the end of the Cosmetic Correction processing
@@ -2,6 +2,7 @@
 #define COSMETIC_CORRECTION_H_
 
 #include "core/siril.h"
+#include "core/processing.h"
 
 typedef struct deviant_struct deviant_pixel;
 
@@ -28,6 +29,7 @@ long count_deviant_pixels(fits *fit, double sig[2], long *icold, long *ihot);
 deviant_pixel *find_deviant_pixels(fits *fit, double sig[2], long *icold, long *ihot);
 int autoDetect(fits *fit, int layer, double sig[2], long *icold, long *ihot,
 		double amount, gboolean is_cfa);
+struct generic_seq_args *new_cosmetic_seq_args(struct cosmetic_data *cosme_args);
 void apply_cosmetic_to_sequence(struct cosmetic_data *cosme_args);
 gpointer autoDetectThreaded(gpointer p);
 int cosmeticCorrection(fits *fit, deviant_pixel *dev, int size, gboolean is_CFA);
@@ -51,6 +51,39 @@ gpointer LRdeconv(gpointer p) {
 	return 0;
 }
 
+/* Lucy-Richardson deconvolution applied by tiles to a FITS file with
+ * process_fits_by_tiles() */
+static int deconvolution_process_tile(struct tile_operation *op, fits *tile, const rectangle *area) {
+	struct RL_data *args = (struct RL_data *) op->data;
+	return cvLucyRichardson(tile, args->sigma, args->iter);
+}
+
+struct tile_operation *new_deconvolution_tile_operation(double sigma, int iterations) {
+	struct tile_operation *op = calloc(1, sizeof(struct tile_operation));
+	struct RL_data *args = calloc(1, sizeof(struct RL_data));
+	int ksize;
+	if (!op || !args) {
+		PRINT_ALLOC_ERR;
+		free(op);
+		free(args);
+		return NULL;
+	}
+	args->sigma = sigma;
+	args->iter = iterations;
+	/* each iteration uses pixels as far as the PSF kernel size, see
+	 * cvLucyRichardson() */
+	ksize = (int)(6.0 * sigma + 0.5) | 1;
+	op->name = _("Lucy-Richardson deconvolution");
+	op->shape = TILES_SQUARE;
+	op->halo = (ksize + 1) * iterations;
+	/* the tile, its conversions and the matrices of doubles of the
+	 * deconvolution */
+	op->bytes_per_pixel = 64.0;
+	op->process = deconvolution_process_tile;
+	op->data = args;
+	return op;
+}
+
 /************************ GUI for deconvolution ***********************/
 void on_menuitem_deconvolution_activate(GtkMenuItem *menuitem, gpointer user_data) {
 	siril_open_dialog("deconvolution_dialog");
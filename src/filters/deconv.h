@@ -2,6 +2,7 @@
 #define SRC_FILTERS_DECONV_H_
 
 #include "core/siril.h"
+#include "algos/tiling.h"
 
 /* Lucy-Richardson data from GUI */
 struct RL_data {
@@ -11,6 +12,7 @@ struct RL_data {
 };
 
 gpointer LRdeconv(gpointer p);
+struct tile_operation *new_deconvolution_tile_operation(double sigma, int iterations);
 
 
 #endif /* SRC_FILTERS_DECONV_H_ */
@@ -18,12 +18,15 @@
  * along with Siril. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
+
 #include "core/siril.h"
 #include "core/proto.h"
 #include "core/undo.h"
 #include "core/processing.h"
 #include "algos/statistics.h"
 #include "algos/sorting.h"
+#include "algos/tiling.h"
 #include "gui/progress_and_log.h"
 #include "gui/callbacks.h"
 #include "gui/dialogs.h"
@@ -110,103 +113,201 @@ static gboolean end_median_filter(gpointer p) {
 	return FALSE;
 }
 
+/* new value of the pixel x, y: the median of its ksize x ksize neighbourhood,
+ * clamped at the borders, mixed with its value by amount. data receives the
+ * neighbourhood. */
+static WORD median_filter_pixel(WORD **image, int nx, int ny, int x, int y,
+		int radius, WORD *data, int ksize_squared, double amount, double norm) {
+	int i = 0, xx, yy;
+	for (yy = y - radius; yy <= y + radius; yy++) {
+		for (xx = x - radius; xx <= x + radius; xx++) {
+			WORD tmp;
+			if (xx < 0 && yy >= 0) {
+				if (yy >= ny)
+					tmp = image[ny - 1][0];
+				else
+					tmp = image[yy][0];
+			} else if (xx > 0 && yy <= 0) {
+				if (xx >= nx)
+					tmp = image[0][nx - 1];
+				else
+					tmp = image[0][xx];
+			} else if (xx <= 0 && yy <= 0) {
+				tmp = image[0][0];
+			} else {
+				if (xx >= nx && yy >= ny)
+					tmp = image[ny - 1][nx - 1];
+				else if (xx >= nx && yy < ny)
+					tmp = image[yy][nx - 1];
+				else if (xx < nx && yy >= ny)
+					tmp = image[ny - 1][xx];
+				else
+					tmp = image[yy][xx];
+			}
+			data[i++] = tmp;
+		}
+	}
+	WORD median = round_to_WORD(quickmedian(data,ksize_squared));
+	double pixel = amount * (median / norm);
+	pixel += (1.0 - amount)
+			* ((double) image[y][x] / norm);
+	return round_to_WORD(pixel * norm);
+}
+
 /* The function smoothes an image using the median filter with the
  * ksize x ksize aperture. Each channel of a multi-channel image is
- * processed independently. In-place operation is supported. */
-gpointer median_filter(gpointer p) {
-	struct median_filter_data *args = (struct median_filter_data *) p;
-	g_assert(args->ksize % 2 == 1 && args->ksize > 1);
-	int i, x, y, xx, yy, layer, iter = 0;
-	int nx = args->fit->rx;
-	int ny = args->fit->ry;
-	int radius = (args->ksize - 1) / 2;
-	int ksize_squared = args->ksize * args->ksize;
-	double norm = (double) get_normalized_value(args->fit);
+ * processed independently. In-place operation is supported.
+ * The progress bar is updated if show_progress is TRUE. */
+int median_filter_image(fits *fit, int ksize, double amount, int iterations, gboolean show_progress) {
+	g_assert(ksize % 2 == 1 && ksize > 1);
+	int i, x, y, layer, iter = 0;
+	int nx = fit->rx;
+	int ny = fit->ry;
+	int radius = (ksize - 1) / 2;
+	int ksize_squared = ksize * ksize;
+	double norm = (double) get_normalized_value(fit);
 	double cur = 0.0, total;
 	g_assert(nx > 0 && ny > 0);
 
-	struct timeval t_start, t_end;
-
-	char *msg = siril_log_color_message(_("Median Filter: processing...\n"), "red");
-	msg[strlen(msg) - 1] = '\0';
-	set_progress_bar_data(msg, PROGRESS_RESET);
-	gettimeofday(&t_start, NULL);
-
 	WORD *data = calloc(ksize_squared, sizeof(WORD));
 	if (data == NULL) {
 		PRINT_ALLOC_ERR;
-		siril_add_idle(end_median_filter, args);
-		set_progress_bar_data(_("Median filter failed"), PROGRESS_DONE);
-		return GINT_TO_POINTER(1);
+		return 1;
 	}
 
 	do {
-		for (layer = 0; layer < args->fit->naxes[2]; layer++) {
+		for (layer = 0; layer < fit->naxes[2]; layer++) {
 			/* FILL image upside-down */
 			WORD **image = malloc(ny * sizeof(WORD *));
 			if (image == NULL) {
 				PRINT_ALLOC_ERR;
-				siril_add_idle(end_median_filter, args);
 				free(data);
-				return GINT_TO_POINTER(1);
+				return 1;
 			}
 			for (i = 0; i < ny; i++)
-				image[ny - i - 1] = args->fit->pdata[layer] + i * nx;
+				image[ny - i - 1] = fit->pdata[layer] + i * nx;
 
 			for (y = 0; y < ny; y++) {
 				if (!get_thread_run())
 					break;
-				total = ny * args->fit->naxes[2] * args->iterations;
-				if (!(y % 16))	// every 16 iterations
+				total = ny * fit->naxes[2] * iterations;
+				if (show_progress && !(y % 16))	// every 16 iterations
 					set_progress_bar_data(NULL, cur / total);
 				cur++;
-				for (x = 0; x < nx; x++) {
-					i = 0;
-					for (yy = y - radius; yy <= y + radius; yy++) {
-						for (xx = x - radius; xx <= x + radius; xx++) {
-							WORD tmp;
-							if (xx < 0 && yy >= 0) {
-								if (yy >= ny)
-									tmp = image[ny - 1][0];
-								else
-									tmp = image[yy][0];
-							} else if (xx > 0 && yy <= 0) {
-								if (xx >= nx)
-									tmp = image[0][nx - 1];
-								else
-									tmp = image[0][xx];
-							} else if (xx <= 0 && yy <= 0) {
-								tmp = image[0][0];
-							} else {
-								if (xx >= nx && yy >= ny)
-									tmp = image[ny - 1][nx - 1];
-								else if (xx >= nx && yy < ny)
-									tmp = image[yy][nx - 1];
-								else if (xx < nx && yy >= ny)
-									tmp = image[ny - 1][xx];
-								else
-									tmp = image[yy][xx];
-							}
-							data[i++] = tmp;
-						}
-					}
-					WORD median = round_to_WORD(quickmedian(data,ksize_squared));
-					double pixel = args->amount * (median / norm);
-					pixel += (1.0 - args->amount)
-							* ((double) image[y][x] / norm);
-					image[y][x] = round_to_WORD(pixel * norm);
-				}
+				for (x = 0; x < nx; x++)
+					image[y][x] = median_filter_pixel(image, nx, ny, x, y,
+							radius, data, ksize_squared, amount, norm);
 			}
 			free(image);
 		}
 		iter++;
-	} while (iter < args->iterations && get_thread_run());
-	invalidate_stats_from_fit(args->fit);
+	} while (iter < iterations && get_thread_run());
+	invalidate_stats_from_fit(fit);
 	free(data);
+	return 0;
+}
+
+gpointer median_filter(gpointer p) {
+	struct median_filter_data *args = (struct median_filter_data *) p;
+	struct timeval t_start, t_end;
+	int retval;
+
+	char *msg = siril_log_color_message(_("Median Filter: processing...\n"), "red");
+	msg[strlen(msg) - 1] = '\0';
+	set_progress_bar_data(msg, PROGRESS_RESET);
+	gettimeofday(&t_start, NULL);
+
+	retval = median_filter_image(args->fit, args->ksize, args->amount,
+			args->iterations, TRUE);
+
 	gettimeofday(&t_end, NULL);
 	show_time(t_start, t_end);
-	set_progress_bar_data(_("Median filter applied"), PROGRESS_DONE);
+	if (retval)
+		set_progress_bar_data(_("Median filter failed"), PROGRESS_DONE);
+	else set_progress_bar_data(_("Median filter applied"), PROGRESS_DONE);
 	siril_add_idle(end_median_filter, args);
 
-	return GINT_TO_POINTER(0);
+	return GINT_TO_POINTER(retval);
+}
+
+/* Same as median_filter_image() without progress, but the filtered pixels are
+ * written to a separate buffer, so each median is computed from the pixels of
+ * the previous iteration whatever the order in which they are processed. */
+static int median_filter_out_of_place(fits *fit, int ksize, double amount, int iterations) {
+	int i, x, y, layer, iter = 0;
+	int nx = fit->rx;
+	int ny = fit->ry;
+	int radius = (ksize - 1) / 2;
+	int ksize_squared = ksize * ksize;
+	double norm = (double) get_normalized_value(fit);
+
+	WORD *data = calloc(ksize_squared, sizeof(WORD));
+	WORD *out = malloc(nx * ny * sizeof(WORD));
+	WORD **image = malloc(ny * sizeof(WORD *));
+	WORD **result = malloc(ny * sizeof(WORD *));
+	if (data == NULL || out == NULL || image == NULL || result == NULL) {
+		PRINT_ALLOC_ERR;
+		free(data);
+		free(out);
+		free(image);
+		free(result);
+		return 1;
+	}
+
+	do {
+		for (layer = 0; layer < fit->naxes[2]; layer++) {
+			/* FILL image upside-down */
+			for (i = 0; i < ny; i++) {
+				image[ny - i - 1] = fit->pdata[layer] + i * nx;
+				result[ny - i - 1] = out + i * nx;
+			}
+
+			for (y = 0; y < ny; y++) {
+				if (!get_thread_run())
+					break;
+				for (x = 0; x < nx; x++)
+					result[y][x] = median_filter_pixel(image, nx, ny, x, y,
+							radius, data, ksize_squared, amount, norm);
+			}
+			if (y < ny)	// interrupted, the layer is left unchanged
+				break;
+			memcpy(fit->pdata[layer], out, nx * ny * sizeof(WORD));
+		}
+		iter++;
+	} while (iter < iterations && get_thread_run());
+	invalidate_stats_from_fit(fit);
+	free(image);
+	free(result);
+	free(out);
+	free(data);
+	return 0;
+}
+
+/* median filter applied by tiles to a FITS file with process_fits_by_tiles().
+ * Each median being computed from the unfiltered pixels, the halo makes the
+ * result independent of the tiling. */
+static int median_process_tile(struct tile_operation *op, fits *tile, const rectangle *area) {
+	struct median_filter_data *args = (struct median_filter_data *) op->data;
+	return median_filter_out_of_place(tile, args->ksize, args->amount, args->iterations);
+}
+
+struct tile_operation *new_median_tile_operation(int ksize, double amount, int iterations) {
+	struct tile_operation *op = calloc(1, sizeof(struct tile_operation));
+	struct median_filter_data *args = calloc(1, sizeof(struct median_filter_data));
+	if (!op || !args) {
+		PRINT_ALLOC_ERR;
+		free(op);
+		free(args);
+		return NULL;
+	}
+	args->ksize = ksize;
+	args->amount = amount;
+	args->iterations = iterations;
+	op->name = _("Median Filter");
+	op->shape = TILES_SQUARE;
+	op->halo = (ksize - 1) / 2 * iterations;
+	op->bytes_per_pixel = 3.0 * sizeof(WORD);	// the tile, the filtered layer and the buffer to write it
+	op->process = median_process_tile;
+	op->data = args;
+	return op;
 }
@@ -2,6 +2,8 @@
 #define SRC_FILTERS_MEDIAN_H_
 
 #include <glib.h>
+#include "core/siril.h"
+#include "algos/tiling.h"
 
 /* median filter data from GUI */
 struct median_filter_data {
@@ -11,6 +13,8 @@ struct median_filter_data {
 	int iterations;
 };
 
+int median_filter_image(fits *fit, int ksize, double amount, int iterations, gboolean show_progress);
 gpointer median_filter(gpointer p);
+struct tile_operation *new_median_tile_operation(int ksize, double amount, int iterations);
 
 #endif /* SRC_FILTERS_MEDIAN_H_ */
@@ -264,3 +264,65 @@ void on_button_compute_w_clicked(GtkButton *button, gpointer user_data) {
 	set_cursor_waiting(FALSE);
 	return;
 }
+
+/* extraction of a plane of the wavelet transform applied by tiles to a FITS
+ * file with process_fits_by_tiles(), like get_wavelet_layers() */
+struct wavelet_layer_data {
+	int Nbr_Plan, Plan, Type;
+};
+
+static int wavelet_layer_process_tile(struct tile_operation *op, fits *tile, const rectangle *area) {
+	struct wavelet_layer_data *args = (struct wavelet_layer_data *) op->data;
+	int Nl = tile->ry, Nc = tile->rx, chan, i;
+	float *Imag, *Pave;
+
+	/* the size of the tile is not checked like in wavelet_transform_data(),
+	 * the halo giving the pixels the smoothing needs */
+	Imag = f_vector_alloc(Nl * Nc);
+	Pave = f_vector_alloc(Nl * Nc * args->Nbr_Plan);
+	if (!Imag || !Pave) {
+		free(Imag);
+		free(Pave);
+		return 1;
+	}
+
+	for (chan = 0; chan < tile->naxes[2]; chan++) {
+		prepare_rawdata(Imag, Nl, Nc, tile->pdata[chan]);
+		pave_2d_tfo(Imag, Pave, Nl, Nc, args->Nbr_Plan, args->Type);
+		pave_2d_extract_plan(Pave, Imag, Nl, Nc, args->Plan);
+		/* the planes of an image of WORD never exceed USHRT_MAX, so
+		 * reget_rawdata() would not rescale them either */
+		for (i = 0; i < Nl * Nc; i++)
+			tile->pdata[chan][i] = round_to_WORD(Imag[i]);
+	}
+	free(Imag);
+	free(Pave);
+	return 0;
+}
+
+struct tile_operation *new_wavelet_layer_tile_operation(int Nbr_Plan, int Plan, int Type) {
+	struct tile_operation *op = calloc(1, sizeof(struct tile_operation));
+	struct wavelet_layer_data *args = calloc(1, sizeof(struct wavelet_layer_data));
+	int reach;
+	if (!op || !args) {
+		PRINT_ALLOC_ERR;
+		free(op);
+		free(args);
+		return NULL;
+	}
+	args->Nbr_Plan = Nbr_Plan;
+	args->Plan = Plan;
+	args->Type = Type;
+	/* smoothing n of the 'a trous' algorithm reads pixels at 2^n, or 2*2^n
+	 * for the B3-spline, and the transform smoothes Nbr_Plan - 1 times */
+	reach = (1 << (Nbr_Plan - 1)) - 1;
+	op->name = _("Wavelet plane extraction");
+	op->shape = TILES_SQUARE;
+	op->halo = Type == TO_PAVE_BSPLINE ? 2 * reach : reach;
+	/* the tile and the buffer to write it, the image, the planes and the
+	 * smoothed image of the transform */
+	op->bytes_per_pixel = 2.0 * sizeof(WORD) + (Nbr_Plan + 2) * sizeof(float);
+	op->process = wavelet_layer_process_tile;
+	op->data = args;
+	return op;
+}
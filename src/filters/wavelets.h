@@ -1,6 +1,9 @@
 #ifndef SRC_GUI_WAVELETS_H_
 #define SRC_GUI_WAVELETS_H_
 
+#include "algos/tiling.h"
+
 void apply_wavelets_cancel();
+struct tile_operation *new_wavelet_layer_tile_operation(int Nbr_Plan, int Plan, int Type);
 
 #endif /* SRC_GUI_WAVELETS_H_ */
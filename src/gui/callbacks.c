@@ -48,6 +48,7 @@
 #include "io/conversion.h"
 #include "io/films.h"
 #include "io/sequence.h"
+#include "io/seqjournal.h"
 #include "io/ser.h"
 #include "io/single_image.h"
 #include "registration/registration.h"
@@ -787,6 +788,7 @@ void delete_selected_area() {
  */
 
 static void toggle_image_selection(int image_num) {
+	gboolean reference_changed = FALSE;
 	gchar *msg;
 	if (com.seq.imgparam[image_num].incl) {
 		com.seq.imgparam[image_num].incl = FALSE;
@@ -794,6 +796,7 @@ static void toggle_image_selection(int image_num) {
 		msg = g_strdup_printf(_("Image %d has been unselected from sequence\n"), image_num);
 		if (image_num == com.seq.reference_image) {
 			com.seq.reference_image = -1;
+			reference_changed = TRUE;
 			sequence_list_change_reference();
 			adjust_refimage(image_num);
 		}
@@ -808,7 +811,9 @@ static void toggle_image_selection(int image_num) {
 	update_reg_interface(FALSE);
 	update_stack_interface(TRUE);
 	adjust_exclude(image_num, TRUE);
-	writeseqfile(&com.seq);
+	seqjournal_log_inclusion(&com.seq, image_num);
+	if (reference_changed)
+		seqjournal_log_reference(&com.seq);
 }
 
 /* method handling all include or all exclude from a sequence */
@@ -4069,7 +4074,7 @@ void on_ref_frame_toggled(GtkToggleButton *togglebutton, gpointer user_data) {
 		sequence_list_change_reference();
 		update_stack_interface(FALSE);// get stacking info and enable the Go button
 		adjust_sellabel();	// reference image is named in the label
-		writeseqfile(&com.seq);
+		seqjournal_log_reference(&com.seq);
 		drawPlot();		// update plots
 	}
 }
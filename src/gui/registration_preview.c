@@ -22,6 +22,7 @@
 #include "core/proto.h"
 #include "gui/callbacks.h"
 #include "gui/progress_and_log.h"
+#include "io/seqjournal.h"
 #include "registration/registration.h"
 
 mouse_status_enum mouse_status;
@@ -233,7 +234,7 @@ void on_spinbut_shift_value_change(GtkSpinButton *spinbutton, gpointer user_data
 	if (spinbutton == spin_shiftx)
 		com.seq.regparam[current_layer][com.seq.current].shiftx = (float) new_value;
 	else com.seq.regparam[current_layer][com.seq.current].shifty = (float) new_value;
-	writeseqfile(&com.seq);
+	seqjournal_log_regdata(&com.seq, current_layer, com.seq.current);
 	fill_sequence_list(&com.seq, current_layer, FALSE);	// update list with new regparam
 	redraw_previews();
 }
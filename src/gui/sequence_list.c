@@ -23,6 +23,7 @@
 #include "gui/callbacks.h"
 #include "gui/progress_and_log.h"
 #include "io/sequence.h"
+#include "io/seqjournal.h"
 #include "algos/PSF.h"
 #include "registration/registration.h"	// for update_reg_interface
 #include "stacking/stacking.h"	// for update_stack_interface
@@ -208,7 +209,7 @@ void on_seqlist_image_selection_toggled(GtkCellRendererToggle *cell_renderer,
 	adjust_exclude(index, TRUE);	// check or uncheck excluded checkbox in seq tab
 	update_reg_interface(FALSE);
 	update_stack_interface(FALSE);
-	writeseqfile(&com.seq);
+	seqjournal_log_inclusion(&com.seq, index);
 	redraw(com.cvport, REMAP_NONE);
 }
 
@@ -0,0 +1,644 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * WARNING: the files written by this code are in the native byte order.
+ */
+
+/* Layout of a chunked sequence file:
+ *  - the magic string, CHUNKED_MAGIC_LEN bytes
+ *  - the header, CHUNKED_HEADER_INTS ints: version, width, height, number of
+ *    layers, rows of a band, compression, number of frames and a reserved int
+ *  - the offset of the index, a 64-bit integer
+ *  - the bands of the frames, layer after layer, in the order of the rows in
+ *    memory (bottom-up)
+ *  - the index: for each frame, its exposure and date, the offsets of its
+ *    bands in the file and their stored size.
+ * A band whose stored size is the size of its pixels is not compressed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_PREAD
+#include <unistd.h>
+#endif
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "gui/progress_and_log.h"
+#include "io/ser.h"		// fseek64
+#include "io/chunked.h"
+
+#define CHUNKED_MAGIC "SIRILCSQ"
+#define CHUNKED_MAGIC_LEN 8
+#define CHUNKED_VERSION 1
+#define CHUNKED_HEADER_INTS 8
+#define CHUNKED_DATA_OFFSET (CHUNKED_MAGIC_LEN + CHUNKED_HEADER_INTS * sizeof(int) + sizeof(gint64))
+
+static int nb_chunks(struct chunked_struct *cfile) {
+	return cfile->nb_layers * cfile->nb_bands;
+}
+
+/* number of rows of the band */
+static int band_rows(struct chunked_struct *cfile, int band) {
+	int rows = cfile->height - band * cfile->chunk_rows;
+	return rows < cfile->chunk_rows ? rows : cfile->chunk_rows;
+}
+
+static int chunked_alloc_frames(struct chunked_struct *cfile, int nb_frames) {
+	int i, n = nb_chunks(cfile);
+	struct chunked_frame *frames;
+	gint64 *offsets;
+	guint32 *sizes;
+
+	if (nb_frames <= cfile->frames_alloc)
+		return 0;
+	frames = realloc(cfile->frames, nb_frames * sizeof(struct chunked_frame));
+	if (!frames) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+	cfile->frames = frames;
+	offsets = realloc(cfile->chunk_offset, (size_t)nb_frames * n * sizeof(gint64));
+	if (!offsets) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+	cfile->chunk_offset = offsets;
+	sizes = realloc(cfile->chunk_size, (size_t)nb_frames * n * sizeof(guint32));
+	if (!sizes) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+	cfile->chunk_size = sizes;
+
+	memset(cfile->frames + cfile->frames_alloc, 0,
+			(nb_frames - cfile->frames_alloc) * sizeof(struct chunked_frame));
+	for (i = cfile->frames_alloc * n; i < nb_frames * n; i++) {
+		cfile->chunk_offset[i] = -1;
+		cfile->chunk_size[i] = 0;
+	}
+	cfile->frames_alloc = nb_frames;
+	return 0;
+}
+
+/* reads size bytes at offset. With pread(2), threads read in parallel,
+ * without it, reads are serialized with the lock, as in SER. */
+static int chunked_read_at(struct chunked_struct *cfile, void *buffer,
+		size_t size, gint64 offset) {
+#ifdef HAVE_PREAD
+	size_t done = 0;
+	while (done < size) {
+		ssize_t ret = pread(cfile->fd, (char *)buffer + done, size - done,
+				(off_t)(offset + done));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pread in chunked sequence");
+			return -1;
+		}
+		if (ret == 0)	// truncated file
+			return -1;
+		done += ret;
+	}
+	return 0;
+#else
+	int retval = 0;
+	g_mutex_lock(&cfile->lock);
+	if ((int64_t)-1 == fseek64(cfile->file, offset, SEEK_SET)) {
+		perror("fseek in chunked sequence");
+		retval = -1;
+	} else if (fread(buffer, 1, size, cfile->file) != size)
+		retval = -1;
+	g_mutex_unlock(&cfile->lock);
+	return retval;
+#endif
+}
+
+/* The bytes of 16-bit pixels are stored by significance, low bytes of the
+ * band then high bytes, which makes long runs of similar bytes for the
+ * deflate: the high bytes of a sky background barely change. */
+static void shuffle_band(const WORD *in, guchar *out, size_t n) {
+	size_t i;
+	for (i = 0; i < n; i++) {
+		out[i] = in[i] & 0xff;
+		out[n + i] = in[i] >> 8;
+	}
+}
+
+static void unshuffle_band(const guchar *in, WORD *out, size_t n) {
+	size_t i;
+	for (i = 0; i < n; i++)
+		out[i] = in[i] | (in[n + i] << 8);
+}
+
+/* converts the whole input in one call, returns the size of the output or 0
+ * if it does not fit in out_size bytes */
+static gsize convert_all(GConverter *conv, const void *in, gsize in_size,
+		void *out, gsize out_size) {
+	gsize read = 0, written = 0, total_read = 0, total_written = 0;
+	GConverterResult res;
+	GError *error = NULL;
+
+	g_converter_reset(conv);
+	do {
+		res = g_converter_convert(conv, (const char *)in + total_read,
+				in_size - total_read, (char *)out + total_written,
+				out_size - total_written, G_CONVERTER_INPUT_AT_END,
+				&read, &written, &error);
+		if (res == G_CONVERTER_ERROR) {
+			// no space left is how a band that does not compress ends
+			g_clear_error(&error);
+			return 0;
+		}
+		if (!read && !written)
+			return 0;
+		total_read += read;
+		total_written += written;
+	} while (res != G_CONVERTER_FINISHED && total_written < out_size);
+	return res == G_CONVERTER_FINISHED ? total_written : 0;
+}
+
+static int chunked_write_header(struct chunked_struct *cfile, gint64 index_offset) {
+	int header[CHUNKED_HEADER_INTS] = { CHUNKED_VERSION, cfile->width,
+		cfile->height, cfile->nb_layers, cfile->chunk_rows,
+		cfile->compression, cfile->frame_count, 0 };
+
+	if ((int64_t)-1 == fseek64(cfile->file, 0, SEEK_SET) ||
+			fwrite(CHUNKED_MAGIC, 1, CHUNKED_MAGIC_LEN, cfile->file) != CHUNKED_MAGIC_LEN ||
+			fwrite(header, sizeof(int), CHUNKED_HEADER_INTS, cfile->file) != CHUNKED_HEADER_INTS ||
+			fwrite(&index_offset, sizeof(gint64), 1, cfile->file) != 1) {
+		perror("write chunked sequence header");
+		return -1;
+	}
+	return 0;
+}
+
+static int chunked_read_header(struct chunked_struct *cfile) {
+	char magic[CHUNKED_MAGIC_LEN];
+	int header[CHUNKED_HEADER_INTS], i, n;
+	gint64 index_offset;
+
+	if (fread(magic, 1, CHUNKED_MAGIC_LEN, cfile->file) != CHUNKED_MAGIC_LEN ||
+			memcmp(magic, CHUNKED_MAGIC, CHUNKED_MAGIC_LEN) ||
+			fread(header, sizeof(int), CHUNKED_HEADER_INTS, cfile->file) != CHUNKED_HEADER_INTS ||
+			fread(&index_offset, sizeof(gint64), 1, cfile->file) != 1) {
+		siril_log_message(_("%s is not a chunked sequence file\n"), cfile->filename);
+		return -1;
+	}
+	if (header[0] != CHUNKED_VERSION || header[1] <= 0 || header[2] <= 0 ||
+			(header[3] != 1 && header[3] != 3) || header[4] <= 0 ||
+			header[5] < CHUNKED_RAW || header[5] > CHUNKED_DEFLATE ||
+			header[6] <= 0 || index_offset < (gint64)CHUNKED_DATA_OFFSET) {
+		siril_log_message(_("Unsupported or damaged chunked sequence file %s\n"),
+				cfile->filename);
+		return -1;
+	}
+	cfile->width = header[1];
+	cfile->height = header[2];
+	cfile->nb_layers = header[3];
+	cfile->chunk_rows = header[4];
+	cfile->nb_bands = (cfile->height + cfile->chunk_rows - 1) / cfile->chunk_rows;
+	cfile->compression = header[5];
+	cfile->end_offset = index_offset;
+	if (chunked_alloc_frames(cfile, header[6]))
+		return -1;
+	cfile->frame_count = header[6];
+
+	n = nb_chunks(cfile);
+	if ((int64_t)-1 == fseek64(cfile->file, index_offset, SEEK_SET))
+		return -1;
+	for (i = 0; i < cfile->frame_count; i++) {
+		struct chunked_frame *frame = cfile->frames + i;
+		if (fread(&frame->exposure, sizeof(double), 1, cfile->file) != 1 ||
+				fread(frame->date_obs, 1, FLEN_VALUE, cfile->file) != FLEN_VALUE ||
+				fread(cfile->chunk_offset + (size_t)i * n, sizeof(gint64), n, cfile->file) != n ||
+				fread(cfile->chunk_size + (size_t)i * n, sizeof(guint32), n, cfile->file) != n) {
+			siril_log_message(_("The index of the chunked sequence file %s is truncated\n"),
+					cfile->filename);
+			return -1;
+		}
+		frame->date_obs[FLEN_VALUE - 1] = '\0';
+	}
+	return 0;
+}
+
+static int chunked_write_index(struct chunked_struct *cfile) {
+	int i, n = nb_chunks(cfile);
+
+	if ((int64_t)-1 == fseek64(cfile->file, cfile->end_offset, SEEK_SET))
+		return -1;
+	for (i = 0; i < cfile->frame_count; i++) {
+		struct chunked_frame *frame = cfile->frames + i;
+		if (fwrite(&frame->exposure, sizeof(double), 1, cfile->file) != 1 ||
+				fwrite(frame->date_obs, 1, FLEN_VALUE, cfile->file) != FLEN_VALUE ||
+				fwrite(cfile->chunk_offset + (size_t)i * n, sizeof(gint64), n, cfile->file) != n ||
+				fwrite(cfile->chunk_size + (size_t)i * n, sizeof(guint32), n, cfile->file) != n) {
+			perror("write chunked sequence index");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int chunked_open_file(const char *filename, struct chunked_struct *cfile) {
+	if (cfile->file) {
+		fprintf(stderr, "chunked sequence: file already opened, or badly closed\n");
+		return -1;
+	}
+	memset(cfile, 0, sizeof(struct chunked_struct));
+	cfile->file = g_fopen(filename, "rb");
+	if (cfile->file == NULL) {
+		perror("chunked sequence file open");
+		return -1;
+	}
+	cfile->filename = strdup(filename);
+	g_mutex_init(&cfile->lock);
+	if (chunked_read_header(cfile)) {
+		chunked_close_file(cfile);
+		return -1;
+	}
+	cfile->fd = fileno(cfile->file);
+	return 0;
+}
+
+int chunked_close_file(struct chunked_struct *cfile) {
+	int retval = 0;
+	if (!cfile)
+		return -1;
+	if (cfile->file)
+		retval = fclose(cfile->file);
+	free(cfile->filename);
+	free(cfile->frames);
+	free(cfile->chunk_offset);
+	free(cfile->chunk_size);
+	g_mutex_clear(&cfile->lock);
+	memset(cfile, 0, sizeof(struct chunked_struct));
+	cfile->fd = -1;
+	return retval;
+}
+
+int chunked_create_file(const char *filename, struct chunked_struct *cfile,
+		chunked_compression compression) {
+	memset(cfile, 0, sizeof(struct chunked_struct));
+	g_unlink(filename);
+	if ((cfile->file = g_fopen(filename, "w+b")) == NULL) {
+		perror("open chunked sequence file for creation");
+		return 1;
+	}
+	cfile->filename = strdup(filename);
+	cfile->fd = -1;
+	cfile->chunk_rows = CHUNKED_ROWS;
+	cfile->compression = compression;
+	cfile->end_offset = CHUNKED_DATA_OFFSET;
+	g_mutex_init(&cfile->lock);
+	siril_log_message(_("Created chunked sequence file %s\n"), filename);
+	return 0;
+}
+
+/* Compresses and appends the frame to the file. Frames can be written by
+ * several threads at the same time and in any order, the bands are
+ * compressed outside the lock. */
+int chunked_write_frame_from_fit(struct chunked_struct *cfile, fits *fit, int frame_no) {
+	int layer, band, r, i, n, retval = 0;
+	size_t max_band = 0;
+	guchar *shuffled = NULL, *packed = NULL;
+	WORD *rows = NULL;
+	GConverter *conv = NULL;
+	gint64 *offsets = NULL;
+	guint32 *sizes = NULL;
+	guchar **stored = NULL;
+
+	if (!cfile || !cfile->file || !fit || fit->type != DATA_USHORT || frame_no < 0)
+		return -1;
+
+	g_mutex_lock(&cfile->lock);
+	if (cfile->nb_layers == 0) {
+		// first frame, it gives the size of the frames
+		cfile->width = fit->rx;
+		cfile->height = fit->ry;
+		cfile->nb_layers = fit->naxes[2];
+		cfile->nb_bands = (cfile->height + cfile->chunk_rows - 1) / cfile->chunk_rows;
+	}
+	g_mutex_unlock(&cfile->lock);
+	if (fit->rx != cfile->width || fit->ry != cfile->height ||
+			fit->naxes[2] != cfile->nb_layers) {
+		siril_log_message(_("Trying to add an image of different size in a chunked sequence\n"));
+		return 1;
+	}
+
+	n = nb_chunks(cfile);
+	max_band = (size_t)cfile->width * cfile->chunk_rows;
+	rows = malloc(max_band * sizeof(WORD));
+	shuffled = malloc(max_band * sizeof(WORD));
+	stored = calloc(n, sizeof(guchar *));
+	offsets = malloc(n * sizeof(gint64));
+	sizes = malloc(n * sizeof(guint32));
+	if (!rows || !shuffled || !stored || !offsets || !sizes) {
+		PRINT_ALLOC_ERR;
+		retval = -1;
+		goto free_and_quit;
+	}
+	if (cfile->compression == CHUNKED_DEFLATE)
+		conv = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+
+	for (layer = 0, i = 0; layer < cfile->nb_layers; layer++) {
+		for (band = 0; band < cfile->nb_bands; band++, i++) {
+			int nb_rows = band_rows(cfile, band);
+			size_t band_size = (size_t)cfile->width * nb_rows * sizeof(WORD);
+			gsize packed_size = 0;
+
+			for (r = 0; r < nb_rows; r++) {
+				int y = band * cfile->chunk_rows + r;
+				if (fit->top_down)
+					y = cfile->height - 1 - y;
+				memcpy(rows + (size_t)r * cfile->width,
+						fit->pdata[layer] + (size_t)y * cfile->width,
+						cfile->width * sizeof(WORD));
+			}
+
+			packed = malloc(band_size);
+			if (!packed) {
+				PRINT_ALLOC_ERR;
+				retval = -1;
+				goto free_and_quit;
+			}
+			if (conv) {
+				shuffle_band(rows, shuffled, band_size / sizeof(WORD));
+				packed_size = convert_all(conv, shuffled, band_size, packed, band_size - 1);
+			}
+			if (packed_size == 0) {
+				// not compressed, or did not compress
+				memcpy(packed, rows, band_size);
+				packed_size = band_size;
+			}
+			stored[i] = packed;
+			sizes[i] = packed_size;
+			packed = NULL;
+		}
+	}
+
+	g_mutex_lock(&cfile->lock);
+	if ((int64_t)-1 == fseek64(cfile->file, cfile->end_offset, SEEK_SET)) {
+		perror("seek");
+		retval = -1;
+	}
+	for (i = 0; i < n && !retval; i++) {
+		if (fwrite(stored[i], 1, sizes[i], cfile->file) != sizes[i]) {
+			perror("write image in chunked sequence");
+			retval = 1;
+			break;
+		}
+		offsets[i] = cfile->end_offset;
+		cfile->end_offset += sizes[i];
+	}
+	if (!retval && !chunked_alloc_frames(cfile, frame_no + 1)) {
+		struct chunked_frame *frame = cfile->frames + frame_no;
+		frame->exposure = fit->exposure;
+		g_strlcpy(frame->date_obs, fit->date_obs, FLEN_VALUE);
+		memcpy(cfile->chunk_offset + (size_t)frame_no * n, offsets, n * sizeof(gint64));
+		memcpy(cfile->chunk_size + (size_t)frame_no * n, sizes, n * sizeof(guint32));
+		cfile->frame_count++;
+	} else if (!retval)
+		retval = -1;
+	g_mutex_unlock(&cfile->lock);
+
+free_and_quit:
+	if (conv)
+		g_object_unref(conv);
+	if (stored) {
+		for (i = 0; i < n; i++)
+			free(stored[i]);
+		free(stored);
+	}
+	free(packed);
+	free(rows);
+	free(shuffled);
+	free(offsets);
+	free(sizes);
+	return retval;
+}
+
+/* Frames that failed to be processed leave holes in the index, they are
+ * removed here, so the frames are numbered contiguously, as in a SER. */
+int chunked_write_and_close(struct chunked_struct *cfile) {
+	int i, j, n;
+	if (!cfile)
+		return -1;
+	n = nb_chunks(cfile);
+	for (i = 0, j = 0; i < cfile->frames_alloc; i++) {
+		if (cfile->chunk_offset[(size_t)i * n] < 0)
+			continue;
+		if (i != j) {
+			cfile->frames[j] = cfile->frames[i];
+			memcpy(cfile->chunk_offset + (size_t)j * n,
+					cfile->chunk_offset + (size_t)i * n, n * sizeof(gint64));
+			memcpy(cfile->chunk_size + (size_t)j * n,
+					cfile->chunk_size + (size_t)i * n, n * sizeof(guint32));
+		}
+		j++;
+	}
+	cfile->frame_count = j;
+
+	if (!cfile->frame_count) {
+		siril_log_color_message(_("The chunked sequence is being created with no image in it.\n"), "red");
+		char *filename = strdup(cfile->filename);
+		chunked_close_file(cfile);
+		g_unlink(filename);
+		free(filename);
+		return -1;
+	}
+	if (chunked_write_index(cfile) || chunked_write_header(cfile, cfile->end_offset)) {
+		chunked_close_file(cfile);
+		return -1;
+	}
+	return chunked_close_file(cfile);
+}
+
+/* reads and decompresses the band of a layer of a frame in out */
+static int chunked_read_band(struct chunked_struct *cfile, GConverter **conv,
+		int frame_no, int layer, int band, WORD *out, guchar *tmp) {
+	size_t idx = (size_t)frame_no * nb_chunks(cfile) + layer * cfile->nb_bands + band;
+	size_t band_size = (size_t)cfile->width * band_rows(cfile, band) * sizeof(WORD);
+	guint32 size = cfile->chunk_size[idx];
+
+	if (cfile->chunk_offset[idx] < 0)
+		return -1;
+	if (size == band_size)
+		return chunked_read_at(cfile, out, band_size, cfile->chunk_offset[idx]);
+	if (size > band_size)
+		return -1;
+
+	guchar *packed = malloc(size);
+	if (!packed) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+	if (chunked_read_at(cfile, packed, size, cfile->chunk_offset[idx])) {
+		free(packed);
+		return -1;
+	}
+	if (!*conv)
+		*conv = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+	if (convert_all(*conv, packed, size, tmp, band_size) != band_size) {
+		siril_log_message(_("Damaged data in frame %d of the chunked sequence\n"), frame_no);
+		free(packed);
+		return -1;
+	}
+	free(packed);
+	unshuffle_band(tmp, out, band_size / sizeof(WORD));
+	return 0;
+}
+
+int chunked_read_frame(struct chunked_struct *cfile, int frame_no, fits *fit) {
+	int layer, band, retval = 0;
+	size_t npixels;
+	WORD *olddata;
+	guchar *tmp;
+	GConverter *conv = NULL;
+
+	if (!cfile || !cfile->file || !fit || frame_no < 0 || frame_no >= cfile->frame_count)
+		return -1;
+
+	npixels = (size_t)cfile->width * cfile->height;
+	if (fit->mapped_base)	// data cannot be reallocated
+		clearfits(fit);
+	olddata = fit->data;
+	if ((fit->data = realloc(fit->data, npixels * cfile->nb_layers * sizeof(WORD))) == NULL) {
+		PRINT_ALLOC_ERR;
+		if (olddata)
+			free(olddata);
+		return -1;
+	}
+	tmp = malloc((size_t)cfile->width * cfile->chunk_rows * sizeof(WORD));
+	if (!tmp) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+
+	for (layer = 0; layer < cfile->nb_layers && !retval; layer++) {
+		WORD *data = fit->data + layer * npixels;
+		for (band = 0; band < cfile->nb_bands && !retval; band++)
+			retval = chunked_read_band(cfile, &conv, frame_no, layer, band,
+					data + (size_t)band * cfile->chunk_rows * cfile->width, tmp);
+	}
+	free(tmp);
+	if (conv)
+		g_object_unref(conv);
+	if (retval)
+		return -1;
+
+	fit->bitpix = USHORT_IMG;
+	fit->orig_bitpix = fit->bitpix;
+	fit->type = DATA_USHORT;
+	fit->naxis = cfile->nb_layers == 3 ? 3 : 2;
+	fit->naxes[0] = fit->rx = cfile->width;
+	fit->naxes[1] = fit->ry = cfile->height;
+	fit->naxes[2] = cfile->nb_layers;
+	fit->pdata[RLAYER] = fit->data;
+	if (cfile->nb_layers == 3) {
+		fit->pdata[GLAYER] = fit->data + npixels;
+		fit->pdata[BLAYER] = fit->data + npixels * 2;
+	} else {
+		fit->pdata[GLAYER] = fit->data;
+		fit->pdata[BLAYER] = fit->data;
+	}
+	fit->top_down = FALSE;
+	fit->exposure = cfile->frames[frame_no].exposure;
+	g_strlcpy(fit->date_obs, cfile->frames[frame_no].date_obs, FLEN_VALUE);
+	return 0;
+}
+
+/* Reads an area of a layer of a frame in buffer, top-down as in SER: the y of
+ * the area is counted from the top of the image. Only the bands containing
+ * the area are read. */
+int chunked_read_opened_partial(struct chunked_struct *cfile, int layer,
+		int frame_no, WORD *buffer, const rectangle *area) {
+	int band, first, last, t, retval = 0;
+	WORD *rows;
+	guchar *tmp;
+	GConverter *conv = NULL;
+
+	if (!cfile || !cfile->file || frame_no < 0 || frame_no >= cfile->frame_count ||
+			layer < 0 || layer >= cfile->nb_layers || area->x < 0 || area->y < 0 ||
+			area->x + area->w > cfile->width || area->y + area->h > cfile->height)
+		return -1;
+
+	/* rows of the area in memory order */
+	first = cfile->height - area->y - area->h;
+	last = cfile->height - 1 - area->y;
+
+	rows = malloc((size_t)cfile->width * cfile->chunk_rows * sizeof(WORD));
+	tmp = malloc((size_t)cfile->width * cfile->chunk_rows * sizeof(WORD));
+	if (!rows || !tmp) {
+		PRINT_ALLOC_ERR;
+		free(rows);
+		free(tmp);
+		return -1;
+	}
+
+	for (band = first / cfile->chunk_rows; band <= last / cfile->chunk_rows; band++) {
+		int band_first = band * cfile->chunk_rows;
+		int from = MAX(first, band_first);
+		int to = MIN(last, band_first + band_rows(cfile, band) - 1);
+		int m;
+
+		if ((retval = chunked_read_band(cfile, &conv, frame_no, layer, band, rows, tmp)))
+			break;
+		for (m = from; m <= to; m++) {
+			t = cfile->height - 1 - m - area->y;	// row in the area
+			memcpy(buffer + (size_t)t * area->w,
+					rows + (size_t)(m - band_first) * cfile->width + area->x,
+					area->w * sizeof(WORD));
+		}
+	}
+	free(rows);
+	free(tmp);
+	if (conv)
+		g_object_unref(conv);
+	return retval;
+}
+
+int chunked_read_opened_partial_fits(struct chunked_struct *cfile, int layer,
+		int frame_no, fits *fit, const rectangle *area) {
+	if (new_fit_image(&fit, area->w, area->h, 1))
+		return -1;
+	fit->top_down = TRUE;
+	if (frame_no >= 0 && frame_no < cfile->frame_count) {
+		fit->exposure = cfile->frames[frame_no].exposure;
+		g_strlcpy(fit->date_obs, cfile->frames[frame_no].date_obs, FLEN_VALUE);
+	}
+	return chunked_read_opened_partial(cfile, layer, frame_no, fit->pdata[0], area);
+}
+
+/* estimated size of a sequence of nb_frames frames like those of the file */
+int64_t chunked_compute_file_size(struct chunked_struct *cfile, int nb_frames) {
+	int64_t data = cfile->end_offset - CHUNKED_DATA_OFFSET;
+	if (cfile->frame_count > 0 && nb_frames != cfile->frame_count)
+		data = data / cfile->frame_count * nb_frames;
+	return CHUNKED_DATA_OFFSET + data;
+}
@@ -0,0 +1,65 @@
+#ifndef _CHUNKED_H_
+#define _CHUNKED_H_
+
+#include <stdio.h>
+#include <glib.h>
+#include "core/siril.h"
+
+/* Siril's chunked sequence file (.csq): all the frames of a sequence in a
+ * single file, like SER, but with each layer of a frame stored as bands of
+ * CHUNKED_ROWS rows compressed independently. Areas of the frames can be read
+ * by decompressing the bands they cross only. An index at the end of the file
+ * gives the position of the bands of each frame and its metadata.
+ *
+ * WARNING: the file is written in the native byte order and is not portable
+ * between little and big endian systems.
+ */
+
+#define CHUNKED_ROWS 32
+
+typedef enum {
+	CHUNKED_RAW,		// bands stored as they are in memory
+	CHUNKED_DEFLATE		// bytes of the pixels shuffled by significance and deflated
+} chunked_compression;
+
+/* metadata of a frame */
+struct chunked_frame {
+	double exposure;
+	char date_obs[FLEN_VALUE];
+};
+
+struct chunked_struct {
+	char *filename;
+	FILE *file;		// for writing, and for reading without pread
+	int fd;			// for positional reads, -1 if not used
+
+	int width, height, nb_layers;	// set by the first frame written
+	int chunk_rows;		// number of rows of a band
+	int nb_bands;		// number of bands of a layer
+	chunked_compression compression;
+	int frame_count;
+
+	struct chunked_frame *frames;
+	gint64 *chunk_offset;	// nb_layers * nb_bands for each frame, -1 if not written
+	guint32 *chunk_size;	// stored size, the size of the band if not compressed
+	int frames_alloc;	// size of the arrays, in frames
+
+	gint64 end_offset;	// end of the frame data, where the index is written
+	GMutex lock;
+};
+
+int chunked_open_file(const char *filename, struct chunked_struct *cfile);
+int chunked_close_file(struct chunked_struct *cfile);
+int chunked_create_file(const char *filename, struct chunked_struct *cfile,
+		chunked_compression compression);
+int chunked_write_frame_from_fit(struct chunked_struct *cfile, fits *fit, int frame_no);
+int chunked_write_and_close(struct chunked_struct *cfile);
+
+int chunked_read_frame(struct chunked_struct *cfile, int frame_no, fits *fit);
+int chunked_read_opened_partial(struct chunked_struct *cfile, int layer,
+		int frame_no, WORD *buffer, const rectangle *area);
+int chunked_read_opened_partial_fits(struct chunked_struct *cfile, int layer,
+		int frame_no, fits *fit, const rectangle *area);
+int64_t chunked_compute_file_size(struct chunked_struct *cfile, int nb_frames);
+
+#endif
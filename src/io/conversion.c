@@ -211,6 +211,11 @@ static void initialize_ser_debayer_settings() {
 	com.debayer.bayer_inter = BAYER_VNG;
 }
 
+static double elapsed_seconds(const struct timeval *t_start, const struct timeval *t_end) {
+	return (double)(t_end->tv_sec - t_start->tv_sec) +
+		(double)(t_end->tv_usec - t_start->tv_usec) / 1000000.0;
+}
+
 static gboolean end_convert_idle(gpointer p) {
 	struct _convert_data *args = (struct _convert_data *) p;
 	struct timeval t_end;
@@ -227,6 +232,12 @@ static gboolean end_convert_idle(gpointer p) {
 	set_progress_bar_data(PROGRESS_TEXT_RESET, PROGRESS_DONE);
 	set_cursor_waiting(FALSE);
 	gettimeofday(&t_end, NULL);
+	if (args->nb_converted > 0) {
+		double elapsed = elapsed_seconds(&args->t_start, &t_end);
+		if (elapsed > 0.0)
+			siril_log_message(_("Conversion: %d files converted, %.2f files per second\n"),
+					args->nb_converted, args->nb_converted / elapsed);
+	}
 	show_time(args->t_start, t_end);
 	stop_processing_thread();
 	g_free(args->destroot);
@@ -629,6 +640,7 @@ static void initialize_convert() {
 	args->command_line = FALSE;
 	args->several_type_of_files = several_type_of_files;
 	args->destroot = g_strdup(destroot);
+	args->nb_threads = com.max_thread;
 	start_in_new_thread(convert_thread_worker, args);
 	return;
 }
@@ -642,6 +654,106 @@ void on_convert_button_clicked(GtkButton *button, gpointer user_data) {
 	initialize_convert();
 }
 
+static gboolean is_single_image_type(image_type imagetype) {
+	return imagetype != TYPEUNDEF && imagetype != TYPEAVI && imagetype != TYPESER;
+}
+
+/* saves a converted image to the destination SER or FITS file(s) */
+static int save_converted_image(struct _convert_data *args, fits *fit,
+		struct ser_struct *ser_file, int *indice) {
+	char dest_filename[128];
+
+	if (convflags & CONVDSTSER) {
+		if (convflags & CONV1X1)
+			keep_first_channel_from_fits(fit);
+		if (ser_write_frame_from_fit(ser_file, fit, args->nb_converted)) {
+			siril_log_message(_("Error while converting to SER (no space left?)\n"));
+			return 1;
+		}
+	} else {
+		g_snprintf(dest_filename, 128, "%s%05d", args->destroot, (*indice)++);
+		if (save_to_target_fits(fit, dest_filename)) {
+			siril_log_message(_("Error while converting to FITS (no space left?)\n"));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Converts the count single images of the list starting at first. Images are
+ * read and demosaiced by a pool of args->nb_threads threads, and saved in the
+ * order of the list, so that files are numbered and appended to a SER as in a
+ * sequential conversion. A thread waits for the previous images to be saved
+ * before saving its own and taking the next one, so no more than one image by
+ * thread is in memory.
+ * Returns 1 if the conversion has to stop. */
+static int convert_single_images(struct _convert_data *args, GList *first,
+		int count, int *indice, struct ser_struct *ser_file) {
+	int i, nb_threads = args->nb_threads, abort = 0;
+	gchar **files;
+	GList *l;
+
+	files = malloc(count * sizeof(gchar *));
+	if (!files) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	for (i = 0, l = first; i < count; i++, l = l->next) {
+		files[i] = (gchar *)l->data;
+		// cfitsio has to be reentrant to read FITS files in parallel
+		if (get_type_for_extension(get_filename_ext(files[i])) == TYPEFITS &&
+				!fits_is_reentrant())
+			nb_threads = 1;
+	}
+	if (nb_threads < 1)
+		nb_threads = 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nb_threads) schedule(dynamic) ordered
+#endif
+	for (i = 0; i < count; i++) {
+		fits *fit = NULL;
+
+		if (!abort && get_thread_run()) {
+			image_type imagetype = get_type_for_extension(get_filename_ext(files[i]));
+			fit = any_to_new_fits(imagetype, files[i], args->compatibility, args->stretch_cfa);
+		}
+#ifdef _OPENMP
+#pragma omp ordered
+#endif
+		{
+			if (!abort && !get_thread_run())
+				abort = 1;
+			if (!abort) {
+				if (fit && save_converted_image(args, fit, ser_file, indice))
+					abort = 1;
+				else {
+					char msg_bar[256];
+					struct timeval t_now;
+					double elapsed;
+					gchar *name = g_path_get_basename(files[i]);
+
+					args->nb_converted++;
+					gettimeofday(&t_now, NULL);
+					elapsed = elapsed_seconds(&args->t_start, &t_now);
+					if (elapsed > 0.0)
+						g_snprintf(msg_bar, 256, _("Converted %s (%.1f files/s)"),
+								name, args->nb_converted / elapsed);
+					else g_snprintf(msg_bar, 256, _("Converted %s"), name);
+					g_free(name);
+					set_progress_bar_data(msg_bar, args->nb_converted / (double)args->total);
+				}
+			}
+		}
+		if (fit) {
+			clearfits(fit);
+			free(fit);
+		}
+	}
+	free(files);
+	return abort;
+}
+
 gpointer convert_thread_worker(gpointer p) {
 	char dest_filename[128], msg_bar[256];
 	int indice;
@@ -823,26 +935,19 @@ gpointer convert_thread_worker(gpointer p) {
 			ser_close_file(&tmp_ser);
 			free(fit);
 		}
-		else {	// single image
-			fits *fit = any_to_new_fits(imagetype, src_filename, args->compatibility, args->stretch_cfa);
-			if (fit) {
-				if (convflags & CONVDSTSER) {
-					if (convflags & CONV1X1)
-						keep_first_channel_from_fits(fit);
-					if (ser_write_frame_from_fit(ser_file, fit, args->nb_converted)) {
-						siril_log_message(_("Error while converting to SER (no space left?)\n"));
-						break;
-					}
-				} else {
-					g_snprintf(dest_filename, 128, "%s%05d", args->destroot, indice++);
-					if (save_to_target_fits(fit, dest_filename)) {
-						siril_log_message(_("Error while converting to FITS (no space left?)\n"));
-						break;
-					}
-				}
-				clearfits(fit);
-				free(fit);
+		else {	// single images, the following ones are converted together
+			GList *last = list;
+			int count = 1;
+			while (last->next && is_single_image_type(get_type_for_extension(
+							get_filename_ext((gchar *)last->next->data)))) {
+				last = last->next;
+				count++;
 			}
+			if (convert_single_images(args, list, count, &indice, ser_file))
+				break;
+			progress += count;
+			list = last;
+			continue;
 		}
 
 		set_progress_bar_data(msg_bar, progress/((double)args->total));
@@ -867,59 +972,66 @@ clean_exit:
 
 int debayer_if_needed(image_type imagetype, fits *fit, gboolean compatibility, gboolean force_debayer, gboolean stretch_cfa) {
 	int retval = 0;
-	sensor_pattern tmp;
+	sensor_pattern pattern;
+	interpolation_method interpolation;
 	/* What the hell?
 	 * Siril's FITS are stored bottom to top, debayering will throw 
 	 * wrong results. So before demosacaing we need to transforme the image
 	 * with fits_flip_top_to_bottom() function */
 	if (imagetype == TYPEFITS && (((convflags & CONVDEBAYER) && !force_debayer) || force_debayer)) {
-		tmp = com.debayer.bayer_pattern;
 		if (fit->naxes[2] != 1) {
 			siril_log_message(_("Cannot perform debayering on image with more than one channel\n"));
 			return retval;
 		}
 		if (!compatibility)
 			fits_flip_top_to_bottom(fit);
-		/* Get Bayer informations from header if available */
-		if (com.debayer.use_bayer_header) {
-			sensor_pattern bayer;
-			bayer = retrieveBayerPattern(fit->bayer_pattern);
-
-			if (bayer <= BAYER_FILTER_MAX) {
-				if (bayer != com.debayer.bayer_pattern) {
-					if (bayer == BAYER_FILTER_NONE) {
-						siril_log_color_message(_("No Bayer pattern found in the header file.\n"), "red");
-					}
-					else {
-						siril_log_color_message(_("Bayer pattern found in header (%s) is different"
-								" from Bayer pattern in settings (%s). Overriding settings.\n"),
-								"red", filter_pattern[bayer], filter_pattern[com.debayer.bayer_pattern]);
-						com.debayer.bayer_pattern = bayer;
+		/* the settings are not modified, images may be demosaiced in
+		 * parallel; only the messages of an image are kept together */
+#ifdef _OPENMP
+#pragma omp critical (debayer_pattern)
+#endif
+		{
+			pattern = com.debayer.bayer_pattern;
+			interpolation = com.debayer.bayer_inter;
+			/* Get Bayer informations from header if available */
+			if (com.debayer.use_bayer_header) {
+				sensor_pattern bayer;
+				bayer = retrieveBayerPattern(fit->bayer_pattern);
+
+				if (bayer <= BAYER_FILTER_MAX) {
+					if (bayer != pattern) {
+						if (bayer == BAYER_FILTER_NONE) {
+							siril_log_color_message(_("No Bayer pattern found in the header file.\n"), "red");
+						}
+						else {
+							siril_log_color_message(_("Bayer pattern found in header (%s) is different"
+									" from Bayer pattern in settings (%s). Overriding settings.\n"),
+									"red", filter_pattern[bayer], filter_pattern[pattern]);
+							pattern = bayer;
+						}
 					}
+				} else { /* FIXME: XTRANS CASE. TESTED FOR ONE FILE */
+					pattern = XTRANS_FILTER;
+					interpolation = XTRANS;
+					siril_log_color_message(_("XTRANS Sensor detected. Using special algorithm.\n"), "red");
 				}
-			} else { /* FIXME: XTRANS CASE. TESTED FOR ONE FILE */
-				com.debayer.bayer_pattern = XTRANS_FILTER;
-				com.debayer.bayer_inter = XTRANS;
-				siril_log_color_message(_("XTRANS Sensor detected. Using special algorithm.\n"), "red");
 			}
-		}
-		if (com.debayer.bayer_pattern >= BAYER_FILTER_MIN
-				&& com.debayer.bayer_pattern <= BAYER_FILTER_MAX) {
-			siril_log_message(_("Filter Pattern: %s\n"), filter_pattern[com.debayer.bayer_pattern]);
-		}
+			if (pattern >= BAYER_FILTER_MIN && pattern <= BAYER_FILTER_MAX) {
+				siril_log_message(_("Filter Pattern: %s\n"), filter_pattern[pattern]);
+			}
 
-		if (stretch_cfa && fit->maximum_pixel_value) {
-			siril_log_message(_("The FITS file is being normalized to 16-bit\n"));
+			if (stretch_cfa && fit->maximum_pixel_value) {
+				siril_log_message(_("The FITS file is being normalized to 16-bit\n"));
+			}
 		}
 
-		if (debayer(fit, com.debayer.bayer_inter, stretch_cfa)) {
+		if (debayer(fit, interpolation, pattern, stretch_cfa)) {
 			siril_log_message(_("Cannot perform debayering\n"));
 			retval = -1;
 		} else {
 			if (!compatibility)
 				fits_flip_top_to_bottom(fit);
 		}
-		com.debayer.bayer_pattern = tmp;
 	}
 	return retval;
 }
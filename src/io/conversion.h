@@ -24,6 +24,7 @@ struct _convert_data {
 	gboolean command_line;
 	gboolean several_type_of_files;
 	gchar *destroot;
+	int nb_threads;		// number of images converted at the same time
 };
 
 extern supported_raw_list supported_raw[];	//supported raw extensions
@@ -19,6 +19,9 @@
  */
 
 /* Management of Siril's internal image format: unsigned 16-bit FITS */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -28,6 +31,15 @@
 #ifdef _WIN32
 #include <windows.h>
 #endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PREAD
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#endif
 
 #include "core/siril.h"
 #include "core/proto.h"
@@ -552,6 +564,44 @@ static int read_fits_with_convert(fits* fit, const char* filename) {
 	return 0;
 }
 
+/* reads the data of a float FITS file in fit->fdata, normalized between 0
+ * and 1 like siril's float data, without conversion to 16 bits */
+static int read_fits_float(fits *fit, const char *filename) {
+	int status = 0, zero = 0;
+	long orig[3] = { 1L, 1L, 1L };
+	size_t i, nbdata = fit->naxes[0] * fit->naxes[1];
+
+	fits_movabs_hdu(fit->fptr, 1, 0, &status); // make sure reading primary HDU
+
+	free(fit->fdata);
+	fit->fdata = malloc(nbdata * fit->naxes[2] * sizeof(float));
+	if (!fit->fdata) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+	fits_read_pix(fit->fptr, TFLOAT, orig, nbdata * fit->naxes[2], &zero,
+			fit->fdata, &zero, &status);
+	if (status) {
+		siril_log_message(_("Fitsio error reading data, file: %s.\n"), filename);
+		report_fits_error(status);
+		free(fit->fdata);
+		fit->fdata = NULL;
+		return -1;
+	}
+	/* same ranges as in convert_data() */
+	if (fit->data_max > 1.0) {
+		float norm = 1.0f / USHRT_MAX;
+		for (i = 0; i < nbdata * fit->naxes[2]; i++)
+			fit->fdata[i] *= norm;
+	}
+	fit->fpdata[RLAYER] = fit->fdata;
+	fit->fpdata[GLAYER] = fit->naxes[2] == 3 ? fit->fdata + nbdata : fit->fdata;
+	fit->fpdata[BLAYER] = fit->naxes[2] == 3 ? fit->fdata + nbdata * 2 : fit->fdata;
+	fit->type = DATA_FLOAT;
+	fit->bitpix = FLOAT_IMG;
+	return 0;
+}
+
 /* This function reads partial data on one layer from the opened FITS and
  * convert it to siril's format (USHORT) */
 static int internal_read_partial_fits(fitsfile *fptr, unsigned int ry,
@@ -676,6 +726,7 @@ static void save_fits_header(fits *fit) {
 	switch (fit->bitpix) {
 	case BYTE_IMG:
 	case SHORT_IMG:
+	case FLOAT_IMG:
 		zero = 0.0;
 		break;
 	default:
@@ -985,9 +1036,17 @@ int readfits(const char *filename, fits *fit, char *realname) {
 		return -1;
 	}
 
+	/* float images are read without conversion if float data is requested */
+	gboolean native_float = fit->type == DATA_FLOAT &&
+		(fit->bitpix == FLOAT_IMG || fit->bitpix == DOUBLE_IMG);
+
 	/* realloc fit->data to the image size */
 	WORD *olddata = fit->data;
-	if ((fit->data = realloc(fit->data, nbdata * fit->naxes[2] * sizeof(WORD)))
+	if (native_float) {
+		free(fit->data);
+		fit->data = NULL;
+	}
+	else if ((fit->data = realloc(fit->data, nbdata * fit->naxes[2] * sizeof(WORD)))
 			== NULL) {
 		PRINT_ALLOC_ERR;
 		status = 0;
@@ -1009,7 +1068,15 @@ int readfits(const char *filename, fits *fit, char *realname) {
 
 	read_fits_header(fit);	// stores useful header data in fit
 
-	retval = read_fits_with_convert(fit, filename);
+	if (native_float) {
+		retval = read_fits_float(fit, filename);
+	} else {
+		gboolean to_float = fit->type == DATA_FLOAT;
+		fit->type = DATA_USHORT;
+		retval = read_fits_with_convert(fit, filename);
+		if (!retval && to_float)
+			retval = fit_convert_to_float(fit);
+	}
 	fit->top_down = FALSE;
 
 	if (!retval) {
@@ -1040,8 +1107,15 @@ int siril_fits_open_diskfile(fitsfile **fptr, const char *filename, int iomode,
 void clearfits(fits *fit) {
 	if (fit == NULL)
 		return;
-	if (fit->data)
+	if (fit->mapped_base) {
+#ifdef HAVE_MMAP
+		munmap(fit->mapped_base, fit->mapped_size);
+#endif
+	}
+	else if (fit->data)
 		free(fit->data);
+	if (fit->fdata)
+		free(fit->fdata);
 	if (fit->header)
 		free(fit->header);
 	if (fit->history)
@@ -1169,6 +1243,119 @@ int readfits_partial(const char *filename, int layer, fits *fit,
 	return 0;
 }
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Siril's own FITS files are uncompressed 16-bit unsigned images: the pixels
+ * of a row are stored at a known offset as big-endian signed values shifted
+ * by 32768. For these files, areas are read directly with positional reads,
+ * which don't need the lock of the cfitsio file and give the rows in the
+ * right order. Other files are read with cfitsio. */
+struct fits_direct_struct {
+	int fd;			// -1 if the file can't be read directly
+	gint64 data_offset;	// offset of the first pixel in the file
+};
+
+/* fd of all the files of a sequence that cannot have a second descriptor */
+#define FITS_DIRECT_DISABLED -2
+
+/* checks if the opened file index of seq can be read directly, and opens it
+ * for that if it can. A direct read needs a second descriptor for the file,
+ * so it is only used if all the files of the sequence can be opened twice:
+ * stacking checks that the system allows one descriptor per file. */
+void open_fits_direct(sequence *seq, int index, const char *filename) {
+#ifdef HAVE_PREAD
+	fitsfile *fptr = seq->fptr[index];
+	LONGLONG headstart, datastart, dataend;
+	long naxes[3] = { 0L, 0L, 1L };
+	int status = 0, bitpix, equivtype, naxis, compressed;
+
+	if (!seq->direct) {
+		int i, nb_allowed_files, fd;
+		seq->direct = malloc(seq->number * sizeof(fits_direct));
+		if (!seq->direct) {
+			PRINT_ALLOC_ERR;
+			return;
+		}
+		fd = allow_to_open_files(2 * seq->number, &nb_allowed_files) ?
+			-1 : FITS_DIRECT_DISABLED;
+		if (fd == FITS_DIRECT_DISABLED)
+			siril_debug_print("Too many files for direct reads of the sequence\n");
+		for (i = 0; i < seq->number; i++)
+			seq->direct[i].fd = fd;
+	}
+	if (seq->direct[index].fd == FITS_DIRECT_DISABLED)
+		return;
+	close_fits_direct(seq, index);
+
+	compressed = fits_is_compressed_image(fptr, &status);
+	fits_get_img_param(fptr, 3, &bitpix, &naxis, naxes, &status);
+	fits_get_img_equivtype(fptr, &equivtype, &status);
+	fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend, &status);
+	if (status || compressed || bitpix != SHORT_IMG || equivtype != USHORT_IMG ||
+			naxes[0] != seq->rx || naxes[1] != seq->ry ||
+			(naxis == 3 ? naxes[2] : 1) != seq->nb_layers ||
+			dataend - datastart < (LONGLONG) seq->rx * seq->ry * seq->nb_layers * 2)
+		return;
+
+	seq->direct[index].fd = g_open(filename, O_RDONLY | O_BINARY, 0);
+	seq->direct[index].data_offset = datastart;
+#endif
+}
+
+void close_fits_direct(sequence *seq, int index) {
+#ifdef HAVE_PREAD
+	if (seq->direct && seq->direct[index].fd >= 0) {
+		close(seq->direct[index].fd);
+		seq->direct[index].fd = -1;
+	}
+#endif
+}
+
+/* reads the area with the direct access of the file, returns -1 if the file
+ * has no direct access */
+static int read_fits_direct(sequence *seq, int layer, int index, WORD *buffer,
+		const rectangle *area) {
+#ifdef HAVE_PREAD
+	fits_direct *direct;
+	int y;
+
+	if (!seq->direct || seq->direct[index].fd < 0)
+		return -1;
+	direct = seq->direct + index;
+
+	for (y = 0; y < area->h; y++) {
+		/* rows are stored bottom-up in the file */
+		int row = seq->ry - 1 - (area->y + y);
+		gint64 offset = direct->data_offset + 2 * (((gint64) layer * seq->ry + row)
+				* seq->rx + area->x);
+		size_t size = area->w * sizeof(WORD), done = 0;
+		WORD *line = buffer + (size_t) y * area->w;
+		int x;
+
+		while (done < size) {
+			ssize_t ret = pread(direct->fd, (char *)line + done, size - done,
+					(off_t)(offset + done));
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				perror("pread in FITS");
+				return 1;
+			}
+			if (ret == 0)	// truncated file
+				return 1;
+			done += ret;
+		}
+		for (x = 0; x < area->w; x++)
+			line[x] = GUINT16_FROM_BE(line[x]) ^ 0x8000;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
 /* read subset of an opened fits file.
  * The rectangle's coordinates x,y start at 0,0 for first pixel in the image.
  * layer and index also start at 0.
@@ -1189,6 +1376,10 @@ int read_opened_fits_partial(sequence *seq, int layer, int index, WORD *buffer,
 		return 1;
 	}
 
+	status = read_fits_direct(seq, layer, index, buffer, area);
+	if (status >= 0)
+		return status;
+
 #ifdef _OPENMP
 	assert(seq->fd_lock);
 	omp_set_lock(&seq->fd_lock[index]);
@@ -1215,6 +1406,209 @@ int read_opened_fits_partial(sequence *seq, int layer, int index, WORD *buffer,
 	return 0;
 }
 
+/* same as read_opened_fits_partial() in float, for sequences of float or
+ * double images. Values are in the range of 16-bit images, images normalized
+ * between 0 and 1 being multiplied by USHRT_MAX, but they are neither rounded
+ * nor clipped. */
+int read_opened_fits_partial_float(sequence *seq, int layer, int index, float *buffer,
+		const rectangle *area) {
+	long fpixel[3], lpixel[3], inc[3] = { 1L, 1L, 1L };
+	size_t i, nbdata;
+	int zero = 0, status = 0;
+	float norm, *swap;
+
+	if (!seq || !seq->fptr || !seq->fptr[index]) {
+		printf("data initialization error in read fits partial\n");
+		return 1;
+	}
+	if (area->x < 0 || area->y < 0 || area->x >= seq->rx || area->y >= seq->ry
+			|| area->w <= 0 || area->h <= 0 || area->x + area->w > seq->rx
+			|| area->y + area->h > seq->ry) {
+		fprintf(stderr, "partial read from FITS file has been requested outside image bounds or with invalid size\n");
+		return 1;
+	}
+
+	fpixel[0] = area->x + 1;
+	fpixel[1] = seq->ry - area->y - area->h + 1;
+	fpixel[2] = layer + 1;
+	lpixel[0] = area->x + area->w;
+	lpixel[1] = seq->ry - area->y;
+	lpixel[2] = layer + 1;
+	nbdata = (size_t) area->w * area->h;
+
+#ifdef _OPENMP
+	assert(seq->fd_lock);
+	omp_set_lock(&seq->fd_lock[index]);
+#endif
+
+	fits_read_subset(seq->fptr[index], TFLOAT, fpixel, lpixel, inc, &zero,
+			buffer, &zero, &status);
+
+#ifdef _OPENMP
+	omp_unset_lock(&seq->fd_lock[index]);
+#endif
+	if (status) {
+		fits_report_error(stderr, status);
+		return 1;
+	}
+
+	norm = seq->data_max > 1.0 ? 1.0f : USHRT_MAX;
+	if (norm != 1.0f)
+		for (i = 0; i < nbdata; i++)
+			buffer[i] *= norm;
+
+	/* reverse the read data, because it's stored upside-down */
+	swap = malloc(area->w * sizeof(float));
+	if (!swap) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	for (i = 0; i < area->h / 2; i++) {
+		memcpy(swap, buffer + i * area->w, area->w * sizeof(float));
+		memcpy(buffer + i * area->w, buffer + (area->h - i - 1) * area->w, area->w * sizeof(float));
+		memcpy(buffer + (area->h - i - 1) * area->w, swap, area->w * sizeof(float));
+	}
+	free(swap);
+
+	return 0;
+}
+
+/* Opens a FITS file to read its image by areas with read_fits_area(), for
+ * images that may not fit in memory. Metadata is stored in fit but no data
+ * is read, the file stays open in fit->fptr until close_fits_for_areas(). */
+int open_fits_for_areas(const char *filename, fits *fit) {
+	int status;
+	char *name = NULL;
+	image_type imagetype;
+	double offset;
+
+	if (stat_file(filename, &imagetype, &name) || imagetype != TYPEFITS) {
+		siril_log_message(_("The file %s is not a FITS file or doesn't exists with FITS extensions.\n"),
+				filename);
+		free(name);
+		return 1;
+	}
+
+	status = 0;
+	siril_fits_open_diskfile(&(fit->fptr), name, READONLY, &status);
+	free(name);
+	if (status) {
+		report_fits_error(status);
+		return status;
+	}
+
+	fits_get_img_param(fit->fptr, 3, &(fit->bitpix), &(fit->naxis), fit->naxes, &status);
+	if (status) {
+		report_fits_error(status);
+		status = 0;
+		fits_close_file(fit->fptr, &status);
+		return 1;
+	}
+
+	/* see readfits() for the bitpix and BZERO story */
+	fits_read_key(fit->fptr, TDOUBLE, "BZERO", &offset, NULL, &status);
+	if (!status) {
+		if (fit->bitpix == SHORT_IMG && offset != 0.0)
+			fit->bitpix = USHORT_IMG;
+		else if (fit->bitpix == LONG_IMG && offset != 0.0)
+			fit->bitpix = ULONG_IMG;
+	} else if (status == KEY_NO_EXIST && fit->bitpix == SHORT_IMG)
+		fit->bitpix = USHORT_IMG;
+	fit->orig_bitpix = fit->bitpix;
+
+	if (fit->naxis == 2 && fit->naxes[2] == 0)
+		fit->naxes[2] = 1;
+	if ((fit->naxis == 3 && fit->naxes[2] != 3) || fit->bitpix == LONGLONG_IMG) {
+		siril_log_message(_("FITS image format not supported by Siril.\n"));
+		status = 0;
+		fits_close_file(fit->fptr, &status);
+		return 1;
+	}
+	fit->rx = fit->naxes[0];
+	fit->ry = fit->naxes[1];
+
+	read_fits_header(fit);
+	return 0;
+}
+
+/* reads an area of a layer of a FITS opened with open_fits_for_areas().
+ * area is in siril's coordinates, with y = 0 at the top of the image, but
+ * the read data is stored bottom-up in dest, like fits->data. */
+int read_fits_area(fits *fit, int layer, const rectangle *area, WORD *dest) {
+	int status = internal_read_partial_fits(fit->fptr, fit->ry, fit->bitpix,
+			dest, fit->data_max > 1.0, layer, area);
+	if (status) {
+		report_fits_error(status);
+		return 1;
+	}
+	return 0;
+}
+
+/* Creates a FITS file for an image with the size and metadata of fit, its
+ * data being written later by areas with write_fits_area(). Only 8-bit and
+ * 16-bit unsigned images are supported, like in savefits(). */
+int create_fits_for_areas(const char *name, fits *fit) {
+	int status;
+	char filename[256];
+
+	if (fit->bitpix != BYTE_IMG && fit->bitpix != USHORT_IMG) {
+		siril_log_message(_("ERROR: trying to save a FITS image "
+				"with an unsupported format (%d).\n"), fit->bitpix);
+		return 1;
+	}
+	if (!ends_with(name, com.ext)) {
+		snprintf(filename, 255, "%s%s", name, com.ext);
+	} else {
+		snprintf(filename, 255, "%s", name);
+	}
+	g_unlink(filename);
+
+	status = 0;
+	if (siril_fits_create_diskfile(&(fit->fptr), filename, &status)) {
+		report_fits_error(status);
+		return 1;
+	}
+	if (fits_create_img(fit->fptr, fit->bitpix, fit->naxis, fit->naxes, &status)) {
+		report_fits_error(status);
+		status = 0;
+		fits_close_file(fit->fptr, &status);
+		return 1;
+	}
+	save_fits_header(fit);
+	return 0;
+}
+
+/* writes an area of a layer of a FITS created with create_fits_for_areas(),
+ * with the same conventions as read_fits_area() */
+int write_fits_area(fits *fit, int layer, const rectangle *area, WORD *src) {
+	long fpixel[3], lpixel[3];
+	int status = 0;
+
+	fpixel[0] = area->x + 1;
+	fpixel[1] = fit->ry - area->y - area->h + 1;
+	fpixel[2] = layer + 1;
+	lpixel[0] = area->x + area->w;
+	lpixel[1] = fit->ry - area->y;
+	lpixel[2] = layer + 1;
+
+	if (fits_write_subset(fit->fptr, TUSHORT, fpixel, lpixel, src, &status)) {
+		report_fits_error(status);
+		return 1;
+	}
+	return 0;
+}
+
+int close_fits_for_areas(fits *fit) {
+	int status = 0;
+	fits_close_file(fit->fptr, &status);
+	fit->fptr = NULL;
+	if (status) {
+		report_fits_error(status);
+		return 1;
+	}
+	return 0;
+}
+
 /* creates, saves and closes the file associated to f, overwriting previous  */
 int savefits(const char *name, fits *f) {
 	int status, i;
@@ -1244,8 +1638,11 @@ int savefits(const char *name, fits *f) {
 		return 1;
 	}
 	status = 0;
+	if (f->type == DATA_FLOAT) {
+		f->bitpix = FLOAT_IMG;
+	}
 	/* some float cases where it is USHORT saved as float */
-	if (f->bitpix != BYTE_IMG && f->data_max > 1.0 && f->data_max <= USHRT_MAX) {
+	else if (f->bitpix != BYTE_IMG && f->data_max > 1.0 && f->data_max <= USHRT_MAX) {
 		f->bitpix = USHORT_IMG;
 	}
 	if (fits_create_img(f->fptr, f->bitpix, f->naxis, f->naxes, &status)) {
@@ -1292,9 +1689,17 @@ int savefits(const char *name, fits *f) {
 			return 1;
 		}
 		break;
+	case FLOAT_IMG:
+		if (f->type == DATA_FLOAT) {
+			if (fits_write_pix(f->fptr, TFLOAT, orig, pixel_count, f->fdata, &status)) {
+				report_fits_error(status);
+				return 1;
+			}
+			break;
+		}
+		/* no break */
 	case LONG_IMG:
 	case LONGLONG_IMG:
-	case FLOAT_IMG:
 	case DOUBLE_IMG:
 	default:
 		siril_log_message(_("ERROR: trying to save a FITS image "
@@ -1324,12 +1729,14 @@ int savefits(const char *name, fits *f) {
  * parameter, oper, indicates with bits what operations will be done:
  *
  * - CP_ALLOC: allocates the to->data pointer to the size of from->data and
- *   sets to->pdata; required if data is not already allocated with the
- *   correct size or at all. No data is copied
+ *   sets to->pdata, or to->fdata and to->fpdata if to->type is DATA_FLOAT;
+ *   required if data is not already allocated with the correct size or at
+ *   all. No data is copied
  * - CP_INIT: initialize to->data with zeros, same size of the image in from,
  *   but no other data is modified. Ignored if not used with CP_ALLOC.
  * - CP_COPYA: copies the actual data, from->data to to->data on all layers,
- *   but no other information from the source. Should not be used with CP_INIT
+ *   but no other information from the source. Should not be used with CP_INIT.
+ *   Float data are copied as float, to must have the type of from
  * - CP_FORMAT: copy all metadata and leaves data to null
  * - CP_EXTRACT: same as CP_FORMAT | CP_COPYA, but only for layer number passed
  *   as argument and sets layer number information to 1, without allocating
@@ -1368,11 +1775,37 @@ int copyfits(fits *from, fits *to, unsigned char oper, int layer) {
 		to->pdata[0] = NULL;
 		to->pdata[1] = NULL;
 		to->pdata[2] = NULL;
+		to->fdata = NULL;
+		to->fpdata[0] = NULL;
+		to->fpdata[1] = NULL;
+		to->fpdata[2] = NULL;
 		to->header = NULL;
 		to->history = NULL;
 	}
 
-	if ((oper & CP_ALLOC)) {
+	if ((oper & CP_ALLOC) && to->type == DATA_FLOAT) {
+		// allocating to->fdata and assigning to->fpdata
+		float *olddata = to->fdata;
+		if (!(to->fdata = realloc(to->fdata, nbdata * depth * sizeof(float)))) {
+			PRINT_ALLOC_ERR;
+			if (olddata)
+				free(olddata);
+			return -1;
+		}
+		to->fpdata[RLAYER] = to->fdata;
+		if (depth == 3) {
+			to->fpdata[GLAYER] = to->fdata + nbdata;
+			to->fpdata[BLAYER] = to->fdata + 2 * nbdata;
+		} else {
+			to->fpdata[GLAYER] = to->fdata;
+			to->fpdata[BLAYER] = to->fdata;
+		}
+
+		if ((oper & CP_INIT)) {
+			// clearing to->fdata allocated above
+			memset(to->fdata, 0, nbdata * depth * sizeof(float));
+		}
+	} else if ((oper & CP_ALLOC)) {
 		// allocating to->data and assigning to->pdata
 		WORD *olddata = to->data;
 		if (!(to->data = realloc(to->data, nbdata * depth * sizeof(WORD)))) {
@@ -1398,7 +1831,9 @@ int copyfits(fits *from, fits *to, unsigned char oper, int layer) {
 
 	if ((oper & CP_COPYA)) {
 		// copying data and stats
-		memcpy(to->data, from->data, nbdata * depth * sizeof(WORD));
+		if (from->type == DATA_FLOAT)
+			memcpy(to->fdata, from->fdata, nbdata * depth * sizeof(float));
+		else memcpy(to->data, from->data, nbdata * depth * sizeof(WORD));
 		if (from->stats) {
 			for (i = 0; i < from->naxes[2]; i++) {
 				if (from->stats[i])
@@ -1422,7 +1857,10 @@ int copyfits(fits *from, fits *to, unsigned char oper, int layer) {
 		if (depth != from->naxes[2]) {
 			to->maxi = -1.0;
 		}
-		memcpy(to->data, from->pdata[layer],
+		if (from->type == DATA_FLOAT)
+			memcpy(to->fdata, from->fpdata[layer],
+					nbdata * to->naxes[2] * sizeof(float));
+		else memcpy(to->data, from->pdata[layer],
 				nbdata * to->naxes[2] * sizeof(WORD));
 		if (from->stats && from->stats[layer])
 			add_stats_to_fit(to, 0, from->stats[layer]);
@@ -1655,6 +2093,74 @@ int new_fit_image(fits **fit, int width, int height, int nblayer) {
 	return 0;
 }
 
+/* converts the 16-bit data of fit to 32-bit float data, normalized between 0
+ * and 1, data being freed */
+int fit_convert_to_float(fits *fit) {
+	size_t i, nbdata = fit->rx * fit->ry;
+	float norm;
+
+	if (fit->type == DATA_FLOAT)
+		return 0;
+	free(fit->fdata);
+	fit->fdata = malloc(nbdata * fit->naxes[2] * sizeof(float));
+	if (!fit->fdata) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	norm = fit->bitpix == BYTE_IMG ? 1.0f / UCHAR_MAX : 1.0f / USHRT_MAX;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(i) schedule(static) if(nbdata > 100000)
+#endif
+	for (i = 0; i < nbdata * fit->naxes[2]; i++)
+		fit->fdata[i] = fit->data[i] * norm;
+
+	if (fit->mapped_base) {
+#ifdef HAVE_MMAP
+		munmap(fit->mapped_base, fit->mapped_size);
+#endif
+		fit->mapped_base = NULL;
+	} else free(fit->data);
+	fit->data = NULL;
+	fit->pdata[RLAYER] = fit->pdata[GLAYER] = fit->pdata[BLAYER] = NULL;
+	fit->fpdata[RLAYER] = fit->fdata;
+	fit->fpdata[GLAYER] = fit->naxes[2] == 3 ? fit->fdata + nbdata : fit->fdata;
+	fit->fpdata[BLAYER] = fit->naxes[2] == 3 ? fit->fdata + nbdata * 2 : fit->fdata;
+	fit->type = DATA_FLOAT;
+	fit->bitpix = FLOAT_IMG;
+	invalidate_stats_from_fit(fit);
+	return 0;
+}
+
+/* converts the float data of fit to 16-bit data, for the functions that only
+ * work with 16-bit data, fdata being freed */
+int fit_convert_to_ushort(fits *fit) {
+	size_t i, nbdata = fit->rx * fit->ry;
+
+	if (fit->type == DATA_USHORT)
+		return 0;
+	fit->data = malloc(nbdata * fit->naxes[2] * sizeof(WORD));
+	if (!fit->data) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(i) schedule(static) if(nbdata > 100000)
+#endif
+	for (i = 0; i < nbdata * fit->naxes[2]; i++)
+		fit->data[i] = round_to_WORD(fit->fdata[i] * USHRT_MAX_DOUBLE);
+
+	free(fit->fdata);
+	fit->fdata = NULL;
+	fit->fpdata[RLAYER] = fit->fpdata[GLAYER] = fit->fpdata[BLAYER] = NULL;
+	fit->pdata[RLAYER] = fit->data;
+	fit->pdata[GLAYER] = fit->naxes[2] == 3 ? fit->data + nbdata : fit->data;
+	fit->pdata[BLAYER] = fit->naxes[2] == 3 ? fit->data + nbdata * 2 : fit->data;
+	fit->type = DATA_USHORT;
+	fit->bitpix = USHORT_IMG;
+	invalidate_stats_from_fit(fit);
+	return 0;
+}
+
 /* In-place conversion to one channel.
  * See copyfits with CP_EXTRACT for the same in a new fits */
 void keep_first_channel_from_fits(fits *fit) {
@@ -0,0 +1,619 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "gui/progress_and_log.h"
+#include "algos/PSF.h"
+#include "algos/star_finder.h"
+#include "io/sequence.h"
+#include "io/ser.h"
+#include "io/chunked.h"
+
+#include "regcache.h"
+
+#define REGCACHE_FILE_MAGIC "SIRILRCC"
+#define REGCACHE_FILE_VERSION 1
+/* size of the blocks read at the beginning, the middle and the end of the
+ * files to compute their hash */
+#define REGCACHE_HASH_BLOCK 65536
+/* number of values saved for each star */
+#define REGCACHE_STAR_VALUES 24
+#define REGCACHE_MAX_VALUES (1 + MAX_STARS * REGCACHE_STAR_VALUES)
+
+/* 64-bit FNV-1a */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* identification of the file of a frame */
+struct regcache_file_key {
+	gint64 size, mtime;
+	guint64 hash;
+};
+
+struct regcache_entry {
+	guint64 key;
+	int nb_values;
+	double *values;
+	struct regcache_entry *next;
+};
+
+struct regcache_frame {
+	struct regcache_file_key file;	// file when the entries were computed
+	gboolean checked;		// file compared with the current one
+	struct regcache_entry *entries;
+};
+
+struct registration_cache {
+	int number;			// copy of seq->number
+	struct regcache_frame *frames;
+	/* a SER file is checked once for all its frames, when the cache is
+	 * opened */
+	struct regcache_file_key container;
+	gboolean container_checked;
+	gboolean modified;
+	int hits;			// results reused since the last save
+	GMutex lock;
+};
+
+static gchar *get_regcache_filename(sequence *seq) {
+	return g_strdup_printf("%s.rcache", seq->seqname);
+}
+
+guint64 regcache_hash(guint64 key, const void *data, size_t size) {
+	const unsigned char *bytes = data;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		key ^= bytes[i];
+		key *= FNV_PRIME;
+	}
+	return key;
+}
+
+/* starts the key of the results of the analysis on layer, the parameters
+ * of the analysis are then added with regcache_hash() */
+guint64 regcache_key(const char *analysis, int layer) {
+	guint64 key = regcache_hash(FNV_OFFSET, analysis, strlen(analysis));
+	return regcache_hash(key, &layer, sizeof(int));
+}
+
+/* The key of a file is its size, its modification time and the hash of its
+ * first, middle and last blocks, which contain the header and change with the
+ * data of the images without reading them all. */
+static int get_file_key(const char *filename, struct regcache_file_key *key) {
+	GStatBuf st;
+	gint64 offsets[3];
+	unsigned char *buf;
+	FILE *f;
+	int i, retval = 0;
+
+	if (g_stat(filename, &st))
+		return 1;
+	key->size = st.st_size;
+	key->mtime = st.st_mtime;
+	key->hash = FNV_OFFSET;
+
+	f = g_fopen(filename, "rb");
+	if (!f)
+		return 1;
+	buf = malloc(REGCACHE_HASH_BLOCK);
+	if (!buf) {
+		PRINT_ALLOC_ERR;
+		fclose(f);
+		return 1;
+	}
+	offsets[0] = 0;
+	offsets[1] = (key->size - REGCACHE_HASH_BLOCK) / 2;
+	offsets[2] = key->size - REGCACHE_HASH_BLOCK;
+	for (i = 0; i < 3; i++) {
+		size_t n;
+		if (i > 0 && offsets[i] <= offsets[i - 1])
+			continue;	// small file, already hashed
+		if (fseek64(f, offsets[i], SEEK_SET)) {
+			retval = 1;
+			break;
+		}
+		n = fread(buf, 1, REGCACHE_HASH_BLOCK, f);
+		key->hash = regcache_hash(key->hash, buf, n);
+	}
+	free(buf);
+	fclose(f);
+	return retval;
+}
+
+static gboolean same_file_key(const struct regcache_file_key *a, const struct regcache_file_key *b) {
+	return a->size == b->size && a->mtime == b->mtime && a->hash == b->hash;
+}
+
+static int get_frame_file_key(sequence *seq, int frame, struct regcache_file_key *key) {
+	regcache *cache = seq->cache;
+	char filename[256];
+
+	switch (seq->type) {
+	case SEQ_REGULAR:
+		if (!fit_sequence_get_image_filename(seq, frame, filename, TRUE))
+			return 1;
+		return get_file_key(filename, key);
+	case SEQ_SER:
+	case SEQ_CHUNKED:
+		if (!cache->container_checked)
+			return 1;
+		*key = cache->container;
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+static void free_entries(struct regcache_entry *entry) {
+	while (entry) {
+		struct regcache_entry *next = entry->next;
+		free(entry->values);
+		free(entry);
+		entry = next;
+	}
+}
+
+void free_regcache(regcache *cache) {
+	int i;
+	if (!cache)
+		return;
+	if (cache->frames) {
+		for (i = 0; i < cache->number; i++)
+			free_entries(cache->frames[i].entries);
+		free(cache->frames);
+	}
+	g_mutex_clear(&cache->lock);
+	free(cache);
+}
+
+/* The file contains the header (magic, version, number of frames of the
+ * sequence and of frames with results), then for each of these frames its
+ * index, the key of its file and its results. It is written in the byte order
+ * of the computer. */
+static int read_regcache_file(regcache *cache, FILE *f) {
+	char magic[8];
+	int header[3], i;
+
+	if (fread(magic, 8, 1, f) != 1 || memcmp(magic, REGCACHE_FILE_MAGIC, 8) ||
+			fread(header, sizeof(header), 1, f) != 1)
+		return 1;
+	if (header[0] != REGCACHE_FILE_VERSION || header[1] != cache->number)
+		return 1;	// older version or other sequence, computed again
+
+	for (i = 0; i < header[2]; i++) {
+		struct regcache_frame *frame;
+		int index, nb_entries, j;
+
+		if (fread(&index, sizeof(int), 1, f) != 1 || index < 0 || index >= cache->number)
+			return 1;
+		frame = cache->frames + index;
+		if (fread(&frame->file.size, sizeof(gint64), 1, f) != 1 ||
+				fread(&frame->file.mtime, sizeof(gint64), 1, f) != 1 ||
+				fread(&frame->file.hash, sizeof(guint64), 1, f) != 1 ||
+				fread(&nb_entries, sizeof(int), 1, f) != 1)
+			return 1;
+		for (j = 0; j < nb_entries; j++) {
+			struct regcache_entry *entry = calloc(1, sizeof(struct regcache_entry));
+			if (!entry) {
+				PRINT_ALLOC_ERR;
+				return 1;
+			}
+			entry->next = frame->entries;
+			frame->entries = entry;
+			if (fread(&entry->key, sizeof(guint64), 1, f) != 1 ||
+					fread(&entry->nb_values, sizeof(int), 1, f) != 1 ||
+					entry->nb_values < 0 || entry->nb_values > REGCACHE_MAX_VALUES)
+				return 1;
+			entry->values = malloc(entry->nb_values * sizeof(double));
+			if (!entry->values) {
+				PRINT_ALLOC_ERR;
+				return 1;
+			}
+			if (fread(entry->values, sizeof(double), entry->nb_values, f) != entry->nb_values)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/* the files may have changed since the previous run, they are checked again */
+static void start_run(sequence *seq, regcache *cache) {
+	int i;
+	for (i = 0; i < cache->number; i++)
+		cache->frames[i].checked = FALSE;
+	cache->container_checked = FALSE;
+	if (seq->type == SEQ_SER || seq->type == SEQ_CHUNKED) {
+		const char *container = seq->type == SEQ_SER ?
+			seq->ser_file->filename : seq->chunked_file->filename;
+		cache->container_checked = !get_file_key(container, &cache->container);
+	}
+}
+
+/* opens the cache of the sequence at the start of each run, it must be done
+ * before the results are read or added, and cannot be done by several threads
+ * at the same time. Returns 1 if the sequence cannot have a cache. */
+int regcache_open(sequence *seq) {
+	regcache *cache;
+	gchar *filename;
+	FILE *f;
+
+	if (seq->cache) {
+		start_run(seq, seq->cache);
+		return 0;
+	}
+	if (seq->type != SEQ_REGULAR && seq->type != SEQ_SER && seq->type != SEQ_CHUNKED)
+		return 1;
+	cache = calloc(1, sizeof(regcache));
+	if (!cache) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	cache->number = seq->number;
+	cache->frames = calloc(seq->number, sizeof(struct regcache_frame));
+	if (!cache->frames) {
+		PRINT_ALLOC_ERR;
+		free(cache);
+		return 1;
+	}
+	g_mutex_init(&cache->lock);
+
+	filename = get_regcache_filename(seq);
+	f = g_fopen(filename, "rb");
+	if (f) {
+		if (read_regcache_file(cache, f)) {
+			int i;
+			siril_debug_print("Ignoring the cache %s\n", filename);
+			for (i = 0; i < cache->number; i++) {
+				free_entries(cache->frames[i].entries);
+				cache->frames[i].entries = NULL;
+			}
+		}
+		fclose(f);
+	}
+	g_free(filename);
+	start_run(seq, cache);
+	seq->cache = cache;
+	return 0;
+}
+
+/* saves the cache if results were added */
+int regcache_save(sequence *seq) {
+	regcache *cache = seq->cache;
+	gchar *filename;
+	FILE *f;
+	int header[3], i, retval = 0;
+
+	if (!cache)
+		return 0;
+	if (cache->hits > 0) {
+		siril_log_message(_("Reused the analysis of %d frames from the previous runs\n"),
+				cache->hits);
+		cache->hits = 0;
+	}
+	if (!cache->modified)
+		return 0;
+
+	header[0] = REGCACHE_FILE_VERSION;
+	header[1] = cache->number;
+	header[2] = 0;
+	for (i = 0; i < cache->number; i++)
+		if (cache->frames[i].entries)
+			header[2]++;
+
+	filename = get_regcache_filename(seq);
+	f = g_fopen(filename, "wb");
+	if (!f) {
+		siril_log_message(_("Could not create the file %s\n"), filename);
+		g_free(filename);
+		return 1;
+	}
+	if (fwrite(REGCACHE_FILE_MAGIC, 8, 1, f) != 1 ||
+			fwrite(header, sizeof(header), 1, f) != 1)
+		retval = 1;
+	for (i = 0; i < cache->number && !retval; i++) {
+		struct regcache_frame *frame = cache->frames + i;
+		struct regcache_entry *entry;
+		int nb_entries = 0;
+
+		if (!frame->entries)
+			continue;
+		for (entry = frame->entries; entry; entry = entry->next)
+			nb_entries++;
+		if (fwrite(&i, sizeof(int), 1, f) != 1 ||
+				fwrite(&frame->file.size, sizeof(gint64), 1, f) != 1 ||
+				fwrite(&frame->file.mtime, sizeof(gint64), 1, f) != 1 ||
+				fwrite(&frame->file.hash, sizeof(guint64), 1, f) != 1 ||
+				fwrite(&nb_entries, sizeof(int), 1, f) != 1) {
+			retval = 1;
+			break;
+		}
+		for (entry = frame->entries; entry; entry = entry->next) {
+			if (fwrite(&entry->key, sizeof(guint64), 1, f) != 1 ||
+					fwrite(&entry->nb_values, sizeof(int), 1, f) != 1 ||
+					fwrite(entry->values, sizeof(double), entry->nb_values, f) != entry->nb_values) {
+				retval = 1;
+				break;
+			}
+		}
+	}
+	if (fclose(f))
+		retval = 1;
+	if (retval) {
+		siril_log_message(_("Could not write the file %s\n"), filename);
+		g_unlink(filename);
+	} else cache->modified = FALSE;
+	g_free(filename);
+	return retval;
+}
+
+/* Compares the file of the frame with the one its results were computed from,
+ * the first time the frame is used in the run, and forgets them if it changed.
+ * The key of the file is computed without holding the lock. */
+static void check_frame(sequence *seq, int index) {
+	regcache *cache = seq->cache;
+	struct regcache_frame *frame;
+	struct regcache_file_key key;
+	gboolean checked;
+
+	if (!cache || index < 0 || index >= cache->number)
+		return;
+	frame = cache->frames + index;
+	g_mutex_lock(&cache->lock);
+	checked = frame->checked;
+	g_mutex_unlock(&cache->lock);
+	if (checked || get_frame_file_key(seq, index, &key))
+		return;
+
+	g_mutex_lock(&cache->lock);
+	if (!frame->checked) {
+		if (!same_file_key(&key, &frame->file)) {
+			if (frame->entries)
+				cache->modified = TRUE;
+			free_entries(frame->entries);
+			frame->entries = NULL;
+			frame->file = key;
+		}
+		frame->checked = TRUE;
+	}
+	g_mutex_unlock(&cache->lock);
+}
+
+/* Returns the frame if it was checked by check_frame(). The lock must be
+ * held. */
+static struct regcache_frame *get_frame(sequence *seq, int index) {
+	regcache *cache = seq->cache;
+
+	if (!cache || index < 0 || index >= cache->number ||
+			!cache->frames[index].checked)
+		return NULL;
+	return cache->frames + index;
+}
+
+static struct regcache_entry *find_entry(struct regcache_frame *frame, guint64 key) {
+	struct regcache_entry *entry;
+	for (entry = frame->entries; entry; entry = entry->next)
+		if (entry->key == key)
+			return entry;
+	return NULL;
+}
+
+/* stores the values of an entry, they are owned by the cache */
+static void set_entry(sequence *seq, int index, guint64 key, double *values, int nb_values) {
+	regcache *cache = seq->cache;
+	struct regcache_frame *frame;
+	struct regcache_entry *entry;
+
+	if (!cache) {
+		free(values);
+		return;
+	}
+	check_frame(seq, index);
+	g_mutex_lock(&cache->lock);
+	frame = get_frame(seq, index);
+	if (!frame) {
+		g_mutex_unlock(&cache->lock);
+		free(values);
+		return;
+	}
+	entry = find_entry(frame, key);
+	if (!entry) {
+		entry = calloc(1, sizeof(struct regcache_entry));
+		if (!entry) {
+			PRINT_ALLOC_ERR;
+			g_mutex_unlock(&cache->lock);
+			free(values);
+			return;
+		}
+		entry->key = key;
+		entry->next = frame->entries;
+		frame->entries = entry;
+	}
+	free(entry->values);
+	entry->values = values;
+	entry->nb_values = nb_values;
+	cache->modified = TRUE;
+	g_mutex_unlock(&cache->lock);
+}
+
+static void star_to_values(const fitted_PSF *star, double *v) {
+	v[0] = star->B;
+	v[1] = star->A;
+	v[2] = star->x0;
+	v[3] = star->y0;
+	v[4] = star->sx;
+	v[5] = star->sy;
+	v[6] = star->fwhmx;
+	v[7] = star->fwhmy;
+	v[8] = star->angle;
+	v[9] = star->mag;
+	v[10] = star->s_mag;
+	v[11] = star->phot_is_valid;
+	v[12] = star->xpos;
+	v[13] = star->ypos;
+	v[14] = star->rmse;
+	v[15] = star->B_err;
+	v[16] = star->A_err;
+	v[17] = star->x_err;
+	v[18] = star->y_err;
+	v[19] = star->sx_err;
+	v[20] = star->sy_err;
+	v[21] = star->ang_err;
+	v[22] = star->layer;
+	v[23] = star->units && !strcmp(star->units, "\"");	// arcseconds
+}
+
+static fitted_PSF *values_to_star(const double *v) {
+	fitted_PSF *star = calloc(1, sizeof(fitted_PSF));
+	if (!star) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	star->B = v[0];
+	star->A = v[1];
+	star->x0 = v[2];
+	star->y0 = v[3];
+	star->sx = v[4];
+	star->sy = v[5];
+	star->fwhmx = v[6];
+	star->fwhmy = v[7];
+	star->angle = v[8];
+	star->mag = v[9];
+	star->s_mag = v[10];
+	star->phot_is_valid = v[11] != 0.0;
+	star->xpos = v[12];
+	star->ypos = v[13];
+	star->rmse = v[14];
+	star->B_err = v[15];
+	star->A_err = v[16];
+	star->x_err = v[17];
+	star->y_err = v[18];
+	star->sx_err = v[19];
+	star->sy_err = v[20];
+	star->ang_err = v[21];
+	star->layer = (int) v[22];
+	star->units = v[23] != 0.0 ? "\"" : "px";
+	return star;
+}
+
+/* Gets the stars found in the frame by the analysis of key, in a new
+ * NULL-terminated array to be freed with free_fitted_stars(). nb_stars is the
+ * number of stars that were found, which can be more than those kept. */
+gboolean regcache_get_stars(sequence *seq, int index, guint64 key, fitted_PSF ***stars, int *nb_stars) {
+	regcache *cache = seq->cache;
+	struct regcache_frame *frame;
+	struct regcache_entry *entry;
+	fitted_PSF **result;
+	int i, nb_kept;
+
+	if (!cache)
+		return FALSE;
+	check_frame(seq, index);
+	g_mutex_lock(&cache->lock);
+	frame = get_frame(seq, index);
+	entry = frame ? find_entry(frame, key) : NULL;
+	if (!entry || entry->nb_values < 1) {
+		g_mutex_unlock(&cache->lock);
+		return FALSE;
+	}
+	nb_kept = (entry->nb_values - 1) / REGCACHE_STAR_VALUES;
+	result = malloc((nb_kept + 1) * sizeof(fitted_PSF *));
+	if (!result) {
+		PRINT_ALLOC_ERR;
+		g_mutex_unlock(&cache->lock);
+		return FALSE;
+	}
+	for (i = 0; i < nb_kept; i++) {
+		result[i] = values_to_star(entry->values + 1 + i * REGCACHE_STAR_VALUES);
+		if (!result[i])
+			break;
+	}
+	result[i] = NULL;
+	if (i < nb_kept) {
+		g_mutex_unlock(&cache->lock);
+		free_fitted_stars(result);
+		return FALSE;
+	}
+	*nb_stars = (int) entry->values[0];
+	cache->hits++;
+	g_mutex_unlock(&cache->lock);
+	*stars = result;
+	return TRUE;
+}
+
+/* Stores the first nb_kept stars of the nb_stars found in the frame by the
+ * analysis of key. The stars are copied. */
+void regcache_set_stars(sequence *seq, int index, guint64 key, fitted_PSF **stars, int nb_stars, int nb_kept) {
+	double *values;
+	int i;
+
+	if (!seq->cache)
+		return;
+	values = malloc((1 + nb_kept * REGCACHE_STAR_VALUES) * sizeof(double));
+	if (!values) {
+		PRINT_ALLOC_ERR;
+		return;
+	}
+	values[0] = nb_stars;
+	for (i = 0; i < nb_kept; i++)
+		star_to_values(stars[i], values + 1 + i * REGCACHE_STAR_VALUES);
+	set_entry(seq, index, key, values, 1 + nb_kept * REGCACHE_STAR_VALUES);
+}
+
+gboolean regcache_get_value(sequence *seq, int index, guint64 key, double *value) {
+	regcache *cache = seq->cache;
+	struct regcache_frame *frame;
+	struct regcache_entry *entry;
+
+	if (!cache)
+		return FALSE;
+	check_frame(seq, index);
+	g_mutex_lock(&cache->lock);
+	frame = get_frame(seq, index);
+	entry = frame ? find_entry(frame, key) : NULL;
+	if (entry && entry->nb_values == 1) {
+		*value = entry->values[0];
+		cache->hits++;
+		g_mutex_unlock(&cache->lock);
+		return TRUE;
+	}
+	g_mutex_unlock(&cache->lock);
+	return FALSE;
+}
+
+void regcache_set_value(sequence *seq, int index, guint64 key, double value) {
+	double *values;
+
+	if (!seq->cache)
+		return;
+	values = malloc(sizeof(double));
+	if (!values) {
+		PRINT_ALLOC_ERR;
+		return;
+	}
+	values[0] = value;
+	set_entry(seq, index, key, values, 1);
+}
@@ -0,0 +1,26 @@
+#ifndef _REGCACHE_H_
+#define _REGCACHE_H_
+
+#include <glib.h>
+#include "core/siril.h"
+
+/* Results of the analysis of the frames of a sequence, the stars found by
+ * peaker(), the PSF of a star in an area or the quality of a frame, kept in a
+ * file next to the sequence file to be reused when the same analysis is done
+ * again on the same frames. Each result is identified by a key made with
+ * regcache_key() and regcache_hash() from the analysis and its parameters,
+ * and is valid as long as the file of the frame has not changed. */
+
+guint64	regcache_key(const char *analysis, int layer);
+guint64	regcache_hash(guint64 key, const void *data, size_t size);
+
+int	regcache_open(sequence *seq);
+int	regcache_save(sequence *seq);
+void	free_regcache(regcache *cache);
+
+gboolean regcache_get_stars(sequence *seq, int frame, guint64 key, fitted_PSF ***stars, int *nb_stars);
+void	regcache_set_stars(sequence *seq, int frame, guint64 key, fitted_PSF **stars, int nb_stars, int nb_kept);
+gboolean regcache_get_value(sequence *seq, int frame, guint64 key, double *value);
+void	regcache_set_value(sequence *seq, int frame, guint64 key, double value);
+
+#endif
@@ -33,6 +33,9 @@
 #include "core/siril.h"
 #include "algos/statistics.h"
 #include "io/ser.h"
+#include "io/seqindex.h"
+#include "io/seqjournal.h"
+#include "io/chunked.h"
 #include "io/sequence.h"
 #include "core/proto.h"
 #include "gui/callbacks.h"
@@ -86,6 +89,13 @@ sequence * readseqfile(const char *name){
 		seqfilename = strdup(name);
 	}
 
+	seq = seqindex_read(seqfilename);
+	if (seq) {
+		seqjournal_apply(seq, seqfilename);
+		free(seqfilename);
+		return seq;
+	}
+
 	if ((seqfile = g_fopen(seqfilename, "r")) == NULL) {
 		fprintf(stderr, "Reading sequence failed, file cannot be opened: %s.\n", seqfilename);
 		free(seqfilename);
@@ -274,15 +284,23 @@ sequence * readseqfile(const char *name){
 					}
 				} else {
 					// new file format with roundness instead of weird things
-					if (sscanf(line+3, "%f %f %g %g %lg",
+					// and optionally the transformation to apply at stacking
+					Homography *H = &regparam[i].H;
+					nb_tokens = sscanf(line+3, "%f %f %g %g %lg %lg %lg %lg %lg %lg %lg %lg %lg %lg",
 								&(regparam[i].shiftx),
 								&(regparam[i].shifty),
 								&(regparam[i].fwhm),
 								&(regparam[i].roundness),
-								&(regparam[i].quality)) != 5) {
+								&(regparam[i].quality),
+								&H->h00, &H->h01, &H->h02,
+								&H->h10, &H->h11, &H->h12,
+								&H->h20, &H->h21, &H->h22);
+					if (nb_tokens != 5 && nb_tokens != 14) {
 						fprintf(stderr,"readseqfile: sequence file format error: %s\n",line);
 						goto error;
 					}
+					if (nb_tokens == 5)
+						memset(H, 0, sizeof(Homography));
 				}
 				++i;
 				break;
@@ -320,6 +338,20 @@ sequence * readseqfile(const char *name){
 						seq->needs_saving = TRUE;
 					}
 				}
+				else if (line[1] == 'C') {
+					size_t len = strlen(seqfilename);
+					seq->type = SEQ_CHUNKED;
+					if (seq->chunked_file) break;
+					seq->chunked_file = calloc(1, sizeof(struct chunked_struct));
+					// name.seq -> name.csq
+					seqfilename[len-3] = 'c';
+					seqfilename[len-2] = 's';
+					if (chunked_open_file(seqfilename, seq->chunked_file)) {
+						free(seq->chunked_file);
+						seq->chunked_file = NULL;
+						goto error;
+					}
+				}
 #ifdef HAVE_FFMS2
 				else if (line[1] == 'A') {
 					seq->type = SEQ_AVI;
@@ -483,6 +515,9 @@ sequence * readseqfile(const char *name){
 			memcpy(&seq->regparam[1][image], &seq->regparam_bkp[0][image], sizeof(regdata));
 		}
 	}
+	// the T line may have changed the extension to open the SER or chunked file
+	memcpy(seqfilename + strlen(seqfilename) - 3, "seq", 3);
+	seqjournal_apply(seq, seqfilename);
 
 	update_used_memory();
 	free(seqfilename);
@@ -498,6 +533,16 @@ error:
 	return NULL;
 }
 
+/* ends a registration line of the sequence file, with the transformation if
+ * it is set */
+static void write_homography(FILE *seqfile, Homography *H) {
+	if (H->h22 != 0.0)
+		fprintf(seqfile, " %.17lg %.17lg %.17lg %.17lg %.17lg %.17lg %.17lg %.17lg %.17lg",
+				H->h00, H->h01, H->h02, H->h10, H->h11, H->h12,
+				H->h20, H->h21, H->h22);
+	fprintf(seqfile, "\n");
+}
+
 /* Saves the sequence in the seqname.seq file. */
 int writeseqfile(sequence *seq){
 	char *filename;
@@ -524,9 +569,11 @@ int writeseqfile(sequence *seq){
 	fprintf(seqfile,"S '%s' %d %d %d %d %d %d\n", 
 			seq->seqname, seq->beg, seq->number, seq->selnum, seq->fixed, seq->reference_image, CURRENT_SEQFILE_VERSION);
 	if (seq->type != SEQ_REGULAR) {
-		/* sequence type, not needed for regular, S for ser, A for avi */
-		fprintf(stderr, "T%c\n", seq->type == SEQ_SER ? 'S' : 'A');
-		fprintf(seqfile, "T%c\n", seq->type == SEQ_SER ? 'S' : 'A');
+		/* sequence type, not needed for regular, S for ser, C for
+		 * chunked, A for avi */
+		char type = seq->type == SEQ_SER ? 'S' : seq->type == SEQ_CHUNKED ? 'C' : 'A';
+		fprintf(stderr, "T%c\n", type);
+		fprintf(seqfile, "T%c\n", type);
 	}
 
 	if (seq->upscale_at_stacking != 1.0) {
@@ -547,7 +594,7 @@ int writeseqfile(sequence *seq){
 	for (layer = 0; layer < seq->nb_layers; layer++) {
 		if (seq->regparam[layer]) {
 			for (i=0; i < seq->number; ++i) {
-				fprintf(seqfile, "R%c %f %f %g %g %g\n",
+				fprintf(seqfile, "R%c %f %f %g %g %g",
 						seq->cfa_opened_monochrome ? '*' : '0' + layer,
 						seq->regparam[layer][i].shiftx,
 						seq->regparam[layer][i].shifty,
@@ -555,6 +602,7 @@ int writeseqfile(sequence *seq){
 						seq->regparam[layer][i].roundness,
 						seq->regparam[layer][i].quality
 				       );
+				write_homography(seqfile, &seq->regparam[layer][i].H);
 			}
 		}
 		if (seq->stats && seq->stats[layer]) {
@@ -584,7 +632,7 @@ int writeseqfile(sequence *seq){
 	for (layer = 0; layer < 3; layer++) {
 		if (seq->regparam_bkp && seq->regparam_bkp[layer]) {
 			for (i=0; i < seq->number; ++i) {
-				fprintf(seqfile, "R%c %f %f %g %g %g\n",
+				fprintf(seqfile, "R%c %f %f %g %g %g",
 						seq->cfa_opened_monochrome ? '0' + layer : '*',
 						seq->regparam_bkp[layer][i].shiftx,
 						seq->regparam_bkp[layer][i].shifty,
@@ -592,6 +640,7 @@ int writeseqfile(sequence *seq){
 						seq->regparam_bkp[layer][i].roundness,
 						seq->regparam_bkp[layer][i].quality
 				       );
+				write_homography(seqfile, &seq->regparam_bkp[layer][i].H);
 			}
 		}
 		if (seq->stats_bkp && seq->stats_bkp[layer]) {
@@ -621,6 +670,8 @@ int writeseqfile(sequence *seq){
 
 	fclose(seqfile);
 	seq->needs_saving = FALSE;
+	seqjournal_remove(seq);	// its changes are in the new sequence file
+	seqindex_write(seq);
 	return 0;
 }
 
@@ -0,0 +1,426 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Layout of the index file, in the native byte order:
+ *  - the magic string and the version
+ *  - size and modification time of the sequence file and of the first image
+ *    file or of the SER or chunked file
+ *  - the fields of the sequence, the name of the sequence
+ *  - file number and inclusion of each image
+ *  - for each layer, the registration data and the statistics, if they exist
+ * CFA SER sequences and films are not indexed, their layers depend on the
+ * settings at opening. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "gui/progress_and_log.h"
+#include "algos/statistics.h"
+#include "io/sequence.h"
+#include "io/ser.h"
+#include "io/chunked.h"
+
+#include "seqindex.h"
+
+#define SEQINDEX_FILE_MAGIC "SIRILSQX"
+#define SEQINDEX_FILE_VERSION 1
+#define SEQINDEX_HEADER_INTS 11
+#define SEQINDEX_STATS_VALUES 12
+
+struct seqindex_file_key {
+	gint64 size, mtime;
+};
+
+/* reading of the mapped index */
+struct seqindex_reader {
+	const gchar *data;
+	gsize size, pos;
+};
+
+static gchar *get_seqindex_filename(const char *seqfilename) {
+	return g_strdup_printf("%sidx", seqfilename);	// name.seqidx
+}
+
+static int get_file_key(const char *filename, struct seqindex_file_key *key) {
+	GStatBuf st;
+	if (g_stat(filename, &st))
+		return 1;
+	key->size = st.st_size;
+	key->mtime = st.st_mtime;
+	return 0;
+}
+
+/* the file of the images that are checked to be unchanged */
+static int get_images_file_key(sequence *seq, struct seqindex_file_key *key) {
+	char filename[256];
+	switch (seq->type) {
+	case SEQ_REGULAR:
+		if (!fit_sequence_get_image_filename(seq, 0, filename, TRUE))
+			return 1;
+		return get_file_key(filename, key);
+	case SEQ_SER:
+		return get_file_key(seq->ser_file->filename, key);
+	case SEQ_CHUNKED:
+		return get_file_key(seq->chunked_file->filename, key);
+	default:
+		return 1;
+	}
+}
+
+static gboolean can_be_indexed(sequence *seq) {
+	if (seq->type != SEQ_REGULAR && seq->type != SEQ_SER && seq->type != SEQ_CHUNKED)
+		return FALSE;
+	if (seq->type == SEQ_SER && ser_is_cfa(seq->ser_file))
+		return FALSE;
+	return seq->number > 0 && !seq->regparam_bkp && !seq->stats_bkp &&
+		!seq->cfa_opened_monochrome;
+}
+
+static gboolean take(struct seqindex_reader *reader, void *dest, gsize size) {
+	if (reader->pos + size > reader->size)
+		return FALSE;
+	memcpy(dest, reader->data + reader->pos, size);
+	reader->pos += size;
+	return TRUE;
+}
+
+static int write_regdata(FILE *f, regdata *regparam, int number) {
+	int i;
+	for (i = 0; i < number; i++) {
+		regdata *reg = regparam + i;
+		if (fwrite(&reg->shiftx, sizeof(float), 1, f) != 1 ||
+				fwrite(&reg->shifty, sizeof(float), 1, f) != 1 ||
+				fwrite(&reg->fwhm, sizeof(float), 1, f) != 1 ||
+				fwrite(&reg->roundness, sizeof(float), 1, f) != 1 ||
+				fwrite(&reg->quality, sizeof(double), 1, f) != 1 ||
+				fwrite(&reg->H.h00, sizeof(double), 9, f) != 9)
+			return 1;
+	}
+	return 0;
+}
+
+static gboolean read_regdata(struct seqindex_reader *reader, regdata *regparam, int number) {
+	int i;
+	for (i = 0; i < number; i++) {
+		regdata *reg = regparam + i;
+		double H[9];
+		if (!take(reader, &reg->shiftx, sizeof(float)) ||
+				!take(reader, &reg->shifty, sizeof(float)) ||
+				!take(reader, &reg->fwhm, sizeof(float)) ||
+				!take(reader, &reg->roundness, sizeof(float)) ||
+				!take(reader, &reg->quality, sizeof(double)) ||
+				!take(reader, H, sizeof(H)))
+			return FALSE;
+		reg->H.h00 = H[0]; reg->H.h01 = H[1]; reg->H.h02 = H[2];
+		reg->H.h10 = H[3]; reg->H.h11 = H[4]; reg->H.h12 = H[5];
+		reg->H.h20 = H[6]; reg->H.h21 = H[7]; reg->H.h22 = H[8];
+	}
+	return TRUE;
+}
+
+static int write_stats(FILE *f, imstats **stats, int number) {
+	int i;
+	for (i = 0; i < number; i++) {
+		char present = stats[i] != NULL;
+		if (fwrite(&present, 1, 1, f) != 1)
+			return 1;
+	}
+	for (i = 0; i < number; i++) {
+		imstats *st = stats[i];
+		gint64 counts[2];
+		double values[SEQINDEX_STATS_VALUES];
+		if (!st)
+			continue;
+		counts[0] = st->total;
+		counts[1] = st->ngoodpix;
+		values[0] = st->mean;		values[1] = st->median;
+		values[2] = st->sigma;		values[3] = st->avgDev;
+		values[4] = st->mad;		values[5] = st->sqrtbwmv;
+		values[6] = st->location;	values[7] = st->scale;
+		values[8] = st->min;		values[9] = st->max;
+		values[10] = st->normValue;	values[11] = st->bgnoise;
+		if (fwrite(counts, sizeof(gint64), 2, f) != 2 ||
+				fwrite(values, sizeof(double), SEQINDEX_STATS_VALUES, f) != SEQINDEX_STATS_VALUES)
+			return 1;
+	}
+	return 0;
+}
+
+static gboolean read_stats(struct seqindex_reader *reader, sequence *seq, int layer) {
+	const gchar *present;
+	int i;
+
+	if (reader->pos + seq->number > reader->size)
+		return FALSE;
+	present = reader->data + reader->pos;
+	reader->pos += seq->number;
+	for (i = 0; i < seq->number; i++) {
+		imstats *st = NULL;
+		gint64 counts[2];
+		double values[SEQINDEX_STATS_VALUES];
+		if (!present[i])
+			continue;
+		if (!take(reader, counts, sizeof(counts)) || !take(reader, values, sizeof(values)))
+			return FALSE;
+		allocate_stats(&st);
+		if (!st)
+			return FALSE;
+		st->total = counts[0];
+		st->ngoodpix = counts[1];
+		st->mean = values[0];		st->median = values[1];
+		st->sigma = values[2];		st->avgDev = values[3];
+		st->mad = values[4];		st->sqrtbwmv = values[5];
+		st->location = values[6];	st->scale = values[7];
+		st->min = values[8];		st->max = values[9];
+		st->normValue = values[10];	st->bgnoise = values[11];
+		add_stats_to_seq(seq, i, layer, st);
+		free_stats(st);	// we unreference it here
+	}
+	return TRUE;
+}
+
+/* Writes the index of the sequence, after its sequence file. */
+int seqindex_write(sequence *seq) {
+	struct seqindex_file_key seqfile_key, images_key;
+	gchar *seqfilename, *filename;
+	int header[SEQINDEX_HEADER_INTS], name_len, i, layer, retval = 0;
+	FILE *f;
+
+	if (!seq->seqname || seq->seqname[0] == '\0')
+		return 1;
+	seqfilename = g_strdup_printf("%s.seq", seq->seqname);
+	filename = get_seqindex_filename(seqfilename);
+	if (!can_be_indexed(seq) || get_file_key(seqfilename, &seqfile_key) ||
+			get_images_file_key(seq, &images_key)) {
+		g_unlink(filename);	// an old index would not be valid anyway
+		g_free(seqfilename);
+		g_free(filename);
+		return 1;
+	}
+	g_free(seqfilename);
+
+	f = g_fopen(filename, "wb");
+	if (!f) {
+		siril_debug_print("Could not create the file %s\n", filename);
+		g_free(filename);
+		return 1;
+	}
+	header[0] = SEQINDEX_FILE_VERSION;
+	header[1] = seq->type;
+	header[2] = seq->beg;
+	header[3] = seq->number;
+	header[4] = seq->selnum;
+	header[5] = seq->fixed;
+	header[6] = seq->reference_image;
+	header[7] = seq->nb_layers;
+	header[8] = seq->rx;
+	header[9] = seq->ry;
+	header[10] = seq->bitpix;
+	name_len = strlen(seq->seqname);
+
+	if (fwrite(SEQINDEX_FILE_MAGIC, 8, 1, f) != 1 ||
+			fwrite(&seqfile_key, sizeof(seqfile_key), 1, f) != 1 ||
+			fwrite(&images_key, sizeof(images_key), 1, f) != 1 ||
+			fwrite(header, sizeof(header), 1, f) != 1 ||
+			fwrite(&seq->data_max, sizeof(double), 1, f) != 1 ||
+			fwrite(&seq->upscale_at_stacking, sizeof(double), 1, f) != 1 ||
+			fwrite(&name_len, sizeof(int), 1, f) != 1 ||
+			fwrite(seq->seqname, 1, name_len, f) != name_len)
+		retval = 1;
+	for (i = 0; i < seq->number && !retval; i++) {
+		if (fwrite(&seq->imgparam[i].filenum, sizeof(int), 1, f) != 1 ||
+				fwrite(&seq->imgparam[i].incl, sizeof(int), 1, f) != 1)
+			retval = 1;
+	}
+	for (layer = 0; layer < seq->nb_layers && !retval; layer++) {
+		char has_reg = seq->regparam && seq->regparam[layer];
+		char has_stats = seq->stats && seq->stats[layer];
+		if (fwrite(&has_reg, 1, 1, f) != 1 ||
+				(has_reg && write_regdata(f, seq->regparam[layer], seq->number)) ||
+				fwrite(&has_stats, 1, 1, f) != 1 ||
+				(has_stats && write_stats(f, seq->stats[layer], seq->number)))
+			retval = 1;
+	}
+	if (fclose(f))
+		retval = 1;
+	if (retval) {
+		siril_debug_print("Could not write the file %s\n", filename);
+		g_unlink(filename);
+	}
+	g_free(filename);
+	return retval;
+}
+
+/* opens the SER or chunked file of the sequence, like the T line of the
+ * sequence file */
+static int open_sequence_container(sequence *seq, const char *seqfilename) {
+	gchar *filename = g_strdup(seqfilename);
+	size_t len = strlen(filename);
+	int retval = 0;
+
+	if (seq->type == SEQ_SER) {
+		filename[len - 1] = 'r';
+		seq->ser_file = malloc(sizeof(struct ser_struct));
+		ser_init_struct(seq->ser_file);
+		if (ser_open_file(filename, seq->ser_file) || ser_is_cfa(seq->ser_file))
+			retval = 1;
+#ifdef HAVE_FFMS2
+		seq->ext = "ser";
+#endif
+	} else if (seq->type == SEQ_CHUNKED) {
+		filename[len - 3] = 'c';
+		filename[len - 2] = 's';
+		seq->chunked_file = calloc(1, sizeof(struct chunked_struct));
+		if (chunked_open_file(filename, seq->chunked_file))
+			retval = 1;
+	}
+	g_free(filename);
+	return retval;
+}
+
+static gboolean read_seqindex(sequence *seq, struct seqindex_reader *reader,
+		const char *seqfilename) {
+	struct seqindex_file_key seqfile_key, images_key, key;
+	char magic[8];
+	int header[SEQINDEX_HEADER_INTS], name_len, i, layer;
+
+	if (!take(reader, magic, 8) || memcmp(magic, SEQINDEX_FILE_MAGIC, 8) ||
+			!take(reader, &seqfile_key, sizeof(seqfile_key)) ||
+			!take(reader, &images_key, sizeof(images_key)) ||
+			!take(reader, header, sizeof(header)) ||
+			header[0] != SEQINDEX_FILE_VERSION || header[3] <= 0 ||
+			header[7] > 3)
+		return FALSE;
+	if (get_file_key(seqfilename, &key) || key.size != seqfile_key.size ||
+			key.mtime != seqfile_key.mtime)
+		return FALSE;	// the sequence file has changed
+
+	seq->type = header[1];
+	seq->beg = header[2];
+	seq->number = header[3];
+	seq->selnum = header[4];
+	seq->fixed = header[5];
+	seq->reference_image = header[6];
+	seq->nb_layers = header[7];
+	seq->rx = header[8];
+	seq->ry = header[9];
+	seq->bitpix = header[10];
+	if (!take(reader, &seq->data_max, sizeof(double)) ||
+			!take(reader, &seq->upscale_at_stacking, sizeof(double)) ||
+			!take(reader, &name_len, sizeof(int)) ||
+			name_len <= 0 || reader->pos + name_len > reader->size)
+		return FALSE;
+	seq->seqname = g_strndup(reader->data + reader->pos, name_len);
+	reader->pos += name_len;
+
+	seq->imgparam = calloc(seq->number, sizeof(imgdata));
+	if (!seq->imgparam) {
+		PRINT_ALLOC_ERR;
+		return FALSE;
+	}
+	for (i = 0; i < seq->number; i++) {
+		if (!take(reader, &seq->imgparam[i].filenum, sizeof(int)) ||
+				!take(reader, &seq->imgparam[i].incl, sizeof(int)))
+			return FALSE;
+	}
+
+	if (seq->nb_layers >= 1) {
+		seq->regparam = calloc(seq->nb_layers, sizeof(regdata *));
+		seq->layers = calloc(seq->nb_layers, sizeof(layer_info));
+		if (!seq->regparam || !seq->layers) {
+			PRINT_ALLOC_ERR;
+			return FALSE;
+		}
+	}
+	for (layer = 0; layer < seq->nb_layers; layer++) {
+		char has_reg, has_stats;
+		if (!take(reader, &has_reg, 1))
+			return FALSE;
+		if (has_reg) {
+			seq->regparam[layer] = calloc(seq->number, sizeof(regdata));
+			if (!seq->regparam[layer]) {
+				PRINT_ALLOC_ERR;
+				return FALSE;
+			}
+			if (!read_regdata(reader, seq->regparam[layer], seq->number))
+				return FALSE;
+		}
+		if (!take(reader, &has_stats, 1) ||
+				(has_stats && !read_stats(reader, seq, layer)))
+			return FALSE;
+	}
+
+	if (open_sequence_container(seq, seqfilename) ||
+			get_images_file_key(seq, &key) || key.size != images_key.size ||
+			key.mtime != images_key.mtime)
+		return FALSE;	// the images have changed
+	return TRUE;
+}
+
+/* Loads the sequence from its index if it is up to date, returns NULL
+ * otherwise, the sequence file has to be read. */
+sequence *seqindex_read(const char *seqfilename) {
+	struct seqindex_reader reader;
+	GMappedFile *mapped;
+	sequence *seq;
+	gchar *filename;
+	int i, nbsel;
+
+	filename = get_seqindex_filename(seqfilename);
+	mapped = g_mapped_file_new(filename, FALSE, NULL);
+	if (!mapped) {
+		g_free(filename);
+		return NULL;
+	}
+	reader.data = g_mapped_file_get_contents(mapped);
+	reader.size = g_mapped_file_get_length(mapped);
+	reader.pos = 0;
+
+	seq = calloc(1, sizeof(sequence));
+	initialize_sequence(seq, TRUE);
+	if (!read_seqindex(seq, &reader, seqfilename)) {
+		siril_debug_print("Ignoring the index %s\n", filename);
+		g_mapped_file_unref(mapped);
+		g_free(filename);
+		free_sequence(seq, TRUE);
+		return NULL;
+	}
+	g_mapped_file_unref(mapped);
+	g_free(filename);
+
+	fprintf(stdout, "Sequence loaded from its index\n");
+	seq->needs_saving = FALSE;	// loading stats sets it to true
+	seq->end = seq->imgparam[seq->number-1].filenum;
+	seq->current = -1;
+	for (i = 0, nbsel = 0; i < seq->number; i++)
+		if (seq->imgparam[i].incl)
+			nbsel++;
+	seq->selnum = nbsel;
+	update_used_memory();
+	return seq;
+}
@@ -0,0 +1,15 @@
+#ifndef _SEQINDEX_H_
+#define _SEQINDEX_H_
+
+#include "core/siril.h"
+
+/* Binary copy of the sequence file, with the size and format of the images
+ * that the sequence file does not store. It is written with the sequence file
+ * and read instead of it if neither it nor the first image (or the SER file)
+ * changed since, so that loading a sequence does not parse the text of the
+ * sequence file nor read an image to know the size of the others. */
+
+int	seqindex_write(sequence *seq);
+sequence *seqindex_read(const char *seqfilename);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The journal, name.seqlog, is a header identifying the sequence file it
+ * applies to, by its size and modification time, followed by records of fixed
+ * size in the native byte order. Records are only appended; when there are too
+ * many of them, the sequence file is written again, which removes the journal.
+ * A record that was not completely written is ignored. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "gui/progress_and_log.h"
+#include "io/ser.h"
+
+#include "seqjournal.h"
+
+#define SEQJOURNAL_FILE_MAGIC "SIRILSQJ"
+#define SEQJOURNAL_FILE_VERSION 1
+#define SEQJOURNAL_MAX_RECORDS 1000	// compaction threshold
+
+enum {
+	RECORD_INCLUSION,
+	RECORD_REGDATA,
+	RECORD_REFERENCE
+};
+
+struct seqjournal_header {
+	char magic[8];
+	gint32 version, record_size;
+	gint64 seq_size, seq_mtime;	// the sequence file the journal applies to
+};
+
+struct seqjournal_record {
+	gint32 type, layer, index, value;
+	float shiftx, shifty, fwhm, roundness;
+	double quality;
+	double H[9];
+};
+
+static gchar *get_seqjournal_filename(const char *seqfilename) {
+	return g_strdup_printf("%slog", seqfilename);	// name.seqlog
+}
+
+static int fill_header(const char *seqfilename, struct seqjournal_header *header) {
+	GStatBuf st;
+	if (g_stat(seqfilename, &st))
+		return 1;
+	memset(header, 0, sizeof(struct seqjournal_header));
+	memcpy(header->magic, SEQJOURNAL_FILE_MAGIC, 8);
+	header->version = SEQJOURNAL_FILE_VERSION;
+	header->record_size = sizeof(struct seqjournal_record);
+	header->seq_size = st.st_size;
+	header->seq_mtime = st.st_mtime;
+	return 0;
+}
+
+/* opens the journal for appending, creating it if it does not exist or if it
+ * was made for another version of the sequence file */
+static FILE *open_journal(const char *filename, const struct seqjournal_header *header) {
+	struct seqjournal_header existing;
+	FILE *f = g_fopen(filename, "r+b");
+	if (f) {
+		if (fread(&existing, sizeof(existing), 1, f) == 1 &&
+				!memcmp(&existing, header, sizeof(existing)) &&
+				!fseek(f, 0, SEEK_END))
+			return f;
+		fclose(f);
+	}
+
+	f = g_fopen(filename, "wb");
+	if (!f)
+		return NULL;
+	if (fwrite(header, sizeof(struct seqjournal_header), 1, f) != 1) {
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* appends the record to the journal of the sequence, or writes the sequence
+ * file if the journal cannot be used or is too long */
+static int append_record(sequence *seq, struct seqjournal_record *record) {
+	struct seqjournal_header header;
+	gchar *seqfilename, *filename;
+	long nb_records = 0;
+	int retval = 1;
+	FILE *f;
+
+	if (!seq->seqname || seq->seqname[0] == '\0')
+		return 1;
+	seqfilename = g_strdup_printf("%s.seq", seq->seqname);
+	filename = get_seqjournal_filename(seqfilename);
+	if (!seq->needs_saving && !fill_header(seqfilename, &header)) {
+		f = open_journal(filename, &header);
+		if (f) {
+			if (fwrite(record, sizeof(struct seqjournal_record), 1, f) == 1) {
+				nb_records = (ftell(f) - (long) sizeof(header)) / (long) sizeof(struct seqjournal_record);
+				retval = 0;
+			}
+			if (fclose(f))
+				retval = 1;
+		}
+	}
+	g_free(seqfilename);
+	g_free(filename);
+
+	if (retval || nb_records >= SEQJOURNAL_MAX_RECORDS) {
+		// other changes are pending or the journal failed, or compaction
+		return writeseqfile(seq);
+	}
+	return 0;
+}
+
+int seqjournal_log_inclusion(sequence *seq, int index) {
+	struct seqjournal_record record = { 0 };
+	record.type = RECORD_INCLUSION;
+	record.index = index;
+	record.value = seq->imgparam[index].incl;
+	return append_record(seq, &record);
+}
+
+int seqjournal_log_regdata(sequence *seq, int layer, int index) {
+	struct seqjournal_record record = { 0 };
+	regdata *reg = &seq->regparam[layer][index];
+	if (ser_is_cfa(seq->ser_file) || seq->regparam_bkp)
+		return writeseqfile(seq);	// layers depend on the debayer setting
+	record.type = RECORD_REGDATA;
+	record.layer = layer;
+	record.index = index;
+	record.shiftx = reg->shiftx;
+	record.shifty = reg->shifty;
+	record.fwhm = reg->fwhm;
+	record.roundness = reg->roundness;
+	record.quality = reg->quality;
+	record.H[0] = reg->H.h00; record.H[1] = reg->H.h01; record.H[2] = reg->H.h02;
+	record.H[3] = reg->H.h10; record.H[4] = reg->H.h11; record.H[5] = reg->H.h12;
+	record.H[6] = reg->H.h20; record.H[7] = reg->H.h21; record.H[8] = reg->H.h22;
+	return append_record(seq, &record);
+}
+
+int seqjournal_log_reference(sequence *seq) {
+	struct seqjournal_record record = { 0 };
+	record.type = RECORD_REFERENCE;
+	record.value = seq->reference_image;
+	return append_record(seq, &record);
+}
+
+static void apply_regdata(sequence *seq, const struct seqjournal_record *record) {
+	regdata *reg;
+	if (record->layer < 0 || record->layer >= seq->nb_layers)
+		return;
+	if (!seq->regparam) {
+		seq->regparam = calloc(seq->nb_layers, sizeof(regdata *));
+		if (!seq->regparam) {
+			PRINT_ALLOC_ERR;
+			return;
+		}
+	}
+	if (!seq->regparam[record->layer]) {
+		seq->regparam[record->layer] = calloc(seq->number, sizeof(regdata));
+		if (!seq->regparam[record->layer]) {
+			PRINT_ALLOC_ERR;
+			return;
+		}
+	}
+	reg = &seq->regparam[record->layer][record->index];
+	reg->shiftx = record->shiftx;
+	reg->shifty = record->shifty;
+	reg->fwhm = record->fwhm;
+	reg->roundness = record->roundness;
+	reg->quality = record->quality;
+	reg->H.h00 = record->H[0]; reg->H.h01 = record->H[1]; reg->H.h02 = record->H[2];
+	reg->H.h10 = record->H[3]; reg->H.h11 = record->H[4]; reg->H.h12 = record->H[5];
+	reg->H.h20 = record->H[6]; reg->H.h21 = record->H[7]; reg->H.h22 = record->H[8];
+}
+
+/* Applies the journal to the sequence just loaded from the sequence file or
+ * from its index. A journal made for another sequence file is removed. */
+void seqjournal_apply(sequence *seq, const char *seqfilename) {
+	struct seqjournal_header header;
+	const struct seqjournal_header *existing;
+	GMappedFile *mapped;
+	const gchar *data;
+	gchar *filename;
+	gsize size, pos;
+	int i, nb_records = 0;
+
+	filename = get_seqjournal_filename(seqfilename);
+	mapped = g_mapped_file_new(filename, FALSE, NULL);
+	if (!mapped) {
+		g_free(filename);
+		return;
+	}
+	data = g_mapped_file_get_contents(mapped);
+	size = g_mapped_file_get_length(mapped);
+	existing = (const struct seqjournal_header *) data;
+	if (size < sizeof(header) || fill_header(seqfilename, &header) ||
+			memcmp(existing, &header, sizeof(header))) {
+		siril_debug_print("Removing the outdated journal %s\n", filename);
+		g_mapped_file_unref(mapped);
+		g_unlink(filename);
+		g_free(filename);
+		return;
+	}
+
+	for (pos = sizeof(header); pos + sizeof(struct seqjournal_record) <= size;
+			pos += sizeof(struct seqjournal_record)) {
+		struct seqjournal_record record;
+		memcpy(&record, data + pos, sizeof(record));
+		if (record.type == RECORD_REFERENCE) {
+			if (record.value >= -1 && record.value < seq->number)
+				seq->reference_image = record.value;
+		}
+		else if (record.index >= 0 && record.index < seq->number) {
+			if (record.type == RECORD_INCLUSION)
+				seq->imgparam[record.index].incl = record.value;
+			else if (record.type == RECORD_REGDATA)
+				apply_regdata(seq, &record);
+		}
+		nb_records++;
+	}
+	g_mapped_file_unref(mapped);
+	g_free(filename);
+
+	seq->selnum = 0;
+	for (i = 0; i < seq->number; i++)
+		if (seq->imgparam[i].incl)
+			seq->selnum++;
+	fprintf(stdout, "Applied %d changes from the journal of the sequence\n", nb_records);
+}
+
+/* Removes the journal, after the sequence file has been written. */
+void seqjournal_remove(sequence *seq) {
+	gchar *seqfilename, *filename;
+	if (!seq->seqname || seq->seqname[0] == '\0')
+		return;
+	seqfilename = g_strdup_printf("%s.seq", seq->seqname);
+	filename = get_seqjournal_filename(seqfilename);
+	g_unlink(filename);
+	g_free(seqfilename);
+	g_free(filename);
+}
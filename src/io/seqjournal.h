@@ -0,0 +1,18 @@
+#ifndef _SEQJOURNAL_H_
+#define _SEQJOURNAL_H_
+
+#include "core/siril.h"
+
+/* Journal of the changes made to single images of a sequence since its
+ * sequence file was written. Changing the selection of an image, its manual
+ * shifts or the reference image appends a small record to the journal instead
+ * of rewriting the sequence file, the journal is applied after the sequence is
+ * loaded, and it is removed when the sequence file is written again. */
+
+int	seqjournal_log_inclusion(sequence *seq, int index);
+int	seqjournal_log_regdata(sequence *seq, int layer, int index);
+int	seqjournal_log_reference(sequence *seq);
+void	seqjournal_apply(sequence *seq, const char *seqfilename);
+void	seqjournal_remove(sequence *seq);
+
+#endif
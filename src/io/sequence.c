@@ -48,6 +48,8 @@
 #include "gui/callbacks.h"
 #include "gui/plot.h"
 #include "ser.h"
+#include "chunked.h"
+#include "regcache.h"
 #ifdef HAVE_FFMS2
 #include "films.h"
 #endif
@@ -61,6 +63,7 @@
 #include "algos/statistics.h"
 #include "algos/geometry.h"
 #include "registration/registration.h"
+#include "registration/multipoint.h"
 #include "stacking/stacking.h"	// for update_stack_interface
 
 
@@ -212,6 +215,24 @@ int check_seq(int recompute_stats) {
 			nb_seq++;
 			fprintf(stdout, "Found a SER sequence (number %d)\n", nb_seq);
 		}
+		else if (!strcasecmp(ext, "csq")) {
+			struct chunked_struct *chunked_file = calloc(1, sizeof(struct chunked_struct));
+			if (chunked_open_file(file, chunked_file)) {
+				free(chunked_file);
+				continue;
+			}
+			new_seq = calloc(1, sizeof(sequence));
+			initialize_sequence(new_seq, TRUE);
+			new_seq->seqname = g_strndup(file, fnlen-4);
+			new_seq->beg = 0;
+			new_seq->end = chunked_file->frame_count-1;
+			new_seq->number = chunked_file->frame_count;
+			new_seq->type = SEQ_CHUNKED;
+			new_seq->chunked_file = chunked_file;
+			sequences[nb_seq] = new_seq;
+			nb_seq++;
+			fprintf(stdout, "Found a chunked sequence (number %d)\n", nb_seq);
+		}
 #ifdef HAVE_FFMS2
 		else if (!check_for_film_extensions(ext)) {
 			struct film_struct *film_file = malloc(sizeof(struct film_struct));
@@ -571,6 +592,9 @@ int64_t seq_compute_size(sequence *seq, int nb_frames) {
 	case SEQ_SER:
 		size = ser_compute_file_size(seq->ser_file, nb_frames);
 		break;
+	case SEQ_CHUNKED:
+		size = chunked_compute_file_size(seq->chunked_file, nb_frames);
+		break;
 	case SEQ_REGULAR:
 		ref = sequence_find_refimage(seq);
 		if (fit_sequence_get_image_filename(seq, ref, filename, TRUE)) {
@@ -665,6 +689,13 @@ char *seq_get_image_filename(sequence *seq, int index, char *name_buf) {
 			snprintf(name_buf, 255, "%s_%d.ser", seq->seqname,  index);
 			name_buf[255] = '\0';
 			return name_buf;
+		case SEQ_CHUNKED:
+			if (!name_buf || index < 0 || index > seq->end) {
+				return NULL;
+			}
+			snprintf(name_buf, 255, "%s_%d.csq", seq->seqname,  index);
+			name_buf[255] = '\0';
+			return name_buf;
 #ifdef HAVE_FFMS2
 		case SEQ_AVI:
 			if (!name_buf || index < 0 || index > seq->end) {
@@ -705,6 +736,14 @@ int seq_read_frame(sequence *seq, int index, fits *dest) {
 				return 1;
 			}
 			break;
+		case SEQ_CHUNKED:
+			assert(seq->chunked_file);
+			if (chunked_read_frame(seq->chunked_file, index, dest)) {
+				siril_log_message(_("Could not load frame %d from chunked sequence %s\n"),
+						index, seq->seqname);
+				return 1;
+			}
+			break;
 #ifdef HAVE_FFMS2
 		case SEQ_AVI:
 			assert(seq->film_file);
@@ -756,6 +795,14 @@ int seq_read_frame_part(sequence *seq, int layer, int index, fits *dest, const r
 				return 1;
 			}
 
+			break;
+		case SEQ_CHUNKED:
+			assert(seq->chunked_file);
+			if (chunked_read_opened_partial_fits(seq->chunked_file, layer, index, dest, area)) {
+				siril_log_message(_("Could not load frame %d from chunked sequence %s\n"),
+						index, seq->seqname);
+				return 1;
+			}
 			break;
 #ifdef HAVE_FFMS2
 		case SEQ_AVI:
@@ -824,11 +871,15 @@ int seq_open_image(sequence *seq, int index) {
 				fits_report_error(stderr, status);
 				return status;
 			}
+			open_fits_direct(seq, index, filename);
 			/* should we check image parameters here? such as bitpix or naxis */
 			break;
 		case SEQ_SER:
 			assert(seq->ser_file->file == NULL);
 			break;
+		case SEQ_CHUNKED:
+			// the file stays opened with the sequence
+			break;
 #ifdef HAVE_FFMS2
 		case SEQ_AVI:
 			siril_log_message(_("This operation is not supported on AVI sequences (seq_open_image)\n"));
@@ -850,6 +901,7 @@ void seq_close_image(sequence *seq, int index) {
 				fits_close_file(seq->fptr[index], &status);
 				seq->fptr[index] = NULL;
 			}
+			close_fits_direct(seq, index);
 			break;
 		default:
 			break;
@@ -864,12 +916,32 @@ int seq_opened_read_region(sequence *seq, int layer, int index, WORD *buffer, co
 			return read_opened_fits_partial(seq, layer, index, buffer, area);
 		case SEQ_SER:
 			return ser_read_opened_partial(seq->ser_file, layer, index, buffer, area);
+		case SEQ_CHUNKED:
+			return chunked_read_opened_partial(seq->chunked_file, layer, index, buffer, area);
 		default:
 			break;
 	}
 	return 0;
 }
 
+/* same as seq_opened_read_region() in float, values being in the range of
+ * 16-bit images. Only FITS of float data are read in float, see
+ * read_opened_fits_partial_float(), others are converted from 16 bits. */
+int seq_opened_read_region_float(sequence *seq, int layer, int index, float *buffer, const rectangle *area) {
+	WORD *data = (WORD *) buffer;
+	size_t i;
+
+	if (seq->type == SEQ_REGULAR && (seq->bitpix == FLOAT_IMG || seq->bitpix == DOUBLE_IMG))
+		return read_opened_fits_partial_float(seq, layer, index, buffer, area);
+	/* the 16-bit data is read in the first half of buffer and widened
+	 * from the end, where it has already been read */
+	if (seq_opened_read_region(seq, layer, index, data, area))
+		return 1;
+	for (i = (size_t) area->w * area->h; i > 0; i--)
+		buffer[i - 1] = (float) data[i - 1];
+	return 0;
+}
+
 
 /*****************************************************************************
  *                         SEQUENCE DATA MANAGEMENT                          *
@@ -993,17 +1065,22 @@ int	get_index_and_basename(const char *filename, char **basename, int *index, in
 }
 
 void remove_prefixed_sequence_files(sequence *seq, const char *prefix) {
+	/* the seqfile and the files kept next to it: index (seqindex.c),
+	 * journal (seqjournal.c), registration cache (regcache.c) and
+	 * multi-point registration data (multipoint.c) */
+	static const char *seq_files_ext[] = { ".seq", ".seqidx", ".seqlog",
+		".rcache", ".mpr" };
 	int i, len;
 	gchar *basename, *seqname;
 	if (!prefix || prefix[0] == '\0')
 		return;
 	basename = g_path_get_basename(seq->seqname);
-	len = strlen(basename) + 5 + strlen(prefix);
-	seqname = malloc(len);
-	g_snprintf(seqname, len, "%s%s.seq", prefix, basename);
-	siril_debug_print("Removing %s\n", seqname);
-	g_unlink(seqname); // removing the seqfile
-	free(seqname);
+	for (i = 0; i < G_N_ELEMENTS(seq_files_ext); i++) {
+		seqname = g_strdup_printf("%s%s%s", prefix, basename, seq_files_ext[i]);
+		siril_debug_print("Removing %s\n", seqname);
+		g_unlink(seqname);
+		g_free(seqname);
+	}
 	g_free(basename);
 
 	switch (seq->type) {
@@ -1026,6 +1103,16 @@ void remove_prefixed_sequence_files(sequence *seq, const char *prefix) {
 		g_snprintf(seqname, len, "%s%s", prefix, basename);
 		siril_debug_print("Removing %s\n", seqname);
 		g_unlink(seqname);
+		free(seqname);
+		break;
+	case SEQ_CHUNKED:
+		basename = seq->chunked_file->filename;
+		len = strlen(basename) + strlen(prefix) + 1;
+		seqname = malloc(len);
+		g_snprintf(seqname, len, "%s%s", prefix, basename);
+		siril_debug_print("Removing %s\n", seqname);
+		g_unlink(seqname);
+		free(seqname);
 		break;
 	}
 }
@@ -1070,6 +1157,8 @@ void free_sequence(sequence *seq, gboolean free_seq_too) {
 		}
 		free(seq->regparam);
 	}
+	free_multipoint_regdata(seq->mpregparam);
+	free_regcache(seq->cache);
 	// free stats
 	if (seq->nb_layers > 0 && seq->stats) {
 		for (layer = 0; layer < seq->nb_layers; layer++) {
@@ -1124,6 +1213,7 @@ void free_sequence(sequence *seq, gboolean free_seq_too) {
 			int status = 0;
 			fits_close_file(seq->fptr[j], &status);
 		}
+		close_fits_direct(seq, j);
 		if (seq->imgparam) {
 			if (seq->imgparam[j].date_obs)
 				free(seq->imgparam[j].date_obs);
@@ -1133,6 +1223,7 @@ void free_sequence(sequence *seq, gboolean free_seq_too) {
 	if (seq->layers)	free(seq->layers);
 	if (seq->imgparam)	free(seq->imgparam);
 	if (seq->fptr)		free(seq->fptr);
+	if (seq->direct)	free(seq->direct);
 
 #ifdef _OPENMP
 	if (seq->fd_lock) {
@@ -1147,6 +1238,10 @@ void free_sequence(sequence *seq, gboolean free_seq_too) {
 		ser_close_file(seq->ser_file);	// frees the data too
 		free(seq->ser_file);
 	}
+	if (seq->chunked_file) {
+		chunked_close_file(seq->chunked_file);
+		free(seq->chunked_file);
+	}
 #ifdef HAVE_FFMS2
 	if (seq->film_file) {
 		film_close_file(seq->film_file);	// frees the data too
@@ -1274,6 +1369,31 @@ void set_shifts(sequence *seq, int frame, int layer, float shiftx, float shifty,
 	if (seq->regparam[layer]) {
 		seq->regparam[layer][frame].shiftx = shiftx;
 		seq->regparam[layer][frame].shifty = data_is_top_down ? -shifty : shifty;
+		memset(&seq->regparam[layer][frame].H, 0, sizeof(Homography));
+	}
+}
+
+/* assign the full transformation of a frame to the reference, which is applied
+ * at stacking instead of the shifts. H is given in the coordinates of the data
+ * it was computed on and, like shifty, is stored in the memory orientation of
+ * the sequence: it is conjugated by the vertical flip if the data is
+ * top-down. */
+void set_homography(sequence *seq, int frame, int layer, Homography H, gboolean data_is_top_down) {
+	if (seq->regparam[layer]) {
+		if (data_is_top_down) {
+			/* conjugation by the vertical flip y' = ry - 1 - y */
+			double h = seq->ry - 1;
+			Homography F = H;
+			F.h01 = -H.h01;
+			F.h02 = H.h02 + h * H.h01;
+			F.h10 = h * H.h20 - H.h10;
+			F.h11 = H.h11 - h * H.h21;
+			F.h12 = h * (H.h22 + h * H.h21) - H.h12 - h * H.h11;
+			F.h21 = -H.h21;
+			F.h22 = H.h22 + h * H.h21;
+			H = F;
+		}
+		seq->regparam[layer][frame].H = H;
 	}
 }
 
@@ -1351,6 +1471,7 @@ gpointer crop_sequence(gpointer p) {
 	int frame, ret;
 	float cur_nb;
 	struct ser_struct *ser_file = NULL;
+	struct chunked_struct *chunked_file = NULL;
 
 	args->retvalue = 0;
 
@@ -1371,6 +1492,24 @@ gpointer crop_sequence(gpointer p) {
 			args->retvalue = 1;
 			siril_add_idle(end_crop_sequence, args);
 		}
+	} else if (args->seq->type == SEQ_CHUNKED) {
+		char dest[256];
+
+		chunked_file = malloc(sizeof(struct chunked_struct));
+		if (chunked_file == NULL) {
+			PRINT_ALLOC_ERR;
+			args->retvalue = 1;
+			siril_add_idle(end_crop_sequence, args);
+			return 0;
+		}
+		sprintf(dest, "%s%s.csq", args->prefix, args->seq->seqname);
+		if (chunked_create_file(dest, chunked_file, args->seq->chunked_file->compression)) {
+			siril_log_message(_("Creating the chunked sequence file failed, aborting.\n"));
+			free(chunked_file);
+			args->retvalue = 1;
+			siril_add_idle(end_crop_sequence, args);
+			return 0;
+		}
 	}
 	set_progress_bar_data(_("Processing..."), PROGRESS_RESET);
 	for (frame = 0, cur_nb = 0.f; frame < args->seq->number; frame++) {
@@ -1400,6 +1539,12 @@ gpointer crop_sequence(gpointer p) {
 					}
 				}
 				break;
+			case SEQ_CHUNKED:
+				if (chunked_write_frame_from_fit(chunked_file, &fit, frame)) {
+					siril_log_message(_("Error while writing the chunked sequence (no space left?)\n"));
+					args->retvalue = 1;
+				}
+				break;
 			default:
 				args->retvalue = 1;	// should not happen
 			}
@@ -1412,6 +1557,9 @@ gpointer crop_sequence(gpointer p) {
 	if (args->seq->type == SEQ_SER) {
 		ser_write_and_close(ser_file);
 		free(ser_file);
+	} else if (chunked_file) {
+		chunked_write_and_close(chunked_file);
+		free(chunked_file);
 	}
 	set_progress_bar_data(PROGRESS_TEXT_RESET, PROGRESS_RESET);
 	siril_add_idle(end_crop_sequence, args);
@@ -1428,6 +1576,8 @@ gboolean sequence_is_rgb(sequence *seq) {
 			return (seq->ser_file->color_id != SER_MONO && com.debayer.open_debayer) ||
 				seq->ser_file->color_id == SER_RGB ||
 				seq->ser_file->color_id == SER_BGR;
+		case SEQ_CHUNKED:
+			return seq->chunked_file->nb_layers == 3;
 		default:
 			return TRUE;
 	}
@@ -1468,6 +1618,28 @@ struct seqpsf_data {
 	double exposure;
 };
 
+static int seqpsf_prepare_hook(struct generic_seq_args *args) {
+	regcache_open(args->seq);	// analysis is done without the cache on failure
+	return 0;
+}
+
+/* the PSF depends on the area in which it is searched and on the photometry
+ * settings when it is computed */
+static guint64 get_psf_cache_key(struct generic_seq_args *args, rectangle *area) {
+	struct seqpsf_args *spsfargs = (struct seqpsf_args *)args->user;
+	guint64 key = regcache_key("psf", args->layer_for_partial);
+	key = regcache_hash(key, area, sizeof(rectangle));
+	key = regcache_hash(key, &spsfargs->for_registration, sizeof(gboolean));
+	if (!spsfargs->for_registration) {
+		key = regcache_hash(key, &com.phot_set.gain, sizeof(double));
+		key = regcache_hash(key, &com.phot_set.inner, sizeof(double));
+		key = regcache_hash(key, &com.phot_set.outer, sizeof(double));
+		key = regcache_hash(key, &com.phot_set.minval, sizeof(int));
+		key = regcache_hash(key, &com.phot_set.maxval, sizeof(int));
+	}
+	return key;
+}
+
 /* Computes FWHM for a sequence image.
  * area is the area from which fit was extracted from the full frame.
  * when the framing is set to follow star, args->area is centered on the found star
@@ -1478,7 +1650,16 @@ int seqpsf_image_hook(struct generic_seq_args *args, int out_index, int index, f
 	data->image_index = index;
 
 	rectangle psfarea = { .x = 0, .y = 0, .w = fit->rx, .h = fit->ry };
-	data->psf = psf_get_minimisation(fit, 0, &psfarea, !spsfargs->for_registration, TRUE);
+	guint64 key = get_psf_cache_key(args, area);
+	fitted_PSF **cached;
+	int nb_cached;
+	if (regcache_get_stars(args->seq, index, key, &cached, &nb_cached)) {
+		data->psf = cached[0];
+		free(cached);	// the star is kept, not freed
+	} else {
+		data->psf = psf_get_minimisation(fit, 0, &psfarea, !spsfargs->for_registration, TRUE);
+		regcache_set_stars(args->seq, index, key, &data->psf, data->psf ? 1 : 0, data->psf ? 1 : 0);
+	}
 	if (data->psf) {
 		data->psf->xpos = data->psf->x0 + area->x;
 		if (fit->top_down)
@@ -1596,6 +1777,7 @@ gboolean end_seqpsf(gpointer p) {
 	}
 
 proper_ending:
+	regcache_save(seq);
 	dont_stop_thread = args->already_in_a_thread;
 	if (spsfargs->list)
 		g_slist_free(spsfargs->list);
@@ -1629,7 +1811,7 @@ int seqpsf(sequence *seq, int layer, gboolean for_registration, gboolean regall,
 	else if (framing == REGISTERED_FRAME)
 		siril_log_color_message(_("The sequence analysis of the PSF will use registration data to move the selection area for each image; this is compatible with parallel processing.\n"), "salmon");
 
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
 	struct seqpsf_args *spsfargs = malloc(sizeof(struct seqpsf_args));
 
 	spsfargs->for_registration = for_registration;
@@ -1644,7 +1826,7 @@ int seqpsf(sequence *seq, int layer, gboolean for_registration, gboolean regall,
 	args->get_photometry_data_for_partial = !for_registration;
 	args->filtering_criterion = (regall == TRUE) ? seq_filter_all : seq_filter_included;
 	args->nb_filtered_images = (regall == TRUE) ? seq->number : seq->selnum;
-	args->prepare_hook = NULL;
+	args->prepare_hook = seqpsf_prepare_hook;
 	args->finalize_hook = NULL;
 	args->image_hook = seqpsf_image_hook;
 	args->idle_function = end_seqpsf;
@@ -19,6 +19,7 @@ gboolean check_if_seq_exist(gchar *basename);
 int	seq_open_image(sequence *seq, int index);
 void	seq_close_image(sequence *seq, int index);
 int	seq_opened_read_region(sequence *seq, int layer, int index, WORD *buffer, const rectangle *area);
+int	seq_opened_read_region_float(sequence *seq, int layer, int index, float *buffer, const rectangle *area);
 void	set_fwhm_star_as_star_list(sequence *seq);
 char *	fit_sequence_get_image_filename(sequence *seq, int index, char *name_buffer, gboolean add_fits_ext);
 char *	fit_sequence_get_image_filename_prefixed(sequence *seq, const char *prefix, int index);
@@ -53,6 +54,7 @@ int	do_fwhm_sequence_processing(sequence *seq, int layer, gboolean print_psf, gb
 int	sequence_find_refimage(sequence *seq);
 void	check_or_allocate_regparam(sequence *seq, int layer);
 void	set_shifts(sequence *seq, int frame, int layer, float shiftx, float shifty, gboolean data_is_top_down);
+void	set_homography(sequence *seq, int frame, int layer, Homography H, gboolean data_is_top_down);
 sequence *create_internal_sequence(int size);
 void	internal_sequence_set(sequence *seq, int index, fits *fit);
 int	internal_sequence_find_index(sequence *seq, fits *fit);
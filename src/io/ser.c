@@ -22,6 +22,9 @@
  * on big endian systems.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
@@ -29,10 +32,14 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 #ifdef _WIN32
 #include <io.h>
 #endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "core/siril.h"
 #include "core/proto.h"
@@ -478,6 +485,12 @@ static int get_SER_Bayer_Pattern(ser_color pattern) {
 /* once a buffer (data) has been acquired from the file, with frame_size pixels
  * read in it, depending on ser_file's endianess and pixel depth, data is
  * reorganized to match Siril's data format . */
+/* TRUE if the 16-bit data of the file are not in the byte order of the host */
+static gboolean ser_needs_byte_swap(struct ser_struct *ser_file) {
+	ser_endian host = G_BYTE_ORDER == G_BIG_ENDIAN ? SER_BIG_ENDIAN : SER_LITTLE_ENDIAN;
+	return ser_file->little_endian != host;
+}
+
 static void ser_manage_endianess_and_depth(struct ser_struct *ser_file,
 		WORD *data, int64_t frame_size) {
 	WORD pixel;
@@ -486,7 +499,7 @@ static void ser_manage_endianess_and_depth(struct ser_struct *ser_file,
 		// inline conversion to 16 bit
 		for (i = frame_size - 1; i >= 0; i--)
 			data[i] = (WORD) (((BYTE*)data)[i]);
-	} else if (ser_file->little_endian == SER_BIG_ENDIAN) {
+	} else if (ser_needs_byte_swap(ser_file)) {
 		// inline conversion
 		for (i = frame_size - 1; i >= 0; i--) {
 			pixel = data[i];
@@ -496,6 +509,157 @@ static void ser_manage_endianess_and_depth(struct ser_struct *ser_file,
 	}
 }
 
+/* reads size bytes from the file at the given offset. With a mapping of the
+ * file, it is a copy from the page cache. With pread(2), the
+ * position of the stream is neither used nor modified, so several threads can
+ * read frames from the same file at the same time, which is what happens in
+ * the parallel sequence processing and stacking. Without it, reads are
+ * serialized with the file lock. */
+static int ser_read_at(struct ser_struct *ser_file, void *buffer, size_t size,
+		int64_t offset) {
+	if (ser_file->mapped) {
+		if (offset + (int64_t)size > ser_file->filesize)
+			return -1;	// truncated file
+		memcpy(buffer, ser_file->mapped + offset, size);
+		return 0;
+	}
+#ifdef HAVE_PREAD
+	size_t done = 0;
+	while (done < size) {
+		ssize_t ret = pread(ser_file->fd, (char *)buffer + done, size - done,
+				(off_t)(offset + done));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pread in SER");
+			return -1;
+		}
+		if (ret == 0)	// truncated file
+			return -1;
+		done += ret;
+	}
+	return 0;
+#else
+	int retval = 0;
+#ifdef _OPENMP
+	omp_set_lock(&ser_file->fd_lock);
+#endif
+	if ((int64_t)-1 == fseek64(ser_file->file, offset, SEEK_SET)) {
+		perror("fseek in SER");
+		retval = -1;
+	} else {
+		if (fread(buffer, 1, size, ser_file->file) != size)
+			retval = -1;
+	}
+#ifdef _OPENMP
+	omp_unset_lock(&ser_file->fd_lock);
+#endif
+	return retval;
+#endif
+}
+
+/* maps the whole file in memory, read-only, if the system allows it. Frame
+ * data can then be used directly from the page cache, without system call nor
+ * intermediate buffer. Failing is not an error, positional reads are used. */
+static void ser_map_file(struct ser_struct *ser_file) {
+	ser_file->mapped = NULL;
+#ifdef HAVE_MMAP
+	if (ser_file->filesize <= SER_HEADER_LEN ||
+			(uint64_t)ser_file->filesize > SIZE_MAX)
+		return;	// 32-bit address space too small for the file
+	void *map = mmap(NULL, (size_t)ser_file->filesize, PROT_READ, MAP_SHARED,
+			ser_file->fd, 0);
+	if (map == MAP_FAILED) {
+		siril_debug_print("SER: could not map the file, using reads\n");
+		return;
+	}
+	ser_file->mapped = map;
+#endif
+}
+
+static void ser_unmap_file(struct ser_struct *ser_file) {
+#ifdef HAVE_MMAP
+	if (ser_file->mapped)
+		munmap((void *)ser_file->mapped, (size_t)ser_file->filesize);
+#endif
+	ser_file->mapped = NULL;
+}
+
+/* Zero-copy read of an area: fit->data points directly into a private mapping
+ * of the frame's rows instead of being allocated and read. Pages are copied by
+ * the system only if the data is modified. This is possible if pixels are
+ * stored in the file as they are in memory, native-endian 16-bit monochrome,
+ * and if rows of the area are contiguous, that is for full-width areas. */
+static int ser_map_area_to_fit(struct ser_struct *ser_file, int frame_no,
+		fits *fit, const rectangle *area) {
+#ifdef HAVE_MMAP
+	static long page_size = 0;
+	int64_t offset, aligned, area_size;
+	void *map;
+
+	if (!ser_file->mapped || ser_file->number_of_planes != 1 ||
+			(ser_file->color_id != SER_MONO && com.debayer.open_debayer) ||
+			ser_file->byte_pixel_depth != SER_PIXEL_DEPTH_16 ||
+			ser_needs_byte_swap(ser_file) ||
+			area->x != 0 || area->w != ser_file->image_width)
+		return -1;
+
+	if (!page_size)
+		page_size = sysconf(_SC_PAGESIZE);
+	area_size = (int64_t)area->w * area->h * sizeof(WORD);
+	offset = SER_HEADER_LEN + (int64_t)ser_file->image_width *
+		ser_file->image_height * sizeof(WORD) * frame_no +
+		(int64_t)area->y * area->w * sizeof(WORD);
+	if (offset + area_size > ser_file->filesize)
+		return -1;
+	aligned = offset - offset % page_size;
+	map = mmap(NULL, (size_t)(offset - aligned + area_size),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE, ser_file->fd, (off_t)aligned);
+	if (map == MAP_FAILED)
+		return -1;
+
+	clearfits(fit);
+	fit->mapped_base = map;
+	fit->mapped_size = (size_t)(offset - aligned + area_size);
+	fit->bitpix = USHORT_IMG;
+	fit->naxis = 2;
+	fit->rx = fit->naxes[0] = area->w;
+	fit->ry = fit->naxes[1] = area->h;
+	fit->naxes[2] = 1;
+	fit->data = (WORD *)((char *)map + (offset - aligned));
+	fit->pdata[RLAYER] = fit->data;
+	fit->pdata[GLAYER] = fit->data;
+	fit->pdata[BLAYER] = fit->data;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/* reads a monochrome frame from the mapping of the file, converting and
+ * flipping rows while they are copied, instead of reading the frame then
+ * flipping it in place, which saves one pass on the image data */
+static void ser_copy_flipped_mono_frame(struct ser_struct *ser_file,
+		int64_t offset, WORD *data) {
+	int x, y;
+	int w = ser_file->image_width, h = ser_file->image_height;
+	for (y = 0; y < h; y++) {
+		WORD *dst = data + (size_t)(h - y - 1) * w;
+		if (ser_file->byte_pixel_depth == SER_PIXEL_DEPTH_8) {
+			const BYTE *src = ser_file->mapped + offset + (int64_t)y * w;
+			for (x = 0; x < w; x++)
+				dst[x] = (WORD)src[x];
+		} else {
+			const BYTE *src = ser_file->mapped + offset + (int64_t)y * w * 2;
+			memcpy(dst, src, w * sizeof(WORD));
+			if (ser_needs_byte_swap(ser_file)) {
+				for (x = 0; x < w; x++)
+					dst[x] = (dst[x] >> 8) | (dst[x] << 8);
+			}
+		}
+	}
+}
+
 static int ser_alloc_ts(struct ser_struct *ser_file, int frame_no) {
 	int retval = 0;
 #ifdef _OPENMP
@@ -687,7 +851,7 @@ int ser_create_file(const char *filename, struct ser_struct *ser_file,
 		ser_file->file_id = strdup("LUCAM-RECORDER");
 		ser_file->lu_id = 0;
 		ser_file->color_id = SER_MONO;	// this is 0
-		ser_file->little_endian = SER_LITTLE_ENDIAN; // what will it do on big endian machine?
+		ser_file->little_endian = SER_LITTLE_ENDIAN; // swapped on write by big-endian hosts
 		memset(ser_file->observer, 0, 40);
 		memset(ser_file->instrument, 0, 40);
 		memset(ser_file->telescope, 0, 40);
@@ -720,6 +884,11 @@ int ser_open_file(const char *filename, struct ser_struct *ser_file) {
 		return -1;
 	}
 	ser_file->filename = strdup(filename);
+	/* the header may have been fixed with buffered writes, they have to
+	 * reach the file before positional reads are made on it */
+	fflush(ser_file->file);
+	ser_file->fd = fileno(ser_file->file);
+	ser_map_file(ser_file);
 
 #ifdef _OPENMP
 	omp_init_lock(&ser_file->fd_lock);
@@ -732,6 +901,7 @@ int ser_close_file(struct ser_struct *ser_file) {
 	int retval = 0;
 	if (!ser_file)
 		return -1;
+	ser_unmap_file(ser_file);
 	if (ser_file->file) {
 		retval = fclose(ser_file->file);
 		ser_file->file = NULL;
@@ -757,10 +927,11 @@ void ser_init_struct(struct ser_struct *ser_file) {
 /* reads a frame on an already opened SER sequence.
  * frame number starts at 0 */
 int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit) {
-	int retval = 0, i, j, swap = 0;
+	int i, j, swap = 0;
 	int64_t offset, frame_size;
 	size_t read_size;
 	WORD *olddata, *tmp;
+	gboolean flipped = FALSE;
 	if (!ser_file || ser_file->file == NULL || !ser_file->number_of_planes ||
 			!fit || frame_no < 0 || frame_no >= ser_file->frame_count)
 		return -1;
@@ -769,6 +940,15 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit) {
 			ser_file->number_of_planes;
 	read_size = frame_size * ser_file->byte_pixel_depth;
 
+	/* If the user checks the SER CFA box, the video is opened in B&W
+	 * RGB and BGR are not coming from raw data. In consequence CFA does
+	 * not exist for these kind of cam */
+	ser_color type_ser = ser_file->color_id;
+	if (!com.debayer.open_debayer && type_ser != SER_RGB && type_ser != SER_BGR)
+		type_ser = SER_MONO;
+
+	if (fit->mapped_base)	// data cannot be reallocated
+		clearfits(fit);
 	olddata = fit->data;
 	if ((fit->data = realloc(fit->data, frame_size * sizeof(WORD))) == NULL) {
 		PRINT_ALLOC_ERR;
@@ -781,34 +961,20 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit) {
 		(int64_t)ser_file->byte_pixel_depth * (int64_t)frame_no;
 	/*fprintf(stdout, "offset is %lu (frame %d, %d pixels, %d-byte)\n", offset,
 	 frame_no, frame_size, ser_file->pixel_bytedepth);*/
-#ifdef _OPENMP
-	omp_set_lock(&ser_file->fd_lock);
-#endif
-	if ((int64_t)-1 == fseek64(ser_file->file, offset, SEEK_SET)) {
-		perror("fseek in SER");
-		retval = -1;
+	if (ser_file->mapped && type_ser == SER_MONO) {
+		if (offset + (int64_t)read_size > ser_file->filesize)
+			return -1;
+		ser_copy_flipped_mono_frame(ser_file, offset, fit->data);
+		flipped = TRUE;
 	} else {
-		if (fread(fit->data, 1, read_size, ser_file->file) != read_size)
-			retval = -1;
+		if (ser_read_at(ser_file, fit->data, read_size, offset))
+			return -1;
+		ser_manage_endianess_and_depth(ser_file, fit->data, frame_size);
 	}
-#ifdef _OPENMP
-	omp_unset_lock(&ser_file->fd_lock);
-#endif
-	if (retval)
-		return -1;
-
-	ser_manage_endianess_and_depth(ser_file, fit->data, frame_size);
 
 	fit->bitpix = (ser_file->byte_pixel_depth == SER_PIXEL_DEPTH_8) ? BYTE_IMG : USHORT_IMG;
 	fit->orig_bitpix = fit->bitpix;
 
-	/* If the user checks the SER CFA box, the video is opened in B&W
-	 * RGB and BGR are not coming from raw data. In consequence CFA does
-	 * not exist for these kind of cam */
-	ser_color type_ser = ser_file->color_id;
-	if (!com.debayer.open_debayer && type_ser != SER_RGB && type_ser != SER_BGR)
-		type_ser = SER_MONO;
-
 	switch (type_ser) {
 	case SER_MONO:
 		fit->naxis = 2;
@@ -827,8 +993,7 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit) {
 		fit->naxes[1] = fit->ry = ser_file->image_height;
 		fit->naxes[2] = 3;
 		/* Get Bayer informations from header if available */
-		sensor_pattern sensortmp;
-		sensortmp = com.debayer.bayer_pattern;
+		sensor_pattern pattern = com.debayer.bayer_pattern;
 		if (com.debayer.use_bayer_header) {
 			sensor_pattern bayer;
 			bayer = get_SER_Bayer_Pattern(type_ser);
@@ -842,7 +1007,7 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit) {
 								" from Bayer pattern in settings (%s). Overriding settings.\n"),
 								"red", filter_pattern[bayer], filter_pattern[com.debayer.bayer_pattern]);
 					}
-					com.debayer.bayer_pattern = bayer;
+					pattern = bayer;
 				}
 				user_warned = TRUE;
 			}
@@ -850,8 +1015,7 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit) {
 		/* for performance consideration (and many others) we force the interpolation algorithm
 		 * to be BAYER_BILINEAR
 		 */
-		debayer(fit, BAYER_BILINEAR, FALSE);
-		com.debayer.bayer_pattern = sensortmp;
+		debayer(fit, BAYER_BILINEAR, pattern, FALSE);
 		break;
 	case SER_BGR:
 		swap = 2;
@@ -891,7 +1055,8 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit) {
 		}
 	}
 
-	fits_flip_top_to_bottom(fit);
+	if (!flipped)
+		fits_flip_top_to_bottom(fit);
 	fit->top_down = FALSE;
 	return 0;
 }
@@ -941,37 +1106,37 @@ static int read_area_from_image(struct ser_struct *ser_file, const int frame_no,
 	int64_t offset, frame_size;
 	int retval = 0;
 	WORD *read_buffer;
+	gboolean from_mapping = FALSE;
 	size_t read_size = ser_file->image_width * area->h * ser_file->byte_pixel_depth;
 	if (layer != -1) read_size *= 3;
-	if (layer != -1 || area->w != ser_file->image_width) {
-		// allocated space is probably not enough to
-		// store whole lines or RGB data
-		read_buffer = malloc(read_size);
-	}
-	else read_buffer = outbuf;
 
 	frame_size = ser_file->image_width * ser_file->image_height *
 		ser_file->number_of_planes * ser_file->byte_pixel_depth;
-
-#ifdef _OPENMP
-	omp_set_lock(&ser_file->fd_lock);
-#endif
 	// we read the full-stride rectangle that contains the requested area
 	offset = SER_HEADER_LEN + frame_size * frame_no +	// requested frame
-		area->y * ser_file->image_width *
+		(int64_t)area->y * ser_file->image_width *
 		ser_file->byte_pixel_depth * (layer != -1 ? 3 : 1);	// requested area
 
-	if ((int64_t)-1 == fseek64(ser_file->file, offset, SEEK_SET)) {
-		perror("fseek in SER");
-		retval = -1;
-	} else {
-		if (fread(read_buffer, 1, read_size, ser_file->file) != read_size) {
-			retval = -1;
+	if (ser_file->mapped && (layer != -1 || area->w != ser_file->image_width)) {
+		/* pixels are cropped directly from the mapping */
+		if (offset + (int64_t)read_size > ser_file->filesize)
+			return -1;
+		read_buffer = (WORD *)(ser_file->mapped + offset);
+		from_mapping = TRUE;
+	}
+	else if (layer != -1 || area->w != ser_file->image_width) {
+		// allocated space is probably not enough to
+		// store whole lines or RGB data
+		read_buffer = malloc(read_size);
+		if (!read_buffer) {
+			PRINT_ALLOC_ERR;
+			return -1;
 		}
 	}
-#ifdef _OPENMP
-	omp_unset_lock(&ser_file->fd_lock);
-#endif
+	else read_buffer = outbuf;
+
+	if (!from_mapping)
+		retval = ser_read_at(ser_file, read_buffer, read_size, offset);
 	if (!retval) {
 		if (area->w != ser_file->image_width) {
 			// here we crop x-wise our area
@@ -999,7 +1164,7 @@ static int read_area_from_image(struct ser_struct *ser_file, const int frame_no,
 			}
 		}
 	}
-	if (layer != -1 || area->w != ser_file->image_width)
+	if (!from_mapping && (layer != -1 || area->w != ser_file->image_width))
 		free(read_buffer);
 	return retval;
 }
@@ -1011,7 +1176,7 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 	ser_color type_ser;
 	WORD *rawbuf, *demosaiced_buf;
 	rectangle debayer_area, image_area;
-	sensor_pattern sensortmp;
+	sensor_pattern pattern;
 
 	if (!ser_file || ser_file->file == NULL || frame_no < 0
 			|| frame_no >= ser_file->frame_count)
@@ -1039,7 +1204,7 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 		 * we extract one of the three channels and crop it to the requested area. */
 
 		/* Get Bayer informations from header if available */
-		sensortmp = com.debayer.bayer_pattern;
+		pattern = com.debayer.bayer_pattern;
 		if (com.debayer.use_bayer_header) {
 			sensor_pattern bayer;
 			bayer = get_SER_Bayer_Pattern(type_ser);
@@ -1053,7 +1218,7 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 								" from Bayer pattern in settings (%s). Overriding settings.\n"),
 								"red", filter_pattern[bayer], filter_pattern[com.debayer.bayer_pattern]);
 					}
-					com.debayer.bayer_pattern = bayer;
+					pattern = bayer;
 				}
 				user_warned = TRUE;
 			}
@@ -1083,8 +1248,7 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 		 * to be BAYER_BILINEAR
 		 */
 		demosaiced_buf = debayer_buffer(rawbuf, &debayer_area.w,
-				&debayer_area.h, BAYER_BILINEAR, com.debayer.bayer_pattern,
-				NULL);
+				&debayer_area.h, BAYER_BILINEAR, pattern, NULL);
 		free(rawbuf);
 		if (!demosaiced_buf)
 			return -1;
@@ -1100,7 +1264,6 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 		}
 
 		free(demosaiced_buf);
-		com.debayer.bayer_pattern = sensortmp;
 		break;
 
 	case SER_BGR:
@@ -1120,8 +1283,12 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 
 int ser_read_opened_partial_fits(struct ser_struct *ser_file, int layer,
 		int frame_no, fits *fit, const rectangle *area) {
-	if (new_fit_image(&fit, area->w, area->h, 1))
-		return -1;
+	int retval = 0;
+	if (ser_map_area_to_fit(ser_file, frame_no, fit, area)) {
+		if (new_fit_image(&fit, area->w, area->h, 1))
+			return -1;
+		retval = 1;	// data still has to be read
+	}
 	fit->top_down = TRUE;
 	if (ser_file->ts) {
 		char *timestamp = ser_timestamp(ser_file->ts[frame_no]);
@@ -1130,6 +1297,8 @@ int ser_read_opened_partial_fits(struct ser_struct *ser_file, int layer,
 			free(timestamp);
 		}
 	}
+	if (!retval)
+		return 0;
 	return ser_read_opened_partial(ser_file, layer, frame_no, fit->pdata[0], area);
 }
 
@@ -1173,7 +1342,7 @@ int ser_write_frame_from_fit(struct ser_struct *ser_file, fits *fit, int frame_n
 			if (ser_file->byte_pixel_depth == SER_PIXEL_DEPTH_8)
 				data8[dest] = (BYTE)(fit->pdata[plane][pixel]);
 			else {
-				if (ser_file->little_endian == SER_BIG_ENDIAN)
+				if (ser_needs_byte_swap(ser_file))
 					data16[dest] = (fit->pdata[plane][pixel] >> 8 | fit->pdata[plane][pixel] << 8);
 				else
 					data16[dest] = fit->pdata[plane][pixel];
@@ -108,6 +108,8 @@ struct ser_struct {
 	ser_pixdepth byte_pixel_depth;	// more useful representation of the bit_pixel_depth
 	unsigned int number_of_planes;	// derived from the color_id
 	FILE *file;
+	int fd;				// descriptor of file, for positional reads
+	const BYTE *mapped;		// read-only mapping of the file, NULL if unavailable
 	char *filename;
 #ifdef _OPENMP
 	omp_lock_t fd_lock, ts_lock;
@@ -41,6 +41,7 @@
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "core/siril.h"
@@ -49,6 +50,11 @@
 
 #undef ECC_DEBUG
 
+/* the pyramid has a level for each halving of the image while its smaller
+ * side is at least ECC_MIN_LEVEL_SIZE pixels */
+#define ECC_MIN_LEVEL_SIZE 256
+#define ECC_MAX_LEVELS 5
+
 /****************************************************************************************\
 *                                       Image Alignment (ECC algorithm)                  *
  \****************************************************************************************/
@@ -304,29 +310,42 @@ static void update_warping_matrix_ECC(Mat& map_matrix, const Mat& update,
 	}
 }
 
-double findTransform_ECC(InputArray templateImage, InputArray inputImage,
-		InputOutputArray warpMatrix, int motionType, TermCriteria criteria,
-		InputArray inputMask) {
-
-	Mat src = templateImage.getMat(); //template image
-	Mat dst = inputImage.getMat(); //input image (to be warped)
-	Mat map = warpMatrix.getMat(); //warp (transformation)
-
-	assert(!src.empty());
+/* template image at one level of the pyramid */
+struct ecc_level {
+	Mat templateFloat;	// (smoothed) template
+	Mat Xgrid, Ygrid;	// pixel coordinates, not used for translations
+};
+
+struct ecc_reference_struct {
+	std::vector<ecc_level> levels;	// from the full resolution to the coarsest
+	int motionType;
+};
+
+/* buffers used to align an image, kept from one frame to the next so that
+ * they are allocated only once for the sequence */
+struct ecc_workspace_struct {
+	std::vector<Mat> pyramid;	// input image at each level
+	Mat imageFloat;		// (smoothed) input image
+	Mat preMask;
+	Mat gradientX, gradientY;
+	Mat imageWarped, gradientXWarped, gradientYWarped, imageMask;
+	Mat templateZM;
+	Mat jacobian, err;
+};
+
+/* The template is prepared once in the ecc_level and the buffers are those of
+ * the workspace. No input mask is used. */
+static double findTransform_ECC(const ecc_level &level, const Mat &dst,
+		Mat &map, int motionType, TermCriteria criteria, ecc_workspace *work) {
+
+	const Mat &templateFloat = level.templateFloat;
+	const Mat &Xgrid = level.Xgrid;
+	const Mat &Ygrid = level.Ygrid;
+
+	assert(!templateFloat.empty());
 	assert(!dst.empty());
-
-	if (!(src.type() == dst.type()))
-		std::cerr << "Both input images must have the same data type"
-				<< std::endl;
-
-	//accept only 1-channel images
-	if (src.type() != CV_8UC1 && src.type() != CV_32FC1)
-		std::cerr << "Images must have 8uC1 or 32fC1 type" << std::endl;
-
-	if (map.type() != CV_32FC1)
-		std::cerr << "warpMatrix must be single-channel floating-point matrix"
-				<< std::endl;
-
+	assert(dst.type() == CV_32FC1);
+	assert(map.type() == CV_32FC1);
 	assert(map.cols == 3);
 	assert(map.rows == 2 || map.rows == 3);
 
@@ -360,65 +379,34 @@ double findTransform_ECC(InputArray templateImage, InputArray inputImage,
 
 	const int numberOfParameters = paramTemp;
 
-	const int ws = src.cols;
-	const int hs = src.rows;
+	const int ws = templateFloat.cols;
+	const int hs = templateFloat.rows;
 	const int wd = dst.cols;
 	const int hd = dst.rows;
 
-	Mat Xcoord = Mat(1, ws, CV_32F);
-	Mat Ycoord = Mat(hs, 1, CV_32F);
-	Mat Xgrid = Mat(hs, ws, CV_32F);
-	Mat Ygrid = Mat(hs, ws, CV_32F);
-
-	float* XcoPtr = Xcoord.ptr<float>(0);
-	float* YcoPtr = Ycoord.ptr<float>(0);
-	int j;
-	for (j = 0; j < ws; j++)
-		XcoPtr[j] = (float) j;
-	for (j = 0; j < hs; j++)
-		YcoPtr[j] = (float) j;
-
-	repeat(Xcoord, hs, 1, Xgrid);
-	repeat(Ycoord, 1, ws, Ygrid);
-
-	Xcoord.release();
-	Ycoord.release();
-
-	Mat templateZM = Mat(hs, ws, CV_32F); // to store the (smoothed)zero-mean version of template
-	Mat templateFloat = Mat(hs, ws, CV_32F); // to store the (smoothed) template
-	Mat imageFloat = Mat(hd, wd, CV_32F); // to store the (smoothed) input image
-	Mat imageWarped = Mat(hs, ws, CV_32F); // to store the warped zero-mean input image
-	Mat imageMask = Mat(hs, ws, CV_8U); //to store the final mask
-
-	Mat inputMaskMat = inputMask.getMat();
-	//to use it for mask warping
-	Mat preMask;
-	if (inputMask.empty())
-		preMask = Mat::ones(hd, wd, CV_8U);
-	else
-		threshold(inputMask, preMask, 0, 1, THRESH_BINARY);
-
-	//gaussian filtering is optional
-	src.convertTo(templateFloat, templateFloat.type());
-	GaussianBlur(templateFloat, templateFloat, Size(5, 5), 0, 0);
+	Mat &templateZM = work->templateZM; // to store the (smoothed)zero-mean version of template
+	Mat &imageFloat = work->imageFloat; // to store the (smoothed) input image
+	Mat &imageWarped = work->imageWarped; // to store the warped zero-mean input image
+	Mat &imageMask = work->imageMask; //to store the final mask
+	templateZM.create(hs, ws, CV_32F);
+	imageWarped.create(hs, ws, CV_32F);
+	imageMask.create(hs, ws, CV_8U);
 
-	Mat preMaskFloat;
-	preMask.convertTo(preMaskFloat, CV_32F);
-	GaussianBlur(preMaskFloat, preMaskFloat, Size(5, 5), 0, 0);
-	// Change threshold.
-	preMaskFloat *= (0.5 / 0.95);
-	// Rounding conversion.
-	preMaskFloat.convertTo(preMask, preMask.type());
-	preMask.convertTo(preMaskFloat, preMaskFloat.type());
+	//without input mask, the whole input image is used
+	Mat &preMask = work->preMask;
+	preMask.create(hd, wd, CV_8U);
+	preMask.setTo(Scalar(1));
 
-	dst.convertTo(imageFloat, imageFloat.type());
-	GaussianBlur(imageFloat, imageFloat, Size(5, 5), 0, 0);
+	//gaussian filtering is optional
+	GaussianBlur(dst, imageFloat, Size(5, 5), 0, 0);
 
 	// needed matrices for gradients and warped gradients
-	Mat gradientX = Mat::zeros(hd, wd, CV_32FC1);
-	Mat gradientY = Mat::zeros(hd, wd, CV_32FC1);
-	Mat gradientXWarped = Mat(hs, ws, CV_32FC1);
-	Mat gradientYWarped = Mat(hs, ws, CV_32FC1);
+	Mat &gradientX = work->gradientX;
+	Mat &gradientY = work->gradientY;
+	Mat &gradientXWarped = work->gradientXWarped;
+	Mat &gradientYWarped = work->gradientYWarped;
+	gradientXWarped.create(hs, ws, CV_32FC1);
+	gradientYWarped.create(hs, ws, CV_32FC1);
 
 	// calculate first order image derivatives
 	Matx13f dx(-0.5f, 0.0f, 0.5f);
@@ -426,11 +414,9 @@ double findTransform_ECC(InputArray templateImage, InputArray inputImage,
 	filter2D(imageFloat, gradientX, -1, dx);
 	filter2D(imageFloat, gradientY, -1, dx.t());
 
-	gradientX = gradientX.mul(preMaskFloat);
-	gradientY = gradientY.mul(preMaskFloat);
-
 	// matrices needed for solving linear equation system for maximizing ECC
-	Mat jacobian = Mat(hs, ws * numberOfParameters, CV_32F);
+	Mat &jacobian = work->jacobian;
+	jacobian.create(hs, ws * numberOfParameters, CV_32F);
 	Mat hessian = Mat(numberOfParameters, numberOfParameters, CV_32F);
 	Mat hessianInv = Mat(numberOfParameters, numberOfParameters, CV_32F);
 	Mat imageProjection = Mat(numberOfParameters, 1, CV_32F);
@@ -439,7 +425,8 @@ double findTransform_ECC(InputArray templateImage, InputArray inputImage,
 	Mat errorProjection = Mat(numberOfParameters, 1, CV_32F);
 
 	Mat deltaP = Mat(numberOfParameters, 1, CV_32F); //transformation parameter correction
-	Mat err = Mat(hs, ws, CV_32F); //error as 2D matrix
+	Mat &err = work->err; //error as 2D matrix
+	err.create(hs, ws, CV_32F);
 
 	const int imageFlags = INTER_LINEAR + WARP_INVERSE_MAP;
 	const int maskFlags = INTER_NEAREST + WARP_INVERSE_MAP;
@@ -476,8 +463,7 @@ double findTransform_ECC(InputArray templateImage, InputArray inputImage,
 		meanStdDev(templateFloat, tmpMean, tmpStd, imageMask);
 
 		subtract(imageWarped, imgMean, imageWarped, imageMask); //zero-mean input
-		templateZM = Mat::zeros(templateZM.rows, templateZM.cols,
-				templateZM.type());
+		templateZM.setTo(Scalar(0));
 		subtract(templateFloat, tmpMean, templateZM, imageMask); //zero-mean template
 
 		const double tmpNorm = std::sqrt(
@@ -555,27 +541,114 @@ double findTransform_ECC(InputArray templateImage, InputArray inputImage,
 
 /* siril code starts here, code above is from opencv */
 
-int findTransform(fits *reference, fits *image, int layer,
-		reg_ecc *reg_param) {
+static int get_pyramid_levels(int width, int height) {
+	int levels = 1, size = min(width, height);
+	while (levels < ECC_MAX_LEVELS && (size >> levels) >= ECC_MIN_LEVEL_SIZE)
+		levels++;
+	return levels;
+}
+
+/* the warp matrix found on a level of the pyramid, expressed for the level
+ * of twice its resolution */
+static void scale_warp_matrix(Mat &map) {
+	map.at<float>(0, 2) *= 2.f;
+	map.at<float>(1, 2) *= 2.f;
+	if (map.rows == 3) {
+		map.at<float>(2, 0) *= 0.5f;
+		map.at<float>(2, 1) *= 0.5f;
+	}
+}
+
+/* The reference is converted and smoothed once for all frames, at the full
+ * resolution and on each level of a pyramid of halved images. */
+ecc_reference *new_ecc_reference(fits *reference, int layer) {
 	Mat ref(reference->ry, reference->rx, CV_16UC1, reference->pdata[layer]);
+	ecc_reference *ecc_ref = new ecc_reference_struct;
+	int nb_levels = get_pyramid_levels(reference->rx, reference->ry);
+	Mat level;
+
+	ecc_ref->motionType = WARP_MODE_TRANSLATION;
+	ecc_ref->levels.resize(nb_levels);
+	ref.convertTo(level, CV_32FC1, 1.0 / reference->stats[layer]->max);
+	for (int l = 0; l < nb_levels; l++) {
+		ecc_level &lev = ecc_ref->levels[l];
+		if (l > 0) {
+			Mat next;
+			pyrDown(level, next);
+			level = next;
+		}
+		GaussianBlur(level, lev.templateFloat, Size(5, 5), 0, 0);
+
+		if (ecc_ref->motionType != WARP_MODE_TRANSLATION) {
+			const int ws = level.cols;
+			const int hs = level.rows;
+			Mat Xcoord = Mat(1, ws, CV_32F);
+			Mat Ycoord = Mat(hs, 1, CV_32F);
+			float* XcoPtr = Xcoord.ptr<float>(0);
+			float* YcoPtr = Ycoord.ptr<float>(0);
+			int j;
+			for (j = 0; j < ws; j++)
+				XcoPtr[j] = (float) j;
+			for (j = 0; j < hs; j++)
+				YcoPtr[j] = (float) j;
+
+			repeat(Xcoord, hs, 1, lev.Xgrid);
+			repeat(Ycoord, 1, ws, lev.Ygrid);
+		}
+	}
+	siril_debug_print("ECC reference prepared on %d levels\n", nb_levels);
+	return ecc_ref;
+}
+
+void free_ecc_reference(ecc_reference *reference) {
+	delete reference;
+}
+
+ecc_workspace *new_ecc_workspace() {
+	return new ecc_workspace_struct;
+}
+
+void free_ecc_workspace(ecc_workspace *workspace) {
+	delete workspace;
+}
+
+/* The shift is first estimated on the coarsest level of the pyramid, where
+ * large shifts are only a few pixels, then refined on each finer level
+ * starting from the shift of the previous one. A level that fails leaves its
+ * warp matrix undefined, the next one starts from the last good estimate. */
+int findTransform(ecc_reference *reference, ecc_workspace *work, fits *image,
+		int layer, reg_ecc *reg_param) {
 	Mat im(image->ry, image->rx, CV_16UC1, image->pdata[layer]);
 	Mat warp_matrix = Mat::eye(2, 3, CV_32F);
-	WARP_MODE warp_mode = WARP_MODE_TRANSLATION;
+	Mat last_good;
+	int nb_levels = (int) reference->levels.size();
 	int number_of_iterations = 180;
 	double termination_eps = 0.002;
+	double ecc = -1.0;
 	int retvalue = 0;
 
-	/* this conversion operation of the reference could be avoided since
-	 * it's the same for all tested images */
-	ref.convertTo(ref, CV_32FC1, 1.0/reference->stats[layer]->max);
-	im.convertTo(im, CV_32FC1, 1.0/image->stats[layer]->max);
+	std::vector<Mat> &pyramid = work->pyramid;
+	pyramid.resize(nb_levels);
+	im.convertTo(pyramid[0], CV_32FC1, 1.0/image->stats[layer]->max);
+	for (int l = 1; l < nb_levels; l++)
+		pyrDown(pyramid[l - 1], pyramid[l]);
 
 	// Define termination criteria
 	TermCriteria criteria (TermCriteria::COUNT+TermCriteria::EPS, number_of_iterations, termination_eps);
 
-	double ecc = findTransform_ECC(ref, im, warp_matrix, warp_mode, criteria, noArray());
+	for (int l = nb_levels - 1; l >= 0; l--) {
+		warp_matrix.copyTo(last_good);
+		ecc = findTransform_ECC(reference->levels[l], pyramid[l], warp_matrix,
+				reference->motionType, criteria, work);
+#ifdef ECC_DEBUG
+		std::cout << "level " << l << ": ecc = " << ecc << std::endl;
+#endif
+		if (!(ecc > 0.0))	// failed or NaN
+			last_good.copyTo(warp_matrix);
+		if (l > 0)
+			scale_warp_matrix(warp_matrix);
+	}
 #ifdef ECC_DEBUG
-	std::cout << "ecc = " << ecc << std::endl;
 	std::cout << "result = " << std::endl << warp_matrix << std::endl;
 #endif
 	if (ecc > 0.8) {
@@ -585,7 +658,7 @@ int findTransform(fits *reference, fits *image, int layer,
 	else retvalue = 1;
 
 	warp_matrix.release();
-	ref.release();
+	last_good.release();
 	im.release();
 	return retvalue;
 }
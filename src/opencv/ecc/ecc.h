@@ -40,7 +40,18 @@ struct reg_ecc_struct {
 	float dy;
 };
 
-int findTransform(fits *reference, fits *image, int layer, reg_ecc *reg_param);
+/* reference image prepared for the alignment of all frames */
+typedef struct ecc_reference_struct ecc_reference;
+/* buffers of the alignment, one for each thread aligning frames */
+typedef struct ecc_workspace_struct ecc_workspace;
+
+ecc_reference *new_ecc_reference(fits *reference, int layer);
+void free_ecc_reference(ecc_reference *reference);
+ecc_workspace *new_ecc_workspace(void);
+void free_ecc_workspace(ecc_workspace *workspace);
+
+int findTransform(ecc_reference *reference, ecc_workspace *work, fits *image,
+		int layer, reg_ecc *reg_param);
 
 #ifdef __cplusplus
 }
@@ -400,80 +400,6 @@ int cvApplyScaleToH(Homography *H1, double s) {
 	return 0;
 }
 
-// transform an image using the homography.
-int cvTransformImage(fits *image, long width, long height, Homography Hom, int interpolation) {
-	assert(image->data);
-	assert(image->rx);
-	assert(image->ry);
-
-	// preparing data
-	Mat in, out;
-	WORD *bgrbgr = NULL;
-	WORD *newdata;
-
-	if (image->naxes[2] == 1) {
-		in = Mat(image->ry, image->rx, CV_16UC1, image->data);
-		out = Mat(height, width, CV_16UC1);
-	}
-	else if (image->naxes[2] == 3) {
-		bgrbgr = fits_to_bgrbgr(image);
-		in = Mat(image->ry, image->rx, CV_16UC3, bgrbgr);
-		out = Mat(height, width, CV_16UC3);
-	}
-	else {
-		siril_log_message(_("Transformation is not supported for images with %d channels\n"), image->naxes[2]);
-		return -1;
-	}
-
-	Mat H = Mat::eye(3, 3, CV_64FC1);
-	convert_H_to_MatH(&Hom, H);
-
-	// OpenCV function
-	warpPerspective(in, out, H, Size(width, height), interpolation);
-
-	// saving result
-	long ndata = height * width;
-
-	if (image->ry != height || image->rx != width) {
-		newdata = (WORD*) realloc(image->data, ndata * sizeof(WORD) * image->naxes[2]);
-		if (!newdata) {
-			PRINT_ALLOC_ERR;
-			return 1;
-		}
-		image->data = newdata;
-	}
-
-	if (image->naxes[2] == 1) {
-		memcpy(image->data, out.data, ndata * sizeof(WORD));
-		image->pdata[RLAYER] = image->data;
-		image->pdata[GLAYER] = image->data;
-		image->pdata[BLAYER] = image->data;
-	} else {
-		std::vector<Mat> channel(3);
-		split(out, channel);
-		memcpy(image->data, channel[2].data, ndata * sizeof(WORD));
-		memcpy(image->data + ndata, channel[1].data, ndata * sizeof(WORD));
-		memcpy(image->data + ndata * 2, channel[0].data, ndata * sizeof(WORD));
-
-		image->pdata[RLAYER] = image->data;
-		image->pdata[GLAYER] = image->data + ndata;
-		image->pdata[BLAYER] = image->data + ndata * 2;
-
-
-		channel[0].release();
-		channel[1].release();
-		channel[2].release();
-		delete[] bgrbgr;
-	}
-	image->rx = image->naxes[0] = out.cols;
-	image->ry = image->naxes[1] = out.rows;
-	H.release();
-	in.release();
-	out.release();
-	invalidate_stats_from_fit(image);
-	return 0;
-}
-
 int cvUnsharpFilter(fits* image, double sigma, double amount) {
 	assert(image->data);
 	assert(image->rx);
@@ -274,7 +274,7 @@ static int comet_align_finalize_hook(struct generic_seq_args *args) {
 }
 
 int register_comet(struct registration_args *regargs) {
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
 	args->seq = regargs->seq;
 	/* we don't need to read image data, for simplicity we just read one
 	 * pixel from it, making sure the header is read */
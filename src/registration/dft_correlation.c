@@ -0,0 +1,213 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <complex.h>
+#include <fftw3.h>
+#include <glib.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "gui/progress_and_log.h"
+
+#include "dft_correlation.h"
+
+/* FFTW wisdom is kept next to the init file, it makes the measured plans
+ * of the sizes already used free to create */
+static gchar *get_wisdom_filename() {
+	gchar *dir, *filename;
+	if (!com.initfile)
+		return NULL;
+	dir = g_path_get_dirname(com.initfile);
+	filename = g_build_filename(dir, "fftw_wisdom", NULL);
+	g_free(dir);
+	return filename;
+}
+
+static void free_thread_data(struct dft_thread_data *data) {
+	if (data->in) fftw_free(data->in);
+	if (data->spectrum) fftw_free(data->spectrum);
+	if (data->correlation) fftw_free(data->correlation);
+}
+
+/* creates the plans and the buffers of nb_threads threads for areas of size x
+ * size pixels. With measure, plans are optimized, which is slower to do and
+ * worth it for long sequences only, unless wisdom from a previous run is used. */
+struct dft_correlation *new_dft_correlation(int size, int nb_threads, gboolean measure) {
+	struct dft_correlation *dft;
+	size_t sqsize = (size_t) size * size, spsize = (size_t) size * (size / 2 + 1);
+	gchar *wisdom = NULL;
+	int i;
+
+	dft = calloc(1, sizeof(struct dft_correlation));
+	if (!dft) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	dft->size = size;
+	dft->nb_threads = nb_threads < 1 ? 1 : nb_threads;
+	dft->threads = calloc(dft->nb_threads, sizeof(struct dft_thread_data));
+	dft->ref_spectrum = fftw_malloc(sizeof(fftw_complex) * spsize);
+	if (!dft->threads || !dft->ref_spectrum) {
+		PRINT_ALLOC_ERR;
+		free_dft_correlation(dft);
+		return NULL;
+	}
+	for (i = 0; i < dft->nb_threads; i++) {
+		struct dft_thread_data *data = dft->threads + i;
+		data->in = fftw_malloc(sizeof(double) * sqsize);
+		data->spectrum = fftw_malloc(sizeof(fftw_complex) * spsize);
+		data->correlation = fftw_malloc(sizeof(double) * sqsize);
+		if (!data->in || !data->spectrum || !data->correlation) {
+			PRINT_ALLOC_ERR;
+			free_dft_correlation(dft);
+			return NULL;
+		}
+	}
+
+	if (com.fftw_wisdom) {
+		wisdom = get_wisdom_filename();
+		if (wisdom && !fftw_import_wisdom_from_filename(wisdom))
+			siril_debug_print("No FFTW wisdom read from %s\n", wisdom);
+	}
+	/* measuring overwrites the arrays, data is set after planning */
+	dft->forward = fftw_plan_dft_r2c_2d(size, size, dft->threads[0].in,
+			dft->threads[0].spectrum, measure ? FFTW_MEASURE : FFTW_ESTIMATE);
+	dft->backward = fftw_plan_dft_c2r_2d(size, size, dft->threads[0].spectrum,
+			dft->threads[0].correlation, measure ? FFTW_MEASURE : FFTW_ESTIMATE);
+	if (wisdom) {
+		if (measure && !fftw_export_wisdom_to_filename(wisdom))
+			siril_debug_print("Could not save FFTW wisdom to %s\n", wisdom);
+		g_free(wisdom);
+	}
+	if (!dft->forward || !dft->backward) {
+		siril_log_message(_("Could not create the Fourier transforms of the registration\n"));
+		free_dft_correlation(dft);
+		return NULL;
+	}
+	return dft;
+}
+
+static void load_area(double *in, WORD *data, int size, int stride) {
+	int x, y;
+	for (y = 0; y < size; y++) {
+		WORD *line = data + (size_t) y * stride;
+		double *out = in + (size_t) y * size;
+		for (x = 0; x < size; x++)
+			out[x] = (double) line[x];
+	}
+}
+
+/* data is the first pixel of the area, in an image of stride pixels wide */
+void dft_correlation_set_reference(struct dft_correlation *dft, WORD *data, int stride) {
+	load_area(dft->threads[0].in, data, dft->size, stride);
+	fftw_execute_dft_r2c(dft->forward, dft->threads[0].in, dft->ref_spectrum);
+}
+
+/* computes the spectrum of an additional reference area, to be given to
+ * dft_correlation_get_shift_from() and freed with fftw_free() */
+fftw_complex *dft_correlation_new_reference(struct dft_correlation *dft, int thread,
+		WORD *data, int stride) {
+	struct dft_thread_data *th = dft->threads + thread;
+	fftw_complex *spectrum = fftw_malloc(sizeof(fftw_complex) * dft->size * (dft->size / 2 + 1));
+	if (!spectrum) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	load_area(th->in, data, dft->size, stride);
+	fftw_execute_dft_r2c(dft->forward, th->in, spectrum);
+	return spectrum;
+}
+
+/* offset of the top of a parabola going through (-1, a), (0, b) and (1, c) */
+static double parabola_peak(double a, double b, double c) {
+	double d = a - 2.0 * b + c;
+	double offset;
+	if (d >= 0.0)	// not a maximum
+		return 0.0;
+	offset = 0.5 * (a - c) / d;
+	if (offset > 0.5)
+		return 0.5;
+	if (offset < -0.5)
+		return -0.5;
+	return offset;
+}
+
+/* computes the shift that aligns the area starting at data with the reference,
+ * with a sub-pixel precision given by parabolas fitted around the correlation
+ * peak. Several threads can call it at the same time with different thread
+ * indices. */
+void dft_correlation_get_shift_from(struct dft_correlation *dft, int thread,
+		fftw_complex *reference, WORD *data, int stride, double *shiftx, double *shifty) {
+	struct dft_thread_data *th = dft->threads + thread;
+	int size = dft->size, x, y, xm, xp, ym, yp;
+	size_t i, shift = 0, sqsize = (size_t) size * size;
+	size_t spsize = (size_t) size * (size / 2 + 1);
+	double *c = th->correlation;
+
+	load_area(th->in, data, size, stride);
+	fftw_execute_dft_r2c(dft->forward, th->in, th->spectrum);
+
+	for (i = 0; i < spsize; i++)
+		th->spectrum[i] = reference[i] * conj(th->spectrum[i]);
+	/* the mean levels only add a constant to the correlation, removing
+	 * them keeps the peak well defined for the refinement */
+	th->spectrum[0] = 0.0;
+
+	/* the backward transform destroys the spectrum, it is not needed anymore */
+	fftw_execute_dft_c2r(dft->backward, th->spectrum, c);
+
+	for (i = 1; i < sqsize; i++) {
+		if (c[i] > c[shift])
+			shift = i;
+	}
+	y = shift / size;
+	x = shift % size;
+	xm = (x + size - 1) % size;
+	xp = (x + 1) % size;
+	ym = (y + size - 1) % size;
+	yp = (y + 1) % size;
+
+	*shiftx = (x > size / 2 ? x - size : x) +
+		parabola_peak(c[y * size + xm], c[shift], c[y * size + xp]);
+	*shifty = (y > size / 2 ? y - size : y) +
+		parabola_peak(c[ym * size + x], c[shift], c[yp * size + x]);
+}
+
+void dft_correlation_get_shift(struct dft_correlation *dft, int thread, WORD *data,
+		double *shiftx, double *shifty) {
+	dft_correlation_get_shift_from(dft, thread, dft->ref_spectrum, data, dft->size,
+			shiftx, shifty);
+}
+
+void free_dft_correlation(struct dft_correlation *dft) {
+	int i;
+	if (!dft)
+		return;
+	if (dft->forward) fftw_destroy_plan(dft->forward);
+	if (dft->backward) fftw_destroy_plan(dft->backward);
+	if (dft->threads) {
+		for (i = 0; i < dft->nb_threads; i++)
+			free_thread_data(dft->threads + i);
+		free(dft->threads);
+	}
+	if (dft->ref_spectrum) fftw_free(dft->ref_spectrum);
+	free(dft);
+}
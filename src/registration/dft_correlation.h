@@ -0,0 +1,36 @@
+#ifndef _DFT_CORRELATION_H_
+#define _DFT_CORRELATION_H_
+
+#include <fftw3.h>
+#include "core/siril.h"
+
+/* buffers of a thread computing shifts */
+struct dft_thread_data {
+	double *in;		/* size x size image area */
+	fftw_complex *spectrum;	/* size x (size / 2 + 1) half spectrum */
+	double *correlation;	/* size x size cross-correlation */
+};
+
+/* Cross-correlation of square image areas with a reference, computed with
+ * real-to-complex transforms. Plans are made once and shared by all threads
+ * using the new-array execute functions, each thread having its own buffers,
+ * so that frames can be processed without allocation nor planning. */
+struct dft_correlation {
+	int size;		/* side of the square areas */
+	int nb_threads;
+	fftw_complex *ref_spectrum;	/* half spectrum of the reference */
+	fftw_plan forward, backward;
+	struct dft_thread_data *threads;
+};
+
+struct dft_correlation *new_dft_correlation(int size, int nb_threads, gboolean measure);
+void dft_correlation_set_reference(struct dft_correlation *dft, WORD *data, int stride);
+void dft_correlation_get_shift(struct dft_correlation *dft, int thread, WORD *data,
+		double *shiftx, double *shifty);
+fftw_complex *dft_correlation_new_reference(struct dft_correlation *dft, int thread,
+		WORD *data, int stride);
+void dft_correlation_get_shift_from(struct dft_correlation *dft, int thread,
+		fftw_complex *reference, WORD *data, int stride, double *shiftx, double *shifty);
+void free_dft_correlation(struct dft_correlation *dft);
+
+#endif
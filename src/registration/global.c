@@ -29,17 +29,20 @@
 #include "core/proto.h"
 #include "algos/star_finder.h"
 #include "algos/PSF.h"
+#include "algos/warp.h"
 #include "gui/PSF_list.h"
 #include "gui/progress_and_log.h"
 #include "gui/callbacks.h"
 #include "io/sequence.h"
 #include "io/ser.h"
+#include "io/chunked.h"
+#include "io/regcache.h"
 #include "registration/matching/atpmatch.h"
 #include "registration/matching/match.h"
 #include "registration/matching/misc.h"
 #include "opencv/opencv.h"
 
-#define MAX_STARS_FITTED 2000
+#define MAX_STARS_FITTED 5000
 
 /* TODO:
  * check usage of openmp in functions called by these ones (to be disabled)
@@ -54,10 +57,71 @@ struct star_align_data {
 	regdata *current_regdata;
 	fitted_PSF **refstars;
 	int fitted_stars;
+	MATCH_REF *match_refs[NB_OF_MATCHING_TRY - 1];	// triangles of refstars for each try
 	BYTE *success;
 	point ref;
 };
 
+/* number of bright stars used for the star matching at each try: the
+ * AT_MATCH_NBRIGHT brightest stars are enough most of the time, then many
+ * more are used, with the triangles of their neighbours */
+static int get_nobj(int attempt) {
+	return attempt == 0 ? AT_MATCH_NBRIGHT : AT_MATCH_NN_NBRIGHT * attempt;
+}
+
+/* the triangles of the reference stars are the same for all images, they are
+ * made once and shared by the threads */
+static int make_match_references(struct star_align_data *sadata) {
+	int attempt;
+	for (attempt = 0; attempt < NB_OF_MATCHING_TRY - 1; attempt++) {
+		sadata->match_refs[attempt] = new_star_match_reference(sadata->refstars,
+				sadata->fitted_stars, get_nobj(attempt));
+		if (!sadata->match_refs[attempt])
+			return 1;
+	}
+	return 0;
+}
+
+static void free_match_references(struct star_align_data *sadata) {
+	int attempt;
+	for (attempt = 0; attempt < NB_OF_MATCHING_TRY - 1; attempt++) {
+		atMatchRefDel(sadata->match_refs[attempt]);
+		sadata->match_refs[attempt] = NULL;
+	}
+}
+
+/* stars found by peaker() depend on the star finder settings and on the
+ * selection, they are kept in the cache of the sequence for the next
+ * registrations */
+static guint64 get_stars_cache_key(struct registration_args *regargs, rectangle *area) {
+	guint64 key = regcache_key("peaker", regargs->layer);
+	key = regcache_hash(key, &com.starfinder_conf.radius, sizeof(int));
+	key = regcache_hash(key, &com.starfinder_conf.sigma, sizeof(double));
+	key = regcache_hash(key, &com.starfinder_conf.roundness, sizeof(double));
+	if (area)
+		key = regcache_hash(key, area, sizeof(rectangle));
+	return key;
+}
+
+/* finds the stars of the frame index, or gets those found by a previous
+ * registration. Only the stars that can be used for the matching are kept. */
+static fitted_PSF **find_stars(sequence *seq, struct registration_args *regargs,
+		int index, fits *fit, int *nb_stars) {
+	rectangle *area = NULL;
+	fitted_PSF **stars;
+	guint64 key;
+
+	if (regargs->matchSelection && regargs->selection.w > 0 && regargs->selection.h > 0)
+		area = &regargs->selection;
+	key = get_stars_cache_key(regargs, area);
+	if (regcache_get_stars(seq, index, key, &stars, nb_stars))
+		return stars;
+	stars = peaker(fit, regargs->layer, &com.starfinder_conf, nb_stars, area, FALSE);
+	if (stars)
+		regcache_set_stars(seq, index, key, stars, *nb_stars, min(*nb_stars, MAX_STARS_FITTED));
+	return stars;
+}
+
 static int star_align_prepare_hook(struct generic_seq_args *args) {
 	struct star_align_data *sadata = args->user;
 	struct registration_args *regargs = sadata->regargs;
@@ -90,12 +154,8 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 	}
 	siril_log_color_message(_("Reference Image:\n"), "green");
 
-	if (regargs->matchSelection && regargs->selection.w > 0 && regargs->selection.h > 0) {
-		com.stars = peaker(&fit, regargs->layer, &com.starfinder_conf, &nb_stars, &regargs->selection, FALSE);
-	}
-	else {
-		com.stars = peaker(&fit, regargs->layer, &com.starfinder_conf, &nb_stars, NULL, FALSE);
-	}
+	regcache_open(args->seq);
+	com.stars = find_stars(args->seq, regargs, regargs->reference_image, &fit, &nb_stars);
 
 	siril_log_message(_("Found %d stars in reference, channel #%d\n"), nb_stars, regargs->layer);
 
@@ -154,6 +214,9 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 	siril_log_message(_("FWHMy:%*.2f %s\n"), 12, FWHMy, units);
 	sadata->current_regdata[regargs->reference_image].fwhm = FWHMx;
 	sadata->current_regdata[regargs->reference_image].roundness = FWHMy/FWHMx;
+
+	if (make_match_references(sadata))
+		return 1;	// freed by the finalize hook
 	
 	if (!regargs->translation_only) {
 		// allocate destination sequence data
@@ -184,6 +247,21 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 			args->new_ser = NULL;
 			return 1;
 		}
+	} else if (args->seq->type == SEQ_CHUNKED) {
+		char dest[256];
+		const char *ptr = strrchr(args->seq->seqname, G_DIR_SEPARATOR);
+		if (ptr)
+			snprintf(dest, 255, "%s%s.csq", regargs->prefix, ptr + 1);
+		else
+			snprintf(dest, 255, "%s%s.csq", regargs->prefix, args->seq->seqname);
+
+		args->new_chunked = malloc(sizeof(struct chunked_struct));
+		if (chunked_create_file(dest, args->new_chunked,
+					args->seq->chunked_file->compression)) {
+			free(args->new_chunked);
+			args->new_chunked = NULL;
+			return 1;
+		}
 	}
 
 	sadata->success = calloc(args->nb_filtered_images, sizeof(BYTE));
@@ -198,8 +276,7 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 	struct registration_args *regargs = sadata->regargs;
 	int nbpoints, nb_stars = 0;
 	int retvalue = 1;
-	int nobj = 0;
-	int attempt = 1;
+	int attempt = 0;
 	float FWHMx, FWHMy;
 	char *units;
 	Homography H = { 0 };
@@ -214,15 +291,10 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 
 	if (in_index != regargs->reference_image) {
 		fitted_PSF **stars;
-		if (args->seq->type == SEQ_SER) {
+		if (args->seq->type == SEQ_SER || args->seq->type == SEQ_CHUNKED) {
 			siril_log_color_message(_("Frame %d:\n"), "bold", filenum);
 		}
-		if (regargs->matchSelection && regargs->selection.w > 0 && regargs->selection.h > 0) {
-			stars = peaker(fit, regargs->layer, &com.starfinder_conf, &nb_stars, &regargs->selection, FALSE);
-		}
-		else {
-			stars = peaker(fit, regargs->layer, &com.starfinder_conf, &nb_stars, NULL, FALSE);
-		}
+		stars = find_stars(args->seq, regargs, in_index, fit, &nb_stars);
 
 		siril_log_message(_("Found %d stars in image %d, channel #%d\n"), nb_stars, filenum, regargs->layer);
 
@@ -244,9 +316,9 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 		}
 
 		/* make a loop with different tries in order to align the two sets of data */
-		while (retvalue && attempt < NB_OF_MATCHING_TRY){
-			retvalue = new_star_match(stars, sadata->refstars, nbpoints, nobj, 0.9, 1.1, &H, FALSE);
-			nobj += 50;
+		while (retvalue && attempt < NB_OF_MATCHING_TRY - 1){
+			retvalue = new_star_match(stars, sadata->refstars, nbpoints, get_nobj(attempt),
+					0.9, 1.1, sadata->match_refs[attempt], &H, FALSE);
 			attempt++;
 		}
 		if (retvalue) {
@@ -267,9 +339,10 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 				cvResizeGaussian(fit, fit->rx * 2, fit->ry * 2, OPENCV_NEAREST);
 				cvApplyScaleToH(&H, 2.0);
 			}
-			fits_flip_top_to_bottom(fit);
-			cvTransformImage(fit, (long) sadata->ref.x, (long) sadata->ref.y, H, regargs->interpolation);
-			fits_flip_top_to_bottom(fit);
+			if (warp_fits(fit, (int) sadata->ref.x, (int) sadata->ref.y, H, regargs->interpolation)) {
+				free_fitted_stars(stars);
+				return 1;
+			}
 		}
 
 		free_fitted_stars(stars);
@@ -288,6 +361,13 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 	} else {
 		set_shifts(args->seq, in_index, regargs->layer, (float)H.h02, (float)-H.h12,
 				fit->top_down);
+		if (regargs->transform_at_stacking) {
+			if (in_index == regargs->reference_image) {
+				memset(&H, 0, sizeof(Homography));
+				H.h00 = H.h11 = H.h22 = 1.0;
+			}
+			set_homography(args->seq, in_index, regargs->layer, H, fit->top_down);
+		}
 		args->seq->imgparam[out_index].incl = SEQUENCE_DEFAULT_INCLUDE;
 	}
 	sadata->success[out_index] = 1;
@@ -300,6 +380,8 @@ static int star_align_finalize_hook(struct generic_seq_args *args) {
 	int i, failed = 0;
 
 	free_fitted_stars(sadata->refstars);
+	free_match_references(sadata);
+	regcache_save(args->seq);
 
 	if (!args->retval) {
 		for (i = 0; i < args->nb_filtered_images; i++)
@@ -325,14 +407,27 @@ static int star_align_finalize_hook(struct generic_seq_args *args) {
 				ser_compact_file(args->new_ser, sadata->success, args->nb_filtered_images);
 		}
 
-		// same as ser_finalize_hook()
+		// same as ser_finalize_hook(), the chunked file compacts itself
 		if (args->seq->type == SEQ_SER) {
 			ser_write_and_close(args->new_ser);
 			free(args->new_ser);
 		}
+		if (args->new_chunked) {
+			chunked_write_and_close(args->new_chunked);
+			free(args->new_chunked);
+			args->new_chunked = NULL;
+		}
 
 	} else {
 		regargs->new_total = 0;
+		if (args->new_chunked) {
+			gchar *filename = g_strdup(args->new_chunked->filename);
+			chunked_close_file(args->new_chunked);
+			g_unlink(filename);
+			g_free(filename);
+			free(args->new_chunked);
+			args->new_chunked = NULL;
+		}
 		free(args->seq->regparam[regargs->layer]);
 		args->seq->regparam[regargs->layer] = NULL;
 	}
@@ -366,7 +461,7 @@ static int star_align_finalize_hook(struct generic_seq_args *args) {
 }
 
 int register_star_alignment(struct registration_args *regargs) {
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
 	args->seq = regargs->seq;
 	args->partial_image = FALSE;
 	if (regargs->process_all_frames) {
@@ -228,6 +228,20 @@ static void print_vote_matrix(int **vote_matrix, int numcells);
 #endif
 static int top_vote_getters(int **vote_matrix, int num, int **winner_votes,
 		int **winner_index_A, int **winner_index_B);
+static s_triangle *stars_to_nn_triangles(s_star *star_array, int numstars,
+		int nbright, int *numtriangles);
+static void bin_triangles(MATCH_REF *ref);
+static int sparse_vote_getters(s_triangle *t_array_A, int num_triangles_A,
+		MATCH_REF *ref, int nbright, double min_scale, double max_scale,
+		double rotation_deg, double tolerance_deg, int **winner_votes,
+		int **winner_index_A, int **winner_index_B);
+static MATCH_REF *match_ref_new(s_star *star_array, int numstars,
+		int nbright, double radius);
+static int get_nbright(int num_stars_A, int num_stars_B, int nobj,
+		TRANS *trans, int *nbright);
+static int find_trans(int numA, s_star *listA, MATCH_REF *ref,
+		double min_scale, double max_scale, double rotation_deg,
+		double tolerance_deg, int max_iter, double halt_sigma, TRANS *trans);
 static int calc_trans(int nbright, s_star *star_array_A, int num_stars_A,
 		s_star *star_array_B, int num_stars_B, int *winner_votes,
 		int *winner_index_A, int *winner_index_B, TRANS *trans);
@@ -324,6 +338,9 @@ static int calc_trans_cubic(int nbright, s_star *star_array_A, int num_stars_A,
  * functions to perform actual tasks.  It mostly creates the proper
  * inputs and outputs for the smaller routines.
  *
+ * The triangles of list B are made by atMatchRefNew, see atFindTransRef
+ * to match several lists with the same list B.
+ *
  * RETURN:
  *    SH_SUCCESS         if all goes well
  *    SH_GENERIC_ERROR   if an error occurs
@@ -355,33 +372,182 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 /*       the coeffs which convert coords of chainA */
 /*       into coords of chainB system. */
 ) {
-	int i, nbright, min;
-	int num_stars_A; /* number of stars in chain A */
-	int num_stars_B; /* number of stars in chain B */
-	int num_triangles_A; /* number of triangles formed from chain A */
-	int num_triangles_B; /* number of triangles formed from chain B */
-	int **vote_matrix;
-	int *winner_votes; /* # votes gotten by top pairs of matched stars */
-	int *winner_index_A; /* elem i in this array is index in star array A */
-	/*    which matches ... */
-	int *winner_index_B; /* elem i in this array, index in star array B */
-	int start_pairs;
-	s_star *star_array_A;
+	int nbright, ret;
+	MATCH_REF *ref;
+
+	if (get_nbright(numA, numB, nobj, trans, &nbright) != SH_SUCCESS) {
+		return (SH_GENERIC_ERROR);
+	}
+	ref = match_ref_new(list_to_array(numB, listB), numB, nbright, radius);
+	ret = find_trans(numA, listA, ref, min_scale, max_scale, rotation_deg,
+			tolerance_deg, max_iter, halt_sigma, trans);
+	atMatchRefDel(ref);
+	return (ret);
+}
+
+/************************************************************************
+ * <AUTO EXTRACT>
+ *
+ * ROUTINE: atFindTransRef
+ *
+ * DESCRIPTION:
+ * Same as atFindTrans, for a list B whose triangles have been made
+ * beforehand by atMatchRefNew.  When list B is matched with many lists A,
+ * like the reference stars of a sequence with the stars of each image,
+ * only the triangles of list A are made for each of them.
+ *
+ * The reference is only read, so it can be used by several threads at
+ * the same time.  If list A has fewer stars than the reference was made
+ * for, the triangles of list B are made again for this call.
+ *
+ * RETURN:
+ *    SH_SUCCESS         if all goes well
+ *    SH_GENERIC_ERROR   if an error occurs
+ *
+ * </AUTO>
+ */
+
+int atFindTransRef(int numA, /* I: number of stars in list A */
+struct s_star *listA, /* I: match this set of objects with list B */
+MATCH_REF *ref, /* I: list B, from atMatchRefNew */
+double min_scale, /* I: minimum permitted relative scale factor */
+/*       if -1, any scale factor is allowed */
+double max_scale, /* I: maximum permitted relative scale factor */
+/*       if -1, any scale factor is allowed */
+double rotation_deg, /* I: desired relative angle of coord systems (deg) */
+/*       if AT_MATCH_NOANGLE, any orientation is allowed */
+double tolerance_deg, /* I: allowed range of orientation angles (deg) */
+/*       if AT_MATCH_NOANGLE, any orientation is allowed */
+int max_iter, /* I: go through at most this many iterations */
+/*       in the iter_trans() loop. */
+double halt_sigma, /* I: halt the fitting procedure if the mean */
+/*       residual becomes this small */
+TRANS *trans /* O: place into this TRANS structure's fields */
+/*       the coeffs which convert coords of chainA */
+/*       into coords of chainB system. */
+) {
+	int nbright, ret;
 	s_star *star_array_B;
-	s_triangle *triangle_array_A = NULL;
-	s_triangle *triangle_array_B = NULL;
+	MATCH_REF *tmp_ref;
 
-	num_stars_A = numA;
-	num_stars_B = numB;
-	star_array_A = list_to_array(numA, listA);
-	star_array_B = list_to_array(numB, listB);
+	g_assert(ref != NULL);
+	if (get_nbright(numA, ref->num_stars, ref->nobj, trans, &nbright) != SH_SUCCESS) {
+		return (SH_GENERIC_ERROR);
+	}
+	if (nbright == ref->nbright) {
+		return (find_trans(numA, listA, ref, min_scale, max_scale,
+				rotation_deg, tolerance_deg, max_iter, halt_sigma, trans));
+	}
 
-#ifdef DEBUG3
-	test_routine();
-#endif
+	/* the reference is shared, its stars are copied to be sorted again */
+	star_array_B = (s_star *) shMalloc(ref->num_stars * sizeof(s_star));
+	copy_star_array(ref->star_array, star_array_B, ref->num_stars);
+	tmp_ref = match_ref_new(star_array_B, ref->num_stars, nbright, ref->radius);
+	ret = find_trans(numA, listA, tmp_ref, min_scale, max_scale,
+			rotation_deg, tolerance_deg, max_iter, halt_sigma, trans);
+	atMatchRefDel(tmp_ref);
+	return (ret);
+}
 
-	g_assert(star_array_A != NULL);
-	g_assert(star_array_B != NULL);
+/************************************************************************
+ * <AUTO EXTRACT>
+ *
+ * ROUTINE: atMatchRefNew
+ *
+ * DESCRIPTION:
+ * Make the triangles of list B used by atFindTransRef: the stars are
+ * sorted by magnitude and the triangles of the brightest 'nobj' ones are
+ * made, pruned and sorted, as atFindTrans does for each call.
+ *
+ * RETURN:
+ *    MATCH_REF *        to be freed with atMatchRefDel
+ *
+ * </AUTO>
+ */
+
+MATCH_REF *
+atMatchRefNew(int numB, /* I: number of stars in list B */
+struct s_star *listB, /* I: the stars to be matched with other lists */
+int nobj, /* I: max number of bright stars to use in creating */
+/*       triangles for matching */
+double radius /* I: max radius in triangle-space allowed for */
+/*       a pair of triangles to match */
+) {
+	MATCH_REF *ref;
+	int nbright = nobj < numB ? nobj : numB;
+
+	ref = match_ref_new(list_to_array(numB, listB), numB, nbright, radius);
+	ref->nobj = nobj;
+	return (ref);
+}
+
+void atMatchRefDel(MATCH_REF *ref) {
+	if (ref == NULL)
+		return;
+	free_star_array(ref->star_array);
+	shFree(ref->triangles);
+	shFree(ref->binned);
+	shFree(ref->bin_start);
+	shFree(ref);
+}
+
+/*
+ * Makes the reference of the 'numstars' stars of 'star_array', which it
+ * takes, with the triangles of the 'nbright' brightest.
+ */
+static MATCH_REF *
+match_ref_new(s_star *star_array, int numstars, int nbright, double radius) {
+	MATCH_REF *ref;
+
+	g_assert(star_array != NULL);
+	ref = (MATCH_REF *) shMalloc(sizeof(MATCH_REF));
+	ref->num_stars = numstars;
+	ref->star_array = star_array;
+	ref->nbright = nbright;
+	ref->nobj = nbright;
+	ref->radius = radius;
+	ref->binned = NULL;
+	ref->bin_start = NULL;
+	ref->nbins = 0;
+
+	/*
+	 * All the triangles are made for a few stars; beyond
+	 * AT_MATCH_NN_MINSTARS, their number would grow as the cube of
+	 * nbright, so only the triangles of each star with its nearest
+	 * neighbours are made.
+	 */
+	if (nbright > AT_MATCH_NN_MINSTARS) {
+		ref->triangles = stars_to_nn_triangles(star_array, numstars, nbright,
+				&ref->num_triangles);
+	} else {
+		ref->triangles = stars_to_triangles(star_array, numstars, nbright,
+				&ref->num_triangles);
+	}
+	g_assert(ref->triangles != NULL);
+
+	/*
+	 * Now we prune the triangle array to eliminate those with
+	 * ratios (b/a) > AT_MATCH_RATIO,
+	 * since Valdes et al. say that this speeds things up and eliminates
+	 * lots of closely-packed triangles.
+	 */
+	prune_triangle_array(ref->triangles, &ref->num_triangles);
+
+	if (nbright > AT_MATCH_NN_MINSTARS) {
+		if (ref->radius < AT_MATCH_NN_RADIUS)
+			ref->radius = AT_MATCH_NN_RADIUS;
+		bin_triangles(ref);
+	}
+	return (ref);
+}
+
+/*
+ * Computes the number of bright stars used to make the triangles, as
+ * explained in atFindTrans.
+ */
+static int get_nbright(int num_stars_A, int num_stars_B, int nobj,
+		TRANS *trans, int *nbright) {
+	int start_pairs, min;
 
 	switch (trans->order) {
 	case AT_TRANS_LINEAR:
@@ -416,61 +582,89 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	if (min < start_pairs) {
 		shError("atFindTrans: only %d stars in list(s), require at least %d",
 				min, start_pairs);
-		free_star_array(star_array_A);
-		free_star_array(star_array_B);
 		return (SH_GENERIC_ERROR);
 	}
 	if (nobj > min) {
 		shDebug(AT_MATCH_ERRLEVEL,
 				"atFindTrans: using only %d stars, fewer than requested %d",
 				min, nobj);
-		nbright = min;
+		*nbright = min;
 	} else {
-		nbright = nobj;
+		*nbright = nobj;
 	}
-	if (nbright < start_pairs) {
+	if (*nbright < start_pairs) {
 		shDebug(AT_MATCH_ERRLEVEL,
 				"atFindTrans: must use %d stars, more than requested %d",
 				start_pairs, nobj);
-		nbright = start_pairs;
+		*nbright = start_pairs;
 	}
 
 	/* this is a sanity check on the above checks */
-	g_assert((nbright >= start_pairs) && (nbright <= min));
+	g_assert((*nbright >= start_pairs) && (*nbright <= min));
+	return (SH_SUCCESS);
+}
+
+/*
+ * The work of atFindTrans, with the triangles of list B already made in
+ * 'ref', which is not modified.
+ */
+static int find_trans(int numA, s_star *listA, MATCH_REF *ref,
+		double min_scale, double max_scale, double rotation_deg,
+		double tolerance_deg, int max_iter, double halt_sigma, TRANS *trans) {
+	int i, nbright = ref->nbright, use_nn = ref->binned != NULL;
+	int num_stars_A; /* number of stars in chain A */
+	int num_triangles_A; /* number of triangles formed from chain A */
+	int **vote_matrix;
+	int *winner_votes; /* # votes gotten by top pairs of matched stars */
+	int *winner_index_A; /* elem i in this array is index in star array A */
+	/*    which matches ... */
+	int *winner_index_B; /* elem i in this array, index in star array B */
+	s_star *star_array_A;
+	s_triangle *triangle_array_A = NULL;
+
+	num_stars_A = numA;
+	star_array_A = list_to_array(numA, listA);
+
+#ifdef DEBUG3
+	test_routine();
+#endif
+
+	g_assert(star_array_A != NULL);
 
 #ifdef DEBUG
 	printf("here comes star array A\n");
 	print_star_array(star_array_A, num_stars_A);
 	printf("here comes star array B\n");
-	print_star_array(star_array_B, num_stars_B);
+	print_star_array(ref->star_array, ref->num_stars);
 #endif
 
 	/*
-	 * we now convert each list of stars into a list of triangles,
-	 * using only a subset of the "nbright" brightest items in each list.
+	 * we now convert list A into a list of triangles, like list B,
+	 * using only a subset of the "nbright" brightest items.
 	 */
-	triangle_array_A = stars_to_triangles(star_array_A, num_stars_A, nbright,
-			&num_triangles_A);
+	if (use_nn) {
+		triangle_array_A = stars_to_nn_triangles(star_array_A, num_stars_A,
+				nbright, &num_triangles_A);
+	} else {
+		triangle_array_A = stars_to_triangles(star_array_A, num_stars_A, nbright,
+				&num_triangles_A);
+	}
 	g_assert(triangle_array_A != NULL);
-	triangle_array_B = stars_to_triangles(star_array_B, num_stars_B, nbright,
-			&num_triangles_B);
-	g_assert(triangle_array_B != NULL);
 
 	/*
-	 * Now we prune the triangle arrays to eliminate those with
+	 * Now we prune the triangle array to eliminate those with
 	 * ratios (b/a) > AT_MATCH_RATIO,
 	 * since Valdes et al. say that this speeds things up and eliminates
 	 * lots of closely-packed triangles.
 	 */
 	prune_triangle_array(triangle_array_A, &num_triangles_A);
-	prune_triangle_array(triangle_array_B, &num_triangles_B);
 #ifdef DEBUG2
 	printf("after pruning, here comes triangle array A\n");
 	print_triangle_array(triangle_array_A, num_triangles_A,
 			star_array_A, num_stars_A);
 	printf("after pruning, here comes triangle array B\n");
-	print_triangle_array(triangle_array_B, num_triangles_B,
-			star_array_B, num_stars_B);
+	print_triangle_array(ref->triangles, ref->num_triangles,
+			ref->star_array, ref->num_stars);
 #endif
 
 	/*
@@ -488,14 +682,12 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	 * in either list, we'll still make the vote_matrix
 	 * contain "nbright"-by-"nbright" cells ...
 	 * there will just be a lot of cells filled with zero.
-	 */
-	vote_matrix = make_vote_matrix(star_array_A, num_stars_A, star_array_B,
-			num_stars_B, triangle_array_A, num_triangles_A, triangle_array_B,
-			num_triangles_B, nbright, radius, min_scale, max_scale,
-			rotation_deg, tolerance_deg);
-
-	/*
-	 * having made the vote_matrix, we next need to pick the
+	 *
+	 * With the triangles of the nearest neighbours, the matrix would be
+	 * large and mostly empty, so the votes are counted only for the
+	 * pairs of stars which get some, see sparse_vote_getters.
+	 *
+	 * Having counted the votes, we next need to pick the
 	 * top 'nbright' vote-getters.  We call 'top_vote_getters'
 	 * and are given, in its output arguments, pointers to three
 	 * arrays, each of which has 'nbright' elements pertaining
@@ -519,12 +711,22 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	 *
 	 * and so on.
 	 */
-	top_vote_getters(vote_matrix, nbright, &winner_votes, &winner_index_A,
-			&winner_index_B);
+	if (use_nn) {
+		sparse_vote_getters(triangle_array_A, num_triangles_A, ref, nbright,
+				min_scale, max_scale, rotation_deg, tolerance_deg,
+				&winner_votes, &winner_index_A, &winner_index_B);
+	} else {
+		vote_matrix = make_vote_matrix(star_array_A, num_stars_A,
+				ref->star_array, ref->num_stars, triangle_array_A,
+				num_triangles_A, ref->triangles, ref->num_triangles, nbright,
+				ref->radius, min_scale, max_scale, rotation_deg, tolerance_deg);
+		top_vote_getters(vote_matrix, nbright, &winner_votes, &winner_index_A,
+				&winner_index_B);
 
-	for (i = 0; i < nbright; i++)
-		shFree(vote_matrix[i]);
-	shFree(vote_matrix);
+		for (i = 0; i < nbright; i++)
+			shFree(vote_matrix[i]);
+		shFree(vote_matrix);
+	}
 
 	/*
 	 * here, we disqualify any of the top vote-getters which have
@@ -553,8 +755,8 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	 * (i.e. a TRANS structure) which converts the coordinates
 	 * of objects in chainA to those in chainB.
 	 */
-	if (iter_trans(nbright, star_array_A, num_stars_A, star_array_B,
-			num_stars_B, winner_votes, winner_index_A, winner_index_B,
+	if (iter_trans(nbright, star_array_A, num_stars_A, ref->star_array,
+			ref->num_stars, winner_votes, winner_index_A, winner_index_B,
 			RECALC_NO, max_iter, halt_sigma, trans) != SH_SUCCESS) {
 
 		shError("atFindTrans: iter_trans unable to create a valid TRANS");
@@ -562,9 +764,7 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 		shFree(winner_index_A);
 		shFree(winner_index_B);
 		free_star_array(star_array_A);
-		free_star_array(star_array_B);
 		shFree(triangle_array_A);
-		shFree(triangle_array_B);
 		return (SH_GENERIC_ERROR);
 	}
 
@@ -580,9 +780,7 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	shFree(winner_index_A);
 	shFree(winner_index_B);
 	free_star_array(star_array_A);
-	free_star_array(star_array_B);
 	shFree(triangle_array_A);
-	shFree(triangle_array_B);
 
 	return (SH_SUCCESS);
 }
@@ -1306,6 +1504,8 @@ print_dist_matrix
  * DESCRIPTION:
  * Set the elements of some given, EXISTING instance of an "s_triangle"
  * structure, given (the indices to) three s_star structures for its vertices.
+ * The distances between the stars are read in "darray", or computed
+ * if it is NULL.
  * We check to make sure
  * that the three stars are three DIFFERENT stars, asserting
  * if not.
@@ -1324,7 +1524,7 @@ s_star *star_array, /* use stars in this array as vertices */
 int s1, /* index in 'star_array' of one vertex */
 int s2, /* index in 'star_array' of one vertex */
 int s3, /* index in 'star_array' of one vertex */
-double **darray /* array of distances between stars */
+double **darray /* array of distances between stars, or NULL */
 ) {
 	static int id_number = 0;
 	double d12, d23, d13;
@@ -1355,9 +1555,15 @@ double **darray /* array of distances between stars */
 	 * for convenience.
 	 *
 	 */
-	d12 = darray[s1][s2];
-	d23 = darray[s2][s3];
-	d13 = darray[s1][s3];
+	if (darray) {
+		d12 = darray[s1][s2];
+		d23 = darray[s2][s3];
+		d13 = darray[s1][s3];
+	} else {
+		d12 = hypot(star1->x - star2->x, star1->y - star2->y);
+		d23 = hypot(star2->x - star3->x, star2->y - star3->y);
+		d13 = hypot(star1->x - star3->x, star1->y - star3->y);
+	}
 
 	/* sanity check */
 	g_assert(d12 >= 0.0);
@@ -2390,6 +2596,370 @@ int **winner_index_B /* O: create this array of index into star array B */
 	return (SH_SUCCESS);
 }
 
+/************************************************************************
+ *
+ *
+ * ROUTINE: stars_to_nn_triangles
+ *
+ * DESCRIPTION:
+ * Convert an array of s_stars to an array of s_triangles, like
+ * stars_to_triangles, but making only the triangles of each of the
+ * 'nbright' brightest stars with its AT_MATCH_NN_NEIGHBOURS nearest
+ * neighbours, instead of all the possible triangles.  Their number
+ * grows linearly with 'nbright', and as they are local, a star missing
+ * from one of the lists changes only the triangles around it.
+ *
+ * The neighbours are found with a grid of cells holding about one star
+ * each: the cells around a star are searched in growing squares, until
+ * the next square cannot hold a star closer than the neighbours found.
+ *
+ * RETURN:
+ *    s_triangle *             pointer to new array of triangles
+ *                                  (and # of triangles put into output arg)
+ *
+ * </AUTO>
+ */
+
+static s_triangle *
+stars_to_nn_triangles(s_star *star_array, /* I: array of s_stars */
+int numstars, /* I: the total number of stars in the array */
+int nbright, /* I: use only the 'nbright' brightest stars */
+int *numtriangles /* O: number of triangles we create */
+) {
+	int i, j, k, l, n, nn, cx, cy, cells_x, cells_y, ncells;
+	int *cell_start, *cell_stars, *cell_of_star;
+	int vertices[AT_MATCH_NN_NEIGHBOURS + 1];
+	double nn_dist2[AT_MATCH_NN_NEIGHBOURS];
+	double xmin, xmax, ymin, ymax, cell_size;
+	s_triangle *triangle_array;
+
+	if (numstars < nbright) {
+		nbright = numstars;
+	}
+	sort_star_by_mag(star_array, numstars);
+	nn = nbright - 1 < AT_MATCH_NN_NEIGHBOURS ? nbright - 1 : AT_MATCH_NN_NEIGHBOURS;
+
+	xmin = xmax = star_array[0].x;
+	ymin = ymax = star_array[0].y;
+	for (i = 1; i < nbright; i++) {
+		if (star_array[i].x < xmin) xmin = star_array[i].x;
+		if (star_array[i].x > xmax) xmax = star_array[i].x;
+		if (star_array[i].y < ymin) ymin = star_array[i].y;
+		if (star_array[i].y > ymax) ymax = star_array[i].y;
+	}
+	/* about one star per cell, and not more cells than stars along
+	 * an axis when they are aligned */
+	cell_size = sqrt((xmax - xmin) * (ymax - ymin) / nbright);
+	if (cell_size < (xmax - xmin) / nbright)
+		cell_size = (xmax - xmin) / nbright;
+	if (cell_size < (ymax - ymin) / nbright)
+		cell_size = (ymax - ymin) / nbright;
+	if (cell_size <= 0.0)
+		cell_size = 1.0;
+	cells_x = (int) ((xmax - xmin) / cell_size) + 1;
+	cells_y = (int) ((ymax - ymin) / cell_size) + 1;
+	ncells = cells_x * cells_y;
+
+	/* counting sort of the stars by cell */
+	cell_start = (int *) shMalloc((ncells + 1) * sizeof(int));
+	cell_stars = (int *) shMalloc(nbright * sizeof(int));
+	cell_of_star = (int *) shMalloc(nbright * sizeof(int));
+	memset(cell_start, 0, (ncells + 1) * sizeof(int));
+	for (i = 0; i < nbright; i++) {
+		cx = (int) ((star_array[i].x - xmin) / cell_size);
+		cy = (int) ((star_array[i].y - ymin) / cell_size);
+		cell_of_star[i] = cy * cells_x + cx;
+		cell_start[cell_of_star[i] + 1]++;
+	}
+	for (i = 0; i < ncells; i++) {
+		cell_start[i + 1] += cell_start[i];
+	}
+	for (i = 0; i < nbright; i++) {
+		cell_stars[cell_start[cell_of_star[i]]++] = i;
+	}
+	for (i = ncells; i > 0; i--) {
+		cell_start[i] = cell_start[i - 1];
+	}
+	cell_start[0] = 0;
+
+	/* each star with its neighbours gives (nn + 1) choose 3 triangles */
+	*numtriangles = nbright * ((nn + 1) * nn * (nn - 1)) / 6;
+	triangle_array = (s_triangle *) shMalloc(
+			(*numtriangles > 0 ? *numtriangles : 1) * sizeof(s_triangle));
+
+	n = 0;
+	for (i = 0; i < nbright; i++) {
+		int found = 0, r;
+		int x0 = cell_of_star[i] % cells_x, y0 = cell_of_star[i] / cells_x;
+
+		for (r = 0; r < cells_x || r < cells_y; r++) {
+			/* search the cells on the square at distance r */
+			for (cy = y0 - r; cy <= y0 + r; cy++) {
+				if (cy < 0 || cy >= cells_y)
+					continue;
+				for (cx = x0 - r; cx <= x0 + r; cx++) {
+					int c;
+					if (cx < 0 || cx >= cells_x)
+						continue;
+					if (cy != y0 - r && cy != y0 + r && cx != x0 - r && cx != x0 + r)
+						continue;
+					c = cy * cells_x + cx;
+					for (j = cell_start[c]; j < cell_start[c + 1]; j++) {
+						int s = cell_stars[j];
+						double dx = star_array[s].x - star_array[i].x;
+						double dy = star_array[s].y - star_array[i].y;
+						double d2 = dx * dx + dy * dy;
+						if (s == i || (found == nn && d2 >= nn_dist2[nn - 1]))
+							continue;
+						/* insertion in the sorted neighbours */
+						k = found < nn ? found++ : nn - 1;
+						while (k > 0 && nn_dist2[k - 1] > d2) {
+							nn_dist2[k] = nn_dist2[k - 1];
+							vertices[k + 1] = vertices[k];
+							k--;
+						}
+						nn_dist2[k] = d2;
+						vertices[k + 1] = s;
+					}
+				}
+			}
+			/* stars of the next squares are at least r cells away */
+			if (found == nn && nn_dist2[nn - 1] <= (r * cell_size) * (r * cell_size))
+				break;
+		}
+		g_assert(found == nn);
+
+		vertices[0] = i;
+		for (j = 0; j < nn - 1; j++) {
+			for (k = j + 1; k < nn; k++) {
+				for (l = k + 1; l <= nn; l++) {
+					set_triangle(&(triangle_array[n]), star_array,
+							vertices[j], vertices[k], vertices[l], NULL);
+					n++;
+				}
+			}
+		}
+	}
+	g_assert(n == *numtriangles);
+
+	shFree(cell_start);
+	shFree(cell_stars);
+	shFree(cell_of_star);
+
+	return (triangle_array);
+}
+
+/* a triangle of array A placed in a bin of "ba" */
+struct binned_triangle {
+	int bin;
+	double ca;
+	s_triangle *tri;
+};
+
+static int compare_binned_triangle(const void *p1, const void *p2) {
+	const struct binned_triangle *t1 = p1, *t2 = p2;
+	if (t1->bin != t2->bin)
+		return t1->bin < t2->bin ? -1 : 1;
+	if (t1->ca != t2->ca)
+		return t1->ca < t2->ca ? -1 : 1;
+	return 0;
+}
+
+/* a vote for a pair of stars, or the count of votes once merged */
+struct star_pair_vote {
+	int index_A;
+	int index_B;
+	int votes;
+};
+
+static int compare_pair(const void *p1, const void *p2) {
+	const struct star_pair_vote *v1 = p1, *v2 = p2;
+	if (v1->index_A != v2->index_A)
+		return v1->index_A < v2->index_A ? -1 : 1;
+	if (v1->index_B != v2->index_B)
+		return v1->index_B < v2->index_B ? -1 : 1;
+	return 0;
+}
+
+static int compare_votes(const void *p1, const void *p2) {
+	const struct star_pair_vote *v1 = p1, *v2 = p2;
+	if (v1->votes != v2->votes)
+		return v1->votes > v2->votes ? -1 : 1;
+	return compare_pair(p1, p2);
+}
+
+static void add_vote(struct star_pair_vote **votes, int *num, int *size,
+		int index_A, int index_B) {
+	if (*num == *size) {
+		struct star_pair_vote *new_votes;
+		*size *= 2;
+		new_votes = (struct star_pair_vote *) shMalloc(
+				*size * sizeof(struct star_pair_vote));
+		memcpy(new_votes, *votes, *num * sizeof(struct star_pair_vote));
+		shFree(*votes);
+		*votes = new_votes;
+	}
+	(*votes)[*num].index_A = index_A;
+	(*votes)[*num].index_B = index_B;
+	(*votes)[*num].votes = 1;
+	(*num)++;
+}
+
+/*
+ * Places the triangles of the reference in bins of "ba" of the size of the
+ * matching radius, sorted by "ca" in each bin, for sparse_vote_getters.
+ */
+static void bin_triangles(MATCH_REF *ref) {
+	int i, b, num = ref->num_triangles;
+
+	ref->nbins = (int) (1.0 / ref->radius) + 2;
+	ref->binned = (struct binned_triangle *) shMalloc(
+			(num > 0 ? num : 1) * sizeof(struct binned_triangle));
+	ref->bin_start = (int *) shMalloc((ref->nbins + 1) * sizeof(int));
+	for (i = 0; i < num; i++) {
+		ref->binned[i].bin = (int) (ref->triangles[i].ba / ref->radius);
+		ref->binned[i].ca = ref->triangles[i].ca;
+		ref->binned[i].tri = &(ref->triangles[i]);
+	}
+	qsort(ref->binned, num, sizeof(struct binned_triangle),
+			compare_binned_triangle);
+	for (b = 0, i = 0; b <= ref->nbins; b++) {
+		while (i < num && ref->binned[i].bin < b)
+			i++;
+		ref->bin_start[b] = i;
+	}
+}
+
+/************************************************************************
+ *
+ *
+ * ROUTINE: sparse_vote_getters
+ *
+ * DESCRIPTION:
+ * Does the work of make_vote_matrix and top_vote_getters without the
+ * 'nbright'-by-'nbright' matrix, for large numbers of stars.
+ *
+ * Triangles of the reference (array B) have been placed by bin_triangles
+ * in bins of "ba" of the size of the matching radius and sorted by "ca"
+ * in each bin, so that the candidates for a triangle of array A are
+ * found by a binary search in three bins, instead of scanning all the
+ * triangles of the "ba" range.
+ * Each match gives a vote to three pairs of stars; the votes are sorted
+ * to count them, and the 'nbright' pairs with most votes are returned
+ * in the same arrays as top_vote_getters.
+ *
+ * RETURN:
+ *    SH_SUCCESS         if all goes well
+ *
+ * </AUTO>
+ */
+
+static int sparse_vote_getters(s_triangle *t_array_A, /* I: array of triangles from star array A */
+int num_triangles_A, /* I: number of triangles in t_array_A */
+MATCH_REF *ref, /* I: binned triangles from star array B */
+int nbright, /* I: number of winners we return */
+double min_scale, /* I: minimum permitted relative scale factor */
+/*       if -1, any scale factor is allowed */
+double max_scale, /* I: maximum permitted relative scale factor */
+/*       if -1, any scale factor is allowed */
+double rotation_deg, /* I: desired relative angle of coord systems (deg) */
+/*       if AT_MATCH_NOANGLE, any orientation is allowed */
+double tolerance_deg, /* I: allowed range of orientation angles (deg) */
+/*       if AT_MATCH_NOANGLE, any orientation is allowed */
+int **winner_votes, /* O: create this array of # of votes for the */
+/*      'nbright' pairs with the most votes */
+int **winner_index_A, /* O: create this array of index into star array A */
+/*      of the 'nbright' pairs with most votes */
+int **winner_index_B /* O: create this array of index into star array B */
+/*      of the 'nbright' pairs with most votes */
+) {
+	int i, j, b, num_votes = 0, size_votes, num_pairs;
+	double max_radius = ref->radius, rad2 = max_radius * max_radius;
+	double ratio, actual_angle_deg;
+	struct star_pair_vote *votes;
+
+	size_votes = 3 * (num_triangles_A > 0 ? num_triangles_A : 1);
+	votes = (struct star_pair_vote *) shMalloc(size_votes * sizeof(struct star_pair_vote));
+
+	for (j = 0; j < num_triangles_A; j++) {
+		s_triangle *tri_A = &(t_array_A[j]);
+		int bin_A = (int) (tri_A->ba / max_radius);
+
+		for (b = bin_A - 1; b <= bin_A + 1; b++) {
+			int top, bottom;
+			if (b < 0 || b >= ref->nbins)
+				continue;
+			/* first triangle of the bin with ca >= tri_A->ca - max_radius */
+			top = ref->bin_start[b];
+			bottom = ref->bin_start[b + 1];
+			while (top < bottom) {
+				int mid = (top + bottom) / 2;
+				if (ref->binned[mid].ca < tri_A->ca - max_radius)
+					top = mid + 1;
+				else bottom = mid;
+			}
+			for (i = top; i < ref->bin_start[b + 1]; i++) {
+				s_triangle *tri_B = ref->binned[i].tri;
+				double dba = tri_B->ba - tri_A->ba, dca = tri_B->ca - tri_A->ca;
+
+				if (dca > max_radius)
+					break;
+				if (dba * dba + dca * dca >= rad2)
+					continue;
+				if (min_scale != -1) {
+					ratio = tri_A->a_length / tri_B->a_length;
+					if (ratio < min_scale || ratio > max_scale) {
+						continue;
+					}
+				}
+				if (rotation_deg != AT_MATCH_NOANGLE) {
+					if (is_desired_rotation(tri_A, tri_B, rotation_deg,
+							tolerance_deg, &actual_angle_deg) == 0) {
+						continue;
+					}
+				}
+				add_vote(&votes, &num_votes, &size_votes, tri_A->a_index, tri_B->a_index);
+				add_vote(&votes, &num_votes, &size_votes, tri_A->b_index, tri_B->b_index);
+				add_vote(&votes, &num_votes, &size_votes, tri_A->c_index, tri_B->c_index);
+			}
+		}
+	}
+
+	/* merge the votes of each pair of stars */
+	qsort(votes, num_votes, sizeof(struct star_pair_vote), compare_pair);
+	for (i = 0, num_pairs = 0; i < num_votes; i++) {
+		if (num_pairs > 0 && !compare_pair(&votes[num_pairs - 1], &votes[i])) {
+			votes[num_pairs - 1].votes++;
+		} else {
+			votes[num_pairs++] = votes[i];
+		}
+	}
+	qsort(votes, num_pairs, sizeof(struct star_pair_vote), compare_votes);
+
+	*winner_votes = (int *) shMalloc(nbright * sizeof(int));
+	*winner_index_A = (int *) shMalloc(nbright * sizeof(int));
+	*winner_index_B = (int *) shMalloc(nbright * sizeof(int));
+	for (i = 0; i < nbright; i++) {
+		if (i < num_pairs) {
+			(*winner_votes)[i] = votes[i].votes;
+			(*winner_index_A)[i] = votes[i].index_A;
+			(*winner_index_B)[i] = votes[i].index_B;
+		} else {
+			(*winner_votes)[i] = 0;
+			(*winner_index_A)[i] = -1;
+			(*winner_index_B)[i] = -1;
+		}
+	}
+	shFree(votes);
+
+#ifdef DEBUG
+	printf("  in sparse_vote_getters, %d pairs got votes, we keep top %d\n",
+			num_pairs, nbright);
+#endif
+
+	return (SH_SUCCESS);
+}
+
 /************************************************************************
  *
  *
@@ -3470,7 +4040,7 @@ int *num_stars_M /* O: number of stars in output array M */
 ) {
 	double Ax, Ay, Bx, By;
 	double dist, limit;
-	int posA, posB;
+	int posA, posB, first, last;
 	int current_num_J, current_num_K;
 	double deltax, deltay;
 	double Axm, Axp, Aym, Ayp;
@@ -3533,10 +4103,9 @@ int *num_stars_M /* O: number of stars in output array M */
 	 * elements onto lists J and K, respectively.  We do NOT check
 	 * yet to see if there are multiply-matched elements.
 	 *
-	 * This implementation could be speeded up a LOT by sorting the
-	 * two arrays in "x" and then making use of the information to check
-	 * only stars which are close to each other in "x".  Do that
-	 * some time later.... MWR 1/18/96.
+	 * As array B is sorted in "x", only the stars of B which are close
+	 * to the star of A in "x" are checked, starting from the first one
+	 * found by a binary search.
 	 */
 #ifdef DEBUG
 	printf(" size of array A is %d, array B is %d\n", num_stars_A, num_stars_B);
@@ -3557,14 +4126,27 @@ int *num_stars_M /* O: number of stars in output array M */
 		Aym = Ay - radius;
 		Ayp = Ay + radius;
 
-		for (posB = 0; posB < num_stars_B; posB++) {
+		first = 0;
+		last = num_stars_B;
+		while (first < last) {
+			int mid = (first + last) / 2;
+			if (star_array_B[mid].x < Axm)
+				first = mid + 1;
+			else last = mid;
+		}
+
+		for (posB = first; posB < num_stars_B; posB++) {
 
 			g_assert((sb = &(star_array_B[posB])) != NULL);
 			Bx = sb->x;
 			By = sb->y;
 
+			/* the next stars of B are even farther in "x" */
+			if (Bx > Axp) {
+				break;
+			}
 			/* check quickly to see if we can avoid a multiply */
-			if ((Bx < Axm) || (Bx > Axp) || (By < Aym) || (By > Ayp)) {
+			if ((By < Aym) || (By > Ayp)) {
 				continue;
 			}
 
@@ -68,6 +68,21 @@
     */
 #define AT_MATCH_NBRIGHT   20
 
+   /*
+    * when more than AT_MATCH_NN_MINSTARS stars are used, making all the
+    * triangles would cost too much: only the triangles of each star
+    * with its AT_MATCH_NN_NEIGHBOURS nearest neighbours are made,
+    * and matched with a radius of at least AT_MATCH_NN_RADIUS, as these
+    * small triangles have less accurate ratios.
+    *
+    * AT_MATCH_NN_NBRIGHT is the number of stars used by the global
+    * star alignment when the AT_MATCH_NBRIGHT brightest are not enough.
+    */
+#define AT_MATCH_NN_MINSTARS    60
+#define AT_MATCH_NN_NEIGHBOURS   5
+#define AT_MATCH_NN_RADIUS     0.005
+#define AT_MATCH_NN_NBRIGHT    500
+
    /*
     * ignore all triangles which have (b/a) > AT_MATCH_RATIO when
     * trying to match up sets of triangles.  If AT_MATCH_RATIO
@@ -214,6 +229,24 @@ typedef struct s_triangle {
 } s_triangle;
 
 
+   /*
+    * the triangles of a list of stars, made once by atMatchRefNew to
+    * match this list with several others with atFindTransRef.
+    * It is only read by atFindTransRef.
+    */
+typedef struct s_match_ref {
+   int num_stars;           /* number of stars in star_array */
+   s_star *star_array;      /* the stars, sorted by magnitude */
+   int nobj;                /* number of bright stars requested */
+   int nbright;             /* number of bright stars in the triangles */
+   double radius;           /* max radius in triangle-space for a match */
+   int num_triangles;       /* number of triangles in triangles */
+   s_triangle *triangles;   /* pruned triangles, sorted by ba */
+   struct binned_triangle *binned; /* triangles binned by ba, or NULL */
+   int *bin_start;          /* index of the first triangle of each bin */
+   int nbins;               /* number of bins */
+} MATCH_REF;
+
    /*
     * these functions are PUBLIC, and may be called by users
     */
@@ -223,6 +256,15 @@ int atFindTrans(int numA, s_star *listA, int numB, s_star *listB,
                 double rotation_deg, double tolerance_deg,
                 int max_iter, double halt_sigma, TRANS *trans);
 
+MATCH_REF *atMatchRefNew(int numB, s_star *listB, int nobj, double radius);
+
+void atMatchRefDel(MATCH_REF *ref);
+
+int atFindTransRef(int numA, s_star *listA, MATCH_REF *ref,
+                double min_scale, double max_scale,
+                double rotation_deg, double tolerance_deg,
+                int max_iter, double halt_sigma, TRANS *trans);
+
 int atApplyTrans(int num, s_star *list, TRANS *trans);
 
 int atMatchLists(int numA, s_star *listA, int numB, s_star *listB,
@@ -121,8 +121,29 @@ static int prepare_to_recalc(int num_matched_A,
 		struct s_star *matched_list_B, struct s_star *star_list_A_copy,
 		TRANS *trans);
 
+/* Makes the triangles of the n first stars of s, to match them with other
+ * lists of stars by new_star_match(). nobj_override is the number of bright
+ * stars used, AT_MATCH_NBRIGHT if 0. */
+MATCH_REF *new_star_match_reference(fitted_PSF **s, int n, int nobj_override) {
+	int num;
+	struct s_star *star_list;
+	MATCH_REF *ref;
+
+	if (get_stars(s, n, &num, &star_list)) {
+		fprintf(stderr,"can't read data\n");
+		return NULL;
+	}
+	ref = atMatchRefNew(num, star_list, nobj_override > 0 ? nobj_override : AT_MATCH_NBRIGHT,
+			AT_TRIANGLE_RADIUS);
+	free_stars(star_list);
+	return ref;
+}
+
+/* Finds the homography H transforming the stars of s1 into those of s2. If
+ * ref is not NULL, it contains the triangles of s2 made by
+ * new_star_match_reference() and nobj_override is not used. */
 int new_star_match(fitted_PSF **s1, fitted_PSF **s2, int n, int nobj_override, double s_min, double s_max,
-		Homography *H, gboolean print_output) {
+		MATCH_REF *ref, Homography *H, gboolean print_output) {
 	int ret;
 	int numA, numB;
 	int num_matched_A, num_matched_B;
@@ -258,9 +279,14 @@ int new_star_match(fitted_PSF **s1, fitted_PSF **s2, int n, int nobj_override, d
 	 */
 	int iter = 0;
 	do {
-	ret = atFindTrans(numA, star_list_A, numB, star_list_B, triangle_radius,
-			nobj, min_scale, max_scale, rot_angle, rot_tol, max_iter,
-			halt_sigma, trans);
+	if (ref) {
+		ret = atFindTransRef(numA, star_list_A, ref, min_scale, max_scale,
+				rot_angle, rot_tol, max_iter, halt_sigma, trans);
+	} else {
+		ret = atFindTrans(numA, star_list_A, numB, star_list_B, triangle_radius,
+				nobj, min_scale, max_scale, rot_angle, rot_tol, max_iter,
+				halt_sigma, trans);
+	}
 		if (ret != SH_SUCCESS && iter == 0) {
 			min_scale = -1.0;
 			max_scale = -1.0;
@@ -2,12 +2,14 @@
 #define MATCH_H
 
 #include "core/siril.h"
+#include "registration/matching/atpmatch.h"
 
 
 #define NB_OF_MATCHING_TRY 3
 
 
+MATCH_REF *new_star_match_reference(fitted_PSF **s, int n, int nobj_override);
 int new_star_match(fitted_PSF **s1, fitted_PSF **s2, int n, int nobj_override, double s_min, double s_max,
-		Homography *H, gboolean print_output);
+		MATCH_REF *ref, Homography *H, gboolean print_output);
 
 #endif   /* MATCH_H */
@@ -0,0 +1,491 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Multi-point registration: for large planetary, lunar or solar frames, the
+ * seeing moves areas of the image differently, so a single shift per frame
+ * cannot align them all. The reference frame is covered by a grid of
+ * alignment boxes and a shift is computed for each box of each frame, around
+ * the global shift of the frame. The stacking then aligns each box with its
+ * own shift and blends the boxes with weights decreasing to their edges.
+ * The quality of each box of each frame is measured in the same pass, so that
+ * the stacking can keep the sharpest frames of each area of the image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <fftw3.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "gui/progress_and_log.h"
+#include "io/sequence.h"
+#include "algos/quality.h"
+#include "registration/dft_correlation.h"
+
+#include "multipoint.h"
+
+#define MP_FILE_MAGIC "SIRILMPR"
+#define MP_FILE_VERSION 2
+/* largest area used to compute the global shift when the sequence has no
+ * registration data */
+#define MP_MAX_GLOBAL_SIZE 1024
+
+static gchar *get_multipoint_filename(sequence *seq) {
+	return g_strdup_printf("%s.mpr", seq->seqname);
+}
+
+void free_multipoint_regdata(mpregdata *mp) {
+	if (!mp)
+		return;
+	free(mp->box_index);
+	free(mp->box_x);
+	free(mp->box_y);
+	free(mp->global);
+	free(mp->shifts);
+	free(mp->quality);
+	free(mp);
+}
+
+static int alloc_multipoint_regdata(mpregdata *mp) {
+	mp->box_index = malloc(mp->grid_w * mp->grid_h * sizeof(int));
+	mp->box_x = malloc(mp->nb_boxes * sizeof(int));
+	mp->box_y = malloc(mp->nb_boxes * sizeof(int));
+	mp->global = calloc(mp->nb_frames * 2, sizeof(float));
+	mp->shifts = calloc((size_t) mp->nb_frames * mp->nb_boxes * 2, sizeof(float));
+	mp->quality = malloc((size_t) mp->nb_frames * mp->nb_boxes * sizeof(float));
+	if (!mp->box_index || !mp->box_x || !mp->box_y || !mp->global || !mp->shifts ||
+			!mp->quality) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	return 0;
+}
+
+/* weight of the pixel (u, v) of a box in the stacking, a pyramid whose value is
+ * 1 at the center of the box and close to 0 at its edges. Because boxes overlap
+ * by half of their size, the weights of the boxes sum to 1 inside the grid. */
+double multipoint_box_weight(const mpregdata *mp, int u, int v) {
+	double half = mp->box_size / 2.0;
+	double wu = min(u + 0.5, mp->box_size - u - 0.5) / half;
+	double wv = min(v + 0.5, mp->box_size - v - 0.5) / half;
+	return wu * wv;
+}
+
+/* The file contains the header (magic, version, layer, box size, grid
+ * origin and size, number of boxes and of frames), the grid, the boxes, the
+ * shifts and the quality of the boxes. It is written in the byte order of the computer. */
+int save_multipoint_regdata(sequence *seq) {
+	mpregdata *mp = seq->mpregparam;
+	gchar *filename;
+	FILE *f;
+	int header[9], retval = 0;
+
+	if (!mp)
+		return 1;
+	filename = get_multipoint_filename(seq);
+	f = g_fopen(filename, "wb");
+	if (!f) {
+		siril_log_message(_("Could not create the file %s\n"), filename);
+		g_free(filename);
+		return 1;
+	}
+	header[0] = MP_FILE_VERSION;
+	header[1] = mp->layer;
+	header[2] = mp->box_size;
+	header[3] = mp->grid_x;
+	header[4] = mp->grid_y;
+	header[5] = mp->grid_w;
+	header[6] = mp->grid_h;
+	header[7] = mp->nb_boxes;
+	header[8] = mp->nb_frames;
+	if (fwrite(MP_FILE_MAGIC, 8, 1, f) != 1 ||
+			fwrite(header, sizeof(header), 1, f) != 1 ||
+			fwrite(mp->box_index, sizeof(int), mp->grid_w * mp->grid_h, f) != mp->grid_w * mp->grid_h ||
+			fwrite(mp->box_x, sizeof(int), mp->nb_boxes, f) != mp->nb_boxes ||
+			fwrite(mp->box_y, sizeof(int), mp->nb_boxes, f) != mp->nb_boxes ||
+			fwrite(mp->global, sizeof(float), mp->nb_frames * 2, f) != mp->nb_frames * 2 ||
+			fwrite(mp->shifts, sizeof(float) * 2 * mp->nb_boxes, mp->nb_frames, f) != mp->nb_frames ||
+			fwrite(mp->quality, sizeof(float) * mp->nb_boxes, mp->nb_frames, f) != mp->nb_frames) {
+		siril_log_message(_("Could not write the file %s\n"), filename);
+		retval = 1;
+	}
+	if (fclose(f))
+		retval = 1;
+	if (retval)
+		g_unlink(filename);
+	g_free(filename);
+	return retval;
+}
+
+/* loads the multi-point registration data of the sequence if it was not */
+int load_multipoint_regdata(sequence *seq) {
+	mpregdata *mp;
+	gchar *filename;
+	char magic[8];
+	int header[9];
+	FILE *f;
+
+	if (seq->mpregparam)
+		return 0;
+	filename = get_multipoint_filename(seq);
+	f = g_fopen(filename, "rb");
+	if (!f) {
+		siril_log_message(_("No multi-point registration data found for the sequence %s\n"),
+				seq->seqname);
+		g_free(filename);
+		return 1;
+	}
+	mp = calloc(1, sizeof(mpregdata));
+	if (!mp) {
+		PRINT_ALLOC_ERR;
+		fclose(f);
+		g_free(filename);
+		return 1;
+	}
+	if (fread(magic, 8, 1, f) != 1 || memcmp(magic, MP_FILE_MAGIC, 8) ||
+			fread(header, sizeof(header), 1, f) != 1) {
+		siril_log_message(_("The file %s is not valid multi-point registration data\n"), filename);
+		goto failure;
+	}
+	if (header[0] != MP_FILE_VERSION) {
+		siril_log_message(_("The multi-point registration data in %s has an unsupported version, register the sequence again\n"),
+				filename);
+		goto failure;
+	}
+	mp->layer = header[1];
+	mp->box_size = header[2];
+	mp->grid_x = header[3];
+	mp->grid_y = header[4];
+	mp->grid_w = header[5];
+	mp->grid_h = header[6];
+	mp->nb_boxes = header[7];
+	mp->nb_frames = header[8];
+	if (mp->nb_frames != seq->number || mp->layer < 0 || mp->layer >= seq->nb_layers ||
+			mp->box_size <= 0 || mp->grid_w <= 0 || mp->grid_h <= 0 ||
+			mp->nb_boxes <= 0 || mp->nb_boxes > mp->grid_w * mp->grid_h) {
+		siril_log_message(_("The multi-point registration data in %s does not match the sequence, register it again\n"),
+				filename);
+		goto failure;
+	}
+	if (alloc_multipoint_regdata(mp))
+		goto failure;
+	if (fread(mp->box_index, sizeof(int), mp->grid_w * mp->grid_h, f) != mp->grid_w * mp->grid_h ||
+			fread(mp->box_x, sizeof(int), mp->nb_boxes, f) != mp->nb_boxes ||
+			fread(mp->box_y, sizeof(int), mp->nb_boxes, f) != mp->nb_boxes ||
+			fread(mp->global, sizeof(float), mp->nb_frames * 2, f) != mp->nb_frames * 2 ||
+			fread(mp->shifts, sizeof(float) * 2 * mp->nb_boxes, mp->nb_frames, f) != mp->nb_frames ||
+			fread(mp->quality, sizeof(float) * mp->nb_boxes, mp->nb_frames, f) != mp->nb_frames) {
+		siril_log_message(_("Could not read the file %s\n"), filename);
+		goto failure;
+	}
+	fclose(f);
+	g_free(filename);
+	seq->mpregparam = mp;
+	return 0;
+
+failure:
+	fclose(f);
+	g_free(filename);
+	free_multipoint_regdata(mp);
+	return 1;
+}
+
+static double area_sigma(WORD *data, int stride, int size) {
+	double sum = 0.0, sumsq = 0.0, mean, n = (double) size * size;
+	int x, y;
+	for (y = 0; y < size; y++) {
+		WORD *line = data + (size_t) y * stride;
+		for (x = 0; x < size; x++) {
+			sum += line[x];
+			sumsq += (double) line[x] * line[x];
+		}
+	}
+	mean = sum / n;
+	return sqrt(max(sumsq / n - mean * mean, 0.0));
+}
+
+/* places the grid of boxes on the reference frame and keeps the boxes that
+ * have enough contrast to be aligned */
+static mpregdata *place_boxes(sequence *seq, WORD *ref, int layer, int box_size) {
+	int step = box_size / 2, rx = seq->rx, ry = seq->ry, i, k;
+	mpregdata *mp;
+	double *sigma, max_sigma = 0.0;
+
+	mp = calloc(1, sizeof(mpregdata));
+	if (!mp) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	mp->layer = layer;
+	mp->box_size = box_size;
+	mp->grid_w = (rx - box_size) / step + 1;
+	mp->grid_h = (ry - box_size) / step + 1;
+	/* center the grid, margins are only aligned with the global shift */
+	mp->grid_x = (rx - ((mp->grid_w - 1) * step + box_size)) / 2;
+	mp->grid_y = (ry - ((mp->grid_h - 1) * step + box_size)) / 2;
+	mp->nb_frames = seq->number;
+
+	sigma = malloc(mp->grid_w * mp->grid_h * sizeof(double));
+	if (!sigma) {
+		PRINT_ALLOC_ERR;
+		free(mp);
+		return NULL;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) reduction(max:max_sigma)
+#endif
+	for (i = 0; i < mp->grid_w * mp->grid_h; i++) {
+		int x = mp->grid_x + (i % mp->grid_w) * step;
+		int y = mp->grid_y + (i / mp->grid_w) * step;
+		sigma[i] = area_sigma(ref + (size_t) y * rx + x, rx, box_size);
+		if (sigma[i] > max_sigma)
+			max_sigma = sigma[i];
+	}
+	for (i = 0; i < mp->grid_w * mp->grid_h; i++) {
+		if (sigma[i] > 0.0 && sigma[i] >= MP_MIN_CONTRAST * max_sigma)
+			mp->nb_boxes++;
+	}
+	if (mp->nb_boxes == 0 || alloc_multipoint_regdata(mp)) {
+		if (mp->nb_boxes == 0)
+			siril_log_message(_("Multi-point registration: no area of the reference frame has enough contrast\n"));
+		free(sigma);
+		free_multipoint_regdata(mp);
+		return NULL;
+	}
+	for (i = 0, k = 0; i < mp->grid_w * mp->grid_h; i++) {
+		if (sigma[i] > 0.0 && sigma[i] >= MP_MIN_CONTRAST * max_sigma) {
+			mp->box_index[i] = k;
+			mp->box_x[k] = mp->grid_x + (i % mp->grid_w) * step;
+			mp->box_y[k] = mp->grid_y + (i / mp->grid_w) * step;
+			k++;
+		} else mp->box_index[i] = -1;
+	}
+	free(sigma);
+	return mp;
+}
+
+static int get_nb_threads() {
+#ifdef _OPENMP
+	return com.max_thread;
+#else
+	return 1;
+#endif
+}
+
+static int largest_power_of_two(int n) {
+	int p = 1;
+	while (p * 2 <= n)
+		p *= 2;
+	return p;
+}
+
+/* Registers the sequence with a grid of alignment boxes of args->box_size
+ * pixels. The global shift of each frame is taken from the registration data
+ * of the layer if it exists, or computed on the center of the frames. Frames
+ * are read one after the other, their boxes being aligned and their quality
+ * measured in parallel, so the sequence can be a SER file and no image is
+ * written. */
+int register_multipoint(struct registration_args *args) {
+	sequence *seq = args->seq;
+	int box_size = args->box_size > 0 ? args->box_size : MP_DEFAULT_BOX_SIZE;
+	int nb_threads = get_nb_threads(), ref_image, frame, k, retval = 0;
+	int gsize = 0, gx0 = 0, gy0 = 0, nb_done = 0, nb_discarded = 0;
+	double max_local;
+	size_t work_size, i;
+	float *work = NULL;
+	struct dft_correlation *dft = NULL, *gdft = NULL;
+	fftw_complex **references = NULL;
+	fits ref = { 0 };
+	mpregdata *mp = NULL;
+	regdata *global = seq->regparam ? seq->regparam[args->layer] : NULL;
+
+	box_size += box_size % 2;
+	if (box_size < 16 || box_size > (int) min(seq->rx, seq->ry)) {
+		siril_log_message(_("Multi-point registration: the size of the boxes must be between 16 and the size of the images\n"));
+		return 1;
+	}
+	max_local = MP_MAX_LOCAL_SHIFT * box_size;
+
+	ref_image = sequence_find_refimage(seq);
+	set_progress_bar_data(_("Multi-point registration: analysing the reference frame"), PROGRESS_RESET);
+	if (seq_read_frame(seq, ref_image, &ref)) {
+		siril_log_message(_("Register: could not load first image to register, aborting.\n"));
+		return 1;
+	}
+	if (args->layer >= ref.naxes[2]) {
+		siril_log_message(_("Multi-point registration: the layer %d does not exist\n"), args->layer);
+		clearfits(&ref);
+		return 1;
+	}
+
+	mp = place_boxes(seq, ref.pdata[args->layer], args->layer, box_size);
+	if (!mp) {
+		clearfits(&ref);
+		return 1;
+	}
+	siril_log_message(_("Multi-point registration: %d alignment boxes of %d pixels kept from a grid of %dx%d\n"),
+			mp->nb_boxes, box_size, mp->grid_w, mp->grid_h);
+
+	for (i = 0; i < (size_t) mp->nb_frames * mp->nb_boxes; i++)
+		mp->quality[i] = -1.f;
+
+	dft = new_dft_correlation(box_size, nb_threads, seq->number > 200);
+	references = calloc(mp->nb_boxes, sizeof(fftw_complex *));
+	work_size = (size_t) (box_size / QTILE_SUBSAMPLE) * (box_size / QTILE_SUBSAMPLE);
+	work = malloc(work_size * nb_threads * sizeof(float));
+	if (!dft || !references || !work) {
+		if (!work)
+			PRINT_ALLOC_ERR;
+		retval = 1;
+		goto the_end;
+	}
+	for (k = 0; k < mp->nb_boxes; k++) {
+		references[k] = dft_correlation_new_reference(dft, 0,
+				ref.pdata[args->layer] + (size_t) mp->box_y[k] * seq->rx + mp->box_x[k], seq->rx);
+		if (!references[k]) {
+			retval = 1;
+			goto the_end;
+		}
+		mp->quality[(size_t) ref_image * mp->nb_boxes + k] = (float) TileQuality(
+				ref.pdata[args->layer] + (size_t) mp->box_y[k] * seq->rx + mp->box_x[k],
+				seq->rx, box_size, work);
+	}
+	if (!global) {
+		gsize = largest_power_of_two(min(MP_MAX_GLOBAL_SIZE, min(seq->rx, seq->ry)));
+		gx0 = (seq->rx - gsize) / 2;
+		gy0 = (seq->ry - gsize) / 2;
+		gdft = new_dft_correlation(gsize, 1, FALSE);
+		if (!gdft) {
+			retval = 1;
+			goto the_end;
+		}
+		dft_correlation_set_reference(gdft, ref.pdata[args->layer] + (size_t) gy0 * seq->rx + gx0, seq->rx);
+		siril_log_message(_("Multi-point registration: no registration data, computing the global shifts\n"));
+	}
+	clearfits(&ref);
+
+	for (frame = 0; frame < seq->number; frame++) {
+		fits fit = { 0 };
+		double gx, gy;
+		WORD *data;
+
+		if (!get_thread_run()) {
+			retval = 1;
+			break;
+		}
+		if (!args->process_all_frames && !seq->imgparam[frame].incl)
+			continue;
+		if (frame == ref_image) {
+			/* shifts stay 0 */
+			nb_done++;
+			continue;
+		}
+		if (seq_read_frame(seq, frame, &fit)) {
+			siril_log_message(_("Multi-point registration: could not read the image %d\n"), frame);
+			retval = 1;
+			break;
+		}
+		data = fit.pdata[args->layer];
+
+		if (global) {
+			gx = global[frame].shiftx;
+			gy = global[frame].shifty;
+		} else {
+			dft_correlation_get_shift_from(gdft, 0, gdft->ref_spectrum,
+					data + (size_t) gy0 * seq->rx + gx0, seq->rx, &gx, &gy);
+		}
+		mp->global[frame * 2] = (float) gx;
+		mp->global[frame * 2 + 1] = (float) gy;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nb_threads) schedule(dynamic) reduction(+:nb_discarded)
+#endif
+		for (k = 0; k < mp->nb_boxes; k++) {
+			int thread = 0, ox, oy;
+			double lx, ly;
+			float *shift = mp->shifts + ((size_t) frame * mp->nb_boxes + k) * 2;
+			float *quality = mp->quality + (size_t) frame * mp->nb_boxes + k;
+#ifdef _OPENMP
+			thread = omp_get_thread_num();
+#endif
+			/* the area of the frame expected to match the box, kept
+			 * inside the frame */
+			ox = mp->box_x[k] - round_to_int(gx);
+			oy = mp->box_y[k] - round_to_int(gy);
+			ox = max(0, min(ox, (int) seq->rx - box_size));
+			oy = max(0, min(oy, (int) seq->ry - box_size));
+			dft_correlation_get_shift_from(dft, thread, references[k],
+					data + (size_t) oy * seq->rx + ox, seq->rx, &lx, &ly);
+			lx += mp->box_x[k] - ox;
+			ly += mp->box_y[k] - oy;
+			if (fabs(lx - gx) > max_local || fabs(ly - gy) > max_local) {
+				/* probably a wrong match, distorted by the seeing */
+				lx = gx;
+				ly = gy;
+				nb_discarded++;
+			}
+			shift[0] = (float) lx;
+			shift[1] = (float) ly;
+
+			/* quality of the area of the frame aligned with the box */
+			ox = mp->box_x[k] - round_to_int(lx);
+			oy = mp->box_y[k] - round_to_int(ly);
+			ox = max(0, min(ox, (int) seq->rx - box_size));
+			oy = max(0, min(oy, (int) seq->ry - box_size));
+			*quality = (float) TileQuality(data + (size_t) oy * seq->rx + ox, seq->rx,
+					box_size, work + work_size * thread);
+		}
+		clearfits(&fit);
+		nb_done++;
+		set_progress_bar_data(NULL, (double) nb_done / seq->number);
+	}
+
+the_end:
+	clearfits(&ref);
+	if (references) {
+		for (k = 0; k < mp->nb_boxes; k++)
+			if (references[k])
+				fftw_free(references[k]);
+		free(references);
+	}
+	free(work);
+	free_dft_correlation(dft);
+	free_dft_correlation(gdft);
+	if (!retval) {
+		free_multipoint_regdata(seq->mpregparam);
+		seq->mpregparam = mp;
+		retval = save_multipoint_regdata(seq);
+		siril_log_message(_("Multi-point registration: %d frames registered, %.2f%% of the local shifts discarded\n"),
+				nb_done, nb_done > 1 ? 100.0 * nb_discarded / ((nb_done - 1) * (double) mp->nb_boxes) : 0.0);
+		set_progress_bar_data(_("Registration complete."), PROGRESS_DONE);
+	} else {
+		free_multipoint_regdata(mp);
+		set_progress_bar_data(_("Registration failed."), PROGRESS_DONE);
+	}
+	return retval;
+}
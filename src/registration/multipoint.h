@@ -0,0 +1,21 @@
+#ifndef _MULTIPOINT_H_
+#define _MULTIPOINT_H_
+
+#include "core/siril.h"
+#include "registration/registration.h"
+
+#define MP_DEFAULT_BOX_SIZE 64
+/* boxes of the reference with a standard deviation lower than this fraction
+ * of the highest one are not used, they show sky or a featureless area */
+#define MP_MIN_CONTRAST 0.1
+/* local shifts larger than this fraction of the box size are discarded and
+ * replaced by the global shift of the frame */
+#define MP_MAX_LOCAL_SHIFT 0.25
+
+int register_multipoint(struct registration_args *args);
+int save_multipoint_regdata(sequence *seq);
+int load_multipoint_regdata(sequence *seq);
+void free_multipoint_regdata(mpregdata *mp);
+double multipoint_box_weight(const mpregdata *mp, int u, int v);
+
+#endif
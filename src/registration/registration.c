@@ -21,12 +21,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <complex.h>
-#include <fftw3.h>
 #include <assert.h>
 #include <float.h>
 #include <math.h>
 #include <gtk/gtk.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #ifdef MAC_INTEGRATION
 #include <gtkosxapplication.h>
 #endif
@@ -39,6 +40,7 @@
 #include "core/proto.h"
 #include "core/initfile.h"
 #include "registration/registration.h"
+#include "registration/dft_correlation.h"
 #include "registration/matching/misc.h"
 #include "registration/matching/match.h"
 #include "registration/matching/atpmatch.h"
@@ -48,6 +50,7 @@
 #include "algos/quality.h"
 #include "io/sequence.h"
 #include "io/ser.h"
+#include "io/regcache.h"
 #include "io/single_image.h"
 #include "opencv/opencv.h"
 #include "opencv/ecc/ecc.h"
@@ -175,17 +178,32 @@ static void normalizeQualityData(struct registration_args *args, double q_min, d
 	}
 }
 
+/* quality of the frame, or of its area for a partial frame, computed with
+ * QualityEstimate() which destroys fit, or taken from the cache of the
+ * sequence if it was already computed */
+static double get_frame_quality(sequence *seq, int frame, fits *fit, int layer,
+		rectangle *area) {
+	guint64 key = regcache_key("quality", layer);
+	double quality;
+
+	if (area)
+		key = regcache_hash(key, area, sizeof(rectangle));
+	if (regcache_get_value(seq, frame, key, &quality))
+		return quality;
+	quality = QualityEstimate(fit, layer, QUALTYPE_NORMAL);
+	regcache_set_value(seq, frame, key, quality);
+	return quality;
+}
+
 /* Calculate shift in images to be aligned with the reference image, using
  * discrete Fourrier transform on a square selected area and matching the
- * phases.
+ * phases. Shifts have a sub-pixel precision.
  */
 int register_shift_dft(struct registration_args *args) {
 	fits fit_ref = { 0 }, fit = { 0 };
-	int frame, size, sqsize;
-	fftw_complex *ref, *in, *out, *convol;
-	fftw_plan p, q;
-	int ret, j;
-	int plan;
+	int frame, size;
+	struct dft_correlation *dft;
+	int ret, nb_threads;
 	int abort = 0;
 	float nb_frames, cur_nb;
 	int ref_image;
@@ -196,7 +214,6 @@ int register_shift_dft(struct registration_args *args) {
 	/* the selection needs to be squared for the DFT */
 	assert(args->selection.w == args->selection.h);
 	size = args->selection.w;
-	sqsize = size * size;
 
 	if (args->process_all_frames)
 		nb_frames = (float) args->seq->number;
@@ -237,27 +254,26 @@ int register_shift_dft(struct registration_args *args) {
 		return ret;
 	}
 
-	ref = fftw_malloc(sizeof(fftw_complex) * sqsize);
-	in = fftw_malloc(sizeof(fftw_complex) * sqsize);
-	out = fftw_malloc(sizeof(fftw_complex) * sqsize);
-	convol = fftw_malloc(sizeof(fftw_complex) * sqsize);
-
-	if (nb_frames > 200.f)
-		plan = FFTW_MEASURE;
-	else
-		plan = FFTW_ESTIMATE;
-
-	p = fftw_plan_dft_2d(size, size, ref, out, FFTW_FORWARD, plan);
-	q = fftw_plan_dft_2d(size, size, convol, out, FFTW_BACKWARD, plan);
-
-	// copying image selection into the fftw data
-	for (j = 0; j < sqsize; j++)
-		ref[j] = (double) fit_ref.data[j];
+#ifdef _OPENMP
+	nb_threads = com.max_thread;
+#else
+	nb_threads = 1;
+#endif
+	/* measured plans are worth it for long sequences only */
+	dft = new_dft_correlation(size, nb_threads, nb_frames > 200.f);
+	if (!dft) {
+		args->seq->regparam[args->layer] = NULL;
+		free(current_regdata);
+		clearfits(&fit_ref);
+		return 1;
+	}
+	dft_correlation_set_reference(dft, fit_ref.data, size);
 
 	// We don't need fit anymore, we can destroy it.
-	current_regdata[ref_image].quality = QualityEstimate(&fit_ref, args->layer, QUALTYPE_NORMAL);
+	regcache_open(args->seq);
+	current_regdata[ref_image].quality = get_frame_quality(args->seq, ref_image,
+			&fit_ref, args->layer, &args->selection);
 	clearfits(&fit_ref);
-	fftw_execute_dft(p, ref, in); /* repeat as needed */
 	set_shifts(args->seq, ref_image, args->layer, 0.0, 0.0, FALSE);
 
 	q_min = q_max = current_regdata[ref_image].quality;
@@ -266,8 +282,8 @@ int register_shift_dft(struct registration_args *args) {
 	cur_nb = 0.f;
 
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(com.max_thread) firstprivate(fit) schedule(static) \
-	if((args->seq->type == SEQ_REGULAR && fits_is_reentrant()) || args->seq->type == SEQ_SER)
+#pragma omp parallel for num_threads(nb_threads) firstprivate(fit) schedule(static) \
+	if((args->seq->type == SEQ_REGULAR && fits_is_reentrant()) || args->seq->type == SEQ_SER || args->seq->type == SEQ_CHUNKED)
 #endif
 	for (frame = 0; frame < args->seq->number; ++frame) {
 		if (!abort) {
@@ -288,17 +304,14 @@ int register_shift_dft(struct registration_args *args) {
 			set_progress_bar_data(tmpmsg, PROGRESS_NONE);
 			if (!(seq_read_frame_part(args->seq, args->layer, frame, &fit,
 					&args->selection, FALSE))) {
+				double shiftx, shifty;
+				int thread = 0;
+#ifdef _OPENMP
+				thread = omp_get_thread_num();
+#endif
 
-				int x;
-				fftw_complex *img = fftw_malloc(sizeof(fftw_complex) * sqsize);
-				fftw_complex *out2 = fftw_malloc(sizeof(fftw_complex) * sqsize);
-
-				// copying image selection into the fftw data
-				for (x = 0; x < sqsize; x++)
-					img[x] = (double) fit.data[x];
-
-				current_regdata[frame].quality = QualityEstimate(&fit, args->layer,
-						QUALTYPE_NORMAL);
+				current_regdata[frame].quality = get_frame_quality(args->seq, frame,
+						&fit, args->layer, &args->selection);
 
 #ifdef _OPENMP
 #pragma omp critical
@@ -312,32 +325,7 @@ int register_shift_dft(struct registration_args *args) {
 					q_min = min(q_min, qual);
 				}
 
-				fftw_execute_dft(p, img, out2); /* repeat as needed */
-
-				fftw_complex *convol2 = fftw_malloc(sizeof(fftw_complex) * sqsize);
-
-				for (x = 0; x < sqsize; x++) {
-					convol2[x] = in[x] * conj(out2[x]);
-				}
-
-				fftw_execute_dft(q, convol2, out2); /* repeat as needed */
-				fftw_free(convol2);
-
-				int shift = 0;
-				for (x = 1; x < sqsize; ++x) {
-					if (creal(out2[x]) > creal(out2[shift])) {
-						shift = x;
-						// break or get last value?
-					}
-				}
-				int shifty = shift / size;
-				int shiftx = shift % size;
-				if (shifty > size / 2) {
-					shifty -= size;
-				}
-				if (shiftx > size / 2) {
-					shiftx -= size;
-				}
+				dft_correlation_get_shift(dft, thread, fit.data, &shiftx, &shifty);
 
 				set_shifts(args->seq, frame, args->layer, (float)shiftx, (float)shifty,
 						fit.top_down);
@@ -363,24 +351,16 @@ int register_shift_dft(struct registration_args *args) {
 #endif
 				cur_nb += 1.f;
 				set_progress_bar_data(NULL, cur_nb / nb_frames);
-				fftw_free(img);
-				fftw_free(out2);
 			} else {
 				//report_fits_error(ret, error_buffer);
-				args->seq->regparam[args->layer] = NULL;
-				free(current_regdata);
 				abort = ret = 1;
 				continue;
 			}
 		}
 	}
 
-	fftw_destroy_plan(p);
-	fftw_destroy_plan(q);
-	fftw_free(in);
-	fftw_free(out);
-	fftw_free(ref);
-	fftw_free(convol);
+	free_dft_correlation(dft);
+	regcache_save(args->seq);
 	if (!ret) {
 		if (args->x2upscale)
 			args->seq->upscale_at_stacking = 2.0;
@@ -488,7 +468,9 @@ int register_ecc(struct registration_args *args) {
 	fits ref, im;
 	double q_max = 0, q_min = DBL_MAX;
 	int q_index = -1;
-	int abort = 0;
+	int abort = 0, nb_threads, i;
+	ecc_reference *ecc_ref;
+	ecc_workspace **workspaces;
 
 	if (args->seq->regparam[args->layer]) {
 		current_regdata = args->seq->regparam[args->layer];
@@ -520,13 +502,31 @@ int register_ecc(struct registration_args *args) {
 		free(current_regdata);
 		return 1;
 	}
-	current_regdata[ref_image].quality = QualityEstimate(&ref, args->layer, QUALTYPE_NORMAL);
+	image_find_minmax(&ref);
+	/* the reference is prepared once, the frame is not needed anymore
+	 * after the estimation of its quality which destroys it */
+	ecc_ref = new_ecc_reference(&ref, args->layer);
+	regcache_open(args->seq);
+	current_regdata[ref_image].quality = get_frame_quality(args->seq, ref_image,
+			&ref, args->layer, NULL);
 	/* we make sure to free data in the destroyed fit */
 	clearfits(&ref);
-	/* Ugly code: as QualityEstimate destroys fit we need to reload it */
-	seq_read_frame(args->seq, ref_image, &ref);
-	image_find_minmax(&ref);
 	q_min = q_max = current_regdata[ref_image].quality;
+
+#ifdef _OPENMP
+	nb_threads = com.max_thread;
+#else
+	nb_threads = 1;
+#endif
+	/* created by each thread on its first frame and reused for the next */
+	workspaces = calloc(nb_threads, sizeof(ecc_workspace *));
+	if (!workspaces) {
+		PRINT_ALLOC_ERR;
+		free_ecc_reference(ecc_ref);
+		args->seq->regparam[args->layer] = NULL;
+		free(current_regdata);
+		return 1;
+	}
 	q_index = ref_image;
 
 	/* then we compare to other frames */
@@ -538,8 +538,8 @@ int register_ecc(struct registration_args *args) {
 
 	memset(&im, 0, sizeof(fits));
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(com.max_thread) firstprivate(im) schedule(static) \
-	if((args->seq->type == SEQ_REGULAR && fits_is_reentrant()) || args->seq->type == SEQ_SER)
+#pragma omp parallel for num_threads(nb_threads) firstprivate(im) schedule(static) \
+	if((args->seq->type == SEQ_REGULAR && fits_is_reentrant()) || args->seq->type == SEQ_SER || args->seq->type == SEQ_CHUNKED)
 #endif
 	for (frame = 0; frame < args->seq->number; frame++) {
 		if (!abort) {
@@ -563,10 +563,17 @@ int register_ecc(struct registration_args *args) {
 				ret = seq_read_frame(args->seq, frame, &im);
 				if (!ret) {
 					reg_ecc reg_param;
+					int thread = 0;
+#ifdef _OPENMP
+					thread = omp_get_thread_num();
+#endif
 					memset(&reg_param, 0, sizeof(reg_ecc));
 					image_find_minmax(&im);
+					if (!workspaces[thread])
+						workspaces[thread] = new_ecc_workspace();
 
-					if (findTransform(&ref, &im, args->layer, &reg_param)) {
+					if (findTransform(ecc_ref, workspaces[thread], &im,
+								args->layer, &reg_param)) {
 						siril_log_message(
 								_("Cannot perform ECC alignment for frame %d\n"),
 								frame);
@@ -582,8 +589,8 @@ int register_ecc(struct registration_args *args) {
 						continue;
 					}
 
-					current_regdata[frame].quality = QualityEstimate(&im,
-							args->layer, QUALTYPE_NORMAL);
+					current_regdata[frame].quality = get_frame_quality(args->seq,
+							frame, &im, args->layer, NULL);
 
 #ifdef _OPENMP
 #pragma omp critical
@@ -615,8 +622,14 @@ int register_ecc(struct registration_args *args) {
 	else
 		args->seq->upscale_at_stacking = 1.0;
 
+	for (i = 0; i < nb_threads; i++)
+		if (workspaces[i])
+			free_ecc_workspace(workspaces[i]);
+	free(workspaces);
+	free_ecc_reference(ecc_ref);
+
 	normalizeQualityData(args, q_min, q_max);
-	clearfits(&ref);
+	regcache_save(args->seq);
 	update_used_memory();
 	siril_log_message(_("Registration finished.\n"));
 	if (failed) {
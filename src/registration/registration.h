@@ -25,6 +25,8 @@ struct registration_args {
 
 	/* data for generated sequence, for star alignment registration */
 	gboolean translation_only;	// don't rotate images => no new sequence
+	gboolean transform_at_stacking;	// with translation_only, keep the full
+					// transformation to apply it when stacking
 	int new_total;                  // remaining images after registration
 	imgdata *imgparam;		// imgparam for the new sequence
 	regdata *regparam;		// regparam for the new sequence
@@ -32,6 +34,7 @@ struct registration_args {
 	gboolean load_new_sequence;	// load the new sequence if success
 	const gchar *new_seq_name;
 	opencv_interpolation interpolation; // type of rotation interpolation
+	int box_size;			// side of the alignment boxes of multi-point registration
 };
 
 typedef enum {
@@ -23,8 +23,10 @@
 #include "stacking.h"
 #include "io/sequence.h"
 #include "io/ser.h"
+#include "io/chunked.h"
 #include "gui/progress_and_log.h"
 #include <string.h>
+#include <math.h>
 
 int stack_open_all_files(struct stacking_args *args, int *bitpix, int *naxis, long *naxes, double *exposure, fits *fit) {
 	char msg[256], filename[256];
@@ -120,6 +122,14 @@ int stack_open_all_files(struct stacking_args *args, int *bitpix, int *naxis, lo
 			return 1;
 		}
 	}
+	else if (args->seq->type == SEQ_CHUNKED) {
+		g_assert(args->seq->chunked_file);
+		naxes[0] = args->seq->chunked_file->width;
+		naxes[1] = args->seq->chunked_file->height;
+		naxes[2] = args->seq->chunked_file->nb_layers;
+		*naxis = naxes[2] == 3 ? 3 : 2;
+		*bitpix = USHORT_IMG;
+	}
 	else {
 		siril_log_message(_("Rejection stacking is only supported for FITS images and SER sequences.\nUse \"Sum Stacking\" instead.\n"));
 		return 2;
@@ -128,13 +138,26 @@ int stack_open_all_files(struct stacking_args *args, int *bitpix, int *naxis, lo
 	return 0;
 }
 
+/* allocates the result of the stacking, in float if fit->type is DATA_FLOAT */
 int stack_create_result_fit(fits *fit, int bitpix, int naxis, long *naxes) {
 	long nbdata;
 	nbdata = naxes[0] * naxes[1];
-	fit->data = malloc(nbdata * naxes[2] * sizeof(WORD));
-	if (!fit->data) {
-		fprintf(stderr, "Memory allocation error for result\n");
-		return 1;
+	if (fit->type == DATA_FLOAT) {
+		int i;
+		fit->fdata = malloc(nbdata * naxes[2] * sizeof(float));
+		if (!fit->fdata) {
+			fprintf(stderr, "Memory allocation error for result\n");
+			return 1;
+		}
+		for (i = 0; i < 3; i++)
+			fit->fpdata[i] = fit->fdata + (naxis == 3 ? nbdata * i : 0);
+		bitpix = FLOAT_IMG;
+	} else {
+		fit->data = malloc(nbdata * naxes[2] * sizeof(WORD));
+		if (!fit->data) {
+			fprintf(stderr, "Memory allocation error for result\n");
+			return 1;
+		}
 	}
 	fit->bitpix = fit->orig_bitpix = bitpix;
 	fit->naxes[0] = naxes[0];
@@ -144,7 +167,9 @@ int stack_create_result_fit(fits *fit, int bitpix, int naxis, long *naxes) {
 	fit->ry = naxes[1];
 	fit->naxis = naxis;
 	fit->maxi = 0;
-	if (fit->naxis == 3) {
+	if (fit->type == DATA_FLOAT) {
+		fit->pdata[RLAYER] = fit->pdata[GLAYER] = fit->pdata[BLAYER] = NULL;
+	} else if (fit->naxis == 3) {
 		fit->pdata[RLAYER] = fit->data;
 		fit->pdata[GLAYER] = fit->data + nbdata;
 		fit->pdata[BLAYER] = fit->data + nbdata * 2;
@@ -240,6 +265,229 @@ int stack_compute_parallel_blocks(struct _image_block **blocksptr, int max_numbe
 	return 0;
 }
 
+/* Gets the transformation from frame to the reference image, in the top-down
+ * coordinates of the read areas and at the stacking scale.
+ * Returns FALSE if the frame is only shifted by an integer number of pixels,
+ * which is done by the block reader and the stacking loop without resampling:
+ * it is the case when no interpolation is requested and the registration has
+ * no transformation other than shifts. */
+gboolean stack_get_frame_transformation(struct stacking_args *args, int frame, double T[9]) {
+	regdata *reg;
+	double scale;
+
+	if (args->reglayer < 0 || !args->seq->regparam[args->reglayer])
+		return FALSE;
+	reg = &args->seq->regparam[args->reglayer][args->image_indices[frame]];
+	scale = args->seq->upscale_at_stacking;
+
+	if (reg->H.h22 != 0.0) {
+		T[0] = reg->H.h00;         T[1] = reg->H.h01;         T[2] = reg->H.h02 * scale;
+		T[3] = reg->H.h10;         T[4] = reg->H.h11;         T[5] = reg->H.h12 * scale;
+		T[6] = reg->H.h20 / scale; T[7] = reg->H.h21 / scale; T[8] = reg->H.h22;
+		return TRUE;
+	}
+	if (args->interpolation == OPENCV_NEAREST)
+		return FALSE;
+	/* shifty is for bottom-up images */
+	T[0] = 1.0; T[1] = 0.0; T[2] = reg->shiftx * scale;
+	T[3] = 0.0; T[4] = 1.0; T[5] = -reg->shifty * scale;
+	T[6] = 0.0; T[7] = 0.0; T[8] = 1.0;
+	return TRUE;
+}
+
+#define LANCZOS_A 4
+
+static double lanczos(double x) {
+	if (x == 0.0)
+		return 1.0;
+	if (x <= -LANCZOS_A || x >= LANCZOS_A)
+		return 0.0;
+	x *= M_PI;
+	return LANCZOS_A * sin(x) * sin(x / LANCZOS_A) / (x * x);
+}
+
+/* weights of the 2 * LANCZOS_A pixels around a position of fractional part f */
+static void lanczos_weights(double f, double w[2 * LANCZOS_A]) {
+	int i;
+	double sum = 0.0;
+	for (i = 0; i < 2 * LANCZOS_A; i++) {
+		w[i] = lanczos(f + LANCZOS_A - 1 - i);
+		sum += w[i];
+	}
+	for (i = 0; i < 2 * LANCZOS_A; i++)
+		w[i] /= sum;
+}
+
+/* pixel i of the source area read for the resampling */
+static inline double resample_source(const struct _data_block *data, gboolean use_float, size_t i) {
+	return use_float ? data->fresample[i] : data->resample[i];
+}
+
+/* Reads the part of the frame that is mapped to the block by the
+ * transformation T and resamples it into data->pix[frame], or data->fpix[frame]
+ * for the stacking in 32 bits. Pixels that come from outside the frame are
+ * black. */
+static int stack_resample_block(struct stacking_args *args, int frame, const double T[9],
+		struct _image_block *my_block, struct _data_block *data, long *naxes) {
+	double I[9], det, xmin, xmax, ymin, ymax;
+	double wx[2 * LANCZOS_A], wy[2 * LANCZOS_A], last_fx = -1.0, last_fy = -1.0;
+	int i, margin;
+	long x, y;
+	rectangle area;
+	gboolean use_float = args->use_32bit_output;
+	WORD *out = use_float ? NULL : data->pix[frame];
+	float *fout = use_float ? data->fpix[frame] : NULL;
+
+	if (use_float)
+		memset(fout, 0, my_block->height * naxes[0] * sizeof(float));
+	else memset(out, 0, my_block->height * naxes[0] * sizeof(WORD));
+
+	/* the inverse transformation gives the frame position of each pixel */
+	det = T[0] * (T[4] * T[8] - T[5] * T[7]) - T[1] * (T[3] * T[8] - T[5] * T[6])
+		+ T[2] * (T[3] * T[7] - T[4] * T[6]);
+	if (fabs(det) < 1e-12)
+		return 0;
+	I[0] = (T[4] * T[8] - T[5] * T[7]) / det;
+	I[1] = (T[2] * T[7] - T[1] * T[8]) / det;
+	I[2] = (T[1] * T[5] - T[2] * T[4]) / det;
+	I[3] = (T[5] * T[6] - T[3] * T[8]) / det;
+	I[4] = (T[0] * T[8] - T[2] * T[6]) / det;
+	I[5] = (T[2] * T[3] - T[0] * T[5]) / det;
+	I[6] = (T[3] * T[7] - T[4] * T[6]) / det;
+	I[7] = (T[1] * T[6] - T[0] * T[7]) / det;
+	I[8] = (T[0] * T[4] - T[1] * T[3]) / det;
+
+	/* area of the frame needed for the block: the bounding box of its mapped
+	 * corners, with the margin required by the interpolation */
+	xmin = ymin = HUGE_VAL;
+	xmax = ymax = -HUGE_VAL;
+	for (i = 0; i < 4; i++) {
+		double cx = (i & 1) ? naxes[0] - 1 : 0;
+		double cy = my_block->start_row + ((i & 2) ? my_block->height - 1 : 0);
+		double w = I[6] * cx + I[7] * cy + I[8];
+		double fx = (I[0] * cx + I[1] * cy + I[2]) / w;
+		double fy = (I[3] * cx + I[4] * cy + I[5]) / w;
+		if (fx < xmin) xmin = fx;
+		if (fx > xmax) xmax = fx;
+		if (fy < ymin) ymin = fy;
+		if (fy > ymax) ymax = fy;
+	}
+	margin = args->interpolation == OPENCV_LANCZOS4 ? LANCZOS_A : 1;
+	xmin = max(floor(xmin) - margin, 0);
+	ymin = max(floor(ymin) - margin, 0);
+	xmax = min(ceil(xmax) + margin, naxes[0] - 1);
+	ymax = min(ceil(ymax) + margin, naxes[1] - 1);
+	if (xmin > xmax || ymin > ymax)
+		return 0;	// entirely outside the frame
+	area.x = (int) xmin;
+	area.y = (int) ymin;
+	area.w = (int) xmax - area.x + 1;
+	area.h = (int) ymax - area.y + 1;
+
+	if ((size_t) area.w * area.h > data->resample_size) {
+		if (use_float) {
+			float *buf = realloc(data->fresample, (size_t) area.w * area.h * sizeof(float));
+			if (!buf) {
+				PRINT_ALLOC_ERR;
+				return 1;
+			}
+			data->fresample = buf;
+		} else {
+			WORD *buf = realloc(data->resample, (size_t) area.w * area.h * sizeof(WORD));
+			if (!buf) {
+				PRINT_ALLOC_ERR;
+				return 1;
+			}
+			data->resample = buf;
+		}
+		data->resample_size = (size_t) area.w * area.h;
+	}
+	if (use_float) {
+		if (seq_opened_read_region_float(args->seq, my_block->channel,
+					args->image_indices[frame], data->fresample, &area))
+			return 1;
+	} else if (seq_opened_read_region(args->seq, my_block->channel,
+				args->image_indices[frame], data->resample, &area))
+		return 1;
+
+	for (y = 0; y < my_block->height; y++) {
+		double dy = my_block->start_row + y;
+		for (x = 0; x < naxes[0]; x++) {
+			double w = I[6] * x + I[7] * dy + I[8];
+			double fx = (I[0] * x + I[1] * dy + I[2]) / w;
+			double fy = (I[3] * x + I[4] * dy + I[5]) / w;
+			double value = 0.0;
+			int ix, iy;
+
+			if (fx < 0.0 || fx > naxes[0] - 1 || fy < 0.0 || fy > naxes[1] - 1)
+				continue;
+			/* position in the read area */
+			fx -= area.x;
+			fy -= area.y;
+
+			switch (args->interpolation) {
+			case OPENCV_NEAREST:
+				ix = min(round_to_int(fx), area.w - 1);
+				iy = min(round_to_int(fy), area.h - 1);
+				value = resample_source(data, use_float, iy * area.w + ix);
+				break;
+			case OPENCV_LANCZOS4: {
+				int j, k;
+				double dx = floor(fx), dyy = floor(fy);
+				ix = (int) dx;
+				iy = (int) dyy;
+				/* the weights only change with the fractional part,
+				 * which is the same for all pixels of shifted frames */
+				if (fx - dx != last_fx) {
+					last_fx = fx - dx;
+					lanczos_weights(last_fx, wx);
+				}
+				if (fy - dyy != last_fy) {
+					last_fy = fy - dyy;
+					lanczos_weights(last_fy, wy);
+				}
+				for (j = 0; j < 2 * LANCZOS_A; j++) {
+					int sy = iy - LANCZOS_A + 1 + j;
+					double row = 0.0;
+					size_t line;
+					if (sy < 0) sy = 0;
+					if (sy >= area.h) sy = area.h - 1;
+					line = (size_t) sy * area.w;
+					for (k = 0; k < 2 * LANCZOS_A; k++) {
+						int sx = ix - LANCZOS_A + 1 + k;
+						if (sx < 0) sx = 0;
+						if (sx >= area.w) sx = area.w - 1;
+						row += wx[k] * resample_source(data, use_float, line + sx);
+					}
+					value += wy[j] * row;
+				}
+				break;
+			}
+			default:
+			case OPENCV_LINEAR: {
+				double ax, ay;
+				int ix1, iy1;
+				ix = (int) fx;
+				iy = (int) fy;
+				ax = fx - ix;
+				ay = fy - iy;
+				ix1 = min(ix + 1, area.w - 1);
+				iy1 = min(iy + 1, area.h - 1);
+				value = (1.0 - ay) * ((1.0 - ax) * resample_source(data, use_float, iy * area.w + ix) +
+						ax * resample_source(data, use_float, iy * area.w + ix1)) +
+					ay * ((1.0 - ax) * resample_source(data, use_float, iy1 * area.w + ix) +
+							ax * resample_source(data, use_float, iy1 * area.w + ix1));
+				break;
+			}
+			}
+			if (use_float)
+				fout[y * naxes[0] + x] = (float) value;
+			else out[y * naxes[0] + x] = round_to_WORD(value);
+		}
+	}
+	return 0;
+}
+
 void stack_read_block_data(struct stacking_args *args, int use_regdata,
 		struct _image_block *my_block, struct _data_block *data, long *naxes) {
 
@@ -254,6 +502,21 @@ void stack_read_block_data(struct stacking_args *args, int use_regdata,
 		if (!get_thread_run()) {
 			return;
 		}
+		if (use_regdata) {
+			double T[9];
+			if (stack_get_frame_transformation(args, frame, T)) {
+				/* sub-pixel shift or rotation: resample the frame */
+				if (stack_resample_block(args, frame, T, my_block, data, naxes)) {
+#ifdef _OPENMP
+					int tid = omp_get_thread_num();
+					if (tid == 0)
+#endif
+						siril_log_message(_("Error reading one of the image areas\n"));
+					break;
+				}
+				continue;
+			}
+		}
 		if (use_regdata && args->reglayer >= 0) {
 			/* Load registration data for current image and modify area.
 			 * Here, only the y shift is managed. If possible, the remaining part
@@ -293,13 +556,19 @@ void stack_read_block_data(struct stacking_args *args, int use_regdata,
 			if (clear) {
 				/* we are reading outside an image, fill with
 				 * zeros and attempt to read lines that fit */
-				memset(data->pix[frame], 0, my_block->height * naxes[0] * sizeof(WORD));
+				if (args->use_32bit_output)
+					memset(data->fpix[frame], 0, my_block->height * naxes[0] * sizeof(float));
+				else memset(data->pix[frame], 0, my_block->height * naxes[0] * sizeof(WORD));
 			}
 		}
 
 		if (!use_regdata || readdata) {
 			// reading pixels from current frame
-			int retval = seq_opened_read_region(args->seq, my_block->channel,
+			int retval;
+			if (args->use_32bit_output)
+				retval = seq_opened_read_region_float(args->seq, my_block->channel,
+						args->image_indices[frame], data->fpix[frame]+offset, &area);
+			else retval = seq_opened_read_region(args->seq, my_block->channel,
 					args->image_indices[frame], data->pix[frame]+offset, &area);
 			if (retval) {
 #ifdef _OPENMP
@@ -0,0 +1,304 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "core/processing.h"
+#include "gui/progress_and_log.h"
+#include "io/sequence.h"
+#include "algos/sorting.h"
+#include "registration/multipoint.h"
+#include "stacking.h"
+
+/* weight of the frame aligned with its global shift, used where no box
+ * covers the image and negligible elsewhere */
+#define MP_BACKGROUND_WEIGHT 1E-3
+
+struct mp_stacking_data {
+	mpregdata *mp;
+	double *sum[3];		/* weighted sums of the aligned pixels */
+	double *weights;	/* sum of the weights of each pixel */
+	double *box_weights;	/* weights of the pixels of a box */
+	double tile_best;	/* percentage of the best frames kept for each box, 0 for all */
+	float *thresholds;	/* for each box, lowest quality of the frames kept */
+	double exposure;
+	int ref_image;
+};
+
+/* bilinear interpolation of data at (x, y), returns 0 outside of the image */
+static int sample(const WORD *data, int rx, int ry, double x, double y, double *value) {
+	int x0 = (int) floor(x), y0 = (int) floor(y), x1, y1;
+	double dx = x - x0, dy = y - y0;
+	if (x0 < 0 || y0 < 0 || x0 >= rx || y0 >= ry)
+		return 0;
+	x1 = min(x0 + 1, rx - 1);
+	y1 = min(y0 + 1, ry - 1);
+	*value = (1.0 - dy) * ((1.0 - dx) * data[y0 * rx + x0] + dx * data[y0 * rx + x1]) +
+		dy * ((1.0 - dx) * data[y1 * rx + x0] + dx * data[y1 * rx + x1]);
+	return 1;
+}
+
+/* For each box, the quality of the frames selected for the stacking is sorted
+ * to find the lowest one of the tile_best percents of best frames. Frames
+ * whose quality was not measured are not taken into account and always kept. */
+static int compute_thresholds(struct generic_seq_args *args, struct mp_stacking_data *mpdata) {
+	mpregdata *mp = mpdata->mp;
+	int k, retval = 0;
+
+	mpdata->thresholds = malloc(mp->nb_boxes * sizeof(float));
+	if (!mpdata->thresholds) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(k) schedule(static)
+#endif
+	for (k = 0; k < mp->nb_boxes; k++) {
+		double *qualities;
+		int frame, n = 0, keep;
+
+		if (retval)
+			continue;
+		qualities = malloc(mp->nb_frames * sizeof(double));
+		if (!qualities) {
+			PRINT_ALLOC_ERR;
+			retval = 1;
+			continue;
+		}
+		for (frame = 0; frame < mp->nb_frames; frame++) {
+			float q = mp->quality[(size_t) frame * mp->nb_boxes + k];
+			if (q >= 0.f && args->filtering_criterion(args->seq, frame, args->filtering_parameter))
+				qualities[n++] = q;
+		}
+		if (n > 0) {
+			quicksort_d(qualities, n);
+			keep = max(1, round_to_int(n * mpdata->tile_best / 100.0));
+			mpdata->thresholds[k] = (float) qualities[n - keep];
+		} else mpdata->thresholds[k] = -1.f;
+		free(qualities);
+	}
+	return retval;
+}
+
+static int mp_stacking_prepare_hook(struct generic_seq_args *args) {
+	struct mp_stacking_data *mpdata = args->user;
+	size_t nbdata = (size_t) args->seq->rx * args->seq->ry;
+	int layer, u, v, box_size;
+
+	if (load_multipoint_regdata(args->seq))
+		return 1;
+	mpdata->mp = args->seq->mpregparam;
+	box_size = mpdata->mp->box_size;
+
+	mpdata->sum[0] = calloc(nbdata * args->seq->nb_layers, sizeof(double));
+	mpdata->weights = calloc(nbdata, sizeof(double));
+	mpdata->box_weights = malloc(box_size * box_size * sizeof(double));
+	if (!mpdata->sum[0] || !mpdata->weights || !mpdata->box_weights) {
+		PRINT_ALLOC_ERR;
+		return 1;	// freed by the finalize hook
+	}
+	for (layer = 1; layer < args->seq->nb_layers; layer++)
+		mpdata->sum[layer] = mpdata->sum[0] + nbdata * layer;
+	for (v = 0; v < box_size; v++)
+		for (u = 0; u < box_size; u++)
+			mpdata->box_weights[v * box_size + u] = multipoint_box_weight(mpdata->mp, u, v);
+	mpdata->exposure = 0.0;
+	if (mpdata->tile_best > 0.0) {
+		if (compute_thresholds(args, mpdata))
+			return 1;
+		siril_log_message(_("Multi-point stacking: keeping the best %g%% of the frames for each box\n"),
+				mpdata->tile_best);
+	}
+	return 0;
+}
+
+/* adds the box k of the frame aligned with its shift */
+static void add_box(struct mp_stacking_data *mpdata, fits *fit, int frame, int k) {
+	mpregdata *mp = mpdata->mp;
+	float *shift = mp->shifts + ((size_t) frame * mp->nb_boxes + k) * 2;
+	int u, v, layer;
+
+	for (v = 0; v < mp->box_size; v++) {
+		int y = mp->box_y[k] + v;
+		for (u = 0; u < mp->box_size; u++) {
+			int x = mp->box_x[k] + u;
+			size_t i = (size_t) y * fit->rx + x;
+			double w = mpdata->box_weights[v * mp->box_size + u], value;
+			for (layer = 0; layer < fit->naxes[2]; layer++) {
+				if (!sample(fit->pdata[layer], fit->rx, fit->ry,
+							x - shift[0], y - shift[1], &value))
+					break;
+				mpdata->sum[layer][i] += w * value;
+			}
+			if (layer == fit->naxes[2])
+				mpdata->weights[i] += w;
+		}
+	}
+}
+
+/* Frames are stacked one after the other, the pixels of a frame being
+ * processed in parallel. Boxes that are two grid steps apart don't overlap,
+ * so the boxes are added in four passes of boxes that can be added in
+ * parallel. */
+static int mp_stacking_image_hook(struct generic_seq_args *args, int o, int frame, fits *fit, rectangle *_) {
+	struct mp_stacking_data *mpdata = args->user;
+	mpregdata *mp = mpdata->mp;
+	float gx = mp->global[frame * 2], gy = mp->global[frame * 2 + 1];
+	int y, pass;
+
+	if (fit->rx != args->seq->rx || fit->ry != args->seq->ry) {
+		siril_log_message(_("Multi-point stacking requires images of the same size\n"));
+		return 1;
+	}
+	mpdata->exposure += fit->exposure;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(y) schedule(static)
+#endif
+	for (y = 0; y < fit->ry; y++) {
+		int x, layer;
+		for (x = 0; x < fit->rx; x++) {
+			size_t i = (size_t) y * fit->rx + x;
+			double value;
+			for (layer = 0; layer < fit->naxes[2]; layer++) {
+				if (!sample(fit->pdata[layer], fit->rx, fit->ry, x - gx, y - gy, &value))
+					break;
+				mpdata->sum[layer][i] += MP_BACKGROUND_WEIGHT * value;
+			}
+			if (layer == fit->naxes[2])
+				mpdata->weights[i] += MP_BACKGROUND_WEIGHT;
+		}
+	}
+
+	for (pass = 0; pass < 4; pass++) {
+		int i;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(i) schedule(dynamic)
+#endif
+		for (i = 0; i < mp->grid_w * mp->grid_h; i++) {
+			int gi = i % mp->grid_w, gj = i / mp->grid_w;
+			int k = mp->box_index[i];
+			if ((gi % 2) + 2 * (gj % 2) != pass || k < 0)
+				continue;
+			if (mpdata->thresholds) {
+				float q = mp->quality[(size_t) frame * mp->nb_boxes + k];
+				/* boxes whose quality was not measured are kept */
+				if (q >= 0.f && q < mpdata->thresholds[k])
+					continue;
+			}
+			add_box(mpdata, fit, frame, k);
+		}
+	}
+	return 0;
+}
+
+static void free_mp_stacking_data(struct mp_stacking_data *mpdata) {
+	free(mpdata->sum[0]);
+	free(mpdata->weights);
+	free(mpdata->box_weights);
+	free(mpdata->thresholds);
+	mpdata->sum[0] = NULL;
+	mpdata->weights = NULL;
+	mpdata->box_weights = NULL;
+	mpdata->thresholds = NULL;
+}
+
+static int mp_stacking_finalize_hook(struct generic_seq_args *args) {
+	struct mp_stacking_data *mpdata = args->user;
+	size_t i, nbdata = (size_t) args->seq->rx * args->seq->ry;
+	int layer;
+	fits *fit = &gfit;
+
+	if (args->retval) {
+		free_mp_stacking_data(mpdata);
+		return 0;
+	}
+
+	clearfits(&gfit);
+	if (new_fit_image(&fit, args->seq->rx, args->seq->ry, args->seq->nb_layers)) {
+		free_mp_stacking_data(mpdata);
+		return -1;
+	}
+	/* We copy metadata from reference to the final fit */
+	if (args->seq->type == SEQ_REGULAR) {
+		if (!seq_open_image(args->seq, mpdata->ref_image)) {
+			import_metadata_from_fitsfile(args->seq->fptr[mpdata->ref_image], &gfit);
+			seq_close_image(args->seq, mpdata->ref_image);
+		}
+	}
+	gfit.exposure = mpdata->exposure;
+	gfit.bitpix = gfit.orig_bitpix = USHORT_IMG;
+
+	for (layer = 0; layer < args->seq->nb_layers; layer++) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) private(i) schedule(static)
+#endif
+		for (i = 0; i < nbdata; i++) {
+			double w = mpdata->weights[i];
+			gfit.pdata[layer][i] = w > 0.0 ? round_to_WORD(mpdata->sum[layer][i] / w) : 0;
+		}
+	}
+
+	free_mp_stacking_data(mpdata);
+	return 0;
+}
+
+/* Stacks the frames aligned with the local shifts of the multi-point
+ * registration: each box is the mean of the frames aligned with its own shift,
+ * and the boxes are blended with weights decreasing to their edges. With
+ * tile_best, only the sharpest frames of each box are used, according to the
+ * quality measured by the registration. */
+int stack_multipoint(struct stacking_args *stackargs) {
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
+	struct mp_stacking_data *mpdata = calloc(1, sizeof(struct mp_stacking_data));
+	int retval;
+
+	args->seq = stackargs->seq;
+	args->partial_image = FALSE;
+	args->filtering_criterion = stackargs->filtering_criterion;
+	args->filtering_parameter = stackargs->filtering_parameter;
+	args->nb_filtered_images = stackargs->nb_images_to_stack;
+	args->prepare_hook = mp_stacking_prepare_hook;
+	args->image_hook = mp_stacking_image_hook;
+	args->save_hook = NULL;
+	args->finalize_hook = mp_stacking_finalize_hook;
+	args->idle_function = NULL;
+	args->stop_on_error = TRUE;
+	args->description = _("Multi-point stacking");
+	args->has_output = FALSE;
+	args->already_in_a_thread = TRUE;
+	/* frames are accumulated in the same buffers, the parallelism is
+	 * inside the processing of each frame */
+	args->parallel = FALSE;
+
+	mpdata->ref_image = stackargs->ref_image;
+	mpdata->tile_best = stackargs->tile_best < 100.0 ? stackargs->tile_best : 0.0;
+	args->user = mpdata;
+
+	generic_sequence_worker(args);
+	retval = args->retval;
+	free(mpdata);
+	free(args);
+	return retval;
+}
@@ -0,0 +1,619 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Pixel rejection for the mean stacking.
+ *
+ * Pixels are stacked by tiles of REJECTION_TILE_WIDTH adjacent pixels of a
+ * row. The values of all frames for a pixel are contiguous in the tile
+ * (pixel-major, frame-minor), so that each stack can be used in place by the
+ * median and clipping functions, while the gathering and normalization of the
+ * frames and the sums of the stacks are computed for all pixels of the tile at
+ * once, with vector instructions.
+ *
+ * The standard deviation of the sigma clipping rejections is computed from
+ * these sums, which are exact integers, instead of the two passes in long
+ * double of gsl_stats_ushort_sd(). The GSL value is still used when a pixel
+ * is so close to a clipping threshold that the tiny difference between the two
+ * could change the decision, so results are identical to the scalar code,
+ * which is kept in rejection_stack_scalar() and used for the other rejections.
+ *
+ * The stacking in 32 bits stacks float values, without the tiles, with
+ * rejection_stack_float().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <gsl/gsl_fit.h>
+#include <gsl/gsl_statistics_ushort.h>
+#include <gsl/gsl_statistics_float.h>
+#include "core/siril.h"
+#include "core/proto.h"
+#include "algos/sorting.h"
+#include "stacking.h"
+#include "rejection.h"
+
+/* The kernels are compiled for several instruction sets when the compiler
+ * supports it, the best for the CPU being selected when siril starts. FMA is
+ * not in the list on purpose: contracting the operations of the normalization
+ * would change their rounding. */
+#ifdef HAVE_FUNC_ATTRIBUTE_TARGET_CLONES
+#define REJECTION_KERNEL __attribute__((target_clones("avx2","sse4.1","default")))
+#else
+#define REJECTION_KERNEL
+#endif
+
+/* the sums of squares of the stacks must fit in 64 bits */
+#define REJECTION_MAX_FRAMES 65535
+
+const char *rejection_kernels_isa() {
+#if defined(HAVE_FUNC_ATTRIBUTE_TARGET_CLONES) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return "AVX2";
+	if (__builtin_cpu_supports("sse4.1"))
+		return "SSE4.1";
+	return "SSE2";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	return "NEON";
+#else
+	return "no vector extension";
+#endif
+}
+
+/* same result as round_to_WORD(), without branches */
+static inline WORD round_to_WORD_nobranch(double x) {
+	x = x <= 0.0 ? 0.0 : x;
+	x = x > USHRT_MAX_DOUBLE ? USHRT_MAX_DOUBLE : x;
+	return (WORD) (x + 0.5);
+}
+
+/* Copies width pixels of a frame row into the stacks of the tile, with the
+ * normalization of the frame, and adds them to the sums of the stacks. */
+static REJECTION_KERNEL void gather_row(const WORD *in, WORD *out, int stride,
+		int width, normalization normalize, double scale, double offset,
+		double mul, int64_t *sum, uint64_t *sumsq) {
+	int p;
+	switch (normalize) {
+	default:
+	case NO_NORM:
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (p = 0; p < width; p++) {
+			WORD pixel = in[p];
+			out[p * stride] = pixel;
+			sum[p] += pixel;
+			sumsq[p] += (uint64_t) pixel * pixel;
+		}
+		break;
+	case ADDITIVE:
+	case ADDITIVE_SCALING:
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (p = 0; p < width; p++) {
+			double tmp = (double) in[p] * scale;
+			WORD pixel = round_to_WORD_nobranch(tmp - offset);
+			out[p * stride] = pixel;
+			sum[p] += pixel;
+			sumsq[p] += (uint64_t) pixel * pixel;
+		}
+		break;
+	case MULTIPLICATIVE:
+	case MULTIPLICATIVE_SCALING:
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (p = 0; p < width; p++) {
+			double tmp = (double) in[p] * scale;
+			WORD pixel = round_to_WORD_nobranch(tmp * mul);
+			out[p * stride] = pixel;
+			sum[p] += pixel;
+			sumsq[p] += (uint64_t) pixel * pixel;
+		}
+		break;
+	}
+}
+
+/* Fills the tile of data with the stacks of pixels x to x + width - 1 of the
+ * row starting at pix_idx in the block, rx being the width of the images.
+ * shiftx contains the horizontal shift of each frame. */
+void rejection_gather_tile(struct stacking_args *args, struct _data_block *data,
+		const int *shiftx, long pix_idx, long x, int width, long rx) {
+	int frame, nb_frames = args->nb_images_to_stack;
+
+	memset(data->sum, 0, width * sizeof(int64_t));
+	memset(data->sumsq, 0, width * sizeof(uint64_t));
+	for (frame = 0; frame < nb_frames; frame++) {
+		WORD *out = data->tile + frame;
+		long start = 0, end = width, p;
+		if (shiftx[frame]) {
+			/* outside bounds, images are black. We could
+			 * also set the background value instead, if available */
+			start = shiftx[frame] - x;
+			if (start < 0) start = 0;
+			if (start > width) start = width;
+			end = rx + shiftx[frame] - x;
+			if (end > width) end = width;
+			if (end < start) end = start;
+			for (p = 0; p < start; p++)
+				out[p * nb_frames] = 0;
+			for (p = end; p < width; p++)
+				out[p * nb_frames] = 0;
+		}
+		if (end > start) {
+			gather_row(data->pix[frame] + pix_idx + x - shiftx[frame] + start,
+					out + start * nb_frames, nb_frames, end - start,
+					args->normalize,
+					args->coeff.scale ? args->coeff.scale[frame] : 1.0,
+					args->coeff.offset ? args->coeff.offset[frame] : 0.0,
+					args->coeff.mul ? args->coeff.mul[frame] : 1.0,
+					data->sum + start, data->sumsq + start);
+		}
+	}
+}
+
+static int percentile_clipping(double pixel, double sig[], double median, uint64_t rej[]) {
+	double plow = sig[0];
+	double phigh = sig[1];
+
+	if ((median - pixel) / median > plow) {
+		rej[0]++;
+		return -1;
+	}
+	else if ((pixel - median) / median > phigh) {
+		rej[1]++;
+		return 1;
+	}
+	else return 0;
+}
+
+/* Rejection of pixels, following sigma_(high/low) * sigma.
+ * The function returns 0 if no rejections are required, 1 if it's a high
+ * rejection and -1 for a low-rejection */
+static int sigma_clipping(double pixel, double sig[], double sigma, double median, uint64_t rej[]) {
+	double sigmalow = sig[0];
+	double sigmahigh = sig[1];
+
+	if (median - pixel > sigmalow * sigma) {
+		rej[0]++;
+		return -1;
+	}
+	else if (pixel - median > sigmahigh * sigma) {
+		rej[1]++;
+		return 1;
+	}
+	else return 0;
+}
+
+static void Winsorize(WORD *pixel, double m0, double m1) {
+	if (*pixel < m0) *pixel = round_to_WORD(m0);
+	else if (*pixel > m1) *pixel = round_to_WORD(m1);
+}
+
+static void Winsorize_float(float *pixel, double m0, double m1) {
+	if (*pixel < m0) *pixel = (float) m0;
+	else if (*pixel > m1) *pixel = (float) m1;
+}
+
+static int line_clipping(double pixel, double sig[], double sigma, int i, double a, double b, uint64_t rej[]) {
+	double sigmalow = sig[0];
+	double sigmahigh = sig[1];
+
+	if (((a * (double)i + b - pixel) / sigma) > sigmalow) {
+		rej[0]++;
+		return -1;
+	}
+	else if (((pixel - a * (double)i - b) / sigma) > sigmahigh) {
+		rej[1]++;
+		return 1;
+	}
+	else return 0;
+}
+
+/* returns 1 if a pixel of the stack is too close to one of the clipping
+ * thresholds for sigma to be known only within error */
+static REJECTION_KERNEL int is_near_thresholds(const WORD *stack, int N,
+		double median, double low, double high, double low_error, double high_error) {
+	int frame, near = 0;
+#ifdef _OPENMP
+#pragma omp simd reduction(|:near)
+#endif
+	for (frame = 0; frame < N; frame++) {
+		double diff = median - (double) stack[frame];
+		near |= fabs(diff - low) <= low_error;
+		near |= fabs(-diff - high) <= high_error;
+	}
+	return near;
+}
+
+/* Computes the standard deviation of the stack of N values with the given sum
+ * and sum of squares, as gsl_stats_ushort_sd() would for the decisions of
+ * sigma_clipping(). copy is the stack in the order GSL would have seen it,
+ * before quickmedian() sorted it partially, since its rounding errors depend
+ * on the order. */
+static double stack_sigma(const WORD *stack, const WORD *copy, int N,
+		int64_t sum, uint64_t sumsq, double median, double sig[]) {
+	double sigma, error;
+
+	/* N * sumsq - sum * sum is exact for up to REJECTION_MAX_FRAMES */
+	sigma = sqrt((double) ((uint64_t) N * sumsq - (uint64_t) sum * (uint64_t) sum) /
+			((double) N * (double) (N - 1)));
+	/* GSL computes with running means, which accumulate the rounding
+	 * errors of the N steps, at least with the precision of double */
+	error = 8.0 * N * DBL_EPSILON * (sigma + USHRT_MAX_DOUBLE);
+	if (is_near_thresholds(stack, N, median, sig[0] * sigma, sig[1] * sigma,
+				sig[0] * error + 4.0 * DBL_EPSILON * sig[0] * sigma,
+				sig[1] * error + 4.0 * DBL_EPSILON * sig[1] * sigma))
+		return gsl_stats_ushort_sd(copy, 1, N);
+	return sigma;
+}
+
+/* Removes the rejected values from the stack of pixel p of the tile and from
+ * its sums, returns the new size of the stack */
+static int remove_rejected(struct _data_block *data, int p, WORD *stack, int N) {
+	int pixel, output;
+	for (pixel = 0, output = 0; pixel < N; pixel++) {
+		if (!data->rejected[pixel]) {
+			// copy only if there was a rejection
+			if (pixel != output)
+				stack[output] = stack[pixel];
+			output++;
+		} else {
+			data->sum[p] -= stack[pixel];
+			data->sumsq[p] -= (uint64_t) stack[pixel] * stack[pixel];
+		}
+	}
+	return output;
+}
+
+/* Applies the rejection to pixel p of the tile and returns the mean of the
+ * values that were kept. crej counts the low and high rejections. */
+double rejection_stack_pixel(struct stacking_args *args, struct _data_block *data,
+		int p, uint64_t crej[2]) {
+	int nb_frames = args->nb_images_to_stack;
+	WORD *stack = data->tile + p * nb_frames;
+	int N = nb_frames;// N is the number of pixels kept from the current stack
+	double median, sigma;
+	int frame, changed, n, r = 0;
+
+	if (nb_frames > REJECTION_MAX_FRAMES)
+		return rejection_stack_scalar(args, data, stack, crej);
+
+	switch (args->type_of_rejection) {
+	case PERCENTILE:
+		median = quickmedian (stack, N);
+		for (frame = 0; frame < N; frame++) {
+			data->rejected[frame] = percentile_clipping(stack[frame], args->sig, median, crej);
+		}
+		N = remove_rejected(data, p, stack, N);
+		break;
+	case SIGMA:
+		do {
+			memcpy(data->w_stack, stack, N * sizeof(WORD));
+			median = quickmedian (stack, N);
+			sigma = stack_sigma(stack, data->w_stack, N, data->sum[p],
+					data->sumsq[p], median, args->sig);
+			for (frame = 0; frame < N; frame++) {
+				data->rejected[frame] = sigma_clipping(stack[frame], args->sig, sigma, median, crej);
+				if (data->rejected[frame])
+					r++;
+				if (N - r <= 4) break;
+			}
+			n = remove_rejected(data, p, stack, N);
+			changed = N != n;
+			N = n;
+		} while (changed && N > 3);
+		break;
+	case SIGMEDIAN:
+		do {
+			memcpy(data->w_stack, stack, N * sizeof(WORD));
+			median = quickmedian (stack, N);
+			sigma = stack_sigma(stack, data->w_stack, N, data->sum[p],
+					data->sumsq[p], median, args->sig);
+			n = 0;
+			for (frame = 0; frame < N; frame++) {
+				if (sigma_clipping(stack[frame], args->sig, sigma, median, crej)) {
+					WORD pixel = stack[frame];
+					stack[frame] = median;
+					data->sum[p] += stack[frame] - pixel;
+					data->sumsq[p] += (uint64_t) stack[frame] * stack[frame];
+					data->sumsq[p] -= (uint64_t) pixel * pixel;
+					n++;
+				}
+			}
+		} while (n > 0 && N > 3);
+		break;
+	case NO_REJEC:
+		break;
+	default:
+		return rejection_stack_scalar(args, data, stack, crej);
+	}
+
+	return data->sum[p] / (double)N;
+}
+
+/* Applies the rejection to a stack of all frames, without using the sums of
+ * the tile, and returns the mean of the values that were kept. */
+double rejection_stack_scalar(struct stacking_args *args, struct _data_block *data,
+		WORD *stack, uint64_t crej[2]) {
+	int N = args->nb_images_to_stack;// N is the number of pixels kept from the current stack
+	double median, sigma = -1.0;
+	int frame, pixel, output, changed, n, r = 0;
+
+	switch (args->type_of_rejection) {
+	case PERCENTILE:
+		median = quickmedian (stack, N);
+		for (frame = 0; frame < N; frame++) {
+			data->rejected[frame] =	percentile_clipping(stack[frame], args->sig, median, crej);
+		}
+
+		for (pixel = 0, output = 0; pixel < N; pixel++) {
+			if (!data->rejected[pixel]) {
+				// copy only if there was a rejection
+				if (pixel != output)
+					stack[output] = stack[pixel];
+				output++;
+			}
+		}
+		N = output;
+		break;
+	case SIGMA:
+		do {
+			sigma = gsl_stats_ushort_sd(stack, 1, N);
+			median = quickmedian (stack, N);
+			for (frame = 0; frame < N; frame++) {
+				data->rejected[frame] =	sigma_clipping(stack[frame], args->sig, sigma, median, crej);
+				if (data->rejected[frame])
+					r++;
+				if (N - r <= 4) break;
+			}
+			for (pixel = 0, output = 0; pixel < N; pixel++) {
+				if (!data->rejected[pixel]) {
+					// copy only if there was a rejection
+					if (pixel != output)
+						stack[output] = stack[pixel];
+					output++;
+				}
+			}
+			changed = N != output;
+			N = output;
+		} while (changed && N > 3);
+		break;
+	case SIGMEDIAN:
+		do {
+			sigma = gsl_stats_ushort_sd(stack, 1, N);
+			median = quickmedian (stack, N);
+			n = 0;
+			for (frame = 0; frame < N; frame++) {
+				if (sigma_clipping(stack[frame], args->sig, sigma, median, crej)) {
+					stack[frame] = median;
+					n++;
+				}
+			}
+		} while (n > 0 && N > 3);
+		break;
+	case WINSORIZED:
+		do {
+			double sigma0;
+			sigma = gsl_stats_ushort_sd(stack, 1, N);
+			median = quickmedian (stack, N);
+			memcpy(data->w_stack, stack, N * sizeof(WORD));
+			do {
+				int jj;
+				double m0 = median - 1.5 * sigma;
+				double m1 = median + 1.5 * sigma;
+				for (jj = 0; jj < N; jj++)
+					Winsorize(data->w_stack+jj, m0, m1);
+				median = quickmedian (data->w_stack, N);
+				sigma0 = sigma;
+				sigma = 1.134 * gsl_stats_ushort_sd(data->w_stack, 1, N);
+			} while ((fabs(sigma - sigma0) / sigma0) > 0.0005);
+			for (frame = 0; frame < N; frame++) {
+				data->rejected[frame] = sigma_clipping(
+						stack[frame], args->sig, sigma,
+						median, crej);
+				if (data->rejected[frame] != 0)
+					r++;
+				if (N - r <= 4) break;
+
+			}
+			for (pixel = 0, output = 0; pixel < N; pixel++) {
+				if (!data->rejected[pixel]) {
+					// copy only if there was a rejection
+					if (pixel != output)
+						stack[output] = stack[pixel];
+					output++;
+				}
+			}
+			changed = N != output;
+			N = output;
+		} while (changed && N > 3);
+		break;
+	case LINEARFIT:
+		do {
+			double a, b, cov00, cov01, cov11, sumsq;
+			quicksort_s(stack, N);
+			for (frame = 0; frame < N; frame++) {
+				data->xf[frame] = (double)frame;
+				data->yf[frame] = (double)stack[frame];
+			}
+			gsl_fit_linear(data->xf, 1, data->yf, 1, N, &b, &a, &cov00, &cov01, &cov11, &sumsq);
+			sigma = 0.0;
+			for (frame = 0; frame < N; frame++)
+				sigma += (fabs((double)stack[frame] - (a*(double)frame + b)));
+			sigma /= (double)N;
+			for (frame = 0; frame < N; frame++) {
+				data->rejected[frame] =
+						line_clipping(stack[frame], args->sig, sigma, frame, a, b, crej);
+				if (data->rejected[frame] != 0)
+					r++;
+				if (N - r <= 4) break;
+			}
+			for (pixel = 0, output = 0; pixel < N; pixel++) {
+				if (!data->rejected[pixel]) {
+					// copy only if there was a rejection
+					if (pixel != output)
+						stack[output] = stack[pixel];
+					output++;
+				}
+			}
+			changed = N != output;
+			N = output;
+		} while (changed && N > 3);
+		break;
+	default:
+	case NO_REJEC:
+		;		// Nothing to do, no rejection
+	}
+
+	int64_t sum = 0L;
+	for (frame = 0; frame < N; ++frame) {
+		sum += stack[frame];
+	}
+	return sum / (double)N;
+}
+
+/* removes the rejected values from the stack of N floats, returns the new
+ * size of the stack */
+static int remove_rejected_float(struct _data_block *data, float *stack, int N) {
+	int pixel, output;
+	for (pixel = 0, output = 0; pixel < N; pixel++) {
+		if (!data->rejected[pixel]) {
+			// copy only if there was a rejection
+			if (pixel != output)
+				stack[output] = stack[pixel];
+			output++;
+		}
+	}
+	return output;
+}
+
+/* Same as rejection_stack_scalar() for a stack of floats, in the range of
+ * 16-bit data, for the stacking in 32 bits. */
+double rejection_stack_float(struct stacking_args *args, struct _data_block *data,
+		float *stack, uint64_t crej[2]) {
+	int N = args->nb_images_to_stack;// N is the number of pixels kept from the current stack
+	double median, sigma = -1.0;
+	int frame, changed, n, r = 0;
+
+	switch (args->type_of_rejection) {
+	case PERCENTILE:
+		median = quickmedian_float (stack, N);
+		for (frame = 0; frame < N; frame++) {
+			data->rejected[frame] = percentile_clipping(stack[frame], args->sig, median, crej);
+		}
+		N = remove_rejected_float(data, stack, N);
+		break;
+	case SIGMA:
+		do {
+			sigma = gsl_stats_float_sd(stack, 1, N);
+			median = quickmedian_float (stack, N);
+			for (frame = 0; frame < N; frame++) {
+				data->rejected[frame] = sigma_clipping(stack[frame], args->sig, sigma, median, crej);
+				if (data->rejected[frame])
+					r++;
+				if (N - r <= 4) break;
+			}
+			n = remove_rejected_float(data, stack, N);
+			changed = N != n;
+			N = n;
+		} while (changed && N > 3);
+		break;
+	case SIGMEDIAN:
+		do {
+			sigma = gsl_stats_float_sd(stack, 1, N);
+			median = quickmedian_float (stack, N);
+			n = 0;
+			for (frame = 0; frame < N; frame++) {
+				if (sigma_clipping(stack[frame], args->sig, sigma, median, crej)) {
+					stack[frame] = (float) median;
+					n++;
+				}
+			}
+		} while (n > 0 && N > 3);
+		break;
+	case WINSORIZED:
+		do {
+			double sigma0;
+			sigma = gsl_stats_float_sd(stack, 1, N);
+			median = quickmedian_float (stack, N);
+			memcpy(data->fw_stack, stack, N * sizeof(float));
+			do {
+				int jj;
+				double m0 = median - 1.5 * sigma;
+				double m1 = median + 1.5 * sigma;
+				for (jj = 0; jj < N; jj++)
+					Winsorize_float(data->fw_stack+jj, m0, m1);
+				median = quickmedian_float (data->fw_stack, N);
+				sigma0 = sigma;
+				sigma = 1.134 * gsl_stats_float_sd(data->fw_stack, 1, N);
+			} while ((fabs(sigma - sigma0) / sigma0) > 0.0005);
+			for (frame = 0; frame < N; frame++) {
+				data->rejected[frame] = sigma_clipping(
+						stack[frame], args->sig, sigma,
+						median, crej);
+				if (data->rejected[frame] != 0)
+					r++;
+				if (N - r <= 4) break;
+			}
+			n = remove_rejected_float(data, stack, N);
+			changed = N != n;
+			N = n;
+		} while (changed && N > 3);
+		break;
+	case LINEARFIT:
+		do {
+			double a, b, cov00, cov01, cov11, sumsq;
+			quicksort_f(stack, N);
+			for (frame = 0; frame < N; frame++) {
+				data->xf[frame] = (double)frame;
+				data->yf[frame] = (double)stack[frame];
+			}
+			gsl_fit_linear(data->xf, 1, data->yf, 1, N, &b, &a, &cov00, &cov01, &cov11, &sumsq);
+			sigma = 0.0;
+			for (frame = 0; frame < N; frame++)
+				sigma += (fabs((double)stack[frame] - (a*(double)frame + b)));
+			sigma /= (double)N;
+			for (frame = 0; frame < N; frame++) {
+				data->rejected[frame] =
+						line_clipping(stack[frame], args->sig, sigma, frame, a, b, crej);
+				if (data->rejected[frame] != 0)
+					r++;
+				if (N - r <= 4) break;
+			}
+			n = remove_rejected_float(data, stack, N);
+			changed = N != n;
+			N = n;
+		} while (changed && N > 3);
+		break;
+	default:
+	case NO_REJEC:
+		;		// Nothing to do, no rejection
+	}
+
+	double sum = 0.0;
+	for (frame = 0; frame < N; ++frame) {
+		sum += stack[frame];
+	}
+	return sum / (double)N;
+}
@@ -0,0 +1,20 @@
+#ifndef _REJECTION_H
+#define _REJECTION_H
+
+#include <stdint.h>
+#include "stacking.h"
+
+/* number of adjacent pixels of a row that are stacked together */
+#define REJECTION_TILE_WIDTH 64
+
+const char *rejection_kernels_isa();
+void rejection_gather_tile(struct stacking_args *args, struct _data_block *data,
+		const int *shiftx, long pix_idx, long x, int width, long rx);
+double rejection_stack_pixel(struct stacking_args *args, struct _data_block *data,
+		int p, uint64_t crej[2]);
+double rejection_stack_scalar(struct stacking_args *args, struct _data_block *data,
+		WORD *stack, uint64_t crej[2]);
+double rejection_stack_float(struct stacking_args *args, struct _data_block *data,
+		float *stack, uint64_t crej[2]);
+
+#endif
@@ -24,8 +24,6 @@
 #include <sys/stat.h>
 #include <math.h>
 #include <assert.h>
-#include <gsl/gsl_fit.h>
-#include <gsl/gsl_statistics_ushort.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -49,6 +47,7 @@
 #include "algos/sorting.h"
 #include "stacking.h"
 #include "sum.h"
+#include "rejection.h"
 #include "opencv/opencv.h"
 
 static struct stacking_args stackparam = {	// parameters passed to stacking
@@ -130,10 +129,11 @@ int stack_median(struct stacking_args *args) {
 	fprintf(stdout, "image size: %ldx%ld, %ld layers\n", naxes[0], naxes[1], naxes[2]);
 
 	/* initialize result image */
+	fit.type = args->use_32bit_output ? DATA_FLOAT : DATA_USHORT;
 	if ((retval = stack_create_result_fit(&fit, bitpix, naxis, naxes))) {
 		goto free_and_close;
 	}
-	if (args->norm_to_16 || fit.orig_bitpix != BYTE_IMG) {
+	if (fit.type == DATA_USHORT && (args->norm_to_16 || fit.orig_bitpix != BYTE_IMG)) {
 		fit.bitpix = USHORT_IMG;
 		if (args->norm_to_16)
 			fit.orig_bitpix = USHORT_IMG;
@@ -186,10 +186,27 @@ int stack_median(struct stacking_args *args) {
 	npixels_in_block = largest_block_height * naxes[0];
 	g_assert(npixels_in_block > 0);
 	fprintf(stdout, "allocating data for %d threads (each %'lu MB)\n", pool_size,
-			(unsigned long) (nb_frames * npixels_in_block * sizeof(WORD)) / BYTES_IN_A_MB);
+			(unsigned long) (nb_frames * npixels_in_block *
+				(args->use_32bit_output ? sizeof(float) : sizeof(WORD))) / BYTES_IN_A_MB);
 	data_pool = calloc(pool_size, sizeof(struct _data_block));
 	for (i = 0; i < pool_size; i++) {
 		int j;
+		if (args->use_32bit_output) {
+			/* frames are read and normalized in float */
+			data_pool[i].fpix = calloc(nb_frames, sizeof(float *));
+			data_pool[i].ftmp = calloc(nb_frames, npixels_in_block * sizeof(float));
+			data_pool[i].fstack = calloc(nb_frames, sizeof(float));
+			if (!data_pool[i].fpix || !data_pool[i].ftmp || !data_pool[i].fstack) {
+				PRINT_ALLOC_ERR;
+				fprintf(stderr, "CHANGE MEMORY SETTINGS if stacking takes too much.\n");
+				retval = -1;
+				goto free_and_close;
+			}
+			for (j=0; j<nb_frames; ++j) {
+				data_pool[i].fpix[j] = data_pool[i].ftmp + j * npixels_in_block;
+			}
+			continue;
+		}
 		data_pool[i].pix = calloc(nb_frames, sizeof(WORD *));
 		data_pool[i].tmp = calloc(nb_frames, npixels_in_block * sizeof(WORD));
 		data_pool[i].stack = calloc(nb_frames, sizeof(WORD));
@@ -209,7 +226,7 @@ int stack_median(struct stacking_args *args) {
 	set_progress_bar_data(_("Median stacking in progress..."), PROGRESS_RESET);
 
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(nb_threads) private(i) schedule(dynamic) if (nb_threads > 1 && (args->seq->type == SEQ_SER || fits_is_reentrant()))
+#pragma omp parallel for num_threads(nb_threads) private(i) schedule(dynamic) if (nb_threads > 1 && (args->seq->type == SEQ_SER || args->seq->type == SEQ_CHUNKED || fits_is_reentrant()))
 #endif
 	for (i = 0; i < nb_blocks; i++)
 	{
@@ -256,6 +273,35 @@ int stack_median(struct stacking_args *args) {
 			if (!(cur_nb % 16))	// every 16 iterations
 				set_progress_bar_data(NULL, (double)cur_nb/total);
 
+			if (fit.type == DATA_FLOAT) {
+				for (x = 0; x < naxes[0]; ++x) {
+					double median;
+					/* same as below without rounding the normalized
+					 * values, in the range of 16-bit data */
+					for (frame = 0; frame < nb_frames; ++frame) {
+						double tmp = data->fpix[frame][pix_idx+x];
+						switch (args->normalize) {
+							default:
+							case NO_NORM:
+								break;
+							case ADDITIVE:
+							case ADDITIVE_SCALING:
+								tmp = tmp * args->coeff.scale[frame] - args->coeff.offset[frame];
+								break;
+							case MULTIPLICATIVE:
+							case MULTIPLICATIVE_SCALING:
+								tmp = tmp * args->coeff.scale[frame] * args->coeff.mul[frame];
+								break;
+						}
+						data->fstack[frame] = (float) tmp;
+					}
+					median = quickmedian_float(data->fstack, nb_frames);
+					normalize_to16bit(bitpix, &median);
+					fit.fpdata[my_block->channel][pixel_idx++] = (float) (median / USHRT_MAX_DOUBLE);
+				}
+				continue;
+			}
+
 			for (x = 0; x < naxes[0]; ++x){
 				/* copy all images pixel values in the same row array `stack'
 				 * to optimize caching and improve readability */
@@ -303,8 +349,12 @@ int stack_median(struct stacking_args *args) {
 	clearfits(&gfit);
 	copyfits(&fit, &gfit, CP_FORMAT, 0);
 	gfit.data = fit.data;
-	for (i = 0; i < fit.naxes[2]; i++)
+	gfit.type = fit.type;
+	gfit.fdata = fit.fdata;
+	for (i = 0; i < fit.naxes[2]; i++) {
 		gfit.pdata[i] = fit.pdata[i];
+		gfit.fpdata[i] = fit.fpdata[i];
+	}
 
 free_and_close:
 	fprintf(stdout, "free and close (%d)\n", retval);
@@ -317,6 +367,9 @@ free_and_close:
 			if (data_pool[i].stack) free(data_pool[i].stack);
 			if (data_pool[i].pix) free(data_pool[i].pix);
 			if (data_pool[i].tmp) free(data_pool[i].tmp);
+			if (data_pool[i].fstack) free(data_pool[i].fstack);
+			if (data_pool[i].fpix) free(data_pool[i].fpix);
+			if (data_pool[i].ftmp) free(data_pool[i].ftmp);
 		}
 		free(data_pool);
 	}
@@ -327,6 +380,7 @@ free_and_close:
 	if (retval) {
 		/* if retval is set, gfit has not been modified */
 		if (fit.data) free(fit.data);
+		if (fit.fdata) free(fit.fdata);
 		set_progress_bar_data(_("Median stacking failed. Check the log."), PROGRESS_RESET);
 		siril_log_message(_("Stacking failed.\n"));
 	} else {
@@ -504,63 +558,10 @@ free_and_reset_progress_bar:
 
 
 /******************************* REJECTION STACKING ******************************
- * The functions below are those managing the rejection, the stacking code is
- * after and similar to median but takes into account the registration data and
- * does a different operation to keep the final pixel values.
+ * The functions managing the rejection are in rejection.c, the stacking code is
+ * similar to median but takes into account the registration data and does a
+ * different operation to keep the final pixel values.
  *********************************************************************************/
-static int percentile_clipping(WORD pixel, double sig[], double median, uint64_t rej[]) {
-	double plow = sig[0];
-	double phigh = sig[1];
-
-	if ((median - (double)pixel) / median > plow) {
-		rej[0]++;
-		return -1;
-	}
-	else if (((double)pixel - median) / median > phigh) {
-		rej[1]++;
-		return 1;
-	}
-	else return 0;
-}
-
-/* Rejection of pixels, following sigma_(high/low) * sigma.
- * The function returns 0 if no rejections are required, 1 if it's a high
- * rejection and -1 for a low-rejection */
-static int sigma_clipping(WORD pixel, double sig[], double sigma, double median, uint64_t rej[]) {
-	double sigmalow = sig[0];
-	double sigmahigh = sig[1];
-
-	if (median - (double)pixel > sigmalow * sigma) {
-		rej[0]++;
-		return -1;
-	}
-	else if ((double)pixel - median > sigmahigh * sigma) {
-		rej[1]++;
-		return 1;
-	}
-	else return 0;
-}
-
-static void Winsorize(WORD *pixel, double m0, double m1) {
-	if (*pixel < m0) *pixel = round_to_WORD(m0);
-	else if (*pixel > m1) *pixel = round_to_WORD(m1);
-}
-
-static int line_clipping(WORD pixel, double sig[], double sigma, int i, double a, double b, uint64_t rej[]) {
-	double sigmalow = sig[0];
-	double sigmahigh = sig[1];
-
-	if (((a * (double)i + b - (double)pixel) / sigma) > sigmalow) {
-		rej[0]++;
-		return -1;
-	}
-	else if ((((double)pixel - a * (double)i - b) / sigma) > sigmahigh) {
-		rej[1]++;
-		return 1;
-	}
-	else return 0;
-}
-
 int stack_mean_with_rejection(struct stacking_args *args) {
 	int nb_frames;		/* number of frames actually used */
 	uint64_t irej[3][2] = {{0,0}, {0,0}, {0,0}};
@@ -576,6 +577,7 @@ int stack_mean_with_rejection(struct stacking_args *args) {
 	fits fit = { 0 };
 	struct _image_block *blocks = NULL;
 	regdata *layerparam = NULL;
+	int *shiftx = NULL;
 
 	nb_frames = args->nb_images_to_stack;
 	naxes[0] = naxes[1] = 0; naxes[2] = 1;
@@ -606,10 +608,11 @@ int stack_mean_with_rejection(struct stacking_args *args) {
 	fprintf(stdout, "image size: %ldx%ld, %ld layers\n", naxes[0], naxes[1], naxes[2]);
 
 	/* initialize result image */
+	fit.type = args->use_32bit_output ? DATA_FLOAT : DATA_USHORT;
 	if ((retval = stack_create_result_fit(&fit, bitpix, naxis, naxes))) {
 		goto free_and_close;
 	}
-	if (args->norm_to_16 || fit.orig_bitpix != BYTE_IMG) {
+	if (fit.type == DATA_USHORT && (args->norm_to_16 || fit.orig_bitpix != BYTE_IMG)) {
 		fit.bitpix = USHORT_IMG;
 		if (args->norm_to_16)
 			fit.orig_bitpix = USHORT_IMG;
@@ -662,23 +665,15 @@ int stack_mean_with_rejection(struct stacking_args *args) {
 	g_assert(npixels_in_block > 0);
 
 	fprintf(stdout, "allocating data for %d threads (each %'lu MB)\n", pool_size,
-			(unsigned long) (nb_frames * npixels_in_block * sizeof(WORD)) / BYTES_IN_A_MB);
+			(unsigned long) (nb_frames * npixels_in_block *
+				(args->use_32bit_output ? sizeof(float) : sizeof(WORD))) / BYTES_IN_A_MB);
 	data_pool = calloc(pool_size, sizeof(struct _data_block));
 	for (i = 0; i < pool_size; i++) {
 		int j;
-		data_pool[i].pix = malloc(nb_frames * sizeof(WORD *));
-		data_pool[i].tmp = malloc(nb_frames * npixels_in_block * sizeof(WORD));
-		data_pool[i].stack = malloc(nb_frames * sizeof(WORD));
-		data_pool[i].rejected = calloc(nb_frames, sizeof(int));
-		if (!data_pool[i].pix || !data_pool[i].tmp || !data_pool[i].stack || !data_pool[i].rejected) {
-			PRINT_ALLOC_ERR;
-			fprintf(stderr, "CHANGE MEMORY SETTINGS if stacking takes too much.\n");
-			retval = -1;
-			goto free_and_close;
-		}
-		if (args->type_of_rejection == WINSORIZED) {
-			data_pool[i].w_stack = malloc(nb_frames * sizeof(WORD));
-			if (!data_pool[i].w_stack) {
+		if (args->type_of_rejection == LINEARFIT) {
+			data_pool[i].xf = malloc(nb_frames * sizeof(double));
+			data_pool[i].yf = malloc(nb_frames * sizeof(double));
+			if (!data_pool[i].xf || !data_pool[i].yf) {
 				PRINT_ALLOC_ERR;
 				fprintf(stderr, "CHANGE MEMORY SETTINGS if stacking takes too much.\n");
 				retval = -1;
@@ -686,15 +681,41 @@ int stack_mean_with_rejection(struct stacking_args *args) {
 			}
 		}
 
-		if (args->type_of_rejection == LINEARFIT) {
-			data_pool[i].xf = malloc(nb_frames * sizeof(double));
-			data_pool[i].yf = malloc(nb_frames * sizeof(double));
-			if (!data_pool[i].xf || !data_pool[i].yf) {
+		if (args->use_32bit_output) {
+			/* frames are read, normalized and stacked in float,
+			 * without the tiles of the 16-bit kernels */
+			data_pool[i].fpix = malloc(nb_frames * sizeof(float *));
+			data_pool[i].ftmp = malloc(nb_frames * npixels_in_block * sizeof(float));
+			data_pool[i].fstack = malloc(nb_frames * sizeof(float));
+			data_pool[i].fw_stack = malloc(nb_frames * sizeof(float));
+			data_pool[i].rejected = calloc(nb_frames, sizeof(int));
+			if (!data_pool[i].fpix || !data_pool[i].ftmp || !data_pool[i].fstack ||
+					!data_pool[i].fw_stack || !data_pool[i].rejected) {
 				PRINT_ALLOC_ERR;
 				fprintf(stderr, "CHANGE MEMORY SETTINGS if stacking takes too much.\n");
 				retval = -1;
 				goto free_and_close;
 			}
+			for (j=0; j<nb_frames; ++j) {
+				data_pool[i].fpix[j] = data_pool[i].ftmp + j * npixels_in_block;
+			}
+			continue;
+		}
+
+		data_pool[i].pix = malloc(nb_frames * sizeof(WORD *));
+		data_pool[i].tmp = malloc(nb_frames * npixels_in_block * sizeof(WORD));
+		data_pool[i].tile = malloc(REJECTION_TILE_WIDTH * nb_frames * sizeof(WORD));
+		data_pool[i].sum = malloc(REJECTION_TILE_WIDTH * sizeof(int64_t));
+		data_pool[i].sumsq = malloc(REJECTION_TILE_WIDTH * sizeof(uint64_t));
+		data_pool[i].rejected = calloc(nb_frames, sizeof(int));
+		data_pool[i].w_stack = malloc(nb_frames * sizeof(WORD));
+		if (!data_pool[i].pix || !data_pool[i].tmp || !data_pool[i].tile ||
+				!data_pool[i].sum || !data_pool[i].sumsq ||
+				!data_pool[i].rejected || !data_pool[i].w_stack) {
+			PRINT_ALLOC_ERR;
+			fprintf(stderr, "CHANGE MEMORY SETTINGS if stacking takes too much.\n");
+			retval = -1;
+			goto free_and_close;
 		}
 
 		for (j=0; j<nb_frames; ++j) {
@@ -703,11 +724,30 @@ int stack_mean_with_rejection(struct stacking_args *args) {
 	}
 	update_used_memory();
 
+	/* horizontal shifts of the frames, from registration data */
+	shiftx = calloc(nb_frames, sizeof(int));
+	if (!shiftx) {
+		PRINT_ALLOC_ERR;
+		retval = -1;
+		goto free_and_close;
+	}
+	if (layerparam) {
+		for (i = 0; i < nb_frames; i++) {
+			double T[9];
+			/* resampled frames are already aligned by the block reader */
+			if (stack_get_frame_transformation(args, i, T))
+				continue;
+			shiftx[i] = round_to_int(layerparam[args->image_indices[i]].shiftx *
+					args->seq->upscale_at_stacking);
+		}
+	}
+	siril_debug_print("rejection kernels: %s\n", rejection_kernels_isa());
+
 	siril_log_message(_("Starting stacking...\n"));
 	set_progress_bar_data(_("Rejection stacking in progress..."), PROGRESS_RESET);
 
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(nb_threads) private(i) schedule(dynamic) if (nb_threads > 1 && (args->seq->type == SEQ_SER || fits_is_reentrant()))
+#pragma omp parallel for num_threads(nb_threads) private(i) schedule(dynamic) if (nb_threads > 1 && (args->seq->type == SEQ_SER || args->seq->type == SEQ_CHUNKED || fits_is_reentrant()))
 #endif
 	for (i = 0; i < nb_blocks; i++)
 	{
@@ -768,194 +808,59 @@ int stack_mean_with_rejection(struct stacking_args *args) {
 			if (!(cur_nb % 16))	// every 16 iterations
 				set_progress_bar_data(NULL, (double)cur_nb/total);
 
-			double sigma = -1.0;
 			uint64_t crej[2] = {0, 0};
-	
-			for (x = 0; x < naxes[0]; ++x){
-				int frame;
-				/* copy all images pixel values in the same row array `stack'
-				 * to optimize caching and improve readability */
-				for (frame = 0; frame < nb_frames; ++frame) {
-					int shiftx = 0;
-					if (layerparam) {
-						shiftx = round_to_int(
-								layerparam[args->image_indices[frame]].shiftx *
-								args->seq->upscale_at_stacking);
-					}
 
-					if (shiftx && (x - shiftx >= naxes[0] || x - shiftx < 0)) {
-						/* outside bounds, images are black. We could
-						 * also set the background value instead, if available */
-						data->stack[frame] = 0;
-					}
-					else {
-						WORD pixel = data->pix[frame][pix_idx+x-shiftx];
+			if (fit.type == DATA_FLOAT) {
+				for (x = 0; x < naxes[0]; x++) {
+					double mean;
+					int frame;
+					/* copy the normalized values of all images for
+					 * the pixel into the stack, without rounding */
+					for (frame = 0; frame < nb_frames; frame++) {
+						long shifted = x - shiftx[frame];
 						double tmp;
+						if (shifted < 0 || shifted >= naxes[0]) {
+							/* outside bounds, images are black */
+							data->fstack[frame] = 0.f;
+							continue;
+						}
+						tmp = data->fpix[frame][pix_idx + shifted];
 						switch (args->normalize) {
-						default:
-						case NO_NORM:
-							// no normalization (scale[frame] = 1, offset[frame] = 0, mul[frame] = 1)
-							data->stack[frame] = pixel;
-							/* it's faster if we don't convert it to double
-							 * to make identity operations */
-							break;
-						case ADDITIVE:
-							// additive (scale[frame] = 1, mul[frame] = 1)
-						case ADDITIVE_SCALING:
-							// additive + scale (mul[frame] = 1)
-							tmp = (double)pixel * args->coeff.scale[frame];
-							data->stack[frame] = round_to_WORD(tmp - args->coeff.offset[frame]);
-							break;
-						case MULTIPLICATIVE:
-							// multiplicative  (scale[frame] = 1, offset[frame] = 0)
-						case MULTIPLICATIVE_SCALING:
-							// multiplicative + scale (offset[frame] = 0)
-							tmp = (double)pixel * args->coeff.scale[frame];
-							data->stack[frame] = round_to_WORD(tmp * args->coeff.mul[frame]);
-							break;
+							default:
+							case NO_NORM:
+								break;
+							case ADDITIVE:
+							case ADDITIVE_SCALING:
+								tmp = tmp * args->coeff.scale[frame] - args->coeff.offset[frame];
+								break;
+							case MULTIPLICATIVE:
+							case MULTIPLICATIVE_SCALING:
+								tmp = tmp * args->coeff.scale[frame] * args->coeff.mul[frame];
+								break;
 						}
+						data->fstack[frame] = (float) tmp;
 					}
+					mean = rejection_stack_float(args, data, data->fstack, crej);
+					/* no rounding of the mean, in the 0..1 range */
+					normalize_to16bit(bitpix, &mean);
+					fit.fpdata[my_block->channel][pdata_idx++] = (float) (mean / USHRT_MAX_DOUBLE);
 				}
-
-				int N = nb_frames;// N is the number of pixels kept from the current stack
-				double median;
-				int pixel, output, changed, n, r = 0;
-				switch (args->type_of_rejection) {
-				case PERCENTILE:
-					median = quickmedian (data->stack, N);
-					for (frame = 0; frame < N; frame++) {
-						data->rejected[frame] =	percentile_clipping(data->stack[frame], args->sig, median, crej);
-					}
-
-					for (pixel = 0, output = 0; pixel < N; pixel++) {
-						if (!data->rejected[pixel]) {
-							// copy only if there was a rejection
-							if (pixel != output)
-								data->stack[output] = data->stack[pixel];
-							output++;
-						}
+			}
+			else for (x = 0; x < naxes[0]; x += REJECTION_TILE_WIDTH) {
+				int p, width = REJECTION_TILE_WIDTH;
+				if (x + width > naxes[0])
+					width = naxes[0] - x;
+				/* copy the pixel values of all images for a run of
+				 * pixels of the row into the stacks of the tile */
+				rejection_gather_tile(args, data, shiftx, pix_idx, x, width, naxes[0]);
+
+				for (p = 0; p < width; p++) {
+					double mean = rejection_stack_pixel(args, data, p, crej);
+					if (args->norm_to_16) {
+						normalize_to16bit(bitpix, &mean);
 					}
-					N = output;
-					break;
-				case SIGMA:
-					do {
-						sigma = gsl_stats_ushort_sd(data->stack, 1, N);
-						median = quickmedian (data->stack, N);
-						for (frame = 0; frame < N; frame++) {
-							data->rejected[frame] =	sigma_clipping(data->stack[frame], args->sig, sigma, median, crej);
-							if (data->rejected[frame])
-								r++;
-							if (N - r <= 4) break;
-						}
-						for (pixel = 0, output = 0; pixel < N; pixel++) {
-							if (!data->rejected[pixel]) {
-								// copy only if there was a rejection
-								if (pixel != output)
-									data->stack[output] = data->stack[pixel];
-								output++;
-							}
-						}
-						changed = N != output;
-						N = output;
-					} while (changed && N > 3);
-					break;
-				case SIGMEDIAN:
-					do {
-						sigma = gsl_stats_ushort_sd(data->stack, 1, N);
-						median = quickmedian (data->stack, N);
-						n = 0;
-						for (frame = 0; frame < N; frame++) {
-							if (sigma_clipping(data->stack[frame], args->sig, sigma, median, crej)) {
-								data->stack[frame] = median;
-								n++;
-							}
-						}
-					} while (n > 0 && N > 3);
-					break;
-				case WINSORIZED:
-					do {
-						double sigma0;
-						sigma = gsl_stats_ushort_sd(data->stack, 1, N);
-						median = quickmedian (data->stack, N);
-						memcpy(data->w_stack, data->stack, N * sizeof(WORD));
-						do {
-							int jj;
-							double m0 = median - 1.5 * sigma;
-							double m1 = median + 1.5 * sigma;
-							for (jj = 0; jj < N; jj++)
-								Winsorize(data->w_stack+jj, m0, m1);
-							median = quickmedian (data->w_stack, N);
-							sigma0 = sigma;
-							sigma = 1.134 * gsl_stats_ushort_sd(data->w_stack, 1, N);
-						} while ((fabs(sigma - sigma0) / sigma0) > 0.0005);
-						for (frame = 0; frame < N; frame++) {
-							data->rejected[frame] = sigma_clipping(
-									data->stack[frame], args->sig, sigma,
-									median, crej);
-							if (data->rejected[frame] != 0)
-								r++;
-							if (N - r <= 4) break;
-
-						}
-						for (pixel = 0, output = 0; pixel < N; pixel++) {
-							if (!data->rejected[pixel]) {
-								// copy only if there was a rejection
-								if (pixel != output)
-									data->stack[output] = data->stack[pixel];
-								output++;
-							}
-						}
-						changed = N != output;
-						N = output;
-					} while (changed && N > 3);
-					break;
-				case LINEARFIT:
-					do {
-						double a, b, cov00, cov01, cov11, sumsq;
-						quicksort_s(data->stack, N);
-						for (frame = 0; frame < N; frame++) {
-							data->xf[frame] = (double)frame;
-							data->yf[frame] = (double)data->stack[frame];
-						}
-						gsl_fit_linear(data->xf, 1, data->yf, 1, N, &b, &a, &cov00, &cov01, &cov11, &sumsq);
-						sigma = 0.0;
-						for (frame = 0; frame < N; frame++)
-							sigma += (fabs((double)data->stack[frame] - (a*(double)frame + b)));
-						sigma /= (double)N;
-						for (frame = 0; frame < N; frame++) {
-							data->rejected[frame] =
-									line_clipping(data->stack[frame], args->sig, sigma, frame, a, b, crej);
-							if (data->rejected[frame] != 0)
-								r++;
-							if (N - r <= 4) break;
-						}
-						for (pixel = 0, output = 0; pixel < N; pixel++) {
-							if (!data->rejected[pixel]) {
-								// copy only if there was a rejection
-								if (pixel != output)
-									data->stack[output] = data->stack[pixel];
-								output++;
-							}
-						}
-						changed = N != output;
-						N = output;
-					} while (changed && N > 3);
-					break;
-				default:
-				case NO_REJEC:
-					;		// Nothing to do, no rejection
-				}
-
-				int64_t sum = 0L;
-				double mean;
-				for (frame = 0; frame < N; ++frame) {
-					sum += data->stack[frame];
-				}
-				mean = sum / (double)N;
-				if (args->norm_to_16) {
-					normalize_to16bit(bitpix, &mean);
+					fit.pdata[my_block->channel][pdata_idx++] = round_to_WORD(mean);
 				}
-				fit.pdata[my_block->channel][pdata_idx++] = round_to_WORD(mean);
 			} // end of for x
 #ifdef _OPENMP
 #pragma omp critical
@@ -995,8 +900,12 @@ int stack_mean_with_rejection(struct stacking_args *args) {
 	copyfits(&fit, &gfit, CP_FORMAT, 0);
 	gfit.exposure = exposure;
 	gfit.data = fit.data;
-	for (i = 0; i < fit.naxes[2]; i++)
+	gfit.type = fit.type;
+	gfit.fdata = fit.fdata;
+	for (i = 0; i < fit.naxes[2]; i++) {
 		gfit.pdata[i] = fit.pdata[i];
+		gfit.fpdata[i] = fit.fpdata[i];
+	}
 
 free_and_close:
 	fprintf(stdout, "free and close (%d)\n", retval);
@@ -1009,13 +918,23 @@ free_and_close:
 			if (data_pool[i].stack) free(data_pool[i].stack);
 			if (data_pool[i].pix) free(data_pool[i].pix);
 			if (data_pool[i].tmp) free(data_pool[i].tmp);
+			if (data_pool[i].tile) free(data_pool[i].tile);
+			if (data_pool[i].sum) free(data_pool[i].sum);
+			if (data_pool[i].sumsq) free(data_pool[i].sumsq);
 			if (data_pool[i].rejected) free(data_pool[i].rejected);
 			if (data_pool[i].w_stack) free(data_pool[i].w_stack);
 			if (data_pool[i].xf) free(data_pool[i].xf);
 			if (data_pool[i].yf) free(data_pool[i].yf);
+			if (data_pool[i].resample) free(data_pool[i].resample);
+			if (data_pool[i].fpix) free(data_pool[i].fpix);
+			if (data_pool[i].ftmp) free(data_pool[i].ftmp);
+			if (data_pool[i].fstack) free(data_pool[i].fstack);
+			if (data_pool[i].fw_stack) free(data_pool[i].fw_stack);
+			if (data_pool[i].fresample) free(data_pool[i].fresample);
 		}
 		free(data_pool);
 	}
+	if (shiftx) free(shiftx);
 	if (blocks) free(blocks);
 	if (args->coeff.offset) free(args->coeff.offset);
 	if (args->coeff.mul) free(args->coeff.mul);
@@ -1023,6 +942,7 @@ free_and_close:
 	if (retval) {
 		/* if retval is set, gfit has not been modified */
 		if (fit.data) free(fit.data);
+		if (fit.fdata) free(fit.fdata);
 		set_progress_bar_data(_("Rejection stacking failed. Check the log."), PROGRESS_RESET);
 		siril_log_message(_("Stacking failed.\n"));
 	} else {
@@ -1052,6 +972,17 @@ void main_stack(struct stacking_args *args) {
 
 	siril_log_message(args->description);
 
+	if (args->method != stack_mean_with_rejection && args->reglayer >= 0 &&
+			args->seq->regparam[args->reglayer]) {
+		int i;
+		for (i = 0; i < args->seq->number; i++) {
+			if (args->seq->regparam[args->reglayer][i].H.h22 != 0.0) {
+				siril_log_message(_("Only the shifts of the registration are used by this stacking method, use rej or mean stacking to apply the full transformation\n"));
+				break;
+			}
+		}
+	}
+
 	// 1. normalization
 	if (do_normalization(args)) // does nothing if NO_NORM
 		return;
@@ -1059,7 +990,8 @@ void main_stack(struct stacking_args *args) {
 	if (upscale_sequence(args)) // does nothing if args->seq->upscale_at_stacking <= 1.05
 		return;
 	// 3. stack
-	args->max_number_of_rows = stack_get_max_number_of_rows(args->seq, args->nb_images_to_stack);
+	args->max_number_of_rows = stack_get_max_number_of_rows(args->seq,
+			args->nb_images_to_stack, args->use_32bit_output);
 	args->retval = args->method(args);
 }
 
@@ -1266,8 +1198,6 @@ static gboolean end_stacking(gpointer p) {
 		com.uniq->fit = &gfit;
 		/* Giving summary if average rejection stacking */
 		_show_summary(args);
-		/* Giving noise estimation (new thread) */
-		_show_bgnoise(com.uniq->fit);
 
 		/* save stacking result */
 		if (args->output_filename != NULL && args->output_filename[0] != '\0') {
@@ -1292,6 +1222,11 @@ static gboolean end_stacking(gpointer p) {
 			}
 			display_filename();
 		}
+		/* a 32-bit result has been saved, it is displayed in 16 bits */
+		if (gfit.type == DATA_FLOAT)
+			fit_convert_to_ushort(&gfit);
+		/* Giving noise estimation (new thread) */
+		_show_bgnoise(com.uniq->fit);
 		/* remove tmp files if exist (Drizzle) */
 		remove_tmp_drizzle_files(args);
 
@@ -1408,12 +1343,14 @@ void on_comborejection_changed (GtkComboBox *box, gpointer user_data) {
 	writeinitfile();
 }
 
-int stack_get_max_number_of_rows(sequence *seq, int nb_images_to_stack) {
+/* use_32bit is TRUE if the frames are read in float, for the stacking in 32 bits */
+int stack_get_max_number_of_rows(sequence *seq, int nb_images_to_stack, gboolean use_32bit) {
 	int max_memory = get_max_memory_in_MB();
 	if (max_memory > 0) {
 		siril_log_message(_("Using %d MB memory maximum for stacking\n"), max_memory);
 		uint64_t number_of_rows = (uint64_t)max_memory * BYTES_IN_A_MB /
-			((uint64_t)seq->rx * nb_images_to_stack * sizeof(WORD) * com.max_thread);
+			((uint64_t)seq->rx * nb_images_to_stack *
+			 (use_32bit ? sizeof(float) : sizeof(WORD)) * com.max_thread);
 		// this is how many rows we can load in parallel from all images of the
 		// sequence and be under the limit defined in config in megabytes.
 		// We want to avoid having blocks larger than the half or they will decrease parallelism
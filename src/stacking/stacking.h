@@ -74,7 +74,13 @@ struct stacking_args {
 	norm_coeff coeff;		/* normalization data */
 	gboolean force_norm;		/* TRUE = force normalization */
 	gboolean norm_to_16;		/* normalize final image to 16bits */
+	gboolean use_32bit_output;	/* result in float, normalized to [0, 1] */
 	int reglayer;		/* layer used for registration data */
+	opencv_interpolation interpolation;	/* resampling of registered frames,
+						   OPENCV_NEAREST for integer shifts */
+	stackMethod stream_type;	/* result of the streaming stacking */
+	int stream_every;	/* streaming: frames between saves of output_filename, 0 for none */
+	double tile_best;	/* multi-point: percentage of the best frames kept for each box, 0 for all */
 };
 
 /* configuration from the command line */
@@ -89,16 +95,22 @@ struct stacking_configuration {
 	int number_of_loaded_sequences;
 	float f_fwhm, f_fwhm_p, f_round, f_round_p, f_quality, f_quality_p; // on if >0
 	gboolean filter_included;
+	opencv_interpolation interpolation;
+	stackMethod stream_type;
+	int stream_every;
+	gboolean use_32bit_output;
+	double tile_best;
 };
 
 void initialize_stacking_methods();
 
-int stack_get_max_number_of_rows(sequence *seq, int nb_images_to_stack);
+int stack_get_max_number_of_rows(sequence *seq, int nb_images_to_stack, gboolean use_32bit);
 
 int stack_median(struct stacking_args *args);
 int stack_mean_with_rejection(struct stacking_args *args);
 int stack_addmax(struct stacking_args *args);
 int stack_addmin(struct stacking_args *args);
+int stack_multipoint(struct stacking_args *args);	// multipoint_stack.c
 
 void main_stack(struct stacking_args *args);
 void clean_end_stacking(struct stacking_args *args);
@@ -124,9 +136,20 @@ struct _data_block {
 	WORD **pix;	// buffer for a block on all images
 	WORD *tmp;	// the actual single buffer for pix
 	WORD *stack;	// the reordered stack for one pixel in all images
+	WORD *tile;	// the stacks of adjacent pixels, for the rejection
+	int64_t *sum;	// sum of the values kept in each stack of the tile
+	uint64_t *sumsq;// sum of their squares
 	int *rejected;  // 0 if pixel ok, 1 or -1 if rejected
 	WORD *w_stack;	// stack for the winsorized rejection
 	double *xf, *yf;// data for the linear fit rejection
+	WORD *resample;	// source area of the frame being resampled
+	size_t resample_size;	// allocated size of resample or fresample, in pixels
+	/* the same in float, for the stacking in 32 bits */
+	float **fpix;
+	float *ftmp;
+	float *fstack;
+	float *fw_stack;
+	float *fresample;
 };
 
 int stack_open_all_files(struct stacking_args *args, int *bitpix, int *naxis, long *naxes, double *exposure, fits *fit);
@@ -136,6 +159,7 @@ int stack_compute_parallel_blocks(struct _image_block **blocks, int max_number_o
 		int *nb_parallel_stacks);
 void stack_read_block_data(struct stacking_args *args, int use_regdata,
 		struct _image_block *my_block, struct _data_block *data, long *naxes);
+gboolean stack_get_frame_transformation(struct stacking_args *args, int frame, double T[9]);
 int find_refimage_in_indices(int *indices, int nb, int ref);
 
 	/* up-scaling functions */
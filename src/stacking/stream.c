@@ -0,0 +1,610 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2019 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Streaming stacking: frames are read one after the other and accumulated
+ * into running statistics of each pixel, the mean and variance with the
+ * Welford algorithm, and the extrema. Unlike the block stacking methods,
+ * the memory used does not depend on the number of frames, and the stack
+ * can be saved at any time, which makes it usable for live stacking or
+ * for very long sequences.
+ * The rejection is an online sigma clipping: a new value is rejected if it
+ * is too far from the mean of the values accepted so far for this pixel.
+ * Results depend on the order of the frames, and the first
+ * STREAM_REJECTION_MIN_COUNT values of each pixel are always accepted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "core/siril.h"
+#include "core/processing.h"
+#include "core/proto.h"
+#include "io/sequence.h"
+#include "algos/sorting.h"
+#include "stacking.h"
+#include "stream.h"
+
+struct stream_stack *new_stream_stack(int rx, int ry, int nb_layers, double sig_low, double sig_high) {
+	size_t nbdata = (size_t) rx * ry * nb_layers;
+	struct stream_stack *st = calloc(1, sizeof(struct stream_stack));
+	if (!st) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	st->rx = rx;
+	st->ry = ry;
+	st->nb_layers = nb_layers;
+	st->sig[0] = sig_low;
+	st->sig[1] = sig_high;
+	st->mean = calloc(nbdata, sizeof(double));
+	st->m2 = calloc(nbdata, sizeof(double));
+	st->count = calloc(nbdata, sizeof(uint32_t));
+	st->min = malloc(nbdata * sizeof(WORD));
+	st->max = calloc(nbdata, sizeof(WORD));
+	if (!st->mean || !st->m2 || !st->count || !st->min || !st->max) {
+		PRINT_ALLOC_ERR;
+		free_stream_stack(st);
+		return NULL;
+	}
+	memset(st->min, 0xff, nbdata * sizeof(WORD));
+	return st;
+}
+
+void free_stream_stack(struct stream_stack *st) {
+	if (!st) return;
+	free(st->mean);
+	free(st->m2);
+	free(st->count);
+	free(st->min);
+	free(st->max);
+	free(st);
+}
+
+/* adds a frame, shifted like in the other stacking methods (bottom-up) */
+int stream_stack_add(struct stream_stack *st, fits *fit, int shiftx, int shifty) {
+	int layer;
+	uint64_t rej_low = 0, rej_high = 0;
+	gboolean clipping = st->sig[0] > 0.0 || st->sig[1] > 0.0;
+
+	if (fit->rx != st->rx || fit->ry != st->ry || fit->naxes[2] != (long) st->nb_layers) {
+		siril_log_message(_("Stacking: image in sequence doesn't has the same dimensions\n"));
+		return -1;
+	}
+
+	for (layer = 0; layer < st->nb_layers; layer++) {
+		WORD *from = fit->pdata[layer];
+		size_t offset = (size_t) layer * st->rx * st->ry;
+		int y;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) reduction(+:rej_low,rej_high)
+#endif
+		for (y = 0; y < st->ry; y++) {
+			int x, ny = y - shifty;
+			if (ny < 0 || ny >= st->ry)
+				continue;
+			for (x = 0; x < st->rx; x++) {
+				int nx = x - shiftx;
+				size_t i = offset + (size_t) y * st->rx + x;
+				double value, delta;
+				uint32_t n;
+				WORD pixel;
+				if (nx < 0 || nx >= st->rx)
+					continue;
+				pixel = from[ny * st->rx + nx];
+				if (pixel < st->min[i])
+					st->min[i] = pixel;
+				if (pixel > st->max[i])
+					st->max[i] = pixel;
+				value = pixel;
+
+				n = st->count[i];
+				if (clipping && n >= STREAM_REJECTION_MIN_COUNT) {
+					/* the standard deviation can't be less than the
+					 * quantization of the data, or a pixel that was
+					 * constant in the first frames would reject all */
+					double sigma = max(sqrt(st->m2[i] / (n - 1)), 1.0);
+					if (st->sig[0] > 0.0 && value < st->mean[i] - st->sig[0] * sigma) {
+						rej_low++;
+						continue;
+					}
+					if (st->sig[1] > 0.0 && value > st->mean[i] + st->sig[1] * sigma) {
+						rej_high++;
+						continue;
+					}
+				}
+				n++;
+				delta = value - st->mean[i];
+				st->mean[i] += delta / n;
+				st->m2[i] += delta * (value - st->mean[i]);
+				st->count[i] = n;
+			}
+		}
+	}
+	st->rejected[0] += rej_low;
+	st->rejected[1] += rej_high;
+	st->exposure += fit->exposure;
+	st->nb_frames++;
+	return 0;
+}
+
+/* computes the stacking result of the frames added so far: sum, mean, min or
+ * max. *result is allocated if NULL, like with new_fit_image(). */
+int stream_stack_get_result(struct stream_stack *st, stackMethod type, fits **result) {
+	size_t i, nbdata = (size_t) st->rx * st->ry * st->nb_layers;
+	double ratio = 1.0;
+	WORD *to, hi = 0;
+
+	if (type == STACK_SUM) {
+		/* like the sum stacking, the result is scaled down if it
+		 * doesn't fit in 16 bits */
+		double max_sum = 0.0;
+		for (i = 0; i < nbdata; i++)
+			if (st->mean[i] * st->count[i] > max_sum)
+				max_sum = st->mean[i] * st->count[i];
+		if (max_sum > USHRT_MAX_DOUBLE)
+			ratio = USHRT_MAX_DOUBLE / max_sum;
+	} else if (type != STACK_MEAN && type != STACK_MIN && type != STACK_MAX) {
+		siril_log_message(_("This stacking method is not available for streaming stacking\n"));
+		return -1;
+	}
+
+	if (new_fit_image(result, st->rx, st->ry, st->nb_layers))
+		return -1;
+	to = (*result)->data;
+
+	for (i = 0; i < nbdata; i++) {
+		if (!st->count[i]) {
+			to[i] = 0;	// never in the field of view
+			continue;
+		}
+		switch (type) {
+		case STACK_SUM:
+			to[i] = round_to_WORD(st->mean[i] * st->count[i] * ratio);
+			break;
+		default:
+		case STACK_MEAN:
+			to[i] = round_to_WORD(st->mean[i]);
+			break;
+		case STACK_MIN:
+			to[i] = st->min[i];
+			break;
+		case STACK_MAX:
+			to[i] = st->max[i];
+			break;
+		}
+		if (to[i] > hi)
+			hi = to[i];
+	}
+	(*result)->hi = hi;
+	(*result)->exposure = st->exposure;
+	(*result)->bitpix = (*result)->orig_bitpix = USHORT_IMG;
+	return 0;
+}
+
+struct stream_stacking_data {
+	struct stream_stack *st;
+	stackMethod type;	// result computed from the accumulators
+	double sig[2];
+	int reglayer;		// layer used for registration data
+	int ref_image;		// reference image index in the stacked sequence
+	int save_every;		// frames between intermediate results, 0 for none
+	const char *output_filename;
+};
+
+static int stream_stacking_prepare_hook(struct generic_seq_args *args) {
+	struct stream_stacking_data *sdata = args->user;
+	sdata->st = new_stream_stack(args->seq->rx, args->seq->ry, args->seq->nb_layers,
+			sdata->sig[0], sdata->sig[1]);
+	return sdata->st ? 0 : -1;
+}
+
+static int stream_stacking_image_hook(struct generic_seq_args *args, int o, int i, fits *fit, rectangle *_) {
+	struct stream_stacking_data *sdata = args->user;
+	int shiftx = 0, shifty = 0;
+
+	if (sdata->reglayer != -1 && args->seq->regparam[sdata->reglayer]) {
+		shiftx = round_to_int(args->seq->regparam[sdata->reglayer][i].shiftx * args->seq->upscale_at_stacking);
+		shifty = round_to_int(args->seq->regparam[sdata->reglayer][i].shifty * args->seq->upscale_at_stacking);
+	}
+	if (stream_stack_add(sdata->st, fit, shiftx, shifty))
+		return -1;
+
+	if (sdata->save_every > 0 && sdata->output_filename &&
+			sdata->st->nb_frames % sdata->save_every == 0) {
+		fits *partial = NULL;
+		if (!stream_stack_get_result(sdata->st, sdata->type, &partial)) {
+			if (savefits(sdata->output_filename, partial))
+				siril_log_message(_("Could not save the stacking result %s\n"),
+						sdata->output_filename);
+			else siril_log_message(_("Stack of %d images saved in %s\n"),
+					sdata->st->nb_frames, sdata->output_filename);
+		}
+		clearfits(partial);
+		free(partial);
+	}
+	return 0;
+}
+
+// store the result into gfit
+static int stream_stacking_finalize_hook(struct generic_seq_args *args) {
+	struct stream_stacking_data *sdata = args->user;
+	struct stream_stack *st = sdata->st;
+	fits *fit = &gfit;
+	int retval = 0;
+
+	if (!st)
+		return -1;
+	if (!args->retval) {
+		clearfits(&gfit);
+		retval = stream_stack_get_result(st, sdata->type, &fit);
+		if (!retval) {
+			/* We copy metadata from reference to the final fit */
+			if (args->seq->type == SEQ_REGULAR) {
+				int ref = sdata->ref_image;
+				if (!seq_open_image(args->seq, ref)) {
+					import_metadata_from_fitsfile(args->seq->fptr[ref], &gfit);
+					seq_close_image(args->seq, ref);
+				}
+			}
+			gfit.exposure = st->exposure;
+			if (st->sig[0] > 0.0 || st->sig[1] > 0.0) {
+				uint64_t nbdata = (uint64_t) st->rx * st->ry * st->nb_layers * st->nb_frames;
+				siril_log_message(_("Pixel rejection in channels: %.3lf%% - %.3lf%%\n"),
+						st->rejected[0] / (double) nbdata * 100.0,
+						st->rejected[1] / (double) nbdata * 100.0);
+			}
+		}
+	}
+	free_stream_stack(st);
+	sdata->st = NULL;
+	return retval;
+}
+
+/* stacking method for a sequence, using the type of stacking_args and
+ * reading the frames in the sequence order */
+int stack_streaming(struct stacking_args *stackargs) {
+	struct generic_seq_args *args;
+	struct stream_stacking_data *sdata;
+	int retval;
+
+	args = calloc(1, sizeof(struct generic_seq_args));
+	sdata = calloc(1, sizeof(struct stream_stacking_data));
+	if (!args || !sdata) {
+		PRINT_ALLOC_ERR;
+		free(args);
+		return -1;
+	}
+	args->seq = stackargs->seq;
+	args->partial_image = FALSE;
+	args->filtering_criterion = stackargs->filtering_criterion;
+	args->filtering_parameter = stackargs->filtering_parameter;
+	args->nb_filtered_images = stackargs->nb_images_to_stack;
+	args->prepare_hook = stream_stacking_prepare_hook;
+	args->image_hook = stream_stacking_image_hook;
+	args->save_hook = NULL;
+	args->finalize_hook = stream_stacking_finalize_hook;
+	args->idle_function = NULL;
+	args->stop_on_error = TRUE;
+	args->description = _("Streaming stacking");
+	args->has_output = FALSE;
+	args->already_in_a_thread = TRUE;
+	args->parallel = FALSE;	// the online rejection needs the frames in order
+
+	sdata->type = stackargs->stream_type;
+	if (stackargs->type_of_rejection != NO_REJEC) {
+		sdata->sig[0] = stackargs->sig[0];
+		sdata->sig[1] = stackargs->sig[1];
+	}
+	sdata->reglayer = stackargs->reglayer;
+	sdata->ref_image = stackargs->ref_image;
+	sdata->save_every = stackargs->stream_every;
+	sdata->output_filename = stackargs->output_filename;
+	assert(sdata->ref_image >= 0 && sdata->ref_image < args->seq->number);
+	args->user = sdata;
+
+	generic_sequence_worker(args);
+	retval = args->retval;
+	free(sdata);
+	free(args);
+	return retval;
+}
+
+/* Approximate median stacking, in two passes over the sequence. The first one
+ * computes the mean and standard deviation of each pixel, the second one
+ * builds for each pixel a histogram of MEDIAN_APPROX_BINS bins over the
+ * interval [mean - sigma, mean + sigma], which always contains the median,
+ * and counts the values below it. The median is then found in its bin and
+ * interpolated inside it, or exact when bins are one value wide. Like the
+ * exact median, registration data is not used.
+ * The memory used by pixel does not depend on the number of frames, and the
+ * frames are read entirely instead of by thin blocks of rows when memory is
+ * short. The exact median of a sample of pixels is computed to report the
+ * accuracy of the result.
+ */
+
+struct median_approx_data {
+	struct stacking_args *stackargs;
+	int nb_frames;
+	int bitpix;
+	struct stream_stack *st;	// first pass: mean and deviation
+	size_t nbdata;
+	WORD *lo, *width;	// second pass: histogram interval of each pixel
+	uint16_t *below;	// number of values below lo
+	uint16_t *bins;		// MEDIAN_APPROX_BINS for each pixel
+	size_t sample_step;	// pixel index step between samples
+	int nb_samples;
+	WORD *samples;		// values of the sampled pixels, for all frames
+};
+
+/* normalizes the frame in place, as the median and mean stacking do for
+ * each pixel stack */
+static void normalize_frame(struct stacking_args *args, int frame, fits *fit) {
+	size_t i, n = (size_t) fit->rx * fit->ry * fit->naxes[2];
+	double scale, offset, mul;
+
+	if (args->normalize == NO_NORM)
+		return;
+	scale = args->coeff.scale[frame];
+	offset = args->coeff.offset[frame];
+	mul = args->coeff.mul[frame];
+	for (i = 0; i < n; i++) {
+		double tmp = (double)fit->data[i] * scale;
+		switch (args->normalize) {
+		default:
+		case ADDITIVE:
+		case ADDITIVE_SCALING:
+			fit->data[i] = round_to_WORD(tmp - offset);
+			break;
+		case MULTIPLICATIVE:
+		case MULTIPLICATIVE_SCALING:
+			fit->data[i] = round_to_WORD(tmp * mul);
+			break;
+		}
+	}
+}
+
+static int median_approx_first_hook(struct generic_seq_args *args, int o, int i, fits *fit, rectangle *_) {
+	struct median_approx_data *mdata = args->user;
+	if (o == 0)
+		mdata->bitpix = fit->bitpix;
+	normalize_frame(mdata->stackargs, o, fit);
+	return stream_stack_add(mdata->st, fit, 0, 0);
+}
+
+static int median_approx_second_hook(struct generic_seq_args *args, int o, int i, fits *fit, rectangle *_) {
+	struct median_approx_data *mdata = args->user;
+	long p;
+
+	if ((size_t) fit->rx * fit->ry * fit->naxes[2] != mdata->nbdata) {
+		siril_log_message(_("Stacking: image in sequence doesn't has the same dimensions\n"));
+		return -1;
+	}
+	normalize_frame(mdata->stackargs, o, fit);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (p = 0; p < (long) mdata->nbdata; p++) {
+		WORD value = fit->data[p];
+		if (value < mdata->lo[p])
+			mdata->below[p]++;
+		else {
+			int bin = (value - mdata->lo[p]) / mdata->width[p];
+			if (bin < MEDIAN_APPROX_BINS)
+				mdata->bins[p * MEDIAN_APPROX_BINS + bin]++;
+		}
+	}
+	for (p = 0; p < mdata->nb_samples; p++)
+		mdata->samples[p * mdata->nb_frames + o] = fit->data[p * mdata->sample_step];
+	return 0;
+}
+
+/* value of rank `rank' in the sorted values of the pixel, values of a bin
+ * being evenly distributed in it */
+static double median_approx_rank_value(struct median_approx_data *mdata, size_t p, int rank) {
+	const uint16_t *bins = mdata->bins + p * MEDIAN_APPROX_BINS;
+	int bin, count = mdata->below[p];
+
+	if (rank < count)	// not possible, the median is in the interval
+		return mdata->lo[p];
+	for (bin = 0; bin < MEDIAN_APPROX_BINS; bin++) {
+		if (rank < count + bins[bin]) {
+			double start = mdata->lo[p] + bin * mdata->width[p];
+			return start + (mdata->width[p] - 1) * (rank - count + 0.5) / bins[bin];
+		}
+		count += bins[bin];
+	}
+	return mdata->lo[p] + MEDIAN_APPROX_BINS * mdata->width[p] - 1;
+}
+
+static double median_approx_value(struct median_approx_data *mdata, size_t p) {
+	int n = mdata->nb_frames;
+	return 0.5 * (median_approx_rank_value(mdata, p, (n - 1) / 2) +
+			median_approx_rank_value(mdata, p, n / 2));
+}
+
+/* sets the histogram interval of each pixel from the first pass statistics */
+static void median_approx_set_intervals(struct median_approx_data *mdata) {
+	struct stream_stack *st = mdata->st;
+	long p;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (p = 0; p < (long) mdata->nbdata; p++) {
+		/* the median is at most one population standard deviation away
+		 * from the mean */
+		double sigma = st->count[p] ? sqrt(st->m2[p] / st->count[p]) : 0.0;
+		double lo = max(floor(st->mean[p] - sigma), 0.0);
+		double hi = min(ceil(st->mean[p] + sigma), USHRT_MAX_DOUBLE);
+		int width = ((int) (hi - lo) + MEDIAN_APPROX_BINS) / MEDIAN_APPROX_BINS;
+		mdata->lo[p] = (WORD) lo;
+		mdata->width[p] = (WORD) width;
+	}
+}
+
+static int median_approx_pass(struct stacking_args *stackargs, struct median_approx_data *mdata,
+		int (*image_hook)(struct generic_seq_args *, int, int, fits *, rectangle *),
+		const char *description) {
+	struct generic_seq_args *args;
+	int retval;
+
+	args = calloc(1, sizeof(struct generic_seq_args));
+	if (!args) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+	args->seq = stackargs->seq;
+	args->partial_image = FALSE;
+	args->filtering_criterion = stackargs->filtering_criterion;
+	args->filtering_parameter = stackargs->filtering_parameter;
+	args->nb_filtered_images = stackargs->nb_images_to_stack;
+	args->prepare_hook = NULL;
+	args->image_hook = image_hook;
+	args->save_hook = NULL;
+	args->finalize_hook = NULL;
+	args->idle_function = NULL;
+	args->stop_on_error = TRUE;
+	args->description = description;
+	args->has_output = FALSE;
+	args->already_in_a_thread = TRUE;
+	args->parallel = FALSE;	// frames are accumulated one at a time
+	args->user = mdata;
+
+	generic_sequence_worker(args);
+	retval = args->retval;
+	free(args);
+	return retval;
+}
+
+int stack_median_approx(struct stacking_args *args) {
+	struct median_approx_data mdata = { 0 };
+	fits *fit = &gfit;
+	double max_error = 0.0, sum_error = 0.0, exposure;
+	int retval = 0, max_width = 0, hi = 0;
+	long p;
+
+	mdata.stackargs = args;
+	mdata.nb_frames = args->nb_images_to_stack;
+	mdata.nbdata = (size_t) args->seq->rx * args->seq->ry * args->seq->nb_layers;
+	if (mdata.nb_frames < 2) {
+		siril_log_message(_("Select at least two frames for stacking. Aborting.\n"));
+		retval = -1;
+		goto the_end;
+	}
+	if (mdata.nb_frames > UINT16_MAX) {
+		siril_log_message(_("Too many images for the approximate median, %d maximum\n"), UINT16_MAX);
+		retval = -1;
+		goto the_end;
+	}
+
+	/* first pass: mean and standard deviation */
+	mdata.st = new_stream_stack(args->seq->rx, args->seq->ry, args->seq->nb_layers, 0.0, 0.0);
+	if (!mdata.st) {
+		retval = -1;
+		goto the_end;
+	}
+	if ((retval = median_approx_pass(args, &mdata, median_approx_first_hook,
+					_("Approximate median stacking, first pass"))))
+		goto the_end;
+
+	/* second pass: histograms */
+	mdata.lo = malloc(mdata.nbdata * sizeof(WORD));
+	mdata.width = malloc(mdata.nbdata * sizeof(WORD));
+	mdata.below = calloc(mdata.nbdata, sizeof(uint16_t));
+	mdata.bins = calloc(mdata.nbdata * MEDIAN_APPROX_BINS, sizeof(uint16_t));
+	mdata.nb_samples = min((size_t) MEDIAN_APPROX_SAMPLES, mdata.nbdata);
+	mdata.sample_step = mdata.nbdata / mdata.nb_samples;
+	mdata.samples = malloc((size_t) mdata.nb_samples * mdata.nb_frames * sizeof(WORD));
+	if (!mdata.lo || !mdata.width || !mdata.below || !mdata.bins || !mdata.samples) {
+		PRINT_ALLOC_ERR;
+		retval = -1;
+		goto the_end;
+	}
+	median_approx_set_intervals(&mdata);
+	exposure = mdata.st->exposure;
+	free_stream_stack(mdata.st);
+	mdata.st = NULL;
+	siril_log_message(_("Approximate median: using %lu MB for the histograms\n"),
+			(unsigned long) (mdata.nbdata * (2 * sizeof(WORD) +
+					(MEDIAN_APPROX_BINS + 1) * sizeof(uint16_t)) / BYTES_IN_A_MB));
+
+	if ((retval = median_approx_pass(args, &mdata, median_approx_second_hook,
+					_("Approximate median stacking, second pass"))))
+		goto the_end;
+
+	/* result */
+	clearfits(&gfit);
+	if (new_fit_image(&fit, args->seq->rx, args->seq->ry, args->seq->nb_layers)) {
+		retval = -1;
+		goto the_end;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) reduction(max:max_width,hi)
+#endif
+	for (p = 0; p < (long) mdata.nbdata; p++) {
+		double median = median_approx_value(&mdata, p);
+		if (args->norm_to_16 && mdata.bitpix == BYTE_IMG)
+			median *= USHRT_MAX_DOUBLE / UCHAR_MAX_DOUBLE;
+		gfit.data[p] = round_to_WORD(median);
+		if (gfit.data[p] > hi)
+			hi = gfit.data[p];
+		if (mdata.width[p] > max_width)
+			max_width = mdata.width[p];
+	}
+
+	/* accuracy on the sampled pixels */
+	for (p = 0; p < mdata.nb_samples; p++) {
+		double exact = quickmedian(mdata.samples + p * mdata.nb_frames, mdata.nb_frames);
+		double error = fabs(median_approx_value(&mdata, p * mdata.sample_step) - exact);
+		sum_error += error;
+		if (error > max_error)
+			max_error = error;
+	}
+	siril_log_message(_("Approximate median: error on %d sampled pixels is %.3lf on average, "
+				"%.2lf at most, bins are at most %d wide\n"),
+			mdata.nb_samples, sum_error / mdata.nb_samples, max_error, max_width);
+
+	/* We copy metadata from reference to the final fit */
+	if (args->seq->type == SEQ_REGULAR) {
+		if (!seq_open_image(args->seq, args->ref_image)) {
+			import_metadata_from_fitsfile(args->seq->fptr[args->ref_image], &gfit);
+			seq_close_image(args->seq, args->ref_image);
+		}
+	}
+	gfit.exposure = exposure;
+	gfit.hi = hi;
+	gfit.bitpix = gfit.orig_bitpix = USHORT_IMG;
+
+the_end:
+	free_stream_stack(mdata.st);
+	free(mdata.lo);
+	free(mdata.width);
+	free(mdata.below);
+	free(mdata.bins);
+	free(mdata.samples);
+	if (args->coeff.offset) free(args->coeff.offset);
+	if (args->coeff.mul) free(args->coeff.mul);
+	if (args->coeff.scale) free(args->coeff.scale);
+	args->coeff.offset = args->coeff.mul = args->coeff.scale = NULL;
+	return retval;
+}
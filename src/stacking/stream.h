@@ -0,0 +1,42 @@
+#ifndef _STACKSTREAM_H
+#define _STACKSTREAM_H
+
+#include <stdint.h>
+#include "stacking.h"
+
+/* minimum number of accepted values of a pixel before the online sigma
+ * clipping starts rejecting new values for it */
+#define STREAM_REJECTION_MIN_COUNT 5
+
+/* Incremental stacking: frames are added one at a time to running
+ * accumulators and a result can be computed at any time, with a memory use
+ * that does not depend on the number of frames. */
+struct stream_stack {
+	int rx, ry, nb_layers;
+	double sig[2];		/* low and high sigma of the online clipping, 0 disables it */
+	int nb_frames;		/* number of frames added */
+	double exposure;	/* sum of the exposures of the added frames */
+	uint64_t rejected[2];	/* number of low and high rejected values */
+
+	/* for each pixel of each layer */
+	double *mean;		/* running mean of the accepted values */
+	double *m2;		/* sum of squared deviations to the mean (Welford) */
+	uint32_t *count;	/* number of accepted values */
+	WORD *min, *max;	/* extrema of all values */
+};
+
+struct stream_stack *new_stream_stack(int rx, int ry, int nb_layers, double sig_low, double sig_high);
+int stream_stack_add(struct stream_stack *st, fits *fit, int shiftx, int shifty);
+int stream_stack_get_result(struct stream_stack *st, stackMethod type, fits **result);
+void free_stream_stack(struct stream_stack *st);
+
+int stack_streaming(struct stacking_args *args);
+
+/* number of histogram bins kept for each pixel by the approximate median */
+#define MEDIAN_APPROX_BINS 16
+/* number of pixels for which the exact median is computed to check accuracy */
+#define MEDIAN_APPROX_SAMPLES 1000
+
+int stack_median_approx(struct stacking_args *args);
+
+#endif
@@ -25,6 +25,7 @@
 #include "stacking.h"
 #include "io/sequence.h"
 #include "io/ser.h"
+#include "io/chunked.h"
 #include "gui/progress_and_log.h"
 #include "gui/callbacks.h" // for delete_selected_area()
 #include "opencv/opencv.h"
@@ -70,6 +71,11 @@ void remove_tmp_drizzle_files(struct stacking_args *args) {
 		g_unlink(args->seq->ser_file->filename);
 		ser_close_file(args->seq->ser_file);
 		break;
+	case SEQ_CHUNKED:
+		siril_debug_print("Removing %s\n", args->seq->chunked_file->filename);
+		g_unlink(args->seq->chunked_file->filename);
+		chunked_close_file(args->seq->chunked_file);
+		break;
 	}
 }
 
@@ -144,7 +150,7 @@ int upscale_sequence(struct stacking_args *stackargs) {
 	int backup_max_thread = com.max_thread;
 	com.max_thread = nb_threads;
 
-	struct generic_seq_args *args = malloc(sizeof(struct generic_seq_args));
+	struct generic_seq_args *args = calloc(1, sizeof(struct generic_seq_args));
 	struct upscale_args *upargs = malloc(sizeof(struct upscale_args));
 
 	upargs->factor = stackargs->seq->upscale_at_stacking;
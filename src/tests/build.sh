@@ -12,3 +12,18 @@ $LD $LDFLAGS -o compare_fits compare_fits.o dummy.o ../io/image_format_fits.o ..
 $CC $CFLAGS -c -o sorting.o sorting.c &&
 $CC $CFLAGS -DUSE_ALL_SORTING_ALGOS -c -o ../algos/sorting.o ../algos/sorting.c &&
 $LD $LDFLAGS -o sorting sorting.o ../algos/sorting.o
+
+$CC $CFLAGS -c -o ser_read.o ser_read.c &&
+$LD $LDFLAGS -o ser_read ser_read.o dummy.o ../io/ser.o ../algos/demosaicing.o ../io/image_format_fits.o ../core/utils.o ../gui/progress_and_log.o
+
+$CC $CFLAGS -c -o rejection.o rejection.c &&
+$LD $LDFLAGS -o rejection rejection.o dummy.o ../stacking/rejection.o ../algos/sorting.o ../io/image_format_fits.o ../core/utils.o ../gui/progress_and_log.o
+
+$CC $CFLAGS -c -o psf_fit.o psf_fit.c &&
+$LD $LDFLAGS -o psf_fit psf_fit.o dummy.o ../algos/PSF.o ../algos/photometry.o ../algos/sorting.o ../io/image_format_fits.o ../core/utils.o ../gui/progress_and_log.o
+
+$CC $CFLAGS -c -o star_matching.o star_matching.c &&
+$LD $LDFLAGS -o star_matching star_matching.o dummy.o ../registration/matching/atpmatch.o ../registration/matching/misc.o
+
+$CC $CFLAGS -c -o chunked.o chunked.c &&
+$LD $LDFLAGS -o chunked chunked.o dummy.o ../io/chunked.o ../io/image_format_fits.o ../core/utils.o ../gui/progress_and_log.o
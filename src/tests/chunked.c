@@ -0,0 +1,216 @@
+#include "../core/siril.h"
+#include "../core/proto.h"
+#include "../io/chunked.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* This program checks that the frames written in a chunked sequence file are
+ * read back identical, for both compressions: whole frames, and areas inside
+ * a band, across band edges or in the last, shorter, band. The frames are
+ * written out of order, some from top-down images like those of SER files,
+ * and one frame is missing, as if its processing had failed: the hole must be
+ * removed when the file is closed, the next frames being renumbered.
+ * Usage: chunked [file.csq] */
+
+#define WIDTH 123
+#define HEIGHT 100	// three full bands and one of 4 rows
+#define NB_LAYERS 3
+#define NB_FRAMES 6
+#define FAILED_FRAME 2
+
+/* frames in the order they are written */
+static const int write_order[NB_FRAMES] = { 3, 0, 5, FAILED_FRAME, 1, 4 };
+
+/* Value of a pixel, y counted from the bottom of the image as in memory. The
+ * first layers are smooth and compress, the last one is noise, its bands
+ * are stored raw. */
+static WORD pixel_value(int frame, int layer, int x, int y) {
+	guint32 h;
+	if (layer < NB_LAYERS - 1)
+		return 1000 * frame + 100 * layer + x + y / 4;
+	h = (frame * 7919 + x) * 2654435761u ^ (y * 40503u);
+	h ^= h >> 15;
+	h *= 2246822519u;
+	h ^= h >> 13;
+	return (WORD) h;
+}
+
+static fits *make_frame(int frame) {
+	fits *fit = NULL;
+	int layer, x, y;
+
+	if (new_fit_image(&fit, WIDTH, HEIGHT, NB_LAYERS))
+		return NULL;
+	fit->type = DATA_USHORT;
+	fit->top_down = frame % 2;
+	fit->exposure = frame + 0.5;
+	g_snprintf(fit->date_obs, FLEN_VALUE, "2020-01-0%dT00:00:00", frame + 1);
+	for (layer = 0; layer < NB_LAYERS; layer++)
+		for (y = 0; y < HEIGHT; y++) {
+			int row = fit->top_down ? HEIGHT - 1 - y : y;
+			for (x = 0; x < WIDTH; x++)
+				fit->pdata[layer][row * WIDTH + x] = pixel_value(frame, layer, x, y);
+		}
+	return fit;
+}
+
+static int write_file(const char *filename, chunked_compression compression) {
+	struct chunked_struct cfile;
+	int i, errors = 0;
+
+	if (chunked_create_file(filename, &cfile, compression))
+		return 1;
+	for (i = 0; i < NB_FRAMES; i++) {
+		fits *fit;
+		if (write_order[i] == FAILED_FRAME)
+			continue;
+		fit = make_frame(write_order[i]);
+		if (!fit || chunked_write_frame_from_fit(&cfile, fit, write_order[i])) {
+			fprintf(stderr, "could not write frame %d\n", write_order[i]);
+			errors++;
+		}
+		if (fit)
+			clearfits(fit);
+		free(fit);
+	}
+	if (chunked_write_and_close(&cfile)) {
+		fprintf(stderr, "could not close %s\n", filename);
+		errors++;
+	}
+	return errors;
+}
+
+/* frame of the file that was written as frame, the hole being removed */
+static int source_frame(int frame_no) {
+	return frame_no < FAILED_FRAME ? frame_no : frame_no + 1;
+}
+
+static int check_frame(struct chunked_struct *cfile, int frame_no) {
+	fits fit = { 0 };
+	int frame = source_frame(frame_no), layer, x, y, errors = 0;
+	char date[FLEN_VALUE];
+
+	if (chunked_read_frame(cfile, frame_no, &fit)) {
+		fprintf(stderr, "could not read frame %d\n", frame_no);
+		return 1;
+	}
+	g_snprintf(date, FLEN_VALUE, "2020-01-0%dT00:00:00", frame + 1);
+	if (fit.rx != WIDTH || fit.ry != HEIGHT || fit.naxes[2] != NB_LAYERS ||
+			fit.top_down || fit.exposure != frame + 0.5 || strcmp(fit.date_obs, date)) {
+		fprintf(stderr, "frame %d: wrong size or metadata\n", frame_no);
+		errors++;
+	}
+	for (layer = 0; layer < NB_LAYERS && !errors; layer++)
+		for (y = 0; y < HEIGHT && !errors; y++)
+			for (x = 0; x < WIDTH; x++)
+				if (fit.pdata[layer][y * WIDTH + x] != pixel_value(frame, layer, x, y)) {
+					fprintf(stderr, "frame %d: wrong pixel %d,%d of layer %d\n",
+							frame_no, x, y, layer);
+					errors++;
+					break;
+				}
+	free(fit.data);
+	return errors;
+}
+
+/* the area is read top-down, its y counted from the top of the image */
+static int check_area(struct chunked_struct *cfile, int frame_no, int layer,
+		const rectangle *area) {
+	int frame = source_frame(frame_no), x, t, errors = 0;
+	WORD *buffer = malloc(area->w * area->h * sizeof(WORD));
+
+	if (!buffer)
+		return 1;
+	if (chunked_read_opened_partial(cfile, layer, frame_no, buffer, area)) {
+		fprintf(stderr, "could not read area %d,%d %dx%d of frame %d\n",
+				area->x, area->y, area->w, area->h, frame_no);
+		free(buffer);
+		return 1;
+	}
+	for (t = 0; t < area->h && !errors; t++) {
+		int y = HEIGHT - 1 - area->y - t;
+		for (x = 0; x < area->w; x++)
+			if (buffer[t * area->w + x] != pixel_value(frame, layer, area->x + x, y)) {
+				fprintf(stderr, "frame %d: wrong pixel %d,%d in area %d,%d %dx%d\n",
+						frame_no, area->x + x, y, area->x, area->y,
+						area->w, area->h);
+				errors++;
+				break;
+			}
+	}
+	free(buffer);
+	return errors;
+}
+
+static int check_file(const char *filename) {
+	static const rectangle areas[] = {
+		{ 0, 0, WIDTH, HEIGHT },	// whole frame
+		{ 10, 70, 50, 20 },		// inside the first band
+		{ 5, 20, 100, 50 },		// across two band edges
+		{ 0, 0, WIDTH, 4 },		// the last band, at the top
+		{ 30, 2, 60, 33 },		// from the last band to the one below
+		{ WIDTH - 1, HEIGHT - 1, 1, 1 },// one pixel
+		{ 0, 35, 17, 2 }		// two rows around a band edge
+	};
+	static const rectangle outside = { 100, 90, 30, 20 };
+	struct chunked_struct cfile = { 0 };
+	WORD buffer[30 * 20];
+	fits fit = { 0 };
+	int i, layer, errors = 0;
+
+	if (chunked_open_file(filename, &cfile)) {
+		fprintf(stderr, "could not open %s\n", filename);
+		return 1;
+	}
+	if (cfile.frame_count != NB_FRAMES - 1 || cfile.width != WIDTH ||
+			cfile.height != HEIGHT || cfile.nb_layers != NB_LAYERS) {
+		fprintf(stderr, "%s: %d frames of %dx%dx%d\n", filename, cfile.frame_count,
+				cfile.width, cfile.height, cfile.nb_layers);
+		chunked_close_file(&cfile);
+		return 1;
+	}
+
+	for (i = 0; i < cfile.frame_count; i++) {
+		errors += check_frame(&cfile, i);
+		for (layer = 0; layer < NB_LAYERS; layer++) {
+			int a;
+			for (a = 0; a < G_N_ELEMENTS(areas); a++)
+				errors += check_area(&cfile, i, layer, areas + a);
+		}
+	}
+
+	/* reads that must fail */
+	if (!chunked_read_opened_partial(&cfile, 0, 0, buffer, &outside)) {
+		fprintf(stderr, "reading an area outside the image did not fail\n");
+		errors++;
+	}
+	if (!chunked_read_frame(&cfile, cfile.frame_count, &fit)) {
+		fprintf(stderr, "reading a frame after the last did not fail\n");
+		errors++;
+	}
+	free(fit.data);
+	chunked_close_file(&cfile);
+	return errors;
+}
+
+int main(int argc, char **argv) {
+	const char *filename = argc > 1 ? argv[1] : "chunked_test.csq";
+	int errors = 0;
+
+	errors += write_file(filename, CHUNKED_RAW);
+	if (!errors)
+		errors += check_file(filename);
+	fprintf(stdout, "raw bands: %s\n", errors ? "FAILED" : "passed");
+
+	if (!errors) {
+		errors += write_file(filename, CHUNKED_DEFLATE);
+		if (!errors)
+			errors += check_file(filename);
+		fprintf(stdout, "compressed bands: %s\n", errors ? "FAILED" : "passed");
+	}
+	g_unlink(filename);
+	return errors != 0;
+}
@@ -0,0 +1,150 @@
+#include "../core/siril.h"
+#include "../algos/PSF.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include <gsl/gsl_matrix.h>
+
+/* This program compares the PSF fitter of siril with the Levenberg-Marquardt
+ * solver of GSL it replaced, on random Gaussian stars with noise: it gives
+ * the number of fits per second of both, and checks that they find the same
+ * positions and FWHM, without and with the angle.
+ * Usage: psf_fit [nb_stars [size]] */
+
+#define POS_TOLERANCE 0.05	// pixels
+#define FWHM_TOLERANCE 0.02	// relative
+
+static double elapsed(struct timeval *t1, struct timeval *t2) {
+	return (double)(t2->tv_sec - t1->tv_sec) +
+		(double)(t2->tv_usec - t1->tv_usec) / 1000000.0;
+}
+
+static double uniform() {
+	return rand() / (RAND_MAX + 1.0);
+}
+
+static double gaussian() {
+	double u = uniform() + 1e-12, v = uniform();
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* star of random amplitude, position, size and angle, seen like the peaker
+ * sees it, on a background of 1000 with photon noise */
+static void make_star(double *area, int size) {
+	double B = 1000.0, A = 300.0 + 30000.0 * uniform();
+	double x0 = size / 2.0 + uniform() - 0.5, y0 = size / 2.0 + uniform() - 0.5;
+	double SX = 2.0 + 8.0 * uniform(), SY = SX * (0.6 + 0.4 * uniform());
+	double alpha = M_PI * (uniform() - 0.5);
+	int i, j;
+
+	for (i = 0; i < size; i++) {
+		for (j = 0; j < size; j++) {
+			double u = j + 1 - x0, v = i + 1 - y0;
+			double X = cos(alpha) * u - sin(alpha) * v;
+			double Y = sin(alpha) * u + cos(alpha) * v;
+			double value = B + A * exp(-(X * X / SX + Y * Y / SY));
+			area[i * size + j] = round(value + sqrt(value) * gaussian());
+		}
+	}
+}
+
+static double fit_all(double *areas, int nb, int size, gboolean angle,
+		psf_workspace *ws, fitted_PSF **results) {
+	struct timeval t1, t2;
+	int i;
+
+	gettimeofday(&t1, NULL);
+	if (angle) {
+		for (i = 0; i < nb; i++) {
+			gsl_matrix_view z = gsl_matrix_view_array(areas + i * size * size,
+					size, size);
+			results[i] = psf_global_minimisation(&z.matrix, 1000.0, 0, TRUE,
+					FALSE, FALSE, ws);
+		}
+	} else {
+		psf_global_minimisation_batch(areas, nb, size, size, 1000.0, 0, ws,
+				results);
+	}
+	gettimeofday(&t2, NULL);
+	return elapsed(&t1, &t2);
+}
+
+static int compare(fitted_PSF **gsl, fitted_PSF **fast, int nb, gboolean angle,
+		double t_gsl, double t_fast) {
+	int i, nb_both = 0, nb_diff = 0, nb_gsl = 0, nb_fast = 0;
+	double max_pos = 0.0, max_fwhm = 0.0;
+
+	for (i = 0; i < nb; i++) {
+		double dpos, dfwhm;
+		if (gsl[i]) nb_gsl++;
+		if (fast[i]) nb_fast++;
+		if (!gsl[i] || !fast[i])
+			continue;
+		nb_both++;
+		dpos = hypot(gsl[i]->x0 - fast[i]->x0, gsl[i]->y0 - fast[i]->y0);
+		dfwhm = max(fabs(gsl[i]->fwhmx - fast[i]->fwhmx) / gsl[i]->fwhmx,
+				fabs(gsl[i]->fwhmy - fast[i]->fwhmy) / gsl[i]->fwhmy);
+		if (dpos > max_pos) max_pos = dpos;
+		if (dfwhm > max_fwhm) max_fwhm = dfwhm;
+		if (dpos > POS_TOLERANCE || dfwhm > FWHM_TOLERANCE)
+			nb_diff++;
+	}
+	fprintf(stdout, "%s angle: GSL %.0f fits/s, siril %.0f fits/s (x%.1f)\n",
+			angle ? "with" : "without", nb / t_gsl, nb / t_fast, t_gsl / t_fast);
+	fprintf(stdout, "\tfitted: %d by GSL, %d by siril\n", nb_gsl, nb_fast);
+	fprintf(stdout, "\tlargest differences: %.4f px, %.2f%% of FWHM, %d stars out of tolerance\n",
+			max_pos, max_fwhm * 100.0, nb_diff);
+	/* stars lost in the noise can have several solutions */
+	return nb_diff > nb_both / 100;
+}
+
+int main(int argc, char **argv) {
+	int nb = 10000, size = 20, i, angle, retval = 0;
+	double *areas;
+	fitted_PSF **gsl, **fast;
+	psf_workspace *gsl_ws, *fast_ws;
+
+	if (argc > 1)
+		nb = atoi(argv[1]);
+	if (argc > 2)
+		size = atoi(argv[2]);
+	if (nb < 1 || size < 4) {
+		fprintf(stderr, "Usage: %s [nb_stars [size]]\n", argv[0]);
+		return 1;
+	}
+	/* psf_global_minimisation() normalizes with the maximum of gfit */
+	gfit.maxi = USHRT_MAX;
+
+	areas = malloc((size_t) nb * size * size * sizeof(double));
+	gsl = calloc(nb, sizeof(fitted_PSF *));
+	fast = calloc(nb, sizeof(fitted_PSF *));
+	gsl_ws = new_psf_workspace(size, size);
+	fast_ws = new_psf_workspace(size, size);
+	if (!areas || !gsl || !fast || !gsl_ws || !fast_ws) {
+		fprintf(stderr, "allocation error\n");
+		return 1;
+	}
+	psf_workspace_use_gsl(gsl_ws, TRUE);
+	srand(42);
+	for (i = 0; i < nb; i++)
+		make_star(areas + (size_t) i * size * size, size);
+
+	for (angle = 0; angle < 2; angle++) {
+		double t_gsl = fit_all(areas, nb, size, angle, gsl_ws, gsl);
+		double t_fast = fit_all(areas, nb, size, angle, fast_ws, fast);
+		retval |= compare(gsl, fast, nb, angle, t_gsl, t_fast);
+		for (i = 0; i < nb; i++) {
+			free(gsl[i]);
+			free(fast[i]);
+		}
+	}
+	fprintf(stdout, retval ? "FAILED\n" : "OK\n");
+
+	free_psf_workspace(gsl_ws);
+	free_psf_workspace(fast_ws);
+	free(areas);
+	free(gsl);
+	free(fast);
+	return retval;
+}
@@ -0,0 +1,216 @@
+#include "../core/siril.h"
+#include "../core/proto.h"
+#include "../stacking/stacking.h"
+#include "../stacking/rejection.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* This program checks that the rejection of the mean stacking, which works on
+ * tiles of pixels with vector instructions, gives exactly the same results as
+ * the scalar code, for all rejection and normalization types, on random
+ * stacks containing outliers, flat and saturated pixels, and shifted frames.
+ * Usage: rejection [nb_frames [width]]
+ * Both results are saved in rejection_scalar.fit and rejection_kernels.fit,
+ * which can also be compared with compare_fits. */
+
+#define ROWS_PER_TEST 8
+#define NB_REJECTIONS 6
+#define NB_NORMALIZATIONS 5
+
+static double uniform() {
+	return rand() / (RAND_MAX + 1.0);
+}
+
+static double gaussian() {
+	double u = uniform() + 1e-12, v = uniform();
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* random row of a frame, with stars, hot pixels and clipped areas */
+static void make_row(WORD *row, int width, int nb_frames, const double *level, const double *noise) {
+	int x;
+	for (x = 0; x < width; x++) {
+		double value = level[x] + noise[x] * gaussian();
+		double dice = uniform();
+		if (dice < 0.02)
+			value = USHRT_MAX_DOUBLE;	// hot pixel or satellite
+		else if (dice < 0.03)
+			value = 0.0;			// dead pixel
+		else if (dice < 0.03 + 2.0 / nb_frames)
+			value += 20.0 * noise[x] * gaussian();	// outlier
+		row[x] = round_to_WORD(value);
+	}
+}
+
+/* the pixel stack as it was gathered before the tiles */
+static void gather_pixel(struct stacking_args *args, struct _data_block *data,
+		const int *shiftx, long x, long width) {
+	int frame;
+	for (frame = 0; frame < args->nb_images_to_stack; frame++) {
+		if (shiftx[frame] && (x - shiftx[frame] >= width || x - shiftx[frame] < 0)) {
+			data->stack[frame] = 0;
+		} else {
+			WORD pixel = data->pix[frame][x - shiftx[frame]];
+			double tmp;
+			switch (args->normalize) {
+			default:
+			case NO_NORM:
+				data->stack[frame] = pixel;
+				break;
+			case ADDITIVE:
+			case ADDITIVE_SCALING:
+				tmp = (double)pixel * args->coeff.scale[frame];
+				data->stack[frame] = round_to_WORD(tmp - args->coeff.offset[frame]);
+				break;
+			case MULTIPLICATIVE:
+			case MULTIPLICATIVE_SCALING:
+				tmp = (double)pixel * args->coeff.scale[frame];
+				data->stack[frame] = round_to_WORD(tmp * args->coeff.mul[frame]);
+				break;
+			}
+		}
+	}
+}
+
+static int alloc_data_block(struct _data_block *data, int nb_frames, int width) {
+	int frame;
+	memset(data, 0, sizeof(struct _data_block));
+	data->pix = malloc(nb_frames * sizeof(WORD *));
+	data->tmp = malloc(nb_frames * width * sizeof(WORD));
+	data->stack = malloc(nb_frames * sizeof(WORD));
+	data->tile = malloc(REJECTION_TILE_WIDTH * nb_frames * sizeof(WORD));
+	data->sum = malloc(REJECTION_TILE_WIDTH * sizeof(int64_t));
+	data->sumsq = malloc(REJECTION_TILE_WIDTH * sizeof(uint64_t));
+	data->rejected = calloc(nb_frames, sizeof(int));
+	data->w_stack = malloc(nb_frames * sizeof(WORD));
+	data->xf = malloc(nb_frames * sizeof(double));
+	data->yf = malloc(nb_frames * sizeof(double));
+	if (!data->pix || !data->tmp || !data->stack || !data->tile || !data->sum ||
+			!data->sumsq || !data->rejected || !data->w_stack ||
+			!data->xf || !data->yf)
+		return 1;
+	for (frame = 0; frame < nb_frames; frame++)
+		data->pix[frame] = data->tmp + frame * width;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	static const double sigmas[NB_REJECTIONS][2] = {
+		{ 0.0, 0.0 }, { 0.2, 0.1 }, { 3.0, 3.0 }, { 2.5, 2.0 }, { 3.0, 3.0 }, { 5.0, 5.0 }
+	};
+	struct stacking_args args = { 0 };
+	struct _data_block scalar, kernels;
+	fits *ref = NULL, *res = NULL;
+	double *level, *noise;
+	int *shiftx;
+	int nb_frames = 50, width = 1000, height, frame, rej, norm, row;
+	long x, differences = 0;
+
+	if (argc > 1)
+		nb_frames = atoi(argv[1]);
+	if (argc > 2)
+		width = atoi(argv[2]);
+	if (nb_frames < 2 || width < 1) {
+		fprintf(stderr, "Usage: %s [nb_frames [width]]\n", argv[0]);
+		return 2;
+	}
+	height = NB_REJECTIONS * NB_NORMALIZATIONS * ROWS_PER_TEST;
+
+	args.nb_images_to_stack = nb_frames;
+	args.coeff.offset = malloc(nb_frames * sizeof(double));
+	args.coeff.mul = malloc(nb_frames * sizeof(double));
+	args.coeff.scale = malloc(nb_frames * sizeof(double));
+	shiftx = malloc(nb_frames * sizeof(int));
+	level = malloc(width * sizeof(double));
+	noise = malloc(width * sizeof(double));
+	if (!args.coeff.offset || !args.coeff.mul || !args.coeff.scale || !shiftx ||
+			!level || !noise || alloc_data_block(&scalar, nb_frames, width) ||
+			alloc_data_block(&kernels, nb_frames, width) ||
+			new_fit_image(&ref, width, height, 1) ||
+			new_fit_image(&res, width, height, 1)) {
+		fprintf(stderr, "allocation error\n");
+		return 2;
+	}
+	fprintf(stdout, "%d frames of %d pixels, rejection kernels: %s\n",
+			nb_frames, width, rejection_kernels_isa());
+
+	srand(42);
+	for (frame = 0; frame < nb_frames; frame++) {
+		args.coeff.offset[frame] = 200.0 * gaussian();
+		args.coeff.mul[frame] = 1.0 + 0.05 * gaussian();
+		args.coeff.scale[frame] = 1.0 + 0.02 * gaussian();
+		shiftx[frame] = frame % 4 ? (int)(8.0 * gaussian()) : 0;
+	}
+
+	for (rej = 0; rej < NB_REJECTIONS; rej++) {
+		for (norm = 0; norm < NB_NORMALIZATIONS; norm++) {
+			long errors = 0;
+			args.type_of_rejection = (rejection) rej;
+			args.normalize = (normalization) norm;
+			args.sig[0] = sigmas[rej][0];
+			args.sig[1] = sigmas[rej][1];
+
+			for (row = 0; row < ROWS_PER_TEST; row++) {
+				long idx = ((rej * NB_NORMALIZATIONS + norm) * ROWS_PER_TEST + row) * width;
+				uint64_t crej_scalar[2] = { 0, 0 }, crej_kernels[2] = { 0, 0 };
+				for (x = 0; x < width; x++) {
+					double type = uniform();
+					if (type < 0.1) {		// flat
+						level[x] = floor(USHRT_MAX_DOUBLE * uniform());
+						noise[x] = 0.0;
+					} else if (type < 0.2) {	// nearly flat
+						level[x] = 1000.0 + 1000.0 * uniform();
+						noise[x] = 0.3;
+					} else if (type < 0.25) {	// saturated
+						level[x] = USHRT_MAX_DOUBLE;
+						noise[x] = 2.0;
+					} else {
+						level[x] = 300.0 + 20000.0 * uniform() * uniform();
+						noise[x] = 5.0 + 100.0 * uniform();
+					}
+				}
+				for (frame = 0; frame < nb_frames; frame++) {
+					make_row(scalar.pix[frame], width, nb_frames, level, noise);
+					memcpy(kernels.pix[frame], scalar.pix[frame], width * sizeof(WORD));
+				}
+
+				for (x = 0; x < width; x++) {
+					gather_pixel(&args, &scalar, shiftx, x, width);
+					ref->data[idx + x] = round_to_WORD(
+							rejection_stack_scalar(&args, &scalar, scalar.stack, crej_scalar));
+				}
+				for (x = 0; x < width; x += REJECTION_TILE_WIDTH) {
+					int p, tile_width = REJECTION_TILE_WIDTH;
+					if (x + tile_width > width)
+						tile_width = width - x;
+					rejection_gather_tile(&args, &kernels, shiftx, 0, x, tile_width, width);
+					for (p = 0; p < tile_width; p++)
+						res->data[idx + x + p] = round_to_WORD(
+								rejection_stack_pixel(&args, &kernels, p, crej_kernels));
+				}
+
+				for (x = 0; x < width; x++)
+					if (ref->data[idx + x] != res->data[idx + x])
+						errors++;
+				if (crej_scalar[0] != crej_kernels[0] || crej_scalar[1] != crej_kernels[1]) {
+					fprintf(stdout, "rejection %d normalization %d: rejection counts differ\n", rej, norm);
+					errors++;
+				}
+			}
+			if (errors)
+				fprintf(stdout, "rejection %d normalization %d: %ld differences\n", rej, norm, errors);
+			differences += errors;
+		}
+	}
+
+	savefits("rejection_scalar.fit", ref);
+	savefits("rejection_kernels.fit", res);
+	if (differences) {
+		fprintf(stdout, "FAILED: %ld differences\n", differences);
+		return 1;
+	}
+	fprintf(stdout, "results are identical\n");
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include "../core/siril.h"
+#include "../io/ser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* This program measures the speed of frame reading from a SER file, with an
+ * increasing number of threads reading different frames at the same time, as
+ * the generic sequence processing and the stacking do.
+ * Usage: ser_read file.ser [max_threads [max_frames]]
+ * Run it twice to have the file in the page cache, or flush the cache between
+ * runs to measure disk throughput. */
+
+static double elapsed(struct timeval *t1, struct timeval *t2) {
+	return (double)(t2->tv_sec - t1->tv_sec) +
+		(double)(t2->tv_usec - t1->tv_usec) / 1000000.0;
+}
+
+/* full frames, with ser_read_frame() */
+static int read_frames(struct ser_struct *ser_file, int nb_frames, int nb_threads) {
+	int i, errors = 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nb_threads) schedule(static) reduction(+:errors)
+#endif
+	for (i = 0; i < nb_frames; i++) {
+		fits fit = { 0 };
+		if (ser_read_frame(ser_file, i, &fit))
+			errors++;
+		free(fit.data);
+	}
+	return errors;
+}
+
+/* the middle half of frames, like the block reads of stacking */
+static int read_areas(struct ser_struct *ser_file, int nb_frames, int nb_threads) {
+	int i, errors = 0;
+	int layer = ser_file->number_of_planes == 3 ? 0 : -1;
+	rectangle area = { 0, ser_file->image_height / 4,
+		ser_file->image_width, ser_file->image_height / 2 };
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nb_threads) schedule(static) reduction(+:errors)
+#endif
+	for (i = 0; i < nb_frames; i++) {
+		WORD *buffer = malloc(area.w * area.h * sizeof(WORD));
+		if (!buffer || ser_read_opened_partial(ser_file, layer, i, buffer, &area))
+			errors++;
+		free(buffer);
+	}
+	return errors;
+}
+
+int main(int argc, char **argv) {
+	struct ser_struct ser_file;
+	struct timeval t1, t2;
+	int nb_threads, max_threads = 1, nb_frames;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s file.ser [max_threads [max_frames]]\n", argv[0]);
+		return 1;
+	}
+#ifdef _OPENMP
+	max_threads = omp_get_num_procs();
+#endif
+	if (argc > 2)
+		max_threads = atoi(argv[2]);
+
+	ser_init_struct(&ser_file);
+	if (ser_open_file(argv[1], &ser_file)) {
+		fprintf(stderr, "could not open %s\n", argv[1]);
+		return 1;
+	}
+	nb_frames = ser_file.frame_count;
+	if (argc > 3 && atoi(argv[3]) > 0 && atoi(argv[3]) < nb_frames)
+		nb_frames = atoi(argv[3]);
+	fprintf(stdout, "%s: %d frames of %dx%d, %d bytes per pixel\n", argv[1],
+			nb_frames, ser_file.image_width, ser_file.image_height,
+			ser_file.byte_pixel_depth * ser_file.number_of_planes);
+	fprintf(stdout, "threads\tframes/s\tareas/s\n");
+
+	nb_threads = 1;
+	while (nb_threads <= max_threads) {
+		double frames_speed, areas_speed;
+		gettimeofday(&t1, NULL);
+		if (read_frames(&ser_file, nb_frames, nb_threads)) {
+			fprintf(stderr, "failed to read frames\n");
+			break;
+		}
+		gettimeofday(&t2, NULL);
+		frames_speed = nb_frames / elapsed(&t1, &t2);
+
+		gettimeofday(&t1, NULL);
+		if (read_areas(&ser_file, nb_frames, nb_threads)) {
+			fprintf(stderr, "failed to read areas\n");
+			break;
+		}
+		gettimeofday(&t2, NULL);
+		areas_speed = nb_frames / elapsed(&t1, &t2);
+
+		fprintf(stdout, "%d\t%.1f\t\t%.1f\n", nb_threads, frames_speed, areas_speed);
+		if (nb_threads < max_threads && nb_threads * 2 > max_threads)
+			nb_threads = max_threads;	// always measure max_threads
+		else nb_threads *= 2;
+	}
+
+	ser_close_file(&ser_file);
+	return 0;
+}
@@ -0,0 +1,164 @@
+#include "../core/siril.h"
+#include "../registration/matching/misc.h"
+#include "../registration/matching/atpmatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+/* This program checks that the star list matching finds the transformation
+ * between two synthetic lists of stars, the second being the first rotated,
+ * shifted and with noise, with a fraction of the stars of each list having no
+ * counterpart in the other. The matching with nbright stars, which only makes
+ * the triangles of nearest neighbours, must find the transformation within
+ * MAX_ERROR pixels. For comparison, it is also timed with the AT_MATCH_NBRIGHT
+ * brightest stars, which makes all the triangles but can fail when too many
+ * of them have no counterpart.
+ * Usage: star_matching [nb_stars [nbright [outliers_percent]]] */
+
+#define WIDTH 4000.0
+#define HEIGHT 3000.0
+#define ANGLE 12.5	// degrees
+#define SHIFT_X 35.2
+#define SHIFT_Y -20.7
+#define NOISE 0.1	// pixels
+#define MAX_ERROR 0.5	// pixels
+
+static double uniform() {
+	return rand() / (RAND_MAX + 1.0);
+}
+
+static double gaussian() {
+	double u = uniform() + 1e-12, v = uniform();
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static struct s_star *make_list(const double *x, const double *y, const double *mag, int n) {
+	struct s_star *head = NULL, *last = NULL;
+	int i;
+	for (i = 0; i < n; i++) {
+		struct s_star *star = atStarNew(x[i], y[i], mag[i], 0.0);
+		if (last)
+			last->next = star;
+		else head = star;
+		last = star;
+	}
+	return head;
+}
+
+static void free_list(struct s_star *head) {
+	while (head) {
+		struct s_star *next = head->next;
+		shFree(head);
+		head = next;
+	}
+}
+
+/* largest distance between the expected and the found positions of the
+ * corners and the center of the image */
+static double trans_error(const TRANS *trans) {
+	static const double px[5] = { 0.0, WIDTH, 0.0, WIDTH, WIDTH / 2.0 };
+	static const double py[5] = { 0.0, 0.0, HEIGHT, HEIGHT, HEIGHT / 2.0 };
+	double c = cos(ANGLE * M_PI / 180.0), s = sin(ANGLE * M_PI / 180.0);
+	double error = 0.0;
+	int i;
+	for (i = 0; i < 5; i++) {
+		double ex = SHIFT_X + c * px[i] - s * py[i];
+		double ey = SHIFT_Y + s * px[i] + c * py[i];
+		double fx = trans->a + trans->b * px[i] + trans->c * py[i];
+		double fy = trans->d + trans->e * px[i] + trans->f * py[i];
+		double d = hypot(fx - ex, fy - ey);
+		if (d > error)
+			error = d;
+	}
+	return error;
+}
+
+static int run_matching(int nb_stars, double *xa, double *ya, double *maga,
+		double *xb, double *yb, double *magb, int nbright) {
+	struct s_star *listA, *listB;
+	struct timeval t_start, t_end;
+	TRANS trans = { 0 };
+	double error;
+	int ret;
+
+	listA = make_list(xa, ya, maga, nb_stars);
+	listB = make_list(xb, yb, magb, nb_stars);
+	atTransOrderSet(AT_TRANS_LINEAR);
+	trans.order = AT_TRANS_LINEAR;
+
+	gettimeofday(&t_start, NULL);
+	ret = atFindTrans(nb_stars, listA, nb_stars, listB, AT_TRIANGLE_RADIUS,
+			nbright, 0.9, 1.1, AT_MATCH_NOANGLE, AT_MATCH_NOANGLE,
+			AT_MATCH_MAXITER, AT_MATCH_HALTSIGMA, &trans);
+	gettimeofday(&t_end, NULL);
+	free_list(listA);
+	free_list(listB);
+
+	if (ret != SH_SUCCESS) {
+		fprintf(stdout, "%4d brightest stars: matching FAILED\n", nbright);
+		return 1;
+	}
+	error = trans_error(&trans);
+	fprintf(stdout, "%4d brightest stars: %.1f ms, %d pairs used, error %.3f px%s\n",
+			nbright, (t_end.tv_sec - t_start.tv_sec) * 1000.0 +
+			(t_end.tv_usec - t_start.tv_usec) / 1000.0,
+			trans.nr, error, error > MAX_ERROR ? " (too large)" : "");
+	return error > MAX_ERROR;
+}
+
+int main(int argc, char **argv) {
+	double *xa, *ya, *maga, *xb, *yb, *magb;
+	double c = cos(ANGLE * M_PI / 180.0), s = sin(ANGLE * M_PI / 180.0);
+	int nb_stars = 5000, nbright = AT_MATCH_NN_NBRIGHT, outliers = 10, i, errors = 0;
+
+	if (argc > 1)
+		nb_stars = atoi(argv[1]);
+	if (argc > 2)
+		nbright = atoi(argv[2]);
+	if (argc > 3)
+		outliers = atoi(argv[3]);
+	if (nb_stars < AT_MATCH_NBRIGHT || nbright <= AT_MATCH_NBRIGHT ||
+			outliers < 0 || outliers >= 100) {
+		fprintf(stderr, "Usage: %s [nb_stars [nbright [outliers_percent]]]\n", argv[0]);
+		return 2;
+	}
+
+	xa = malloc(nb_stars * sizeof(double));
+	ya = malloc(nb_stars * sizeof(double));
+	maga = malloc(nb_stars * sizeof(double));
+	xb = malloc(nb_stars * sizeof(double));
+	yb = malloc(nb_stars * sizeof(double));
+	magb = malloc(nb_stars * sizeof(double));
+	if (!xa || !ya || !maga || !xb || !yb || !magb) {
+		fprintf(stderr, "allocation error\n");
+		return 2;
+	}
+
+	srand(42);
+	for (i = 0; i < nb_stars; i++) {
+		xa[i] = WIDTH * uniform();
+		ya[i] = HEIGHT * uniform();
+		maga[i] = 8.0 + 8.0 * uniform();
+		if (uniform() * 100.0 < outliers) {
+			/* a star of B that is not in A, and the reverse */
+			xb[i] = WIDTH * uniform();
+			yb[i] = HEIGHT * uniform();
+			magb[i] = 8.0 + 8.0 * uniform();
+		} else {
+			xb[i] = SHIFT_X + c * xa[i] - s * ya[i] + NOISE * gaussian();
+			yb[i] = SHIFT_Y + s * xa[i] + c * ya[i] + NOISE * gaussian();
+			magb[i] = maga[i] + 0.05 * gaussian();
+		}
+	}
+	fprintf(stdout, "%d stars, %d%% without counterpart, rotation %g degrees\n",
+			nb_stars, outliers, ANGLE);
+
+	run_matching(nb_stars, xa, ya, maga, xb, yb, magb, AT_MATCH_NBRIGHT);
+	errors = run_matching(nb_stars, xa, ya, maga, xb, yb, magb, nbright);
+
+	free(xa); free(ya); free(maga);
+	free(xb); free(yb); free(magb);
+	return errors;
+}